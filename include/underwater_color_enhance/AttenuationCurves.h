@@ -0,0 +1,80 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_ATTENUATIONCURVES_H
+#define UNDERWATER_COLOR_ENHANCE_ATTENUATIONCURVES_H
+
+#include <tinyxml.h>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Attenuation curves class.
+ *  Backscatter and direct signal attenuation values of each channel as piecewise linear curves over depth, with
+ *  knots every step meters from start. Evaluated at any depth in O(1); depths beyond the knots take the values of
+ *  the first or last knot. Fitted over a whole mission by DepthCurveFit.
+ *
+ *  Stored in the attenuation XML file next to the Depth elements:
+ *  <Attenuation_Curves start="" step="">, then one Knot element per knot with the same Backscatter_Attenuation and
+ *  Direct_Signal_Attenuation children as a Depth element.
+ */
+
+class AttenuationCurves
+{
+public:
+  /** Constructor.
+   *  No curves, see empty().
+   */
+  AttenuationCurves() {}
+
+  /** \param knots - 6 values per knot: BGR backscatter then BGR direct signal attenuation.
+   */
+  AttenuationCurves(float start, float step, const std::vector<float>& knots);
+
+  bool empty() const {return this->knots.size() < 6;}
+  int size() const {return this->knots.size() / 6;}
+  float get_start() const {return this->start;}
+  float get_step() const {return this->step;}
+  const std::vector<float>& get_knots() const {return this->knots;}
+
+  /** BGR backscatter and direct signal attenuation values at a depth.
+   */
+  void evaluate(float depth, float* backscatter_att, float* direct_signal_att) const
+  {
+    const int last = size() - 1;
+    float position = (depth - this->start) / this->step;
+    position = position > 0.0f ? (position < last ? position : last) : 0.0f;   // Also 0 for NaN
+    const int i = position < last ? static_cast<int>(position) : (last > 0 ? last - 1 : 0);
+    const float t = last > 0 ? position - i : 0.0f;
+
+    const float* first = &this->knots[6 * i];
+    const float* second = last > 0 ? first + 6 : first;
+    for (int c = 0; c < 3; c++)
+    {
+      backscatter_att[c] = first[c] + t * (second[c] - first[c]);
+      direct_signal_att[c] = first[3 + c] + t * (second[3 + c] - first[3 + c]);
+    }
+  }
+
+  /** Writes the curves as an Attenuation_Curves element of the document, replacing the one it has.
+   */
+  void write(TiXmlDocument& doc) const;
+
+  /** Reads the Attenuation_Curves element of a document, false if it has none or it is malformed.
+   */
+  bool read(const TiXmlDocument& doc);
+
+private:
+  float start = 0.0;
+  float step = 1.0;
+  std::vector<float> knots;
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_ATTENUATIONCURVES_H
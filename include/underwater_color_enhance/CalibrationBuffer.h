@@ -0,0 +1,67 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_CALIBRATIONBUFFER_H
+#define UNDERWATER_COLOR_ENHANCE_CALIBRATIONBUFFER_H
+
+#include <atomic>
+#include <mutex>
+
+namespace underwater_color_enhance
+{
+
+/** Attenuation values of one calibration, for the depth they were calculated at.
+ */
+struct Calibration
+{
+  float depth = 0.0;
+  float backscatter_att [3] = {0.0, 0.0, 0.0};    /**< BGR */
+  float direct_signal_att [3] = {0.0, 0.0, 0.0};  /**< BGR */
+};
+
+
+/** Calibration buffer class.
+ *  Publishes calibrations from the optimizer or the color chart to the enhancement of other frames.
+ *  Double buffered with a sequence counter per slot (seqlock): a writer fills the inactive slot and then
+ *  switches the active index, so readers never see a half written calibration and never take a lock.
+ *  A reader only retries if two calibrations were published while it was copying one.
+ */
+
+class CalibrationBuffer
+{
+public:
+  /** Constructor.
+   *  Nothing is published.
+   */
+  CalibrationBuffer();
+
+  /** Publishes a complete calibration. Writers are serialized, readers are not blocked.
+   */
+  void publish(const Calibration& calibration);
+
+  /** Copies the latest calibration, returns false if nothing was published yet.
+   */
+  bool read(Calibration& calibration) const;
+
+private:
+  static const int NUM_VALUES = 7;  /**< depth, 3 backscatter and 3 direct signal attenuation values */
+
+  struct Slot
+  {
+    std::atomic<unsigned int> seq;  /**< odd while the slot is written */
+    std::atomic<float> values [NUM_VALUES];
+  };
+
+  Slot slots [2];
+  std::atomic<int> active;  /**< slot of the latest calibration, -1 if nothing was published */
+
+  std::mutex write_mutex;   /**< serializes writers */
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_CALIBRATIONBUFFER_H
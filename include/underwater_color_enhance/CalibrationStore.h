@@ -0,0 +1,119 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_CALIBRATIONSTORE_H
+#define UNDERWATER_COLOR_ENHANCE_CALIBRATIONSTORE_H
+
+#include "underwater_color_enhance/CalibrationBuffer.h"
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace underwater_color_enhance
+{
+
+/** Calibration store class.
+ *  Persistent attenuation values over depth, kept across missions so a dive is enhanced from its first frame
+ *  without a color chart or a prior optimization file.
+ *
+ *  Calibrations are keyed by camera profile, water type and site (location or date, optional), and binned by
+ *  depth. Each depth bin is one versioned XML file in STORE_DIR/<camera>__<water>[__<site>]/, listed at
+ *  construction but only read when it is used. The most recently used bins stay in memory, the others are written
+ *  back (if changed) and dropped. New calibrations are merged into their bin weighted by sample count, the count
+ *  is capped so the bin keeps following the water.
+ *
+ *  Thread safe, lookups and merges are serialized.
+ */
+
+class CalibrationStore
+{
+public:
+  /** Version of the bin files, files of other versions are ignored.
+   *  Version 1 bins may mix the optimizer multipliers with attenuation coefficients, version 2 holds coefficients.
+   */
+  static const int VERSION = 2;
+
+  /** Constructor.
+   *  Creates the directory of the key if needed and lists its bins.
+   *
+   *  \param STORE_DIR is the root directory of the store, shared by all keys.
+   *  \param CAMERA, WATER_TYPE, SITE - key of the calibrations (e.g. camera response file, "Jerlov IA",
+   *      "" for any site). Characters other than letters, digits, '-' and '.' are replaced in the directory name.
+   *  \param BIN_SIZE is the depth range of a bin in meters.
+   *  \param MAX_CACHED_BINS is the number of bins kept in memory.
+   *  \param MAX_SAMPLES caps the sample count of a bin: a new calibration of n samples moves the bin by at least
+   *      n / (MAX_SAMPLES + n) towards it.
+   *  \param LOG_SCREEN - true: print the bins that were found.
+   */
+  CalibrationStore(std::string STORE_DIR, std::string CAMERA, std::string WATER_TYPE, std::string SITE,
+    float BIN_SIZE = 0.5, size_t MAX_CACHED_BINS = 16, int MAX_SAMPLES = 1000, bool LOG_SCREEN = false);
+
+  /** Writes the changed bins.
+   */
+  ~CalibrationStore();
+
+  /** Calibration of the bin nearest to a depth, with the depth of the frame. False if the store is empty.
+   */
+  bool lookup(float depth, Calibration& calibration);
+
+  /** Merges a calibration of SAMPLES samples into the bin of its depth. Values that are not finite are ignored.
+   *  The values are attenuation coefficients (1/m), as the chart calibration and the converted optimizer fits.
+   */
+  void add(const Calibration& calibration, int SAMPLES);
+
+  /** Writes the changed bins, e.g. at the end of a dive.
+   */
+  void flush();
+
+  /** Number of bins of the key, on disk or in memory.
+   */
+  size_t size();
+
+  const std::string& get_directory() const {return this->directory;}
+
+private:
+  /** Merged calibration of one depth bin.
+   */
+  struct Bin
+  {
+    Calibration calibration;
+    int samples = 0;
+    int revision = 0;     /**< writes of the bin, over all missions */
+    bool dirty = false;   /**< changed since it was read or written */
+    std::list<int>::iterator use;   /**< position in the recently used list */
+  };
+
+  std::string directory;
+  std::string key;
+  float BIN_SIZE;
+  size_t MAX_CACHED_BINS;
+  int MAX_SAMPLES;
+
+  std::set<int> bins;           /**< every bin of the key, on disk or in memory */
+  std::map<int, Bin> cache;     /**< bins in memory */
+  std::list<int> recently_used; /**< bins in memory, most recently used first */
+
+  std::mutex mutex;
+
+  int bin_index(float depth) const;
+  std::string bin_filename(int index) const;
+
+  /** Bin in memory, read from disk if needed. 0 if it does not exist or cannot be read.
+   *  Marks the bin as most recently used and pages out the least recently used bin if the cache is full.
+   */
+  Bin* get_bin(int index, bool create);
+
+  bool read_bin(int index, Bin& bin) const;
+  void write_bin(int index, Bin& bin) const;
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_CALIBRATIONSTORE_H
@@ -0,0 +1,50 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_CHARTFIT_H
+#define UNDERWATER_COLOR_ENHANCE_CHARTFIT_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Chart fit class.
+ *  Robust calibration from every patch of a color chart at one distance. For each channel the observed patches are
+ *  a line of their ground truths: I = J * exp(-b_ds * z) + B * (1 - exp(-b_bs * z)) = J * transmission + backscatter.
+ *  The line is fitted by iteratively reweighted least squares with Huber weights, so a patch that is shadowed,
+ *  saturated or partly occluded is down-weighted instead of corrupting the frame. Two patches give the exact line,
+ *  as the analytic calculation from the white and black patches.
+ *
+ *  The three channels are solved together over fixed-size arrays (2x2 normal equations per channel), a few
+ *  microseconds for a full chart.
+ */
+
+class ChartFit
+{
+public:
+  static const int MAX_PATCHES = 64;      /**< patches beyond are not used */
+  static const int MAX_ITERATIONS = 10;
+  static constexpr float HUBER_K = 1.345; /**< Huber threshold in robust standard deviations (95% efficiency) */
+
+  /** Fits the line of each channel.
+   *
+   *  \param truth, observed - BGR ground truth and observed mean of each patch, in the same pixel units.
+   *  \param noise_floor - smallest robust standard deviation of the residuals, e.g. half an 8-bit value: residuals
+   *      below it are never down-weighted.
+   *  \param transmission, backscatter - BGR slope and intercept of the lines.
+   *  \param weights - 0, or the final weight of each patch (BGR, in [0, 1]) for diagnostics.
+   *  Returns false if there are fewer than two patches or their ground truths do not differ in a channel.
+   */
+  static bool fit(const std::vector<cv::Scalar>& truth, const std::vector<cv::Scalar>& observed, float noise_floor,
+    float* transmission, float* backscatter, std::vector<cv::Scalar>* weights = 0);
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_CHARTFIT_H
@@ -10,8 +10,10 @@
 
 #include "underwater_color_enhance/Scene.h"
 #include "underwater_color_enhance/Method.h"
+#include "underwater_color_enhance/KeypointSpan.h"
 
 #include <opencv2/opencv.hpp>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -20,6 +22,10 @@ namespace underwater_color_enhance
 
 /** Calibration color correction class.
  *  Handles the set up for the choice of color correction method.
+ *
+ *  The scene and the method are shared by copies of this object, so a copy can be handed to each worker.
+ *  The functions taking the depth of the frame are reentrant; the set_* functions must be called
+ *  before any image is processed.
  */
 
 class ColorCorrect
@@ -29,8 +35,9 @@ public:
    *  Initializes the parameters and sets up the color correction method.
    *
    *  \param underwater_scene - see below.
-   *  \param METHOD_ID decides what color enhancement method to apply.
+   *  \param METHOD_ID decides what color enhancement method to apply, see MethodRegistry.
    *      0:    NewModel
+   *      1:    GrayWorld
    *      else: NewModel (safety measures)
    *  \param EST_VEILING_LIGHT parameter for method object.
    *  \param OPTIMIZE - true: optimize attenuation values.
@@ -42,35 +49,156 @@ public:
    *  \param OUTPUT_FILENAME - see below.
    */
   ColorCorrect() {}
-  ColorCorrect(Scene& underwater_scene, int METHOD_ID, bool EST_VEILING_LIGHT, bool OPTIMIZE,
+  ColorCorrect(const Scene& underwater_scene, int METHOD_ID, bool EST_VEILING_LIGHT, bool OPTIMIZE,
     float RANGE, bool SAVE_DATA, bool CHECK_TIME, bool LOG_SCREEN, bool PRIOR_DATA, std::string INPUT_FILENAME,
     std::string OUTPUT_FILENAME);
   ~ColorCorrect() {}
 
   bool OPTIMIZE;  /**< determines if this program will be calculating optimized attenuation values */
 
-  void optimize(cv::Mat& img);
+  void optimize(const cv::Mat& img, float depth);
+  void optimize(const cv::Mat& img) {optimize(img, this->depth);}
 
   /** Functions that lead to the current color enhancement methods.
+   *  depth is the altitude depth measurement of the frame; without it the depth set by set_depth() is used.
+   *  metrics: 0, or filled with the quality and health of the corrected frame, see FrameMetrics.
    */
-  cv::Mat enhance(cv::Mat& img);      /** requires image and depth **/
-  cv::Mat enhance_slam(cv::Mat& img,       /** requires image, depth, and SLAM points **/
-    std::vector<cv::Point2f> point_data, std::vector<float> distance_data);
+  cv::Mat enhance(const cv::Mat& img, float depth,        /** requires image and depth **/
+    FrameMetrics* metrics = 0);
+  cv::Mat enhance_slam(const cv::Mat& img,                /** requires image, depth, and SLAM points **/
+    const KeypointSpan& keypoints, float depth, FrameMetrics* metrics = 0);
+  cv::Mat enhance_depth(const cv::Mat& img,               /** requires image, depth, and a dense depth map **/
+    const cv::Mat& depth_map, float depth, FrameMetrics* metrics = 0);
+
+  /** Functions for consumers that need only parts of the frame, with one distance for the whole frame.
+   *  The correction is computed once from the full frame and only the requested pixels are corrected.
+   */
+  FrameCorrection prepare(const cv::Mat& img, float depth);   /** correction of the frame, see FrameCorrection **/
+  std::vector<cv::Mat> enhance_regions(const cv::Mat& img,    /** corrected regions, clipped to the frame **/
+    const std::vector<cv::Rect>& regions, float depth);
+  cv::Mat enhance_mask(const cv::Mat& img,                    /** frame with the masked (CV_8UC1) pixels corrected **/
+    const cv::Mat& mask, float depth);
+  TileIterator enhance_tiles(const cv::Mat& img,              /** corrects the frame tile by tile **/
+    cv::Size tile_size, float depth);
+
+  cv::Mat enhance(const cv::Mat& img) {return enhance(img, this->depth);}
+  cv::Mat enhance_slam(const cv::Mat& img, const KeypointSpan& keypoints)
+  {
+    return enhance_slam(img, keypoints, this->depth);
+  }
+  cv::Mat enhance_depth(const cv::Mat& img, const cv::Mat& depth_map)
+  {
+    return enhance_depth(img, depth_map, this->depth);
+  }
+
+  /** Sets how dense depth maps are converted to a range map aligned with the image.
+   *
+   *  \param DEPTH_MAP_SCALE - meters per unit of CV_16U depth maps (CV_32F depth maps are in meters).
+   *  \param DEPTH_MAP_REGISTRATION - row-major 3x3 homography from depth map to image pixels.
+   *      empty: depth map is only resized to the image resolution.
+   */
+  void set_depth_map_options(float DEPTH_MAP_SCALE, std::vector<double> DEPTH_MAP_REGISTRATION);
+
+  /** Sets the accuracy of the exp approximation used for per-pixel range correction (SLAM, depth maps).
+   *
+   *  \param EXP_MAX_ERROR - maximum relative error to std::exp.
+   */
+  void set_exp_max_error(float EXP_MAX_ERROR);
+
+  /** Sets how the SLAM range map is represented.
+   *
+   *  \param SLAM_LABEL_MAP - true: facet label per pixel (CV_16U) and a table of factors per facet.
+   *      false: distance per pixel (CV_32F) and factors calculated for every pixel.
+   */
+  void set_slam_label_map(bool SLAM_LABEL_MAP);
+
+  /** Sets the channel order of the images that will be enhanced (BGR or RGB).
+   */
+  void set_channel_order(ChannelOrder CHANNEL_ORDER);
+  ChannelOrder get_channel_order() const {return this->method_config.CHANNEL_ORDER;}
+
+  /** Sets how the corrected values are tone mapped before they are quantized to the pixel type of the image.
+   *  Default: clipped, see ToneMap.
+   */
+  void set_tone_map(const ToneMap& TONE_MAP);
+
+  /** Sets if 8-bit images corrected with one gain and offset per channel use a lookup table per channel, filled
+   *  with the float kernel, for CPUs where float SIMD is slow.
+   */
+  void set_lookup_table(bool LOOKUP_TABLE);
+
+  /** Sets where the attenuation values come from when there is no prior data.
+   *
+   *  \param COLOR_CHART - true: the color chart in view, or the last calibration when it is not usable.
+   *      false: the calibration store only, the sample regions of the chart are not used.
+   *  \param CALIBRATION_STORE - calibrations of previous missions to start from and to refine, 0 for none.
+   *      May be shared by several ColorCorrect objects of the same camera and water.
+   */
+  void set_calibration_source(bool COLOR_CHART, std::shared_ptr<CalibrationStore> CALIBRATION_STORE);
+
+  /** Sets a veiling light that varies over the frame, for dives lit by strobes or lamps, see VeilingLightGrid.
+   *  Default: the same veiling light for every pixel.
+   *
+   *  \param GRID_SIZE - cells over the width and the height of the frame, e.g. 32x18. Empty: disabled.
+   *  \param SMOOTHING - weight of each new frame in the moving average of the grid, in (0, 1].
+   *  \param MAX_RATIO - largest ratio of a cell to the mean veiling light of the frame (and of its inverse).
+   */
+  void set_veiling_light_grid(cv::Size GRID_SIZE, float SMOOTHING, float MAX_RATIO);
+
+  /** Sets the color stage applied after the attenuation correction in the same pass (camera to display colors):
+   *  a 3x3 matrix on the BGR values, the tone curve, then a gamma encoding, see ColorMatrix. Default: none.
+   *
+   *  \param COLOR_MATRIX - the matrix and gamma, or the gamma and the starting matrix of the fit.
+   *  \param FIT - true: the matrix is fitted on the chart patches of every frame with a usable chart
+   *      (color_1_sample, color_2_sample and the scene COLOR_PATCHES), the frames without use the last fit.
+   */
+  void set_color_matrix(const ColorMatrix& COLOR_MATRIX, bool FIT);
+
+  /** Sets the joint fit of the attenuation values over the whole mission, when optimizing: the chart samples of
+   *  every frame are kept, and fit_attenuation_curves() fits smooth curves over depth on them, see DepthCurveFit.
+   *
+   *  \param JOINT_OPTIMIZE - true: keep the samples for the joint fit. Default: false.
+   *  \param KNOT_SPACING - meters between the knots of the curves.
+   *  \param SMOOTHNESS - curvature penalty of the curves, per sample.
+   */
+  void set_joint_optimization(bool JOINT_OPTIMIZE, float KNOT_SPACING, float SMOOTHNESS);
+
+  /** Fits the attenuation curves on the samples of the whole mission, once all the frames are optimized, and
+   *  adds them to the data saved by save_final_data(). False if there are no samples or the fit fails.
+   */
+  bool fit_attenuation_curves();
+
+  /** Runs the correction kernels of the configured paths once on a blank frame of the expected size and type (see
+   *  Method::prewarm) and reads the model tables, so the first frame does not pay for lazy allocations and page
+   *  faults. Has no effect on the calibration.
+   *  Safe to call from several threads at once, e.g. on every worker of a StreamScheduler.
+   */
+  void prewarm(cv::Size size, int type = CV_8UC3) const;
 
   /** Calculated attenuation values are saved to the OUTPUT_FILENAME.
    */
   void save_final_data();
 
-  /** Functions for retrieving and setting altitude depth measurements.
+  /** Functions for retrieving and setting the altitude depth measurement of this copy.
    */
-  double get_depth() {return underwater_scene.get_depth();}
-  void set_depth(double new_depth) {underwater_scene.set_depth(new_depth);}
+  double get_depth() const {return this->depth;}
+  void set_depth(double new_depth) {this->depth = Scene::round_depth(new_depth);}
 
 private:
-  Scene underwater_scene; /**< object that contains pysical scene properties over changes in depth */
-  Method *method;         /**< object that contains the set up color enhancement method.*/
+  std::shared_ptr<const Scene> underwater_scene;  /**< pysical scene properties, not changed while processing */
+  std::shared_ptr<Method> method;                 /**< the set up color enhancement method */
+  MethodConfig method_config;  /**< settings of the color enhancement method */
+
+  float depth = 0.01;   /**< altitude depth measurement used when a frame does not give one */
 
   std::string OUTPUT_FILENAME;  /**< name of the file that will contain the save attenuation values */
+
+  float DEPTH_MAP_SCALE = 0.001;  /**< meters per unit of CV_16U depth maps */
+  cv::Mat DEPTH_MAP_REGISTRATION; /**< depth map to image homography; empty if not set */
+
+  /** Converts a CV_16U or CV_32F depth map to a CV_32F range map in meters, registered to the image.
+   */
+  cv::Mat register_depth_map(const cv::Mat& depth_map, cv::Size img_size) const;
 };
 
 }  // namespace underwater_color_enhance
@@ -0,0 +1,42 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_COLORMATRIXFIT_H
+#define UNDERWATER_COLOR_ENHANCE_COLORMATRIXFIT_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Color matrix fit class.
+ *  Least squares 3x3 matrix from the attenuation corrected colors of the chart patches to their ground truths,
+ *  for the color stage of the kernels (see ColorMatrix). Three patches or more give a full matrix, fewer give a
+ *  diagonal one (white balance only).
+ */
+
+class ColorMatrixFit
+{
+public:
+  /** Fits the matrix, false if it is singular or not finite (e.g. patches of one color, chart not visible).
+   *
+   *  \param measured - corrected BGR values of the patches.
+   *  \param reference - ground truth BGR values of the patches, in the units of measured.
+   *  \param matrix - 9 values, row-major: reference = matrix * measured.
+   */
+  static bool fit(const std::vector<cv::Scalar>& measured, const std::vector<cv::Scalar>& reference, float* matrix);
+
+  /** Ground truth of a patch as the color stage has to produce it before the gamma encoding: the encoded 8-bit
+   *  truth decoded with 1 / gamma and scaled to the pixel values (see pixel_scale).
+   */
+  static cv::Scalar linear_truth(const cv::Scalar& truth, float gamma, float pixel_scale);
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_COLORMATRIXFIT_H
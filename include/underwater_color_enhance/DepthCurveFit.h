@@ -0,0 +1,81 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_DEPTHCURVEFIT_H
+#define UNDERWATER_COLOR_ENHANCE_DEPTHCURVEFIT_H
+
+#include "underwater_color_enhance/AttenuationCurves.h"
+
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** One observation of a chart patch in one channel, as 8-bit values.
+ */
+struct DepthSample
+{
+  float depth;          /**< altitude depth measurement of the frame */
+  float observed;       /**< observed mean of the patch */
+  float veiling_light;  /**< wideband veiling light of the frame */
+  float truth;          /**< ground truth of the patch */
+};
+
+
+/** Depth curve fit class.
+ *  Joint fit of the backscatter and direct signal attenuation curves of a channel over all the chart samples of a
+ *  mission, instead of independent values per depth range. The curves are piecewise linear over uniform knots (see
+ *  AttenuationCurves), with a penalty on their second differences so that depths with few samples follow their
+ *  neighbors. Each sample gives the residual of the depth range optimizer:
+ *  (I - B * (1 - exp(-b_bs(d) * z))) / exp(-b_ds(d) * z) - J.
+ *
+ *  Solved by Levenberg-Marquardt. A sample only depends on the two knots around its depth, so the normal equations
+ *  are banded (bandwidth 4 with the knots interleaved) and are solved by a banded Cholesky factorization in
+ *  O(knots). The channels are fitted in parallel.
+ */
+
+class DepthCurveFit
+{
+public:
+  static const int MAX_ITERATIONS = 100;
+
+  /** Constructor.
+   *
+   *  \param DISTANCE - distance of the chart to the camera, meters.
+   *  \param KNOT_SPACING - meters between the knots.
+   *  \param SMOOTHNESS - weight of the squared second differences of the curves, per sample.
+   */
+  DepthCurveFit(float DISTANCE, float KNOT_SPACING, float SMOOTHNESS);
+
+  /** Fits the curves of the three channels (BGR samples). False if a channel has no sample or does not converge
+   *  to finite values.
+   */
+  bool fit(const std::vector<DepthSample>* samples, AttenuationCurves& curves) const;
+
+  /** Fits the curves of one channel over the knots start + i * KNOT_SPACING, i < num_knots.
+   *
+   *  \param backscatter_att, direct_signal_att - initial values, then the fitted values at the knots.
+   *  Returns false if the fit is not finite.
+   */
+  bool fit_channel(const std::vector<DepthSample>& samples, float start, int num_knots,
+    std::vector<double>& backscatter_att, std::vector<double>& direct_signal_att) const;
+
+private:
+  float DISTANCE;
+  float KNOT_SPACING;
+  float SMOOTHNESS;
+
+  /** Sum of squared residuals and curvature penalty of the parameters (interleaved backscatter and direct signal
+   *  attenuation values of the knots). With gradient and band: the gradient and the banded Gauss-Newton matrix.
+   */
+  double evaluate(const std::vector<DepthSample>& samples, float start, const std::vector<double>& params,
+    std::vector<double>* gradient, std::vector<double>* band) const;
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_DEPTHCURVEFIT_H
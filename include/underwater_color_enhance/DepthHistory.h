@@ -0,0 +1,77 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_DEPTHHISTORY_H
+#define UNDERWATER_COLOR_ENHANCE_DEPTHHISTORY_H
+
+#include <mutex>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Depth history class.
+ *  Ring buffer of the latest altitude depth measurements, fed by the depth subscriber independently of the
+ *  camera. Gives the depth at the timestamp of an image without waiting for a matching depth message.
+ */
+
+class DepthHistory
+{
+public:
+  /** Constructor.
+   *
+   *  \param CAPACITY is the number of depth measurements that are kept.
+   *  \param MAX_EXTRAPOLATION is how far (seconds) the depth is extrapolated past the newest measurement,
+   *      later images get the depth extrapolated to this bound.
+   */
+  explicit DepthHistory(size_t CAPACITY = 64, double MAX_EXTRAPOLATION = 0.5);
+
+  /** Adds a depth measurement. Measurements older than the newest one are ignored.
+   */
+  void add(double stamp, float depth);
+
+  /** Depth at a timestamp, linearly interpolated between the measurements around it, found in O(log CAPACITY).
+   *  Before the oldest measurement: the oldest depth. After the newest: linearly extrapolated, up to
+   *  MAX_EXTRAPOLATION seconds. Returns false if there is no measurement yet.
+   */
+  bool get_depth(double stamp, float& depth) const;
+
+  void set_max_extrapolation(double MAX_EXTRAPOLATION);
+
+private:
+  struct Sample
+  {
+    double stamp;
+    float depth;
+  };
+
+  std::vector<Sample> samples;  /**< ring buffer, the newest sample is at newest */
+  size_t count;                 /**< number of valid samples */
+  size_t newest;                /**< index of the newest sample */
+
+  double MAX_EXTRAPOLATION;
+
+  mutable std::mutex mutex;     /**< depth and camera callbacks may run on different threads */
+
+  /** i-th newest sample, 0 is the newest.
+   */
+  const Sample& from_newest(size_t i) const
+  {
+    return this->samples[(this->newest + this->samples.size() - i) % this->samples.size()];
+  }
+
+  /** i-th oldest sample, 0 is the oldest.
+   */
+  const Sample& from_oldest(size_t i) const
+  {
+    return from_newest(this->count - 1 - i);
+  }
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_DEPTHHISTORY_H
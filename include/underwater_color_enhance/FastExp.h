@@ -0,0 +1,100 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_FASTEXP_H
+#define UNDERWATER_COLOR_ENHANCE_FASTEXP_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+namespace underwater_color_enhance
+{
+
+/** Fast exponential handler class.
+ *  Approximates exp(x) = 2^n * 2^f, where n is an integer and 2^f (0 <= f < 1) is a minimax polynomial.
+ *  The polynomial degree is the lowest one that meets the requested accuracy, measured against std::exp, and only
+ *  its terms are evaluated. exp_array() is specialized on the degree, so its loop is branch free and vectorized by
+ *  the compiler.
+ */
+
+class FastExp
+{
+public:
+  /** Constructor.
+   *  Selects the polynomial and checks its accuracy over the range of attenuation arguments.
+   *
+   *  \param MAX_REL_ERROR - maximum relative error to std::exp.
+   *      The most accurate polynomial (about 1e-6, single precision) is used if no degree meets it.
+   */
+  explicit FastExp(float MAX_REL_ERROR = 1e-4);
+
+  static const int MIN_DEGREE = 2;
+  static const int MAX_DEGREE = 6;
+
+  /** Approximation with the polynomial of a given degree (MIN_DEGREE to MAX_DEGREE), whatever its accuracy.
+   */
+  static FastExp of_degree(int degree);
+
+  /** Approximation of exp(x), valid for |x| < 87.
+   */
+  inline float operator()(float x) const
+  {
+    float f;
+    const float scale = split(x, f);
+    float p = this->coeffs[this->degree];
+    for (int i = this->degree - 1; i >= 0; i--)
+    {
+      p = p * f + this->coeffs[i];
+    }
+    return p * scale;
+  }
+
+  /** Splits exp(x) = 2^t into the fraction f of t and 2^n, the integer part of t (returned).
+   *  t is clamped to [-126, 126], so 2^n stays a normal float.
+   */
+  static inline float split(float x, float& f)
+  {
+    // The offset keeps the truncation a floor
+    float t = x * 1.44269504f;
+    t = std::min(std::max(t, -126.0f), 126.0f);
+    int32_t n = static_cast<int32_t>(t + 126.0f) - 126;
+    f = t - static_cast<float>(n);
+
+    // 2^n by placing n in the exponent bits
+    int32_t bits = (n + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+  }
+
+  /** Applies exp(scale * src[i]) to an array, see operator() above.
+   */
+  void exp_array(const float* src, float scale, float* dst, int length) const;
+
+  /** Relative error of the selected approximation to std::exp, measured on [-MAX_ARG, MAX_ARG].
+   */
+  float get_max_rel_error() const {return this->max_rel_error;}
+  int get_degree() const {return this->degree;}
+
+  /** Measures the maximum relative error of the approximation against std::exp.
+   */
+  float measure_rel_error(float min_arg, float max_arg, int samples) const;
+
+  static const int MAX_ARG = 20;  /**< Range of arguments checked, attenuation * distance rarely passes 20 */
+
+private:
+  int degree;
+  float max_rel_error = 0.0;
+  float coeffs [MAX_DEGREE + 1];  /**< Polynomial of 2^f, terms above the degree are zero */
+
+  void set_degree(int new_degree);
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_FASTEXP_H
@@ -0,0 +1,130 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_FRAMECORRECTION_H
+#define UNDERWATER_COLOR_ENHANCE_FRAMECORRECTION_H
+
+#include "underwater_color_enhance/Kernels.h"
+#include "underwater_color_enhance/ToneMap.h"
+
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Frame correction class.
+ *  Correction of one frame with one distance for the whole frame: gain, offset and tone curve of each channel.
+ *  Computed once from the full frame (calibration, veiling light, tone sample), then applied to any part of it,
+ *  so consumers that need a few regions of the frame only pay for the pixels of those regions.
+ */
+
+class FrameCorrection
+{
+public:
+  /** Constructor.
+   *  Identity correction.
+   */
+  FrameCorrection();
+
+  /** Constructor.
+   *  Chooses the tone curve from a sample of the frame and fills the lookup tables of the table kernel.
+   *  Coefficients that cannot be applied (not finite, gains not positive) give the identity correction,
+   *  see valid().
+   *
+   *  \param img - the full frame, used for the tone sample.
+   *  \param order - channel order of the frame.
+   *  \param gain, offset - BGR gain and offset of the correction: I * gain + offset.
+   *  \param tone_map - see ToneMap.
+   *  \param LOOKUP_TABLE - true: 8-bit frames use a lookup table per channel (see AffineTable).
+   *  \param veiling_light_grid - veiling light ratio over the frame that scales the offset, see VeilingLightGrid.
+   *                              Empty: same veiling light for the whole frame. Not used by the table kernel.
+   *  \param color_matrix - color stage after the correction, see ColorMatrix. 0: none. Not used by the table
+   *                        kernel.
+   */
+  FrameCorrection(const cv::Mat& img, ChannelOrder order, const float* gain, const float* offset,
+    const ToneMap& tone_map, bool LOOKUP_TABLE, const GridSampler& veiling_light_grid = GridSampler(),
+    std::shared_ptr<const ColorMatrix> color_matrix = std::shared_ptr<const ColorMatrix>());
+
+  /** Corrects the frame or any part of it (img(rect)) into dst.
+   *  With a veiling light grid, a part is located in the frame it was taken from (cv::Mat::locateROI). A part that
+   *  is not a view into the frame (e.g. a copy or a resized frame) cannot be located: pass its origin instead.
+   *  dst may be a part of a larger image of the same size and type as src, it is written in place.
+   *  metrics: 0, or the coefficients and the corrected pixels are added to it.
+   */
+  void apply(const cv::Mat& src, cv::Mat& dst, FrameMetrics* metrics = 0) const;
+  cv::Mat apply(const cv::Mat& src, FrameMetrics* metrics = 0) const;
+
+  /** Corrects the part of the frame with its top left corner at origin into dst, see apply().
+   */
+  void apply(const cv::Mat& src, cv::Point origin, cv::Mat& dst, FrameMetrics* metrics = 0) const;
+
+  /** Corrected regions of the frame, each clipped to the frame. Empty regions give empty images.
+   */
+  std::vector<cv::Mat> apply(const cv::Mat& img, const std::vector<cv::Rect>& regions) const;
+
+  /** Copy of the frame where the pixels with a nonzero mask (CV_8UC1, size of the frame) are corrected.
+   *  Only the masked pixels are corrected, the others are copied.
+   */
+  cv::Mat apply_mask(const cv::Mat& img, const cv::Mat& mask) const;
+
+  bool uses_lookup_table() const {return this->lookup_table;}
+
+  /** False if the coefficients of the frame could not be applied and the frame is passed through.
+   */
+  bool valid() const {return this->valid_coefficients;}
+
+private:
+  ChannelOrder order = BGR;
+  float gain [3] = {1.0, 1.0, 1.0};
+  float offset [3] = {0.0, 0.0, 0.0};
+  ToneCurve tone;
+  AffineTable table;
+  bool lookup_table = false; /**< table holds the float kernel for every 8-bit value */
+  GridSampler grid;         /**< veiling light ratio over the frame, empty: not used */
+  std::shared_ptr<const ColorMatrix> color;   /**< color stage, 0: none */
+  bool valid_coefficients = true;
+};
+
+
+/** Tile iterator class.
+ *  Corrects a frame tile by tile in row-major order, for consumers that stream the frame.
+ */
+
+class TileIterator
+{
+public:
+  /** Constructor.
+   *
+   *  \param img - the frame, shared (not copied): it must not change while iterating.
+   *  \param correction - correction of the frame.
+   *  \param tile_size - size of the tiles, the tiles at the right and bottom borders may be smaller.
+   */
+  TileIterator(const cv::Mat& img, const FrameCorrection& correction, cv::Size tile_size);
+
+  /** Corrects the next tile. Returns false after the last tile.
+   *
+   *  \param tile - position of the tile in the frame.
+   *  \param corrected_tile - the corrected pixels of the tile, its buffer is reused while the tile size is the same.
+   */
+  bool next(cv::Rect& tile, cv::Mat& corrected_tile);
+
+  /** Number of tiles of the frame.
+   */
+  int size() const;
+
+private:
+  cv::Mat img;
+  FrameCorrection correction;
+  cv::Size tile_size;
+  cv::Point position;   /**< top left corner of the next tile */
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_FRAMECORRECTION_H
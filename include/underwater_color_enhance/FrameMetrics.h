@@ -0,0 +1,173 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_FRAMEMETRICS_H
+#define UNDERWATER_COLOR_ENHANCE_FRAMEMETRICS_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <string>
+
+namespace underwater_color_enhance
+{
+
+/** Frame metrics class.
+ *  Quality and health of a corrected frame: per-channel histograms, mean, standard deviation and clipped
+ *  fractions, a UCIQE-like quality score, and the coefficients the frame was corrected with.
+ *  The kernels add each corrected row while it is still in cache, so the metrics do not take a pass of their own.
+ *  Values are in 8-bit units and BGR order, whatever the pixel type and channel order of the image.
+ */
+
+class FrameMetrics
+{
+public:
+  static const int BINS = 64;             /**< histogram bins of each channel over [0, 256) */
+  static const int LUMINANCE_BINS = 256;  /**< luminance histogram for the contrast percentiles */
+
+  FrameMetrics();
+
+  /** Adds a corrected row of 3-channel pixels.
+   *
+   *  \param b, r - index of the blue and red channel in a pixel.
+   *  \param full - largest pixel value (255, 65535 or 1), pixels at or beyond it (or at or below 0) are clipped.
+   */
+  template <typename T>
+  void add_row(const T* row, int cols, int b, int r, float full)
+  {
+    const float to_8bit = 255.0f / full;
+    const float to_bin = BINS / 256.0f;
+    const int index[3] = {b, 1, r};
+
+    double row_sum[3] = {0.0, 0.0, 0.0};
+    double row_sum_sq[3] = {0.0, 0.0, 0.0};
+    double row_chroma = 0.0;
+    double row_chroma_sq = 0.0;
+    double row_saturation = 0.0;
+    for (int col = 0; col < cols; col++)
+    {
+      const T* pixel = row + 3 * col;
+      float v[3];
+      for (int c = 0; c < 3; c++)
+      {
+        float value = static_cast<float>(pixel[index[c]]);
+        this->clipped_low[c] += !(value > 0.0f);    // Also NaN
+        this->clipped_high[c] += value >= full;
+        v[c] = value * to_8bit;
+        row_sum[c] += v[c];
+        row_sum_sq[c] += v[c] * v[c];
+        this->histogram[c][bin(v[c] * to_bin, BINS)]++;
+      }
+
+      // Opponent color chroma and HSV saturation, the luminance contrast is taken from its histogram
+      float luminance = 0.114f * v[0] + 0.587f * v[1] + 0.299f * v[2];
+      this->luminance_histogram[bin(luminance, LUMINANCE_BINS)]++;
+      float red_green = v[2] - v[1];
+      float yellow_blue = 0.5f * (v[2] + v[1]) - v[0];
+      float pixel_chroma_sq = red_green * red_green + yellow_blue * yellow_blue;
+      row_chroma += std::sqrt(pixel_chroma_sq);
+      row_chroma_sq += pixel_chroma_sq;
+      float max_value = std::max(v[0], std::max(v[1], v[2]));
+      float min_value = std::min(v[0], std::min(v[1], v[2]));
+      row_saturation += max_value > 0.0f ? (max_value - min_value) / max_value : 0.0f;
+    }
+
+    for (int c = 0; c < 3; c++)
+    {
+      this->sum[c] += row_sum[c];
+      this->sum_sq[c] += row_sum_sq[c];
+    }
+    this->chroma_sum += row_chroma;
+    this->chroma_sq_sum += row_chroma_sq;
+    this->saturation_sum += row_saturation;
+    this->pixels += cols;
+  }
+
+  /** Records the gain and offset (BGR) the frame is corrected with.
+   *  valid: false if the coefficients of the frame failed check_coefficients() and the identity is applied.
+   */
+  void set_coefficients(const float* gain, const float* offset, bool valid);
+
+  /** Records the attenuation values (BGR) of the frame. Values that are not finite make the correction invalid,
+   *  values that are not positive (e.g. the color chart observations do not fit the model) are flagged.
+   */
+  void set_attenuation(const float* backscatter_att, const float* direct_signal_att);
+
+  /** Coefficients of an affine correction that can be applied: finite, with positive gains.
+   */
+  static bool check_coefficients(const float* gain, const float* offset);
+
+  /** Statistics of the frame.
+   */
+  int64_t get_pixels() const {return this->pixels;}
+  double mean(int c) const;
+  double stddev(int c) const;
+  double clipped_low_fraction(int c) const;
+  double clipped_high_fraction(int c) const;
+  const uint32_t* get_histogram(int c) const {return this->histogram[c];}
+
+  /** Components of the quality score: standard deviation of the chroma, luminance contrast between the 1st and
+   *  99th percentile (both in 8-bit units), and mean saturation in [0, 1].
+   */
+  double chroma_stddev() const;
+  double luminance_contrast() const;
+  double mean_saturation() const;
+
+  /** UCIQE-like quality score, the weighted sum of the normalized components above with the UCIQE weights.
+   *  Higher is better, a collapsed contrast or a color cast lowers it.
+   */
+  double quality() const;
+
+  /** Health of the correction.
+   *  coefficients_valid: false if the frame could not be corrected and was passed through, see get_error().
+   *  attenuation_valid: false if the attenuation values are not physical, the frame is corrected with them.
+   */
+  bool coefficients_valid() const {return this->valid_coefficients;}
+  bool attenuation_valid() const {return this->valid_attenuation;}
+  bool has_coefficients() const {return this->coefficients_set;}
+  bool has_attenuation() const {return this->attenuation_set;}
+  const std::string& get_error() const {return this->error;}
+
+  float gain [3] = {1.0, 1.0, 1.0};
+  float offset [3] = {0.0, 0.0, 0.0};
+  float backscatter_att [3] = {0.0, 0.0, 0.0};
+  float direct_signal_att [3] = {0.0, 0.0, 0.0};
+
+private:
+  int64_t pixels = 0;
+  double sum [3] = {0.0, 0.0, 0.0};
+  double sum_sq [3] = {0.0, 0.0, 0.0};
+  int64_t clipped_low [3] = {0, 0, 0};
+  int64_t clipped_high [3] = {0, 0, 0};
+  uint32_t histogram [3][BINS];
+  uint32_t luminance_histogram [LUMINANCE_BINS];
+
+  double chroma_sum = 0.0;
+  double chroma_sq_sum = 0.0;
+  double saturation_sum = 0.0;
+
+  bool coefficients_set = false;
+  bool attenuation_set = false;
+  bool valid_coefficients = true;
+  bool valid_attenuation = true;
+  std::string error;
+
+  /** Histogram bin of a value in bin units, out of range values (and NaN) go to the first or last bin.
+   */
+  static inline int bin(float value, int bins)
+  {
+    return value > 0.0f ? (value < bins - 1 ? static_cast<int>(value) : bins - 1) : 0;
+  }
+
+  /** Value (8-bit units) below which a fraction of the luminance histogram lies.
+   */
+  double luminance_percentile(double fraction) const;
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_FRAMEMETRICS_H
@@ -0,0 +1,59 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_GRAYWORLD_H
+#define UNDERWATER_COLOR_ENHANCE_GRAYWORLD_H
+
+#include "underwater_color_enhance/Method.h"
+
+#include <string>
+#include <opencv2/opencv.hpp>
+
+namespace underwater_color_enhance
+{
+
+/** Gray World handler class.
+ *  Baseline method without a physical model: scales each channel so the average color of the image is gray.
+ *  Distances and depth are not used, the SLAM and depth map variants apply the same correction.
+ */
+
+class GrayWorld : public Method
+{
+public:
+  /** Constructor.
+   */
+  GrayWorld() {}
+  ~GrayWorld() override {}
+
+  /** No attenuation values to optimize.
+   */
+  void calculate_optimized_attenuation(const cv::Mat& img, float depth) override {}
+
+  /** See functions in Method class
+   */
+  cv::Mat color_correct(const cv::Mat& img, float depth, FrameMetrics* metrics) override;
+  cv::Mat color_correct_slam(const cv::Mat& img, const KeypointSpan& keypoints, float depth,
+    FrameMetrics* metrics) override
+  {
+    return color_correct(img, depth, metrics);
+  }
+  cv::Mat color_correct_depth(const cv::Mat& img, const cv::Mat& range_map, float depth,
+    FrameMetrics* metrics) override
+  {
+    return color_correct(img, depth, metrics);
+  }
+  FrameCorrection prepare_frame(const cv::Mat& img, float depth) override;
+
+  /** No attenuation values to save or load.
+   */
+  void end_file(std::string output_filename) override {}
+  void load_data(std::string input_filename) override {}
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_GRAYWORLD_H
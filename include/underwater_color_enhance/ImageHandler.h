@@ -9,11 +9,20 @@
 #define UNDERWATER_COLOR_ENHANCE_IMAGEHANDLER_H
 
 #include "underwater_color_enhance/ColorCorrect.h"
+#include "underwater_color_enhance/StreamScheduler.h"
+#include "underwater_color_enhance/DepthHistory.h"
+#include "underwater_color_enhance/PreviewPublisher.h"
+#include "underwater_color_enhance/MetricsPublisher.h"
 
 #include <ros/ros.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <image_transport/image_transport.h>
+#include <image_transport/subscriber_filter.h>
+#include <cv_bridge/cv_bridge.h>
 #include <mavros_msgs/VFR_HUD.h>
 #include <ORB_SLAM2/Points.h>
+#include <memory>
 #include <string>
 
 #include <message_filters/subscriber.h>
@@ -26,6 +35,8 @@ namespace underwater_color_enhance
 /** Image handler class.
  *  Handles ROS messages (images, altitude depth measurements, and ORB-SLAM features),
  *  and calls appropriate color enhancement method.
+ *  Depth measurements are kept in a history and interpolated to the timestamp of each image, so images are
+ *  enhanced as soon as they arrive instead of waiting for a matching depth message.
  */
 
 class ImageHandler
@@ -36,68 +47,165 @@ public:
    *
    *  \param correction_method object includes the focused color enhancement method.
    *  \param SLAM_INPUT - true: utilize ORB-SLAM features.
+   *  \param DEPTH_MAP_INPUT - true: utilize dense depth map images (ignored if SLAM_INPUT is true).
    *  \param SAVE_DATA - see below.
-   *  \param SHOW_IMAGE - see below.
    *  \param CHECK_TIME - see below.
    *  \param CAMERA_TOPIC is the name of the topic for camera images.
    *  \param DEPTH_TOPIC is the name of the topic for the altitude depth measurements.
+   *  \param DEPTH_MAP_TOPIC is the name of the topic for the dense depth map images.
+   *  \param OUTPUT_TOPIC is the name of the topic for the enhanced images.
+   *  \param scheduler is the worker pool shared with other camera streams. 0: process in the ROS callback.
+   *  \param INPUT_TRANSPORT is the image_transport of the camera images, "raw" or "compressed".
+   *      Compressed images without SLAM features or depth maps are decoded with the frame, on the scheduler.
+   *  \param OUTPUT_FORMAT is the format of the compressed output ("jpeg" or "png", on OUTPUT_TOPIC/compressed).
+   *  \param OUTPUT_JPEG_QUALITY is the quality of the JPEG compressed output (1-100).
    */
-  ImageHandler(ColorCorrect correction_method, bool SLAM_INPUT, bool SAVE_DATA, bool SHOW_IMAGE, bool CHECK_TIME,
-    std::string CAMERA_TOPIC, std::string DEPTH_TOPIC);
+  ImageHandler(ColorCorrect correction_method, bool SLAM_INPUT, bool DEPTH_MAP_INPUT, bool SAVE_DATA,
+    bool CHECK_TIME, std::string CAMERA_TOPIC, std::string DEPTH_TOPIC, std::string DEPTH_MAP_TOPIC,
+    std::string OUTPUT_TOPIC = "/image_enhancement/output_image", StreamScheduler* scheduler = 0,
+    std::string INPUT_TRANSPORT = "raw", std::string OUTPUT_FORMAT = "jpeg", int OUTPUT_JPEG_QUALITY = 90);
   ~ImageHandler() {}
 
+  /** Sets how far (seconds) the depth is extrapolated past the newest depth measurement.
+   */
+  void set_max_depth_extrapolation(double MAX_DEPTH_EXTRAPOLATION);
+
+  /** Publishes a side-by-side preview of the raw and corrected images, see PreviewPublisher.
+   *
+   *  \param PREVIEW_TOPIC is the name of the topic for the preview images.
+   *  \param PREVIEW_RATE is the maximum rate of previews (Hz).
+   *  \param PREVIEW_WIDTH is the width of the preview in pixels.
+   */
+  void enable_preview(std::string PREVIEW_TOPIC, double PREVIEW_RATE, int PREVIEW_WIDTH);
+
+  /** Publishes the quality and health of corrected frames as diagnostics, see MetricsPublisher.
+   *  The metrics are computed by the correction kernel, only for the frames that are published.
+   *
+   *  \param METRICS_TOPIC is the name of the topic for the diagnostics.
+   *  \param METRICS_RATE is the maximum rate of metrics (Hz).
+   *  \param MAX_CLIPPED_FRACTION is the fraction of clipped pixels in a channel above which a warning is raised.
+   *  \param name is the name of the camera stream in the diagnostics.
+   */
+  void enable_metrics(std::string METRICS_TOPIC, double METRICS_RATE, double MAX_CLIPPED_FRACTION, std::string name);
+
+  /** Converts a ROS image to an image for the color enhancement method,
+   *  in its channel order and without losing the precision of 16-bit and float images.
+   */
+  static cv_bridge::CvImagePtr convert_image(const sensor_msgs::ImageConstPtr& img_msg, ChannelOrder CHANNEL_ORDER);
+
+  /** Decodes a compressed (JPEG, PNG) ROS image to an image for the color enhancement method,
+   *  in its channel order. 16-bit PNG images keep their precision.
+   */
+  static cv_bridge::CvImagePtr decode_image(const sensor_msgs::CompressedImageConstPtr& img_msg,
+    ChannelOrder CHANNEL_ORDER);
+
 private:
   ros::NodeHandle nh_;
+  image_transport::ImageTransport it_;
+
+  image_transport::Publisher img_pub_;  /**< publisher for current enhanced image, raw and compressed */
 
-  ros::Publisher img_pub_;          /**< publisher for current enhanced image */
+  ros::Subscriber depth_sub_;       /**< altitude depth measurements, independent of the images */
 
-  message_filters::Subscriber<sensor_msgs::Image> img_sub_;
-  message_filters::Subscriber<mavros_msgs::VFR_HUD> depth_sub_;
+  image_transport::Subscriber camera_sub_;      /**< camera images, without SLAM features or depth maps */
+  ros::Subscriber camera_compressed_sub_;       /**< compressed camera images, decoded on the scheduler */
+  image_transport::SubscriberFilter img_sub_;   /**< camera images paired with SLAM features or depth maps */
   message_filters::Subscriber<ORB_SLAM2::Points> orb_slam2_sub_;
+  message_filters::Subscriber<sensor_msgs::Image> depth_map_sub_;
 
-  ColorCorrect correction_method;   /**< handles current color enhancement method */
+  ColorCorrect correction_method;   /**< handles current color enhancement method, shares the model with copies */
 
-  /** With no SLAM implementation (SLAM_INPUT == false).
-    * Only handles camera images and altitude depth measurements.
-    */
-  typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::Image, mavros_msgs::VFR_HUD> SyncPolicy;
-  typedef message_filters::Synchronizer<SyncPolicy> Sync;
-  boost::shared_ptr<Sync> sync;
+  StreamScheduler* scheduler;       /**< shared worker pool, 0 if frames are processed in the callbacks */
+  int stream_id;                    /**< ID of this camera stream in the scheduler */
+
+  DepthHistory depth_history;       /**< latest altitude depth measurements */
 
   /** With SLAM implementation (SLAM_INPUT == true).
-   *  Only handles camera images, altitude depth measurements, and ORB-SLAM features.
+   *  Pairs camera images with the ORB-SLAM features found in them.
    */
-  typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::Image, mavros_msgs::VFR_HUD,
-    ORB_SLAM2::Points> SyncPolicySLAM;
+  typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::Image, ORB_SLAM2::Points> SyncPolicySLAM;
   typedef message_filters::Synchronizer<SyncPolicySLAM> SyncSLAM;
   boost::shared_ptr<SyncSLAM> sync_slam;
 
+  /** With dense depth map implementation (DEPTH_MAP_INPUT == true).
+   *  Pairs camera images with depth map images (CV_16U or CV_32F).
+   */
+  typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::Image, sensor_msgs::Image> SyncPolicyDepthMap;
+  typedef message_filters::Synchronizer<SyncPolicyDepthMap> SyncDepthMap;
+  boost::shared_ptr<SyncDepthMap> sync_depth_map;
+
   bool SAVE_DATA;     /**< true: save attenuation values to output file */
-  bool SHOW_IMAGE;    /**< true: visualize images, both raw and corrected */
+  std::unique_ptr<PreviewPublisher> preview;  /**< preview of raw and corrected images, 0 if disabled */
+  std::unique_ptr<MetricsPublisher> metrics_publisher;  /**< diagnostics of corrected frames, 0 if disabled */
 
-  std::clock_t begin;
-  std::clock_t end;
   bool CHECK_TIME;    /**< true: track and publish time periods */
 
-  /** Callback for image and depth measurements.
+
+  /** Enhances (or optimizes with) an image without SLAM features or depth maps, and publishes it.
+   */
+  void enhance_frame(const cv_bridge::CvImagePtr& cv_ptr, float depth, std::clock_t begin);
+
+  /** Publishes the enhanced image and hands it to the preview.
+   *  metrics: 0, or the metrics of the frame, published with the depth.
+   */
+  void publish_frame(const cv_bridge::CvImagePtr& cv_ptr, const cv::Mat& corrected_frame,
+    const FrameMetrics* metrics = 0, float depth = 0.0);
+
+  /** Metrics to fill while the frame is corrected: 0 if the metrics of this frame are not published.
+   */
+  FrameMetrics* frame_metrics(FrameMetrics& metrics);
+
+  /** Callback for altitude depth measurements, adds them to the depth history.
+   *
+   *  \param depth_msg is the message from the depth sensor topic.
+   */
+  void depth_callback(const mavros_msgs::VFR_HUD::ConstPtr& depth_msg);
+
+  /** Altitude depth at the timestamp of an image, from the depth history.
+   */
+  float frame_depth(const ros::Time& stamp);
+
+  /** Callback for images.
    *  Handles processing of messages and calls color enhancement method.
    *
    *  \param img_msg is the message from the camera/image topic.
-   *  \param depth_msg is the message from the depth sensor topic.
+   *  \param depth is the altitude depth at the time of the image.
    */
-  void camera_depth_callback(const sensor_msgs::ImageConstPtr& img_msg,
-    const mavros_msgs::VFR_HUD::ConstPtr& depth_msg);
+  void camera_callback(const sensor_msgs::ImageConstPtr& img_msg);
+  void process_camera(const sensor_msgs::ImageConstPtr& img_msg, float depth);
 
-  /** Callback for image, depth measurements, and ORB-SLAM features.
+  /** Callback for compressed images.
+   *  Decoding is part of the processing, so it runs on the scheduler workers.
+   *
+   *  \param img_msg is the message from the camera/image/compressed topic.
+   *  \param depth is the altitude depth at the time of the image.
+   */
+  void camera_compressed_callback(const sensor_msgs::CompressedImageConstPtr& img_msg);
+  void process_camera_compressed(const sensor_msgs::CompressedImageConstPtr& img_msg, float depth);
+
+  /** Callback for image and ORB-SLAM features.
    *  Handles processing of messages and calls color enhancment method.
    *
    *  \param img_msg is the message from the camera/image topic.
-   *  \param depth_msg is the message from the depth sensor topic.
    *  \param orb_slam2_msg is the message from the ORB-SLAM topic.
+   *  \param depth is the altitude depth at the time of the image.
    */
-  void camera_depth_slam_callback(const sensor_msgs::ImageConstPtr& img_msg,
-    const mavros_msgs::VFR_HUD::ConstPtr& depth_msg,
+  void camera_slam_callback(const sensor_msgs::ImageConstPtr& img_msg,
     const ORB_SLAM2::Points::ConstPtr& orb_slam2_msg);
+  void process_camera_slam(const sensor_msgs::ImageConstPtr& img_msg,
+    const ORB_SLAM2::Points::ConstPtr& orb_slam2_msg, float depth);
+
+  /** Callback for image and dense depth maps.
+   *  Handles processing of messages and calls color enhancment method.
+   *
+   *  \param img_msg is the message from the camera/image topic.
+   *  \param depth_map_msg is the message from the depth map topic.
+   *  \param depth is the altitude depth at the time of the image.
+   */
+  void camera_depth_map_callback(const sensor_msgs::ImageConstPtr& img_msg,
+    const sensor_msgs::ImageConstPtr& depth_map_msg);
+  void process_camera_depth_map(const sensor_msgs::ImageConstPtr& img_msg,
+    const sensor_msgs::ImageConstPtr& depth_map_msg, float depth);
 };
 
 }  // namespace underwater_color_enhance
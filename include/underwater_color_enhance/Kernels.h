@@ -0,0 +1,641 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_KERNELS_H
+#define UNDERWATER_COLOR_ENHANCE_KERNELS_H
+
+#include "underwater_color_enhance/FastExp.h"
+#include "underwater_color_enhance/FrameMetrics.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Per-pixel correction kernels.
+ *  Every correction of the image formation model is affine per channel: I * gain + offset.
+ *  Kernels are specialized at compile time on the pixel type (uchar, ushort, float) and the channel order,
+ *  gains and offsets are always given in BGR order. The corrected values are computed in float and pass through
+ *  a ToneCurve before they are quantized to the pixel type, so nothing is clipped before tone mapping.
+ *  With FrameMetrics, each corrected row is added to the metrics right after it is written.
+ *  With a ColorMatrix, each corrected row is kept in a float row buffer and written through the color stage.
+ */
+
+enum ChannelOrder
+{
+  BGR = 0,
+  RGB = 1
+};
+
+/** Scale of pixel values relative to 8-bit values, used for ground truths and calculated veiling light.
+ *  8-bit: [0, 255], 16-bit: [0, 65535], float: [0, 1].
+ */
+template <typename T> struct PixelTraits;
+template <> struct PixelTraits<uchar>  {static float scale() {return 1.0f;}};
+template <> struct PixelTraits<ushort> {static float scale() {return 65535.0f / 255.0f;}};
+template <> struct PixelTraits<float>  {static float scale() {return 1.0f / 255.0f;}};
+
+inline float pixel_scale(int depth)
+{
+  switch (depth)
+  {
+    case CV_16U: return PixelTraits<ushort>::scale();
+    case CV_32F: return PixelTraits<float>::scale();
+    default:     return PixelTraits<uchar>::scale();
+  }
+}
+
+/** Largest pixel value: 255 for 8-bit, 65535 for 16-bit and 1 for float images.
+ */
+inline float full_scale(int depth)
+{
+  return 255.0f * pixel_scale(depth);
+}
+
+/** Tone curve applied to the corrected values (in pixel units) before quantization.
+ *  Linear with a gain up to the knee, above it a Reinhard shoulder that reaches white_value at the white point:
+ *  t = (v - knee) / (white_value - knee), v' = knee + (white_value - knee) * t * (1 + t / t_white^2) / (1 + t).
+ *  The default curve is the identity, values are then clipped by the quantization as before.
+ */
+struct ToneCurve
+{
+  float gain = 1.0f;
+  float knee = FLT_MAX;           /**< start of the shoulder, after the gain; FLT_MAX: no shoulder */
+  float shoulder_range = 1.0f;    /**< white_value - knee */
+  float inv_shoulder_range = 1.0f;
+  float inv_white_sq = 0.0f;      /**< 1 / t_white^2, t_white: white point after the gain in shoulder units */
+
+  inline float operator()(float v) const
+  {
+    v *= this->gain;
+    if (v > this->knee)   // Predictable: never taken without a shoulder
+    {
+      float t = (v - this->knee) * this->inv_shoulder_range;
+      v = this->knee + this->shoulder_range * t * (1.0f + t * this->inv_white_sq) / (1.0f + t);
+    }
+    return v;
+  }
+};
+
+/** Index of BGR channel c in the image.
+ */
+template <ChannelOrder ORDER>
+inline int channel_index(int c)
+{
+  return ORDER == BGR ? c : 2 - c;
+}
+
+
+/** Color stage after the attenuation correction, in the same pass: a 3x3 matrix on the BGR values (camera to
+ *  display primaries and white balance), the tone curve, then a gamma encoding of the values relative to full scale:
+ *  v' = full_scale * (v / full_scale)^gamma. The gamma encoding is a table with linear interpolation.
+ *  Immutable once built, shared by the frames that use it.
+ */
+struct ColorMatrix
+{
+  static const int GAMMA_TABLE_SIZE = 4096;   /**< steps over [0, full scale] */
+
+  float matrix [9] = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};  /**< BGR rows, row-major */
+  float gamma = 1.0f;
+
+  ColorMatrix() {}
+
+  /** \param matrix - 9 values, row-major, BGR out = matrix * BGR in.
+   *  \param gamma - encoding exponent, e.g. 1 / 2.2; 1: linear.
+   */
+  ColorMatrix(const float* matrix, float gamma) : gamma(gamma)
+  {
+    std::copy(matrix, matrix + 9, this->matrix);
+    if (gamma != 1.0f)
+    {
+      std::vector<float>* table = new std::vector<float>(GAMMA_TABLE_SIZE + 2);
+      for (int i = 0; i < GAMMA_TABLE_SIZE + 2; i++)
+      {
+        (*table)[i] = std::pow(static_cast<float>(i) / GAMMA_TABLE_SIZE, gamma);
+      }
+      this->gamma_table.reset(table);
+    }
+  }
+
+  bool identity() const
+  {
+    static const float IDENTITY [9] = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+    return std::equal(this->matrix, this->matrix + 9, IDENTITY) && this->gamma == 1.0f;
+  }
+
+  /** The matrix without the gamma encoding, e.g. for the tone sample.
+   */
+  ColorMatrix linear() const {return ColorMatrix(this->matrix, 1.0f);}
+
+  /** Gamma encoding of a value relative to full scale. Values above full scale are calculated.
+   */
+  inline float encode(float v) const
+  {
+    if (!(v > 0.0f))
+    {
+      return 0.0f;
+    }
+    if (v >= 1.0f)
+    {
+      return std::pow(v, this->gamma);
+    }
+    const float position = v * GAMMA_TABLE_SIZE;
+    const int i = static_cast<int>(position);
+    const float* table = &(*this->gamma_table)[i];
+    return table[0] + (position - i) * (table[1] - table[0]);
+  }
+
+  /** Writes a row of corrected BGR values (3 floats per pixel, in pixel units) through the matrix, the tone curve
+   *  and the gamma encoding.
+   */
+  template <typename T, ChannelOrder ORDER>
+  void store_row(const float* bgr, T* d, int cols, const ToneCurve& tone) const
+  {
+    const int b = channel_index<ORDER>(0);
+    const int r = channel_index<ORDER>(2);
+    const float* m = this->matrix;
+    const float scale = 255.0f * PixelTraits<T>::scale();
+    const float inv_scale = 1.0f / scale;
+
+    for (int col = 0; col < cols; col++)
+    {
+      const float* v = &bgr[3 * col];
+      float out [3] = {
+        tone(m[0] * v[0] + m[1] * v[1] + m[2] * v[2]),
+        tone(m[3] * v[0] + m[4] * v[1] + m[5] * v[2]),
+        tone(m[6] * v[0] + m[7] * v[1] + m[8] * v[2])};
+      if (this->gamma_table)
+      {
+        for (int c = 0; c < 3; c++)
+        {
+          out[c] = scale * encode(out[c] * inv_scale);
+        }
+      }
+      d[3 * col + b] = cv::saturate_cast<T>(out[0]);
+      d[3 * col + 1] = cv::saturate_cast<T>(out[1]);
+      d[3 * col + r] = cv::saturate_cast<T>(out[2]);
+    }
+  }
+
+private:
+  std::shared_ptr<const std::vector<float>> gamma_table;  /**< 0 if gamma is 1; one entry past 1 for interpolation */
+};
+
+
+/** Same gain and offset for every pixel (one distance for the whole frame).
+ */
+template <typename T, ChannelOrder ORDER>
+struct AffineKernel
+{
+  static void run(const cv::Mat& src, cv::Mat& dst, const float* gain, const float* offset, const ToneCurve& tone,
+    FrameMetrics* metrics = 0, const ColorMatrix* color = 0)
+  {
+    float g[3], o[3];
+    for (int c = 0; c < 3; c++)
+    {
+      g[channel_index<ORDER>(c)] = gain[c];
+      o[channel_index<ORDER>(c)] = offset[c];
+    }
+
+    // Corrected row in BGR order for the color stage, kept in cache
+    std::vector<float> corrected(color ? 3 * src.cols : 0);
+    const int b = channel_index<ORDER>(0);
+    const int r = channel_index<ORDER>(2);
+
+    dst.create(src.size(), src.type());
+    for (int row = 0; row < src.rows; row++)
+    {
+      const T* s = src.ptr<T>(row);
+      T* d = dst.ptr<T>(row);
+      if (color)
+      {
+        for (int i = 0; i < 3 * src.cols; i += 3)
+        {
+          corrected[i] = s[i + b] * g[b] + o[b];
+          corrected[i + 1] = s[i + 1] * g[1] + o[1];
+          corrected[i + 2] = s[i + r] * g[r] + o[r];
+        }
+        color->store_row<T, ORDER>(&corrected[0], d, src.cols, tone);
+      }
+      else
+      {
+        for (int i = 0; i < 3 * src.cols; i += 3)
+        {
+          d[i] = cv::saturate_cast<T>(tone(s[i] * g[0] + o[0]));
+          d[i + 1] = cv::saturate_cast<T>(tone(s[i + 1] * g[1] + o[1]));
+          d[i + 2] = cv::saturate_cast<T>(tone(s[i + 2] * g[2] + o[2]));
+        }
+      }
+      if (metrics)
+      {
+        metrics->add_row(d, src.cols, channel_index<ORDER>(0), channel_index<ORDER>(2),
+          255.0f * PixelTraits<T>::scale());
+      }
+    }
+  }
+};
+
+
+/** Bilinear interpolation of a low resolution grid of BGR values over a frame, one row at a time.
+ *  Cell centers are at ((i + 0.5) * width / grid width, (j + 0.5) * height / grid height), pixels beyond the outer
+ *  centers take the values of the border cells. Used for the veiling light ratio of each pixel, see VeilingLightGrid.
+ */
+struct GridSampler
+{
+  GridSampler() {}
+
+  /** \param grid - BGR values of the cells, row-major.
+   */
+  GridSampler(const std::vector<float>& grid, cv::Size grid_size, cv::Size frame_size) :
+    frame_size(frame_size), values(grid), grid_size(grid_size)
+  {
+    CV_Assert(grid.size() == 3 * static_cast<size_t>(grid_size.area()));
+
+    this->x0.resize(frame_size.width);
+    this->x1.resize(frame_size.width);
+    this->wx.resize(frame_size.width);
+    for (int x = 0; x < frame_size.width; x++)
+    {
+      cell(x, frame_size.width, grid_size.width, this->x0[x], this->x1[x], this->wx[x]);
+    }
+  }
+
+  bool empty() const {return this->values.empty();}
+
+  /** Floats of scratch memory row() needs.
+   */
+  int scratch_size() const {return 3 * this->grid_size.width;}
+
+  /** Values of the pixels [x, x + cols) of frame row y, one row per BGR channel.
+   */
+  void row(int y, int x, int cols, float* const value[3], float* scratch) const
+  {
+    // Grid row at y, blended once for the whole frame row
+    int y0, y1;
+    float wy;
+    cell(y, this->frame_size.height, this->grid_size.height, y0, y1, wy);
+    const float* top = &this->values[3 * y0 * this->grid_size.width];
+    const float* bottom = &this->values[3 * y1 * this->grid_size.width];
+    for (int i = 0; i < 3 * this->grid_size.width; i++)
+    {
+      scratch[i] = top[i] + wy * (bottom[i] - top[i]);
+    }
+
+    for (int c = 0; c < 3; c++)
+    {
+      for (int col = 0; col < cols; col++)
+      {
+        const float left = scratch[3 * this->x0[x + col] + c];
+        const float right = scratch[3 * this->x1[x + col] + c];
+        value[c][col] = left + this->wx[x + col] * (right - left);
+      }
+    }
+  }
+
+  cv::Size frame_size;
+
+private:
+  std::vector<float> values;
+  cv::Size grid_size;
+  std::vector<int> x0, x1;  /**< cells left and right of each frame column */
+  std::vector<float> wx;    /**< weight of the right cell */
+
+  static void cell(int pixel, int pixels, int cells, int& first, int& second, float& weight)
+  {
+    float position = (pixel + 0.5f) * cells / pixels - 0.5f;
+    position = std::min(std::max(position, 0.0f), static_cast<float>(cells - 1));
+    first = static_cast<int>(position);
+    second = std::min(first + 1, cells - 1);
+    weight = position - first;
+  }
+};
+
+
+/** Same gain for every pixel, the offset scaled by a ratio interpolated from a grid: I * gain + offset * ratio(x, y).
+ *  Veiling light that varies over the frame (artificial lights), the offset is linear in the veiling light.
+ *  origin: position of src in the frame the grid covers, src may be a part of it.
+ */
+template <typename T, ChannelOrder ORDER>
+struct GridAffineKernel
+{
+  static void run(const cv::Mat& src, cv::Mat& dst, const float* gain, const float* offset, const ToneCurve& tone,
+    const GridSampler& grid, cv::Point origin, FrameMetrics* metrics = 0, const ColorMatrix* color = 0)
+  {
+    std::vector<float> buffer(3 * src.cols + grid.scratch_size() + (color ? 3 * src.cols : 0));
+    float* ratio[3] = {&buffer[0], &buffer[src.cols], &buffer[2 * src.cols]};
+    float* scratch = &buffer[3 * src.cols];
+    float* corrected = scratch + grid.scratch_size();   // BGR row for the color stage
+
+    const int b = channel_index<ORDER>(0);
+    const int r = channel_index<ORDER>(2);
+
+    dst.create(src.size(), src.type());
+    for (int row = 0; row < src.rows; row++)
+    {
+      grid.row(origin.y + row, origin.x, src.cols, ratio, scratch);
+
+      const T* s = src.ptr<T>(row);
+      T* d = dst.ptr<T>(row);
+      if (color)
+      {
+        for (int col = 0; col < src.cols; col++)
+        {
+          corrected[3 * col] = s[3 * col + b] * gain[0] + offset[0] * ratio[0][col];
+          corrected[3 * col + 1] = s[3 * col + 1] * gain[1] + offset[1] * ratio[1][col];
+          corrected[3 * col + 2] = s[3 * col + r] * gain[2] + offset[2] * ratio[2][col];
+        }
+        color->store_row<T, ORDER>(corrected, d, src.cols, tone);
+      }
+      else
+      {
+        for (int col = 0; col < src.cols; col++)
+        {
+          d[3 * col + b] = cv::saturate_cast<T>(tone(s[3 * col + b] * gain[0] + offset[0] * ratio[0][col]));
+          d[3 * col + 1] = cv::saturate_cast<T>(tone(s[3 * col + 1] * gain[1] + offset[1] * ratio[1][col]));
+          d[3 * col + r] = cv::saturate_cast<T>(tone(s[3 * col + r] * gain[2] + offset[2] * ratio[2][col]));
+        }
+      }
+      if (metrics)
+      {
+        metrics->add_row(d, src.cols, b, r, 255.0f * PixelTraits<T>::scale());
+      }
+    }
+  }
+};
+
+
+/** Same gain and offset for every pixel of an 8-bit image, as a lookup table of the float kernel per channel.
+ *  For CPUs where float SIMD is slow: one table load per value, no arithmetic. The tables are filled with the
+ *  float kernel itself (tone curve included), so the output is the same.
+ */
+struct AffineTable
+{
+  uchar table[3][256];  /**< BGR corrected value of every 8-bit value */
+
+  /** Fills the tables from the float coefficients. Returns false if they are not finite.
+   */
+  bool set(const float* float_gain, const float* float_offset, const ToneCurve& tone)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      if (!std::isfinite(float_gain[c]) || !std::isfinite(float_offset[c]))
+      {
+        return false;
+      }
+      for (int value = 0; value < 256; value++)
+      {
+        this->table[c][value] = cv::saturate_cast<uchar>(tone(value * float_gain[c] + float_offset[c]));
+      }
+    }
+
+    return true;
+  }
+
+  inline int apply(int value, int c) const
+  {
+    return this->table[c][value];
+  }
+};
+
+
+template <ChannelOrder ORDER>
+struct TableAffineKernel
+{
+  static void run(const cv::Mat& src, cv::Mat& dst, const AffineTable& table, FrameMetrics* metrics = 0)
+  {
+    CV_Assert(src.type() == CV_8UC3);
+
+    const uchar* t0 = table.table[channel_index<ORDER>(0)];
+    const uchar* t1 = table.table[1];
+    const uchar* t2 = table.table[channel_index<ORDER>(2)];
+
+    dst.create(src.size(), src.type());
+    for (int row = 0; row < src.rows; row++)
+    {
+      const uchar* s = src.ptr<uchar>(row);
+      uchar* d = dst.ptr<uchar>(row);
+      for (int i = 0; i < 3 * src.cols; i += 3)
+      {
+        d[i] = t0[s[i]];
+        d[i + 1] = t1[s[i + 1]];
+        d[i + 2] = t2[s[i + 2]];
+      }
+      if (metrics)
+      {
+        metrics->add_row(d, src.cols, channel_index<ORDER>(0), channel_index<ORDER>(2), 255.0f);
+      }
+    }
+  }
+};
+
+
+/** Gain and offset rows from a row of distances:
+ *  (I - B * (1 - exp(-b_bs * z))) / exp(-b_ds * z) = I * gain + offset, with gain = exp(b_ds * z).
+ */
+struct RangeFactors
+{
+  const FastExp* fast_exp;
+  float backscatter_att[3];
+  float direct_signal_att[3];
+  float veiling_light[3];
+  float default_distance;   /**< used for missing or invalid distances (zero, negative, NaN, inf) */
+  const GridSampler* veiling_light_grid = 0;  /**< veiling light ratio over the frame, 0: same veiling light */
+
+  void row(const float* range, int cols, float* distance, float* const gain[3], float* const offset[3]) const
+  {
+    for (int col = 0; col < cols; col++)
+    {
+      distance[col] = (range[col] > 0.0f && range[col] < FLT_MAX) ? range[col] : this->default_distance;
+    }
+
+    // exp(-b_bs * z) is computed into the offset row, then turned into the offset
+    for (int c = 0; c < 3; c++)
+    {
+      this->fast_exp->exp_array(distance, -this->backscatter_att[c], offset[c], cols);
+      this->fast_exp->exp_array(distance, this->direct_signal_att[c], gain[c], cols);
+
+      const float veiling_light = this->veiling_light[c];
+      for (int col = 0; col < cols; col++)
+      {
+        offset[c][col] = -veiling_light * (1.0f - offset[c][col]) * gain[c][col];
+      }
+    }
+  }
+};
+
+
+/** Distance per pixel (CV_32FC1 range map), all six factors derived in one pass over the range map.
+ */
+template <typename T, ChannelOrder ORDER>
+struct RangeKernel
+{
+  static void run(const cv::Mat& src, const cv::Mat& range_map, cv::Mat& dst, const RangeFactors& factors,
+    const ToneCurve& tone, FrameMetrics* metrics = 0, const ColorMatrix* color = 0)
+  {
+    // Row buffers for the range and the six correction factors, kept in cache between the passes below.
+    // The grid ratios are also the BGR row of the color stage.
+    const GridSampler* grid = factors.veiling_light_grid;
+    std::vector<float> buffer(10 * src.cols + (grid ? grid->scratch_size() : 0));
+    float* distance = &buffer[0];
+    float* gain[3] = {&buffer[src.cols], &buffer[2 * src.cols], &buffer[3 * src.cols]};
+    float* offset[3] = {&buffer[4 * src.cols], &buffer[5 * src.cols], &buffer[6 * src.cols]};
+    float* ratio[3] = {&buffer[7 * src.cols], &buffer[8 * src.cols], &buffer[9 * src.cols]};
+    float* scratch = &buffer[10 * src.cols];
+
+    const int b = channel_index<ORDER>(0);
+    const int r = channel_index<ORDER>(2);
+
+    dst.create(src.size(), src.type());
+    for (int row = 0; row < src.rows; row++)
+    {
+      factors.row(range_map.ptr<float>(row), src.cols, distance, gain, offset);
+      if (grid)
+      {
+        grid->row(row, 0, src.cols, ratio, scratch);
+        for (int c = 0; c < 3; c++)
+        {
+          for (int col = 0; col < src.cols; col++)
+          {
+            offset[c][col] *= ratio[c][col];
+          }
+        }
+      }
+
+      const T* s = src.ptr<T>(row);
+      T* d = dst.ptr<T>(row);
+      if (color)
+      {
+        float* corrected = ratio[0];
+        for (int col = 0; col < src.cols; col++)
+        {
+          corrected[3 * col] = s[3 * col + b] * gain[0][col] + offset[0][col];
+          corrected[3 * col + 1] = s[3 * col + 1] * gain[1][col] + offset[1][col];
+          corrected[3 * col + 2] = s[3 * col + r] * gain[2][col] + offset[2][col];
+        }
+        color->store_row<T, ORDER>(corrected, d, src.cols, tone);
+      }
+      else
+      {
+        for (int col = 0; col < src.cols; col++)
+        {
+          d[3 * col + b] = cv::saturate_cast<T>(tone(s[3 * col + b] * gain[0][col] + offset[0][col]));
+          d[3 * col + 1] = cv::saturate_cast<T>(tone(s[3 * col + 1] * gain[1][col] + offset[1][col]));
+          d[3 * col + r] = cv::saturate_cast<T>(tone(s[3 * col + r] * gain[2][col] + offset[2][col]));
+        }
+      }
+      if (metrics)
+      {
+        metrics->add_row(d, src.cols, b, r, 255.0f * PixelTraits<T>::scale());
+      }
+    }
+  }
+};
+
+
+/** Label per pixel (CV_16UC1 label map), six factors per label: BGR gains followed by BGR offsets.
+ */
+template <typename T, ChannelOrder ORDER>
+struct LabelKernel
+{
+  static void run(const cv::Mat& src, const cv::Mat& label_map, cv::Mat& dst, const std::vector<float>& factors,
+    const ToneCurve& tone, FrameMetrics* metrics = 0, const ColorMatrix* color = 0)
+  {
+    const int b = channel_index<ORDER>(0);
+    const int r = channel_index<ORDER>(2);
+
+    // Corrected row in BGR order for the color stage, kept in cache
+    std::vector<float> corrected(color ? 3 * src.cols : 0);
+
+    dst.create(src.size(), src.type());
+    for (int row = 0; row < src.rows; row++)
+    {
+      const T* s = src.ptr<T>(row);
+      const uint16_t* label = label_map.ptr<uint16_t>(row);
+      T* d = dst.ptr<T>(row);
+      if (color)
+      {
+        for (int col = 0; col < src.cols; col++)
+        {
+          const float* factor = &factors[6 * label[col]];
+          corrected[3 * col] = s[3 * col + b] * factor[0] + factor[3];
+          corrected[3 * col + 1] = s[3 * col + 1] * factor[1] + factor[4];
+          corrected[3 * col + 2] = s[3 * col + r] * factor[2] + factor[5];
+        }
+        color->store_row<T, ORDER>(&corrected[0], d, src.cols, tone);
+      }
+      else
+      {
+        for (int col = 0; col < src.cols; col++)
+        {
+          const float* factor = &factors[6 * label[col]];
+          d[3 * col + b] = cv::saturate_cast<T>(tone(s[3 * col + b] * factor[0] + factor[3]));
+          d[3 * col + 1] = cv::saturate_cast<T>(tone(s[3 * col + 1] * factor[1] + factor[4]));
+          d[3 * col + r] = cv::saturate_cast<T>(tone(s[3 * col + r] * factor[2] + factor[5]));
+        }
+      }
+      if (metrics)
+      {
+        metrics->add_row(d, src.cols, b, r, 255.0f * PixelTraits<T>::scale());
+      }
+    }
+  }
+};
+
+
+/** Runs the kernel specialized for the image type (CV_8UC3, CV_16UC3, CV_32FC3) and channel order.
+ */
+template <template <typename, ChannelOrder> class Kernel, typename... Args>
+void dispatch_kernel(int type, ChannelOrder order, Args&&... args)
+{
+  switch (type)
+  {
+    case CV_8UC3:
+      if (order == BGR)
+      {
+        Kernel<uchar, BGR>::run(std::forward<Args>(args)...);
+      }
+      else
+      {
+        Kernel<uchar, RGB>::run(std::forward<Args>(args)...);
+      }
+      break;
+    case CV_16UC3:
+      if (order == BGR)
+      {
+        Kernel<ushort, BGR>::run(std::forward<Args>(args)...);
+      }
+      else
+      {
+        Kernel<ushort, RGB>::run(std::forward<Args>(args)...);
+      }
+      break;
+    case CV_32FC3:
+      if (order == BGR)
+      {
+        Kernel<float, BGR>::run(std::forward<Args>(args)...);
+      }
+      else
+      {
+        Kernel<float, RGB>::run(std::forward<Args>(args)...);
+      }
+      break;
+    default:
+      CV_Error(cv::Error::StsUnsupportedFormat, "Images must be CV_8UC3, CV_16UC3 or CV_32FC3");
+  }
+}
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_KERNELS_H
@@ -0,0 +1,92 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_KEYPOINTSPAN_H
+#define UNDERWATER_COLOR_ENHANCE_KEYPOINTSPAN_H
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <vector>
+#include <string.h>
+
+namespace underwater_color_enhance
+{
+
+/** Keypoint view class.
+ *  Read-only view over the points and distances of SLAM features, without copying them.
+ *  Points can be of any type with x and y members (cv::Point2f, geometry_msgs::Point, ...),
+ *  coordinates and distances can be float or double. The viewed arrays must outlive the view.
+ */
+
+class KeypointSpan
+{
+public:
+  /** Constructor.
+   *  Empty view.
+   */
+  KeypointSpan() : length(0) {}
+
+  /** Constructor.
+   *  View over the first min(points.size(), distances.size()) points and distances.
+   */
+  template <typename PointT, typename DistanceT>
+  KeypointSpan(const std::vector<PointT>& points, const std::vector<DistanceT>& distances)
+  {
+    this->length = std::min(points.size(), distances.size());
+    if (this->length > 0)
+    {
+      this->x = Field(&points[0].x, sizeof(PointT));
+      this->y = Field(&points[0].y, sizeof(PointT));
+      this->distances = Field(&distances[0], sizeof(DistanceT));
+    }
+  }
+
+  size_t size() const {return this->length;}
+  bool empty() const {return this->length == 0;}
+
+  cv::Point2f point(size_t i) const {return cv::Point2f(this->x.get(i), this->y.get(i));}
+  float distance(size_t i) const {return this->distances.get(i);}
+
+private:
+  /** Strided float or double values.
+   */
+  struct Field
+  {
+    Field() : data(0), stride(0), is_double(false) {}
+    Field(const float* first, size_t stride) :
+      data(reinterpret_cast<const unsigned char*>(first)), stride(stride), is_double(false) {}
+    Field(const double* first, size_t stride) :
+      data(reinterpret_cast<const unsigned char*>(first)), stride(stride), is_double(true) {}
+
+    float get(size_t i) const
+    {
+      if (this->is_double)
+      {
+        double val;
+        memcpy(&val, this->data + i * this->stride, sizeof(val));
+        return static_cast<float>(val);
+      }
+
+      float val;
+      memcpy(&val, this->data + i * this->stride, sizeof(val));
+      return val;
+    }
+
+    const unsigned char* data;
+    size_t stride;
+    bool is_double;
+  };
+
+  Field x;
+  Field y;
+  Field distances;
+  size_t length;
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_KEYPOINTSPAN_H
@@ -9,17 +9,87 @@
 #define UNDERWATER_COLOR_ENHANCE_METHOD_H
 
 #include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/CalibrationBuffer.h"
+#include "underwater_color_enhance/CalibrationStore.h"
+#include "underwater_color_enhance/FastExp.h"
+#include "underwater_color_enhance/KeypointSpan.h"
+#include "underwater_color_enhance/Kernels.h"
+#include "underwater_color_enhance/ToneMap.h"
+#include "underwater_color_enhance/FrameCorrection.h"
+#include "underwater_color_enhance/FrameMetrics.h"
+#include "underwater_color_enhance/VeilingLightGrid.h"
 
 #include <opencv2/opencv.hpp>
 #include <tinyxml.h>
+#include <ctime>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 namespace underwater_color_enhance
 {
 
+/** Settings shared by every color enhancement method, set up by ColorCorrect.
+ */
+struct MethodConfig
+{
+  bool EST_VEILING_LIGHT = false; /**< true: estimate as background color in image; false: calculate */
+
+  bool OPTIMIZE = false;  /**< required to set what depth values when writing to file */
+  float RANGE = -1.0;     /**< Range for each optimization calculation to account for */
+  bool JOINT_OPTIMIZE = false;  /**< true: also fit attenuation curves over depth on all the samples of the mission */
+  float KNOT_SPACING = 0.5;     /**< meters between the knots of the attenuation curves */
+  float SMOOTHNESS = 1.0;       /**< curvature penalty of the attenuation curves, per sample */
+
+  bool PRIOR_DATA = false;  /**< true: use data that is loaded. false: calculate attenuation values */
+  bool SAVE_DATA = false;   /**< true: write attenuation values. false: do not */
+
+  bool CHECK_TIME = false;  /**< true: track and print time latencies. false: do not */
+  bool LOG_SCREEN = false;  /**< true: print log statements to screen. false: do not */
+
+  float EXP_MAX_ERROR = 1e-4;   /**< max relative error of the exp approximation for range dependent attenuation */
+  bool SLAM_LABEL_MAP = true;   /**< true: SLAM range map holds a facet label per pixel. false: a distance per pixel */
+  ChannelOrder CHANNEL_ORDER = BGR; /**< channel order of the images given to the method */
+  ToneMap TONE_MAP;   /**< tone mapping of the corrected values before they are quantized */
+  bool LOOKUP_TABLE = false;   /**< true: 8-bit images with one gain and offset per channel use lookup tables */
+
+  bool COLOR_CHART = true;    /**< true: a color chart is in view to calibrate from. false: stored calibrations only */
+  std::shared_ptr<CalibrationStore> CALIBRATION_STORE;  /**< calibrations of previous missions, 0 for none */
+
+  std::shared_ptr<VeilingLightGrid> VEILING_LIGHT_GRID;  /**< veiling light over the frame, 0: same for every pixel */
+
+  ColorMatrix COLOR_MATRIX;       /**< color stage after the correction, the identity for none */
+  bool COLOR_MATRIX_FIT = false;  /**< true: the matrix is fitted on the chart patches of the frames */
+};
+
+
+/** Per-frame state of a color enhancement method.
+ *  Every call owns its context, so one method object can enhance several frames concurrently.
+ */
+struct FrameContext
+{
+  float depth = 0.01;         /**< altitude depth measurement of the frame */
+  float pixel_scale = 1.0;    /**< scale of the image pixel values relative to 8-bit values */
+
+  float backscatter_att [3] = {0.0, 0.0, 0.0};    /**< backscatter attenuation values for the depth of the frame */
+  float direct_signal_att [3] = {0.0, 0.0, 0.0};  /**< direct signal attenuation values for the depth of the frame */
+
+  std::shared_ptr<const ColorMatrix> color_matrix;  /**< color stage of the frame, 0: none */
+
+  std::clock_t begin;
+  std::clock_t end;
+};
+
+
 /** Method handler class.
  *  Handles the universal parameters and funcitons for any color enhancement method.
+ *  Methods are created through the MethodRegistry, see REGISTER_METHOD.
+ *
+ *  Ownership: the scene and the settings are set up once, before any image is processed, and are not changed
+ *  afterwards. Per-frame values live in a FrameContext on the stack of each call, and the state that is
+ *  accumulated over frames (optimization samples, output file) is guarded by data_mutex. The color_correct
+ *  functions may be called from several threads at once.
  */
 
 class Method
@@ -28,44 +98,140 @@ public:
   /** Constructor
    */
   Method() {}
-  ~Method() {}
-
-  bool EST_VEILING_LIGHT; /**< true: estimate as background color in image; false: calculate */
+  virtual ~Method() {}
 
-  bool OPTIMIZE;  /**< required to set what depth values when writing to file */
-  float RANGE;    /**< Range for each optimization calculation to account for */
-
-  Scene *scene;   /**< contains the physical underwater properties. */
-  float depth;    /**< current altitude depth measurement. */
+  /** Sets the method settings, called by ColorCorrect before any image is processed.
+   */
+  virtual void configure(const MethodConfig& config)
+  {
+    this->EST_VEILING_LIGHT = config.EST_VEILING_LIGHT;
+    this->OPTIMIZE = config.OPTIMIZE;
+    this->RANGE = config.RANGE;
+    this->JOINT_OPTIMIZE = config.JOINT_OPTIMIZE;
+    this->KNOT_SPACING = config.KNOT_SPACING;
+    this->SMOOTHNESS = config.SMOOTHNESS;
+    this->PRIOR_DATA = config.PRIOR_DATA;
+    this->SAVE_DATA = config.SAVE_DATA;
+    this->CHECK_TIME = config.CHECK_TIME;
+    this->LOG_SCREEN = config.LOG_SCREEN;
+    this->SLAM_LABEL_MAP = config.SLAM_LABEL_MAP;
+    this->CHANNEL_ORDER = config.CHANNEL_ORDER;
+    this->tone_map = config.TONE_MAP;
+    this->LOOKUP_TABLE = config.LOOKUP_TABLE;
+    this->COLOR_CHART = config.COLOR_CHART;
+    this->calibration_store = config.CALIBRATION_STORE;
+    this->veiling_light_grid = config.VEILING_LIGHT_GRID;
+    this->COLOR_MATRIX_FIT = config.COLOR_MATRIX_FIT;
+    std::atomic_store(&this->color_matrix, config.COLOR_MATRIX.identity() && !config.COLOR_MATRIX_FIT ?
+      std::shared_ptr<const ColorMatrix>() : std::make_shared<const ColorMatrix>(config.COLOR_MATRIX));
+    if (config.EXP_MAX_ERROR != this->EXP_MAX_ERROR)  // The polynomial is fitted again only when the bound changes
+    {
+      this->EXP_MAX_ERROR = config.EXP_MAX_ERROR;
+      this->fast_exp = FastExp(this->EXP_MAX_ERROR);
+    }
+  }
+  const FastExp& get_fast_exp() const {return this->fast_exp;}
+
+  /** Sets the physical underwater properties, shared with other methods and not changed while processing.
+   */
+  void set_scene(std::shared_ptr<const Scene> scene) {this->scene = scene;}
 
-  bool PRIOR_DATA;  /**< true: use data that is loaded. false: calculate attenuation values */
+  /** Latest calibration published by the optimizer or the color chart, false if there is none yet.
+   *  Lock-free, safe to call while a calibration is being published.
+   */
+  bool get_calibration(Calibration& calibration) const {return this->calibration.read(calibration);}
 
-  std::clock_t begin;
-  std::clock_t end;
-  bool CHECK_TIME;  /**< true: track and print time latencies. false: do not */
+  /** Latest color stage, the configured one or the last fit on the chart, 0 if there is none.
+   *  Safe to call while a fit is being published.
+   */
+  std::shared_ptr<const ColorMatrix> get_color_matrix() const {return std::atomic_load(&this->color_matrix);}
 
-  bool LOG_SCREEN;  /**< true: print log statements to screen. false: do not */
+  virtual void calculate_optimized_attenuation(const cv::Mat& img, float depth) = 0;
 
-  /** Parameters used for writing attenuation values to file.
+  /** Fits the attenuation curves over depth on the samples of the whole mission, once all the frames are
+   *  processed, and adds them to the output file. False if the method does not support it or has no samples.
    */
-  TiXmlDocument out_doc;
-  bool SAVE_DATA; /**< true: write attenuation values. false: do not */
-  bool file_initialized;
+  virtual bool fit_attenuation_curves() {return false;}
 
-  virtual void calculate_optimized_attenuation(cv::Mat& img) = 0;
+  /** Functions for applying the color enhancement method at the altitude depth measurement of the frame.
+   *  metrics: 0, or filled with the metrics of the corrected frame by the correction kernel, see FrameMetrics.
+   */
+  virtual cv::Mat color_correct(const cv::Mat& img, float depth, FrameMetrics* metrics) = 0;
+  virtual cv::Mat color_correct_slam(const cv::Mat& img, const KeypointSpan& keypoints, float depth,
+    FrameMetrics* metrics) = 0;
+  virtual cv::Mat color_correct_depth(const cv::Mat& img, const cv::Mat& range_map, float depth,
+    FrameMetrics* metrics) = 0;
+
+  /** Correction of a frame with one distance for the whole frame, to be applied to parts of the frame.
+   *  color_correct(img, depth) is prepare_frame(img, depth).apply(img).
+   */
+  virtual FrameCorrection prepare_frame(const cv::Mat& img, float depth) = 0;
 
-  /** Functions for applying the color enhancement method
+  /** Runs the correction kernels of the configured paths once on a blank frame, so the first frame does not pay
+   *  for lazy allocations. Nothing is published, stored or saved. Default: the correction of prepare_frame().
    */
-  virtual cv::Mat color_correct(cv::Mat& img) = 0;
-  virtual cv::Mat color_correct_slam(cv::Mat& img, std::vector<cv::Point2f> point_data,
-    std::vector<float> distance_data) = 0;
+  virtual void prewarm(const cv::Mat& img, float depth) {prepare_frame(img, depth).apply(img);}
 
   /** Functions for handling file reading/loading/closing.
    */
   virtual void end_file(std::string output_filename) = 0;
   virtual void load_data(std::string input_filename) = 0;
 
-private:
+protected:
+  bool EST_VEILING_LIGHT = false; /**< true: estimate as background color in image; false: calculate */
+
+  bool OPTIMIZE = false;  /**< required to set what depth values when writing to file */
+  float RANGE = -1.0;     /**< Range for each optimization calculation to account for */
+  bool JOINT_OPTIMIZE = false;  /**< true: samples of the mission are kept for fit_attenuation_curves */
+  float KNOT_SPACING = 0.5;     /**< meters between the knots of the attenuation curves */
+  float SMOOTHNESS = 1.0;       /**< curvature penalty of the attenuation curves, per sample */
+
+  std::shared_ptr<const Scene> scene; /**< contains the physical underwater properties. */
+
+  bool PRIOR_DATA = false;  /**< true: use data that is loaded. false: calculate attenuation values */
+
+  bool CHECK_TIME = false;  /**< true: track and print time latencies. false: do not */
+
+  bool LOG_SCREEN = false;  /**< true: print log statements to screen. false: do not */
+
+  float EXP_MAX_ERROR = 1e-4;  /**< max relative error fast_exp was built for, the FastExp default */
+  FastExp fast_exp; /**< exp approximation for range dependent attenuation over full frames */
+  bool SLAM_LABEL_MAP = true; /**< true: SLAM range map holds a facet label per pixel. false: a distance per pixel */
+  ChannelOrder CHANNEL_ORDER = BGR; /**< channel order of the images, the kernels are specialized on it */
+  ToneMap tone_map;   /**< chooses the tone curve of each frame, applied by the kernels before quantization */
+  bool LOOKUP_TABLE = false;   /**< true: 8-bit affine corrections use the lookup table kernel */
+
+  /** Latest complete calibration, shared between the frames without locks.
+   */
+  CalibrationBuffer calibration;
+
+  bool COLOR_CHART = true;  /**< true: a color chart is in view to calibrate from. false: stored calibrations only */
+
+  /** Persistent calibrations over depth, warm-starts the method and is refined by the optimizer and the chart.
+   *  Shared with the other streams of the same camera and water, 0 if not used.
+   */
+  std::shared_ptr<CalibrationStore> calibration_store;
+
+  /** Veiling light ratio over the frame, for artificial lights, estimated and smoothed over the frames.
+   *  0: the veiling light is the same for every pixel.
+   */
+  std::shared_ptr<VeilingLightGrid> veiling_light_grid;
+
+  /** Color stage applied by the kernels after the correction, replaced as a whole (std::atomic_store) when it is
+   *  fitted on the chart. 0: none.
+   */
+  std::shared_ptr<const ColorMatrix> color_matrix;
+  bool COLOR_MATRIX_FIT = false;  /**< true: the matrix is fitted on the chart patches of the frames */
+
+  /** Guards the state accumulated over frames, e.g. optimization samples and the output file.
+   */
+  std::mutex data_mutex;
+
+  /** Parameters used for writing attenuation values to file.
+   */
+  TiXmlDocument out_doc;
+  bool SAVE_DATA = false; /**< true: write attenuation values. false: do not */
+  bool file_initialized = false;
 };
 
 }  // namespace underwater_color_enhance
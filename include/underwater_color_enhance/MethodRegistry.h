@@ -0,0 +1,69 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_METHODREGISTRY_H
+#define UNDERWATER_COLOR_ENHANCE_METHODREGISTRY_H
+
+#include "underwater_color_enhance/Method.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Method registry class.
+ *  Factory of the color enhancement methods, keyed by METHOD_ID and by name.
+ *  New methods register themselves with REGISTER_METHOD in their source file, ColorCorrect does not change.
+ */
+
+class MethodRegistry
+{
+public:
+  typedef Method* (*Factory)();
+
+  /** Adds a method to the registry.
+   *  Returns false if the ID or the name is already taken.
+   */
+  static bool register_method(int METHOD_ID, std::string name, Factory factory);
+
+  /** Creates a new method object, or returns 0 if the ID or name is not registered.
+   */
+  static Method* create(int METHOD_ID);
+  static Method* create(std::string name);
+
+  /** Name of a registered method, empty if not registered.
+   */
+  static std::string get_name(int METHOD_ID);
+
+  /** IDs of all registered methods.
+   */
+  static std::vector<int> get_ids();
+
+private:
+  struct Entry
+  {
+    std::string name;
+    Factory factory;
+  };
+
+  /** Registered methods; a function local static so registration from other files is safe at start up.
+   */
+  static std::map<int, Entry>& entries();
+};
+
+}  // namespace underwater_color_enhance
+
+/** Registers TYPE under METHOD_ID and NAME, place in the source file of the method.
+ */
+#define REGISTER_METHOD(METHOD_ID, NAME, TYPE) \
+  static underwater_color_enhance::Method* create_##TYPE() {return new TYPE;} \
+  static const bool TYPE##_registered = \
+    underwater_color_enhance::MethodRegistry::register_method(METHOD_ID, NAME, create_##TYPE);
+
+#endif  // UNDERWATER_COLOR_ENHANCE_METHODREGISTRY_H
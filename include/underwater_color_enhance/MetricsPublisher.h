@@ -0,0 +1,66 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_METRICSPUBLISHER_H
+#define UNDERWATER_COLOR_ENHANCE_METRICSPUBLISHER_H
+
+#include "underwater_color_enhance/FrameMetrics.h"
+
+#include <ros/ros.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+namespace underwater_color_enhance
+{
+
+/** Metrics publisher class.
+ *  Publishes the quality and health of the corrected frames of a camera stream as diagnostic_msgs on a low rate
+ *  topic (e.g. /diagnostics). Metrics are only computed for the frames that are published: due() tells the
+ *  enhancement whether to hand FrameMetrics to the correction kernel.
+ *  Level: ERROR if the frame could not be corrected, WARN if the attenuation values are not physical or a channel
+ *  is clipped more than MAX_CLIPPED_FRACTION, OK otherwise.
+ */
+
+class MetricsPublisher
+{
+public:
+  /** Constructor.
+   *  Advertises the metrics topic.
+   *
+   *  \param METRICS_TOPIC is the name of the topic for the diagnostic_msgs/DiagnosticArray messages.
+   *  \param METRICS_RATE is the maximum rate of metrics (Hz).
+   *  \param MAX_CLIPPED_FRACTION is the fraction of clipped pixels in a channel above which a warning is raised.
+   *  \param name is the name of the camera stream, e.g. its camera topic.
+   */
+  MetricsPublisher(ros::NodeHandle& nh, std::string METRICS_TOPIC, double METRICS_RATE, double MAX_CLIPPED_FRACTION,
+    std::string name);
+
+  /** True if the metrics of the next frame are to be published. Claims the slot: until the next period,
+   *  it is true once. Safe to call from several workers.
+   */
+  bool due();
+
+  /** Publishes the metrics of a corrected frame.
+   */
+  void publish(const FrameMetrics& metrics, const ros::Time& stamp, float depth);
+
+private:
+  ros::Publisher metrics_pub_;
+
+  double METRICS_RATE;
+  double MAX_CLIPPED_FRACTION;
+  std::string name;
+
+  std::chrono::steady_clock::time_point next_metrics;   /**< frames before this time are not measured */
+  std::mutex mutex;
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_METRICSPUBLISHER_H
@@ -0,0 +1,126 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_MODELBUNDLE_H
+#define UNDERWATER_COLOR_ENHANCE_MODELBUNDLE_H
+
+#include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/AttenuationCurves.h"
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace underwater_color_enhance
+{
+
+/** Model bundle class.
+ *  Prebuilt model of one camera and water type: the parsed camera response and Jerlov water tables, the
+ *  veiling light of every depth (at the centimeter resolution of Scene::round_depth), and optionally the prior
+ *  attenuation table and curves. Written once by the bundle tool from the CSV and XML inputs, then memory-mapped
+ *  read-only at startup, so the node does not parse any text file.
+ *
+ *  The file is a fixed header followed by float (and int32) arrays in native byte order, see Header.
+ *  Immutable once opened, shared by the scenes that use it.
+ */
+
+class ModelBundle
+{
+public:
+  static const uint32_t VERSION = 2;  /**< 2: prior attenuation curves */
+  static constexpr float DEPTH_STEP = 0.01;  /**< depth resolution of the veiling light table, meters */
+
+  ~ModelBundle();
+
+  /** Maps a bundle file. Returns 0 (with an ERROR log) if it cannot be read, is of another version or byte order,
+   *  or is truncated.
+   */
+  static std::shared_ptr<const ModelBundle> open(const std::string& FILENAME);
+
+  /** True if the file starts like a model bundle, e.g. to tell it from an XML attenuation file.
+   */
+  static bool is_bundle(const std::string& FILENAME);
+
+  /** Writes the bundle of a scene with its camera response and water loaded.
+   *
+   *  \param CAMERA, WATER_TYPE - names the bundle is matched with (camera response file and Jerlov water type).
+   *  \param prior_data - depth to BGR backscatter and direct signal attenuation values, may be empty.
+   *  \param prior_curves - attenuation curves over depth, may be empty.
+   *  \param MAX_DEPTH - deepest depth of the veiling light table, deeper frames are calculated.
+   */
+  static bool write(const std::string& FILENAME, const Scene& scene, const std::string& CAMERA,
+    const std::string& WATER_TYPE, const std::map<float, std::vector<double>>& prior_data,
+    const AttenuationCurves& prior_curves, float MAX_DEPTH);
+
+  const std::string& get_camera() const {return this->camera;}
+  const std::string& get_water_type() const {return this->water_type;}
+
+  /** Tables of the bundle, copied into the types of the scene (they are a few values per wavelength).
+   */
+  std::vector<int> get_wavelengths() const;
+  std::vector<float> get_camera_response() const;   /**< BGR interleaved per wavelength */
+  std::shared_ptr<const JerlovWater> get_water() const;
+  std::map<float, std::vector<double>> get_prior_data() const;
+  AttenuationCurves get_prior_curves() const;   /**< empty if the bundle has none */
+  float get_k() const;
+
+  /** Integral of the veiling light over the camera response (BGR) at a depth rounded by Scene::round_depth,
+   *  read from the table. False if the depth is beyond the table.
+   */
+  bool get_veiling_light(float depth, cv::Scalar& veiling_light) const;
+
+  /** Reads every page of the mapping, so the first frames do not take the page faults.
+   */
+  void prewarm() const;
+
+private:
+  /** File header, all sizes in elements. The arrays follow in this order:
+   *  wavelengths (int32), camera response (3 floats per wavelength, BGR), K_d, b_abs, b_sca, b_att (floats),
+   *  veiling light (3 floats per depth step from 0), prior data (depth, 3 backscatter, 3 direct signal floats),
+   *  prior curve knots (3 backscatter, 3 direct signal floats).
+   */
+  struct Header
+  {
+    char magic [8];
+    uint32_t version;
+    uint32_t byte_order;     /**< BYTE_ORDER as written, a bundle of another byte order is rejected */
+    char camera [128];
+    char water_type [64];
+    float k;                 /**< exposure and pixel geometry the veiling light is divided by */
+    uint32_t num_wavelengths;
+    uint32_t num_depths;
+    uint32_t num_prior;
+    float curve_start;       /**< depth of the first knot of the prior curves */
+    float curve_step;        /**< meters between the knots of the prior curves */
+    uint32_t num_knots;
+  };
+
+  ModelBundle() {}
+
+  void* mapping = 0;
+  size_t size = 0;
+
+  const Header* header = 0;
+  const int32_t* wavelengths = 0;
+  const float* camera_response = 0;
+  const float* water = 0;
+  const float* veiling_light = 0;
+  const float* prior = 0;
+  const float* knots = 0;
+
+  std::string camera;
+  std::string water_type;
+
+  static size_t file_size(const Header& header);
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_MODELBUNDLE_H
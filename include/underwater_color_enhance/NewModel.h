@@ -9,6 +9,8 @@
 #define UNDERWATER_COLOR_ENHANCE_NEWMODEL_H
 
 #include "underwater_color_enhance/Method.h"
+#include "underwater_color_enhance/AttenuationCurves.h"
+#include "underwater_color_enhance/DepthCurveFit.h"
 
 #include <map>
 #include <vector>
@@ -32,30 +34,43 @@ public:
   /** Constructor.
    */
   NewModel() {}
-  ~NewModel() {}
+  ~NewModel() override {}
 
-  void calculate_optimized_attenuation(cv::Mat& img) override;
+  void calculate_optimized_attenuation(const cv::Mat& img, float depth) override;
+  bool fit_attenuation_curves() override;
 
   /** See functions in Method class
    */
-  cv::Mat color_correct(cv::Mat& img) override;
-  cv::Mat color_correct_slam(cv::Mat& img, std::vector<cv::Point2f> point_data,
-    std::vector<float> distance_data) override;
+  cv::Mat color_correct(const cv::Mat& img, float depth, FrameMetrics* metrics) override;
+  cv::Mat color_correct_slam(const cv::Mat& img, const KeypointSpan& keypoints, float depth,
+    FrameMetrics* metrics) override;
+  cv::Mat color_correct_depth(const cv::Mat& img, const cv::Mat& range_map, float depth,
+    FrameMetrics* metrics) override;
+  FrameCorrection prepare_frame(const cv::Mat& img, float depth) override {return prepare_frame(img, depth, 0);}
+  void prewarm(const cv::Mat& img, float depth) override;
 
   /** See functions in Method class
    */
   void end_file(std::string output_filename) override;
   void load_data(std::string input_filename) override;
 
+  /** Prior attenuation values loaded by load_data(), depth to BGR backscatter and direct signal attenuation.
+   */
+  const std::map<float, std::vector<double>>& get_prior_data() const {return this->att_map;}
+
+  /** Prior attenuation curves loaded by load_data(), empty if the input file has none.
+   */
+  const AttenuationCurves& get_prior_curves() const {return this->curves;}
+
 private:
   const double COLOR_1_TRUTH [3] = {242, 243, 243};  /**< White patch ground truth in BGR */
   const double COLOR_2_TRUTH [3] = {52, 52, 52};     /**< Black patch ground turth in BGR */
 
-  float backscatter_att [3];    /**< Contains the backscatter attenuation values for that depth */
-  float direct_signal_att [3];  /**< Contains the direct signal attenuation values for that depth */
-
   std::map<float, std::vector<double>> att_map; /** Contains the mapping of depth to pre calculated att values */
+  AttenuationCurves curves;   /**< pre calculated att curves, used instead of att_map when loaded */
 
+  /** Optimization state accumulated over frames, guarded by data_mutex.
+   */
   float depth_max_range = -1;  /**< Current max depth until next optimization calculation occurs */
   dlib::matrix<double, 2, 1> observed_input;
 
@@ -65,6 +80,10 @@ private:
   std::vector<std::pair<dlib::matrix<double, 2, 1>, double>> observed_samples_green;
   std::vector<std::pair<dlib::matrix<double, 2, 1>, double>> observed_samples_red;
 
+  /** Samples of every chart patch over the whole mission in their BGR channels, for the joint fit
+   */
+  std::vector<DepthSample> mission_samples [3];
+
   /** Functions for optimizing attenuation values in a set range of depth.
    */
   // double model(const opt_vector& input, const opt_vector& params);
@@ -72,14 +91,112 @@ private:
 
   /** Functions for calculating or estimating parameters vital to the enhancement algorithm.
    */
-  cv::Scalar calc_wideband_veiling_light();
-  void calc_attenuation(cv::Scalar color_1_obs, cv::Scalar color_2_obs, cv::Scalar wideband_veiling_light);
-  void est_attenuation();
+  cv::Scalar calc_wideband_veiling_light(float depth) const;
+  void calc_attenuation(cv::Scalar color_1_obs, cv::Scalar color_2_obs, cv::Scalar wideband_veiling_light,
+    FrameContext& context) const;
+  void est_attenuation(FrameContext& context) const;
+
+  /** Attenuation values from every patch of the chart (COLOR_1_SAMPLE, COLOR_2_SAMPLE and the scene
+   *  COLOR_PATCHES), robust to bad patches, see ChartFit. Not finite if the patches cannot be fitted.
+   */
+  void fit_attenuation(const cv::Mat& img, cv::Scalar wideband_veiling_light, FrameContext& context) const;
+
+  /** Sample regions of the chart patches and their 8-bit BGR ground truths: the two patches of the attenuation
+   *  calculation, then the scene COLOR_PATCHES.
+   */
+  void chart_patches(std::vector<std::vector<int>>& samples, std::vector<cv::Scalar>& truths) const;
+
+  /** Publishes the attenuation values of the frame as the latest calibration, if they are finite.
+   *  Returns false if they are not, e.g. when the color chart is not visible.
+   */
+  bool publish_calibration(const FrameContext& context);
+
+  /** Sets the attenuation values of the frame from the latest calibration, false if there is none.
+   */
+  bool use_calibration(FrameContext& context) const;
+
+  /** Sets the attenuation values of the frame from the stored calibration nearest to its depth, false if there is
+   *  no calibration store or it has no calibration yet.
+   */
+  bool use_stored_calibration(FrameContext& context) const;
+
+  /** Merges the attenuation values of the frame into the calibration store, weighted by the number of samples
+   *  they were calculated from. Values that are not positive are not stored.
+   */
+  void store_calibration(const FrameContext& context, int samples) const;
 
-  /** Helper functions for preparing file usage.
+  /** Fits the color matrix on the chart patches of the frame corrected with its attenuation values (COLOR_1_SAMPLE,
+   *  COLOR_2_SAMPLE and the scene COLOR_PATCHES) and publishes it. Keeps the last matrix if the fit fails.
+   */
+  void fit_color_matrix(const cv::Mat& img, cv::Scalar wideband_veiling_light, const FrameContext& context);
+
+  /** Records the attenuation values of the frame in the metrics (if any). Returns false if they are not finite,
+   *  e.g. a non-positive backscatter ratio of the color chart without an earlier calibration: the frame cannot be
+   *  corrected with them and is passed through.
+   */
+  bool check_attenuation(const FrameContext& context, FrameMetrics* metrics) const;
+
+  /** Mean of a sample region (x, y, width, height) of the image, in BGR order.
+   */
+  cv::Scalar sample_mean(const cv::Mat& img, const std::vector<int>& sample) const;
+
+  /** Calculates the wideband veiling light and the attenuation values of the frame into its context.
+   *  Returns the wideband veiling light.
+   */
+  cv::Scalar prepare_correction(const cv::Mat& img, FrameContext& context);
+
+  /** See prepare_frame(), the attenuation values of the frame are recorded in the metrics (if any).
+   */
+  FrameCorrection prepare_frame(const cv::Mat& img, float depth, FrameMetrics* metrics);
+
+  /** Correction of the frame with one distance for the whole frame, from the attenuation values of the context.
+   */
+  FrameCorrection frame_correction(const cv::Mat& img, cv::Scalar wideband_veiling_light,
+    const FrameContext& context, const GridSampler& grid) const;
+
+  /** Sampler of the veiling light grid, updated with the frame. Empty if there is no grid.
+   */
+  GridSampler update_grid(const cv::Mat& img) const;
+
+  /** Fused per-pixel correction with a range value for every pixel.
+   *  Range values that are not positive or not finite fall back to the scene DISTANCE.
+   *
+   *  \param img is the image (CV_8UC3, CV_16UC3 or CV_32FC3).
+   *  \param range_map is the distance from the camera for each pixel in meters (CV_32FC1, same size as img).
+   *  \param wideband_veiling_light is the veiling light of the current frame.
+   *  \param context holds the attenuation values of the current frame.
+   *  \param grid is the veiling light grid over the frame, empty for none.
+   *  \param metrics is 0, or the corrected pixels are added to it.
+   */
+  cv::Mat correct_range_map(const cv::Mat& img, const cv::Mat& range_map, cv::Scalar wideband_veiling_light,
+    const FrameContext& context, const GridSampler& grid, FrameMetrics* metrics) const;
+
+  /** Per-pixel correction with a label for every pixel, the factors are calculated once per label.
+   *
+   *  \param img is the image (CV_8UC3, CV_16UC3 or CV_32FC3).
+   *  \param label_map is the label for each pixel (CV_16UC1, same size as img).
+   *  \param label_distances is the distance from the camera for each label in meters.
+   *  \param wideband_veiling_light is the veiling light of the current frame.
+   *  \param context holds the attenuation values of the current frame.
+   *  \param metrics is 0, or the corrected pixels are added to it.
+   */
+  cv::Mat correct_label_map(const cv::Mat& img, const cv::Mat& label_map, const std::vector<float>& label_distances,
+    cv::Scalar wideband_veiling_light, const FrameContext& context, FrameMetrics* metrics) const;
+
+  /** Voronoi facets of the SLAM features, with the distance of the feature in each facet.
+   *  Features outside of the image, or with non-finite or non-positive values, are skipped.
+   */
+  void calc_voronoi_facets(cv::Size img_size, const KeypointSpan& keypoints,
+    std::vector<std::vector<cv::Point> >& facets, std::vector<float>& facet_distances) const;
+
+  /** Helper functions for preparing file usage, called with data_mutex held.
    */
   void initialize_file();
-  void set_data_to_file();
+  void set_data_to_file(float depth, const float* backscatter_att, const float* direct_signal_att);
+
+  /** Writes the attenuation values of a frame to the output document.
+   */
+  void save_frame_data(const FrameContext& context);
 };
 
 }  // namespace underwater_color_enhance
@@ -0,0 +1,85 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_ORDEREDPIPELINE_H
+#define UNDERWATER_COLOR_ENHANCE_ORDEREDPIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Ordered pipeline class.
+ *  Runs jobs on a pool of worker threads and their output steps on one output thread, in the order the jobs
+ *  were submitted. Unlike the StreamScheduler no job is dropped, the producer waits instead: used for offline
+ *  processing, where every frame must be enhanced and written in order.
+ */
+
+class OrderedPipeline
+{
+public:
+  /** Output step of a job, run on the output thread in submission order. May be empty.
+   */
+  typedef std::function<void()> OutputStep;
+
+  /** Work of a job, run on a worker thread.
+   */
+  typedef std::function<OutputStep()> Job;
+
+  /** Constructor.
+   *  Starts the worker threads and the output thread.
+   *
+   *  \param NUM_WORKERS is the number of worker threads. 0: one per hardware thread.
+   *  \param MAX_IN_FLIGHT is the number of submitted jobs whose output step has not run yet, submit() waits
+   *      above it. 0: twice the number of workers.
+   */
+  explicit OrderedPipeline(int NUM_WORKERS, size_t MAX_IN_FLIGHT = 0);
+
+  /** Destructor.
+   *  Finishes all submitted jobs, see finish().
+   */
+  ~OrderedPipeline();
+
+  /** Queues a job, waits while MAX_IN_FLIGHT jobs are in the pipeline.
+   */
+  void submit(Job job);
+
+  /** Waits until every submitted job and its output step are complete, then stops the threads.
+   */
+  void finish();
+
+  int get_num_workers() const {return this->workers.size();}
+
+private:
+  std::deque<std::pair<size_t, Job>> jobs;  /**< waiting jobs with their submission index */
+  std::map<size_t, OutputStep> outputs;     /**< output steps of completed jobs, by submission index */
+  size_t next_job = 0;      /**< submission index of the next submitted job */
+  size_t next_output = 0;   /**< submission index of the next output step to run */
+  size_t MAX_IN_FLIGHT;
+  bool stopping = false;
+
+  std::mutex mutex;
+  std::condition_variable job_available;
+  std::condition_variable output_available;
+  std::condition_variable space_available;
+  std::vector<std::thread> workers;
+  std::thread output_thread;
+
+  void worker_loop();
+  void output_loop();
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_ORDEREDPIPELINE_H
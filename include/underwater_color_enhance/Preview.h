@@ -0,0 +1,28 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_PREVIEW_H
+#define UNDERWATER_COLOR_ENHANCE_PREVIEW_H
+
+#include <opencv2/opencv.hpp>
+
+namespace underwater_color_enhance
+{
+
+/** Side-by-side preview of a raw and a corrected image, raw on the left.
+ *  Both images are downscaled to half of PREVIEW_WIDTH (never upscaled) and converted to 8-bit,
+ *  the channel order is kept.
+ *
+ *  \param raw is the image before enhancement (CV_8UC3, CV_16UC3 or CV_32FC3).
+ *  \param corrected is the enhanced image, same size and type as raw.
+ *  \param PREVIEW_WIDTH is the width of the preview in pixels.
+ */
+cv::Mat make_preview(const cv::Mat& raw, const cv::Mat& corrected, int PREVIEW_WIDTH);
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_PREVIEW_H
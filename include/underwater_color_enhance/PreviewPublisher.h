@@ -0,0 +1,84 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_PREVIEWPUBLISHER_H
+#define UNDERWATER_COLOR_ENHANCE_PREVIEWPUBLISHER_H
+
+#include "underwater_color_enhance/Kernels.h"
+
+#include <ros/ros.h>
+#include <image_transport/image_transport.h>
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace underwater_color_enhance
+{
+
+/** Preview publisher class.
+ *  Publishes a downscaled side-by-side view of the raw and corrected images for monitoring without a display.
+ *  Building and compressing the preview runs on a low priority thread: the enhancement only hands over the
+ *  two images, and frames are skipped to keep the PREVIEW_RATE or while the previous preview is being built.
+ *  JPEG compression is provided by the compressed transport of image_transport (<topic>/compressed).
+ */
+
+class PreviewPublisher
+{
+public:
+  /** Constructor.
+   *  Advertises the preview topic and starts the preview thread.
+   *
+   *  \param PREVIEW_TOPIC is the name of the topic for the preview images.
+   *  \param PREVIEW_RATE is the maximum rate of previews (Hz).
+   *  \param PREVIEW_WIDTH is the width of the side-by-side preview in pixels.
+   *  \param CHANNEL_ORDER is the channel order of the images.
+   */
+  PreviewPublisher(ros::NodeHandle& nh, std::string PREVIEW_TOPIC, double PREVIEW_RATE, int PREVIEW_WIDTH,
+    ChannelOrder CHANNEL_ORDER);
+
+  /** Destructor.
+   *  Stops the preview thread, a preview that was not built yet is dropped.
+   */
+  ~PreviewPublisher();
+
+  /** Hands over a frame for the preview, returns immediately. The images must not be modified afterwards.
+   */
+  void submit(const cv::Mat& raw, const cv::Mat& corrected, const ros::Time& stamp, const std::string& frame_id);
+
+private:
+  image_transport::ImageTransport it_;
+  image_transport::Publisher preview_pub_;
+
+  double PREVIEW_RATE;
+  int PREVIEW_WIDTH;
+  ChannelOrder CHANNEL_ORDER;
+
+  std::chrono::steady_clock::time_point next_preview;   /**< frames before this time are skipped */
+
+  /** Frame waiting for the preview thread.
+   */
+  cv::Mat raw;
+  cv::Mat corrected;
+  ros::Time stamp;
+  std::string frame_id;
+  bool pending = false;
+  bool stop = false;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::thread worker;
+
+  void run();
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_PREVIEWPUBLISHER_H
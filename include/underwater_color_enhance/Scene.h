@@ -10,11 +10,27 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <opencv2/opencv.hpp>
 
 namespace underwater_color_enhance
 {
 
+class ModelBundle;
+
+/** Physical properties of a Jerlov water type over the WAVELENGTHS of the scene.
+ *  Immutable once loaded, so it is shared between the scenes of several cameras.
+ */
+struct JerlovWater
+{
+  std::string WATER_TYPE;
+  std::vector<float> K_d;                   /**< Diffuse downwelling attenuation coefficient. */
+  std::vector<float> b_abs;                 /**< Beam absorption coefficient. */
+  std::vector<float> b_sca;                 /**< Beam scattering coefficient. */
+  std::vector<float> b_att;                 /**< Beam attenuation coefficient. */
+};
+
+
 /** Scene handler class.
  *  Handles phsyical properties of the underwater environment.
  */
@@ -28,13 +44,7 @@ public:
 
   /** Parameters used for calculating the wideband veiling light.
    */
-  std::vector<cv::Scalar> camera_response;  /**< rows: wavelengths; columns: BGR */
-  std::vector<float> K_d;                   /**< Diffuse downwelling attenuation coefficient. */
-  std::vector<float> b_abs;                 /**< Beam absorption coefficient. */
-  std::vector<float> b_sca;                 /**< Beam scattering coefficient. */
-  std::vector<float> b_att;                 /**< Beam attenuation coefficient. */
-  std::vector<float> irradiance;            /**< E */
-  std::vector<float> veiling_light;         /**< B^inf */
+  std::shared_ptr<const JerlovWater> water; /**< Jerlov water properties, shared between scenes, see set_water(). */
 
   // TO DO: Set this as a parameter from a YAML file.
   float K = 0.1;                            /**< Camera image exposure and camera pixel geometry */
@@ -49,25 +59,113 @@ public:
   std::vector<int> COLOR_1_SAMPLE;
   std::vector<int> COLOR_2_SAMPLE;
 
-  /** Functions for handling altitude depth measurements.
+  /** More patches of the chart (e.g. a full Macbeth or DKK chart), 7 values each: x, y, width, height of the region
+   *  and the 8-bit BGR ground truth. With them the attenuation values are a robust fit over all the patches
+   *  (see ChartFit), and the color matrix is fitted on all of them.
+   */
+  std::vector<int> COLOR_PATCHES;
+
+  /** Functions for handling the initial altitude depth measurement.
    */
   void set_depth(float new_depth);
-  float get_depth() {return this->depth;}
+  float get_depth() const {return this->depth;}
+
+  /** Altitude depth measurement as used for calculations: absolute, rounded to centimeters, and not 0.
+   */
+  static float round_depth(float depth);
 
-  /** Function for recalculating environment properties, which occurs when depth changes.
+  /** Veiling light (B^inf = b_sca * E / b_att) of each wavelength at a depth, with the irradiance
+   *  E = E_0 * exp(-K_d * depth). Does not change the scene, so it is safe to call concurrently.
    */
-  void reset_data();
+  std::vector<float> calc_veiling_light(float depth) const;
+
+  /** Batch versions for many depths at once, e.g. to precompute tables or for several streams. The exponentials
+   *  run over a row of depths with the FastExp polynomial of the highest degree (relative error about 1e-6), so they
+   *  are vectorized. Do not change the scene, so they are safe to call concurrently.
+   *
+   *  calc_irradiance: irradiance of each wavelength of the water properties, one row of count values per
+   *      wavelength. Nothing is written if the water properties are not loaded.
+   *  integrate_veiling_light: veiling light of each depth integrated over the camera response of each channel,
+   *      count values per channel. Calculated from the spectral data, not read from the model bundle, and zero if
+   *      the camera response or the water properties are not loaded.
+   */
+  void calc_irradiance(const float* depths, int count, float* irradiance) const;
+  void integrate_veiling_light(const float* depths, int count, float* blue, float* green, float* red) const;
+
+  /** Integral of a spectrum sampled at WAVELENGTHS over the camera response of each channel (BGR),
+   *  with the trapezoidal rule.
+   */
+  cv::Scalar integrate_response(const std::vector<float>& spectrum) const;
+
+  /** Wideband beam attenuation of each channel (BGR): b_att weighted by the camera response.
+   *  Zero if the camera response or the water properties are not loaded.
+   */
+  cv::Scalar calc_wideband_attenuation() const;
+
+  /** Veiling light at a depth (rounded by round_depth) integrated over the camera response of each channel (BGR):
+   *  integrate_response(calc_veiling_light(depth)), read from the model bundle when it covers the depth.
+   */
+  cv::Scalar integrate_veiling_light(float depth) const;
 
   /** Functions for loading camera response data and jerlov water physical properties.
    */
   void load_camera_response_data(std::string CAMERA_RESPONSE_FILENAME);
+
+  /** Sets the camera response, BGR values interleaved for each of the WAVELENGTHS.
+   */
+  void set_camera_response(const std::vector<float>& camera_response);
+
+  /** Camera response of a channel (0: blue, 1: green, 2: red) at each wavelength, get_num_response() values.
+   */
+  const float* get_camera_response(int channel) const {return spectral_row(RESPONSE_BLUE + channel);}
+  int get_num_response() const {return this->num_response;}
   void load_jerlov_water_data(std::string JERLOV_WATER_FILENAME, std::string WATER_TYPE);
 
+  /** Sets water properties that were already loaded, e.g. shared with the scenes of other cameras.
+   */
+  void set_water(std::shared_ptr<const JerlovWater> water);
+
+  /** Takes the camera response, water properties, wavelengths, K and the veiling light table from a prebuilt
+   *  model bundle instead of the CSV files, see ModelBundle.
+   */
+  void load_bundle(std::shared_ptr<const ModelBundle> bundle);
+  std::shared_ptr<const ModelBundle> get_bundle() const {return this->bundle;}
+
+  /** Reads the physical properties of a jerlov water type, returns empty properties if not found.
+   */
+  static std::shared_ptr<const JerlovWater> read_jerlov_water_data(std::string JERLOV_WATER_FILENAME,
+    std::string WATER_TYPE);
+
 private:
-  float depth = 0.01;        /**< Current altitude depth measurement. Let set_depth() handle checks. */
+  float depth = 0.01;        /**< Initial altitude depth measurement. Let set_depth() handle checks. */
   float IRRADIANCE_0 = 1.0;  /**< Irradiance (E) at the surface */
+  std::shared_ptr<const ModelBundle> bundle;  /**< prebuilt tables, 0 if loaded from the CSV files */
 
-  float MIN_DEPTH = 0.01;    /**< Minimum altitude depth measurement. */
+  /** Spectral data as rows of floats over the wavelengths, one row per property: structure of arrays, so the loops
+   *  over them are vectorized. The rows are aligned by the OpenCV allocator and padded with zeros to a multiple of
+   *  8 values. Rebuilt by update_spectra() whenever the camera response or the water changes, immutable and shared
+   *  by the copies of the scene.
+   */
+  enum SpectralRow
+  {
+    RESPONSE_BLUE, RESPONSE_GREEN, RESPONSE_RED,  /**< camera response */
+    WEIGHT_BLUE, WEIGHT_GREEN, WEIGHT_RED,        /**< camera response times the trapezoidal rule weights */
+    K_D,                                          /**< diffuse downwelling attenuation coefficient */
+    SURFACE_VEILING_LIGHT,                        /**< b_sca * E_0 / b_att, the veiling light at the surface */
+    NUM_SPECTRAL_ROWS
+  };
+  std::shared_ptr<const float> spectra;
+  int spectra_stride = 0;   /**< floats per row */
+  int num_response = 0;     /**< wavelengths of the camera response */
+  int num_water = 0;        /**< wavelengths of the water properties, 0 if not loaded */
+  int num_integrated = 0;   /**< wavelengths of the water properties with a camera response, 0 if none */
+  std::vector<float> camera_response;  /**< BGR interleaved per wavelength, as loaded */
+
+  const float* spectral_row(int row) const
+  {
+    return this->spectra ? this->spectra.get() + row * this->spectra_stride : 0;
+  }
+  void update_spectra();
 };
 
 }  // namespace underwater_color_enhance
@@ -0,0 +1,117 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_SCENEGENERATOR_H
+#define UNDERWATER_COLOR_ENHANCE_SCENEGENERATOR_H
+
+#include "underwater_color_enhance/Scene.h"
+
+#include <opencv2/opencv.hpp>
+#include <memory>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Synthetic frame with its ground truth.
+ */
+struct SyntheticFrame
+{
+  cv::Mat image;        /**< degraded frame, CV_8UC3 or CV_16UC3, BGR */
+  cv::Mat clean;        /**< clean scene (ground truth of the enhancement), same type as image */
+  cv::Mat range_map;    /**< distance per pixel in meters, CV_32FC1 */
+  float depth;          /**< altitude depth of the frame */
+
+  std::vector<cv::Point2f> points;  /**< ORB-style keypoints */
+  std::vector<float> distances;     /**< distance of each keypoint */
+};
+
+
+/** Scene generator class.
+ *  Renders a clean scene into degraded underwater frames with the forward image formation model, the inverse of
+ *  the correction: I = J * exp(-b_ds * z) + B * (1 - exp(-b_bs * z)). The wideband attenuation and veiling light
+ *  of each channel come from the Jerlov water and the camera response of the Scene, so the frames have a known
+ *  ground truth for load and recovery error testing. The direct signal and the backscatter have their own
+ *  attenuation, as in the water: b_att weighted by the camera response for the direct signal (a gray object), and
+ *  also by the spectrum of the veiling light for the backscatter.
+ */
+
+class SceneGenerator
+{
+public:
+  /** Constructor.
+   *
+   *  \param scene - water, camera response, DISTANCE and the color chart and background sample locations.
+   *  \param size - resolution of the frames.
+   *  \param seed - of the procedural texture, noise and keypoints; the same seed renders the same frames.
+   */
+  SceneGenerator(std::shared_ptr<const Scene> scene, cv::Size size, int seed = 1);
+
+  /** Clean scene to render instead of the procedural texture, resized to the resolution of the frames.
+   */
+  void set_texture(const cv::Mat& texture);
+
+  /** Settings of the rendered frames.
+   *
+   *  \param RANGE_SLOPE - relative change of the distance from the bottom to the top of the frame,
+   *      0: every pixel at DISTANCE, 1: from 0.5 * DISTANCE to 1.5 * DISTANCE.
+   *  \param NUM_KEYPOINTS - ORB-style keypoints per frame, at random positions.
+   *  \param NOISE - standard deviation of the sensor noise in 8-bit units.
+   *  \param SIXTEEN_BIT - true: CV_16UC3 frames; false: CV_8UC3.
+   */
+  void set_options(float RANGE_SLOPE, int NUM_KEYPOINTS, float NOISE, bool SIXTEEN_BIT);
+
+  /** Wideband attenuation of the backscatter and of the direct signal (BGR) instead of the values of the water,
+   *  e.g. to test a model with known coefficients. Empty: from the water.
+   */
+  void set_attenuation(const std::vector<float>& backscatter_att, const std::vector<float>& direct_signal_att);
+
+  /** Renders a frame at an altitude depth. The color chart patches (COLOR_1_SAMPLE, COLOR_2_SAMPLE and
+   *  COLOR_PATCHES) are at DISTANCE and the background sample shows the veiling light, like the scenes the color
+   *  chart calibration is made for.
+   */
+  SyntheticFrame render(float depth);
+
+  /** Ground truth of the model at a depth, in 8-bit units and BGR order.
+   */
+  cv::Scalar get_veiling_light(float depth) const;
+  cv::Scalar get_backscatter_attenuation(float depth) const;
+  cv::Scalar get_direct_signal_attenuation() const {return this->direct_signal_att;}
+
+private:
+  std::shared_ptr<const Scene> scene;
+  cv::Size size;
+  cv::RNG rng;
+
+  cv::Mat texture;        /**< clean scene, CV_32FC3 in 8-bit units */
+  cv::Scalar direct_signal_att;   /**< wideband attenuation of the direct signal of each channel */
+  cv::Scalar backscatter_att;     /**< wideband attenuation of the backscatter, if fixed_backscatter */
+  bool fixed_backscatter = false; /**< false: backscatter attenuation of the water at the depth of the frame */
+
+  float RANGE_SLOPE = 0.5;
+  int NUM_KEYPOINTS = 500;
+  float NOISE = 1.0;
+  bool SIXTEEN_BIT = false;
+
+  const float FAR_RANGE = 1000.0;  /**< range of the background sample: only veiling light */
+
+  /** Procedural clean scene: colored tiles over smooth gradients, with the color chart patches.
+   */
+  void make_texture(int seed);
+
+  /** Paints the ground truth of the color chart into the texture.
+   */
+  void paint_chart();
+
+  /** Regions and BGR ground truths of every color chart patch in the frame, see NewModel::chart_patches().
+   */
+  void chart_patches(std::vector<cv::Rect>& regions, std::vector<cv::Scalar>& truths) const;
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_SCENEGENERATOR_H
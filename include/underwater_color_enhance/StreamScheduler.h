@@ -0,0 +1,96 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_STREAMSCHEDULER_H
+#define UNDERWATER_COLOR_ENHANCE_STREAMSCHEDULER_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Stream scheduler class.
+ *  One pool of worker threads shared by several camera streams.
+ *  Each stream has at most one frame waiting and one frame in progress: a new frame replaces the waiting one,
+ *  so a slow stream drops its own frames instead of building a backlog. Workers take streams in round-robin
+ *  order, so a stream with large frames cannot starve the others.
+ *  One frame in progress per stream is deliberate: the frames of a stream are published in order, and the state
+ *  a stream keeps between frames (e.g. its depth history and veiling light grid) is only touched by one worker
+ *  at a time. The workers run several streams in parallel, not several frames of one stream; a single
+ *  raw stream is processed in the ROS callback instead, which gives the same one frame in flight without the
+ *  hand-off to a worker (see ros_correct).
+ */
+
+class StreamScheduler
+{
+public:
+  /** Constructor.
+   *  Starts the worker threads.
+   *
+   *  \param NUM_WORKERS is the number of worker threads. 0: one per hardware thread.
+   */
+  explicit StreamScheduler(int NUM_WORKERS);
+
+  /** Destructor.
+   *  Waits for the frames in progress, waiting frames are dropped.
+   */
+  ~StreamScheduler();
+
+  /** Adds a stream, returns its ID.
+   */
+  int add_stream();
+
+  /** Queues the processing of a frame, replaces the waiting frame of the stream if there is one.
+   */
+  void submit(int stream_id, std::function<void()> job);
+
+  /** Number of frames of a stream that were replaced before being processed.
+   */
+  size_t get_dropped(int stream_id);
+
+  int get_num_workers() const {return this->workers.size();}
+
+  /** Runs a job once on every worker and waits for all of them, e.g. to allocate the buffers of each worker
+   *  thread before the first frame arrives. Frames submitted meanwhile wait for the job of their worker.
+   */
+  void prewarm(std::function<void()> job);
+
+private:
+  struct Stream
+  {
+    std::function<void()> waiting_job;
+    bool busy = false;     /**< a worker is processing a frame of this stream */
+    size_t dropped = 0;
+  };
+
+  std::vector<Stream> streams;
+  size_t next_stream = 0;   /**< round-robin position */
+  bool stopping = false;
+
+  std::function<void()> warmup_job;   /**< job of the latest prewarm() */
+  int warmup_generation = 0;          /**< incremented by every prewarm(), each worker runs the job once */
+  size_t warmup_pending = 0;          /**< workers that did not run the job yet */
+  std::condition_variable warmup_done;
+
+  std::mutex mutex;
+  std::condition_variable job_available;
+  std::vector<std::thread> workers;
+
+  void worker_loop();
+
+  /** Next stream with a waiting frame and no frame in progress, or -1. Requires the lock.
+   */
+  int take_next_stream();
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_STREAMSCHEDULER_H
@@ -0,0 +1,82 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_TONEMAP_H
+#define UNDERWATER_COLOR_ENHANCE_TONEMAP_H
+
+#include "underwater_color_enhance/Kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+namespace underwater_color_enhance
+{
+
+enum ToneMapMode
+{
+  TONE_MAP_CLIP = 0,      /**< corrected values are clipped to the pixel type */
+  TONE_MAP_EXPOSURE = 1,  /**< auto-exposure: one gain maps the white point to full scale */
+  TONE_MAP_REINHARD = 2   /**< linear up to the knee, highlights up to the white point compressed into the rest */
+};
+
+/** Tone map handler class.
+ *  Chooses the tone curve of a frame from its corrected values before they are quantized. The white point is
+ *  a percentile of the brightest channel of each pixel, measured on a sparse sample of the frame that is
+ *  corrected in float by the same kernel, so the full frame is corrected and quantized in a single pass.
+ */
+
+class ToneMap
+{
+public:
+  /** Constructor.
+   *
+   *  \param MODE - see ToneMapMode.
+   *  \param PERCENTILE of the brightest channels that is taken as white point, e.g. 99.5.
+   *  \param KNEE - start of the Reinhard shoulder, relative to full scale.
+   *  \param MAX_GAIN - largest auto-exposure gain, limits the noise brought up in dark frames.
+   */
+  explicit ToneMap(ToneMapMode MODE = TONE_MAP_CLIP, float PERCENTILE = 99.5, float KNEE = 0.8,
+    float MAX_GAIN = 4.0);
+
+  /** Parses "clip", "exposure" or "reinhard", anything else is clip.
+   */
+  static ToneMapMode parse_mode(const std::string& name);
+
+  /** Pixels of the sample taken from each frame: every SAMPLE_STEP-th pixel of every SAMPLE_STEP-th row.
+   */
+  static const int SAMPLE_STEP = 8;
+
+  /** True if the tone curve depends on the frame, which then has to be sampled.
+   */
+  bool needs_sample() const {return this->MODE != TONE_MAP_CLIP;}
+
+  /** Sparse sample of an image or a map aligned with it, 3-channel images as CV_32FC3 so the float kernel
+   *  corrects them without clipping.
+   */
+  static cv::Mat sample(const cv::Mat& img);
+
+  /** Tone curve of a frame.
+   *
+   *  \param corrected_sample - CV_32FC3 sample of the frame corrected by the kernel, see sample().
+   *  \param depth - pixel depth of the frame (CV_8U, CV_16U, CV_32F).
+   */
+  ToneCurve curve(const cv::Mat& corrected_sample, int depth) const;
+
+private:
+  ToneMapMode MODE;
+  float PERCENTILE;
+  float KNEE;
+  float MAX_GAIN;
+
+  /** PERCENTILE of the brightest channel of the pixels of the sample.
+   */
+  float white_point(const cv::Mat& corrected_sample) const;
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_TONEMAP_H
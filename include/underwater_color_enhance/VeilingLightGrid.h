@@ -0,0 +1,68 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#ifndef UNDERWATER_COLOR_ENHANCE_VEILINGLIGHTGRID_H
+#define UNDERWATER_COLOR_ENHANCE_VEILINGLIGHTGRID_H
+
+#include "underwater_color_enhance/Kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <mutex>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+/** Veiling light grid class.
+ *  Veiling light that varies over the frame, for dives lit by strobes and lamps: a low resolution grid (e.g. 32x18)
+ *  of the ratio of the local veiling light to the veiling light of the frame, per BGR channel.
+ *
+ *  The backscatter of a cell is estimated as the darkest part of the cell (objects add to the backscatter, so the
+ *  darkest parts are closest to it), on a downsampled sparse sample of the frame. The ratios are smoothed over the
+ *  grid (median of 3x3 cells) and over frames (exponential moving average), and the kernels interpolate them
+ *  bilinearly, see GridSampler. The frame mean of the ratios is 1, so the calibrated level is kept.
+ *
+ *  Shared by the frames of a method, update() is thread safe.
+ */
+
+class VeilingLightGrid
+{
+public:
+  static const int SUBCELLS = 4;  /**< sub-blocks per cell side, the darkest one is the backscatter of the cell */
+
+  /** Constructor.
+   *  Ratios are 1 until the first frame.
+   *
+   *  \param GRID_SIZE - cells over the width and the height of the frame.
+   *  \param SMOOTHING - weight of a new frame in the moving average, in (0, 1]. 1: no temporal smoothing.
+   *  \param MAX_RATIO - ratios are clamped to [1 / MAX_RATIO, MAX_RATIO].
+   */
+  VeilingLightGrid(cv::Size GRID_SIZE, float SMOOTHING, float MAX_RATIO);
+
+  /** Estimates the ratios of a frame and blends them into the moving average.
+   *  Returns the sampler of the smoothed grid over the frame, for the kernels.
+   */
+  GridSampler update(const cv::Mat& img, ChannelOrder order);
+
+  /** Ratios of one frame (BGR per cell, row-major), without smoothing over frames.
+   */
+  std::vector<float> estimate(const cv::Mat& img, ChannelOrder order) const;
+
+  cv::Size get_grid_size() const {return this->GRID_SIZE;}
+
+private:
+  cv::Size GRID_SIZE;
+  float SMOOTHING;
+  float MAX_RATIO;
+
+  std::mutex mutex;             /**< guards the moving average */
+  std::vector<float> smoothed;  /**< moving average of the ratios, empty before the first frame */
+};
+
+}  // namespace underwater_color_enhance
+
+#endif  // UNDERWATER_COLOR_ENHANCE_VEILINGLIGHTGRID_H
@@ -0,0 +1,98 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/AttenuationCurves.h"
+
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+static const char* const CHANNELS [3] = {"blue", "green", "red"};
+
+
+AttenuationCurves::AttenuationCurves(float start, float step, const std::vector<float>& knots) :
+  start(start), step(step > 0.0f ? step : 1.0f), knots(knots)
+{
+}
+
+
+void AttenuationCurves::write(TiXmlDocument& doc) const
+{
+  TiXmlElement* old_curves = doc.FirstChildElement("Attenuation_Curves");
+  if (old_curves)
+  {
+    doc.RemoveChild(old_curves);
+  }
+
+  TiXmlElement* curves = new TiXmlElement("Attenuation_Curves");
+  doc.LinkEndChild(curves);
+  curves->SetDoubleAttribute("start", this->start);
+  curves->SetDoubleAttribute("step", this->step);
+
+  for (int i = 0; i < size(); i++)
+  {
+    TiXmlElement* knot = new TiXmlElement("Knot");
+    curves->LinkEndChild(knot);
+    knot->SetDoubleAttribute("val", this->start + i * this->step);
+
+    TiXmlElement* backscatter_att = new TiXmlElement("Backscatter_Attenuation");
+    TiXmlElement* direct_signal_att = new TiXmlElement("Direct_Signal_Attenuation");
+    knot->LinkEndChild(backscatter_att);
+    knot->LinkEndChild(direct_signal_att);
+    for (int c = 0; c < 3; c++)
+    {
+      backscatter_att->SetDoubleAttribute(CHANNELS[c], this->knots[6 * i + c]);
+      direct_signal_att->SetDoubleAttribute(CHANNELS[c], this->knots[6 * i + 3 + c]);
+    }
+  }
+}
+
+
+bool AttenuationCurves::read(const TiXmlDocument& doc)
+{
+  const TiXmlElement* curves = doc.FirstChildElement("Attenuation_Curves");
+  double start, step;
+  if (!curves || curves->QueryDoubleAttribute("start", &start) != TIXML_SUCCESS ||
+    curves->QueryDoubleAttribute("step", &step) != TIXML_SUCCESS || !(step > 0.0))
+  {
+    return false;
+  }
+
+  std::vector<float> knots;
+  for (const TiXmlElement* knot = curves->FirstChildElement("Knot"); knot; knot = knot->NextSiblingElement("Knot"))
+  {
+    const TiXmlElement* backscatter_att = knot->FirstChildElement("Backscatter_Attenuation");
+    const TiXmlElement* direct_signal_att = knot->FirstChildElement("Direct_Signal_Attenuation");
+    if (!backscatter_att || !direct_signal_att)
+    {
+      return false;
+    }
+
+    double values [6];
+    for (int c = 0; c < 3; c++)
+    {
+      if (backscatter_att->QueryDoubleAttribute(CHANNELS[c], &values[c]) != TIXML_SUCCESS ||
+        direct_signal_att->QueryDoubleAttribute(CHANNELS[c], &values[3 + c]) != TIXML_SUCCESS)
+      {
+        return false;
+      }
+    }
+    knots.insert(knots.end(), values, values + 6);
+  }
+  if (knots.empty())
+  {
+    return false;
+  }
+
+  this->start = start;
+  this->step = step;
+  this->knots = knots;
+  return true;
+}
+
+}  // namespace underwater_color_enhance
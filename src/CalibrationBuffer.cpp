@@ -0,0 +1,97 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/CalibrationBuffer.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace underwater_color_enhance
+{
+
+CalibrationBuffer::CalibrationBuffer()
+{
+  for (int i = 0; i < 2; i++)
+  {
+    this->slots[i].seq.store(0, std::memory_order_relaxed);
+    for (int j = 0; j < NUM_VALUES; j++)
+    {
+      this->slots[i].values[j].store(0.0, std::memory_order_relaxed);
+    }
+  }
+  this->active.store(-1, std::memory_order_release);
+}
+
+
+void CalibrationBuffer::publish(const Calibration& calibration)
+{
+  std::lock_guard<std::mutex> lock(this->write_mutex);
+
+  const float values[NUM_VALUES] = {calibration.depth,
+    calibration.backscatter_att[0], calibration.backscatter_att[1], calibration.backscatter_att[2],
+    calibration.direct_signal_att[0], calibration.direct_signal_att[1], calibration.direct_signal_att[2]};
+
+  // Fill the slot that readers are not directed to
+  int index = this->active.load(std::memory_order_relaxed) == 0 ? 1 : 0;
+  Slot& slot = this->slots[index];
+
+  unsigned int seq = slot.seq.load(std::memory_order_relaxed);
+  slot.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (int i = 0; i < NUM_VALUES; i++)
+  {
+    slot.values[i].store(values[i], std::memory_order_relaxed);
+  }
+
+  slot.seq.store(seq + 2, std::memory_order_release);
+  this->active.store(index, std::memory_order_release);
+}
+
+
+bool CalibrationBuffer::read(Calibration& calibration) const
+{
+  float values[NUM_VALUES];
+
+  while (true)
+  {
+    int index = this->active.load(std::memory_order_acquire);
+    if (index < 0)
+    {
+      return false;
+    }
+
+    const Slot& slot = this->slots[index];
+    unsigned int seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1)  // Slot is written, two calibrations were published since the index was loaded
+    {
+      continue;
+    }
+
+    for (int i = 0; i < NUM_VALUES; i++)
+    {
+      values[i] = slot.values[i].load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) == seq)
+    {
+      break;
+    }
+  }
+
+  calibration.depth = values[0];
+  for (int c = 0; c < 3; c++)
+  {
+    calibration.backscatter_att[c] = values[1 + c];
+    calibration.direct_signal_att[c] = values[4 + c];
+  }
+
+  return true;
+}
+
+}  // namespace underwater_color_enhance
@@ -0,0 +1,365 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/CalibrationStore.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <dirent.h>
+#include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+#include <tinyxml.h>
+
+namespace underwater_color_enhance
+{
+
+/** Directory name of a key part: letters, digits, '-' and '.' are kept, anything else becomes '_'.
+ */
+static std::string sanitize(const std::string& name)
+{
+  std::string sanitized = name;
+  for (size_t i = 0; i < sanitized.size(); i++)
+  {
+    char c = sanitized[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '.'))
+    {
+      sanitized[i] = '_';
+    }
+  }
+
+  return sanitized;
+}
+
+
+/** Creates a directory and its missing parents.
+ */
+static bool make_directories(const std::string& path)
+{
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+  {
+    std::string part = path.substr(0, pos);
+    struct stat info;
+    if (stat(part.c_str(), &info) != 0 && mkdir(part.c_str(), 0755) != 0)
+    {
+      return false;
+    }
+    if (pos == std::string::npos)
+    {
+      return true;
+    }
+  }
+}
+
+
+CalibrationStore::CalibrationStore(std::string STORE_DIR, std::string CAMERA, std::string WATER_TYPE,
+  std::string SITE, float BIN_SIZE, size_t MAX_CACHED_BINS, int MAX_SAMPLES, bool LOG_SCREEN)
+{
+  this->key = sanitize(CAMERA) + "__" + sanitize(WATER_TYPE);
+  if (!SITE.empty())
+  {
+    this->key += "__" + sanitize(SITE);
+  }
+  while (STORE_DIR.size() > 1 && STORE_DIR[STORE_DIR.size() - 1] == '/')
+  {
+    STORE_DIR.erase(STORE_DIR.size() - 1);
+  }
+  this->directory = STORE_DIR + "/" + this->key;
+  this->BIN_SIZE = BIN_SIZE > 0.0 ? BIN_SIZE : 0.5;
+  this->MAX_CACHED_BINS = MAX_CACHED_BINS > 0 ? MAX_CACHED_BINS : 1;
+  this->MAX_SAMPLES = MAX_SAMPLES > 0 ? MAX_SAMPLES : 1;
+
+  if (!make_directories(this->directory))
+  {
+    std::cout << "ERROR: Could not create calibration store directory " << this->directory << "." << std::endl;
+    return;
+  }
+
+  // List the bins, they are read when first used
+  DIR* dir = opendir(this->directory.c_str());
+  if (dir)
+  {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != 0)
+    {
+      int index;
+      int length = 0;
+      if (sscanf(entry->d_name, "bin_%d.xml%n", &index, &length) == 1 && length > 0 && entry->d_name[length] == '\0')
+      {
+        this->bins.insert(index);
+      }
+    }
+    closedir(dir);
+  }
+
+  if (LOG_SCREEN)
+  {
+    std::cout << "LOG: Calibration store " << this->directory << " has " << this->bins.size() << " depth bins."
+      << std::endl;
+  }
+}
+
+
+CalibrationStore::~CalibrationStore()
+{
+  flush();
+}
+
+
+bool CalibrationStore::lookup(float depth, Calibration& calibration)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  int index = bin_index(depth);
+  while (!this->bins.empty())
+  {
+    // Nearest bin, the deeper one on a tie
+    std::set<int>::iterator upper = this->bins.lower_bound(index);
+    int nearest;
+    if (upper == this->bins.end())
+    {
+      nearest = *this->bins.rbegin();
+    }
+    else if (upper == this->bins.begin() || *upper - index <= index - *std::prev(upper))
+    {
+      nearest = *upper;
+    }
+    else
+    {
+      nearest = *std::prev(upper);
+    }
+
+    Bin* bin = get_bin(nearest, false);
+    if (bin)
+    {
+      calibration = bin->calibration;
+      calibration.depth = depth;
+      return true;
+    }
+
+    // Unreadable, already reported
+    this->bins.erase(nearest);
+  }
+
+  return false;
+}
+
+
+void CalibrationStore::add(const Calibration& calibration, int SAMPLES)
+{
+  if (SAMPLES <= 0 || !std::isfinite(calibration.depth))
+  {
+    return;
+  }
+  for (int c = 0; c < 3; c++)
+  {
+    if (!std::isfinite(calibration.backscatter_att[c]) || !std::isfinite(calibration.direct_signal_att[c]))
+    {
+      return;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  Bin* bin = get_bin(bin_index(calibration.depth), true);
+  if (!bin)
+  {
+    return;
+  }
+
+  // Weighted by sample count, old samples are forgotten beyond MAX_SAMPLES
+  int old_samples = std::min(bin->samples, this->MAX_SAMPLES);
+  float weight = static_cast<float>(SAMPLES) / (old_samples + SAMPLES);
+  for (int c = 0; c < 3; c++)
+  {
+    bin->calibration.backscatter_att[c] += weight * (calibration.backscatter_att[c] -
+      bin->calibration.backscatter_att[c]);
+    bin->calibration.direct_signal_att[c] += weight * (calibration.direct_signal_att[c] -
+      bin->calibration.direct_signal_att[c]);
+  }
+  bin->calibration.depth += weight * (calibration.depth - bin->calibration.depth);
+  bin->samples = std::min(old_samples + SAMPLES, this->MAX_SAMPLES);
+  bin->dirty = true;
+}
+
+
+void CalibrationStore::flush()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  for (std::map<int, Bin>::iterator it = this->cache.begin(); it != this->cache.end(); ++it)
+  {
+    if (it->second.dirty)
+    {
+      write_bin(it->first, it->second);
+    }
+  }
+}
+
+
+size_t CalibrationStore::size()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->bins.size();
+}
+
+
+int CalibrationStore::bin_index(float depth) const
+{
+  return static_cast<int>(std::floor(depth / this->BIN_SIZE));
+}
+
+
+std::string CalibrationStore::bin_filename(int index) const
+{
+  return this->directory + "/bin_" + std::to_string(index) + ".xml";
+}
+
+
+CalibrationStore::Bin* CalibrationStore::get_bin(int index, bool create)
+{
+  std::map<int, Bin>::iterator it = this->cache.find(index);
+  if (it != this->cache.end())
+  {
+    this->recently_used.splice(this->recently_used.begin(), this->recently_used, it->second.use);
+    return &it->second;
+  }
+
+  Bin bin;
+  if (this->bins.count(index) && !read_bin(index, bin))
+  {
+    // Another version or corrupted: a new calibration starts the bin over
+    if (!create)
+    {
+      return 0;
+    }
+    bin = Bin();
+  }
+  else if (!this->bins.count(index) && !create)
+  {
+    return 0;
+  }
+
+  // Page out the least recently used bin
+  if (this->cache.size() >= this->MAX_CACHED_BINS)
+  {
+    int oldest = this->recently_used.back();
+    Bin& evicted = this->cache[oldest];
+    if (evicted.dirty)
+    {
+      write_bin(oldest, evicted);
+    }
+    this->recently_used.pop_back();
+    this->cache.erase(oldest);
+  }
+
+  this->recently_used.push_front(index);
+  bin.use = this->recently_used.begin();
+  this->bins.insert(index);
+  return &(this->cache[index] = bin);
+}
+
+
+bool CalibrationStore::read_bin(int index, Bin& bin) const
+{
+  std::string filename = bin_filename(index);
+  TiXmlDocument doc;
+  if (!doc.LoadFile(filename.c_str()))
+  {
+    std::cout << "ERROR: Could not load calibration bin " << filename << "." << std::endl;
+    return false;
+  }
+
+  TiXmlElement* pBinNode = doc.FirstChildElement("Calibration_Bin");
+  int version = 0;
+  if (!pBinNode || pBinNode->QueryIntAttribute("version", &version) != TIXML_SUCCESS || version != VERSION)
+  {
+    std::cout << "ERROR: Calibration bin " << filename << " is not of version " << VERSION << "." << std::endl;
+    return false;
+  }
+
+  double depth = 0.0;
+  pBinNode->QueryDoubleAttribute("depth", &depth);
+  pBinNode->QueryIntAttribute("samples", &bin.samples);
+  pBinNode->QueryIntAttribute("revision", &bin.revision);
+  bin.calibration.depth = depth;
+
+  const char* channels[3] = {"blue", "green", "red"};
+  TiXmlElement* pBackscatterNode = pBinNode->FirstChildElement("Backscatter_Attenuation");
+  TiXmlElement* pDirectSignalNode = pBinNode->FirstChildElement("Direct_Signal_Attenuation");
+  if (!pBackscatterNode || !pDirectSignalNode)
+  {
+    std::cout << "ERROR: Calibration bin " << filename << " has no attenuation values." << std::endl;
+    return false;
+  }
+  for (int c = 0; c < 3; c++)
+  {
+    double backscatter_att = 0.0;
+    double direct_signal_att = 0.0;
+    if (pBackscatterNode->QueryDoubleAttribute(channels[c], &backscatter_att) != TIXML_SUCCESS ||
+      pDirectSignalNode->QueryDoubleAttribute(channels[c], &direct_signal_att) != TIXML_SUCCESS)
+    {
+      std::cout << "ERROR: Calibration bin " << filename << " has no attenuation values." << std::endl;
+      return false;
+    }
+    bin.calibration.backscatter_att[c] = backscatter_att;
+    bin.calibration.direct_signal_att[c] = direct_signal_att;
+  }
+
+  bin.dirty = false;
+  return true;
+}
+
+
+void CalibrationStore::write_bin(int index, Bin& bin) const
+{
+  bin.revision++;
+
+  char updated[32];
+  std::time_t now = std::time(0);
+  std::strftime(updated, sizeof(updated), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+  TiXmlDocument doc;
+  doc.LinkEndChild(new TiXmlDeclaration("1.0", "", ""));
+
+  TiXmlElement * data_bin = new TiXmlElement("Calibration_Bin");
+  doc.LinkEndChild(data_bin);
+  data_bin->SetAttribute("version", VERSION);
+  data_bin->SetAttribute("key", this->key.c_str());
+  data_bin->SetDoubleAttribute("depth", bin.calibration.depth);
+  data_bin->SetDoubleAttribute("bin_size", this->BIN_SIZE);
+  data_bin->SetAttribute("samples", bin.samples);
+  data_bin->SetAttribute("revision", bin.revision);
+  data_bin->SetAttribute("updated", updated);
+
+  TiXmlElement * data_backscatter_att = new TiXmlElement("Backscatter_Attenuation");
+  data_bin->LinkEndChild(data_backscatter_att);
+  data_backscatter_att->SetDoubleAttribute("blue", bin.calibration.backscatter_att[0]);
+  data_backscatter_att->SetDoubleAttribute("green", bin.calibration.backscatter_att[1]);
+  data_backscatter_att->SetDoubleAttribute("red", bin.calibration.backscatter_att[2]);
+
+  TiXmlElement * data_direct_signal_att = new TiXmlElement("Direct_Signal_Attenuation");
+  data_bin->LinkEndChild(data_direct_signal_att);
+  data_direct_signal_att->SetDoubleAttribute("blue", bin.calibration.direct_signal_att[0]);
+  data_direct_signal_att->SetDoubleAttribute("green", bin.calibration.direct_signal_att[1]);
+  data_direct_signal_att->SetDoubleAttribute("red", bin.calibration.direct_signal_att[2]);
+
+  // Written next to the bin and renamed, a crash never leaves a half written bin
+  std::string filename = bin_filename(index);
+  std::string temporary = filename + ".tmp";
+  if (!doc.SaveFile(temporary.c_str()) || std::rename(temporary.c_str(), filename.c_str()) != 0)
+  {
+    std::cout << "ERROR: Could not write calibration bin " << filename << "." << std::endl;
+    return;
+  }
+
+  bin.dirty = false;
+}
+
+}  // namespace underwater_color_enhance
@@ -0,0 +1,119 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/ChartFit.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+constexpr float ChartFit::HUBER_K;
+
+
+bool ChartFit::fit(const std::vector<cv::Scalar>& truth, const std::vector<cv::Scalar>& observed, float noise_floor,
+  float* transmission, float* backscatter, std::vector<cv::Scalar>* weights)
+{
+  const int n = std::min(static_cast<int>(std::min(truth.size(), observed.size())), MAX_PATCHES);
+  if (n < 2)
+  {
+    return false;
+  }
+
+  // Channels in rows, patches in columns: the loops over the patches vectorize
+  float x [3][MAX_PATCHES];
+  float y [3][MAX_PATCHES];
+  float w [3][MAX_PATCHES];
+  float residual [3][MAX_PATCHES];
+  for (int c = 0; c < 3; c++)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      x[c][i] = truth[i][c];
+      y[c][i] = observed[i][c];
+      w[c][i] = 1.0f;
+    }
+  }
+
+  float slope [3] = {0.0, 0.0, 0.0};
+  float intercept [3] = {0.0, 0.0, 0.0};
+  for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++)
+  {
+    bool converged = true;
+    for (int c = 0; c < 3; c++)
+    {
+      // Weighted 2x2 normal equations, centered on the weighted means
+      float sw = 0.0f, swx = 0.0f, swy = 0.0f;
+      for (int i = 0; i < n; i++)
+      {
+        sw += w[c][i];
+        swx += w[c][i] * x[c][i];
+        swy += w[c][i] * y[c][i];
+      }
+      const float mean_x = swx / sw;
+      const float mean_y = swy / sw;
+      float sxx = 0.0f, sxy = 0.0f;
+      for (int i = 0; i < n; i++)
+      {
+        const float dx = x[c][i] - mean_x;
+        sxx += w[c][i] * dx * dx;
+        sxy += w[c][i] * dx * (y[c][i] - mean_y);
+      }
+      if (!(sxx > 0.0f))
+      {
+        return false;
+      }
+
+      const float new_slope = sxy / sxx;
+      const float new_intercept = mean_y - new_slope * mean_x;
+      converged = converged && std::fabs(new_slope - slope[c]) <= 1e-5f * std::fabs(new_slope) &&
+        std::fabs(new_intercept - intercept[c]) <= 1e-3f * noise_floor;
+      slope[c] = new_slope;
+      intercept[c] = new_intercept;
+
+      // Huber weights from the robust standard deviation (median absolute residual) of the channel
+      float absolute [MAX_PATCHES];
+      for (int i = 0; i < n; i++)
+      {
+        residual[c][i] = y[c][i] - (slope[c] * x[c][i] + intercept[c]);
+        absolute[i] = std::fabs(residual[c][i]);
+      }
+      std::nth_element(absolute, absolute + n / 2, absolute + n);
+      const float threshold = HUBER_K * std::max(1.4826f * absolute[n / 2], noise_floor);
+      for (int i = 0; i < n; i++)
+      {
+        const float r = std::fabs(residual[c][i]);
+        w[c][i] = r <= threshold ? 1.0f : threshold / r;
+      }
+    }
+
+    if (converged && iteration > 0)
+    {
+      break;
+    }
+  }
+
+  for (int c = 0; c < 3; c++)
+  {
+    transmission[c] = slope[c];
+    backscatter[c] = intercept[c];
+  }
+  if (weights)
+  {
+    weights->assign(n, cv::Scalar());
+    for (int i = 0; i < n; i++)
+    {
+      (*weights)[i] = cv::Scalar(w[0][i], w[1][i], w[2][i]);
+    }
+  }
+
+  return true;
+}
+
+}  // namespace underwater_color_enhance
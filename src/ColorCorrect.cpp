@@ -7,84 +7,277 @@
 
 #include "underwater_color_enhance/ColorCorrect.h"
 
-#include "underwater_color_enhance/NewModel.h"
+#include "underwater_color_enhance/MethodRegistry.h"
+#include "underwater_color_enhance/ModelBundle.h"
 
+#include <iostream>
 #include <string>
 #include <vector>
 
 namespace underwater_color_enhance
 {
 
-ColorCorrect::ColorCorrect(Scene& underwater_scene, int METHOD_ID, bool EST_VEILING_LIGHT, bool OPTIMIZE,
+ColorCorrect::ColorCorrect(const Scene& underwater_scene, int METHOD_ID, bool EST_VEILING_LIGHT, bool OPTIMIZE,
   float RANGE, bool SAVE_DATA, bool CHECK_TIME, bool LOG_SCREEN, bool PRIOR_DATA, std::string INPUT_FILENAME,
   std::string OUTPUT_FILENAME)
 {
-  this->underwater_scene = underwater_scene;
+  this->underwater_scene = std::make_shared<const Scene>(underwater_scene);
+  this->depth = underwater_scene.get_depth();
   this->OUTPUT_FILENAME = OUTPUT_FILENAME;
   this->OPTIMIZE = OPTIMIZE;
 
-  if (METHOD_ID == 0)
-  {
-    this->method = new NewModel;
-    this->method->EST_VEILING_LIGHT = EST_VEILING_LIGHT;
-    this->method->CHECK_TIME = CHECK_TIME;
-    this->method->OPTIMIZE = OPTIMIZE;
-    this->method->LOG_SCREEN = LOG_SCREEN;
-
-    if (this->OPTIMIZE == true)
-    {
-      // Is this required? will attenuation not be saved?
-      this->method->SAVE_DATA = true;
-      this->method->PRIOR_DATA = false;
-      this->method->RANGE = RANGE;
-    }
-    else
-    {
-      this->method->SAVE_DATA = SAVE_DATA;
-      this->method->PRIOR_DATA = PRIOR_DATA;
-    }
-
-    this->method->file_initialized = false;
-    this->method->scene = &this->underwater_scene;
-    this->method->depth = this->underwater_scene.get_depth();
-
-    if (PRIOR_DATA)
-    {
-      this->method->load_data(INPUT_FILENAME);
-    }
+  this->method.reset(MethodRegistry::create(METHOD_ID));
+  if (!this->method)  // Safety measures: fall back to NewModel
+  {
+    std::cout << "ERROR: Unknown color enhancement method " << METHOD_ID << ", using " <<
+      MethodRegistry::get_name(0) << "." << std::endl;
+    this->method.reset(MethodRegistry::create(0));
+  }
+  else if (LOG_SCREEN)
+  {
+    std::cout << "LOG: Color enhancement method " << MethodRegistry::get_name(METHOD_ID) << std::endl;
+  }
+
+  this->method_config.EST_VEILING_LIGHT = EST_VEILING_LIGHT;
+  this->method_config.CHECK_TIME = CHECK_TIME;
+  this->method_config.OPTIMIZE = OPTIMIZE;
+  this->method_config.LOG_SCREEN = LOG_SCREEN;
+
+  if (this->OPTIMIZE == true)
+  {
+    // Is this required? will attenuation not be saved?
+    this->method_config.SAVE_DATA = true;
+    this->method_config.PRIOR_DATA = false;
+    this->method_config.RANGE = RANGE;
   }
   else
   {
-    this->method = 0;
+    this->method_config.SAVE_DATA = SAVE_DATA;
+    this->method_config.PRIOR_DATA = PRIOR_DATA;
+  }
+
+  this->method->configure(this->method_config);
+  this->method->set_scene(this->underwater_scene);
+
+  if (this->method_config.PRIOR_DATA)
+  {
+    this->method->load_data(INPUT_FILENAME);
   }
 }
 
 
-cv::Mat ColorCorrect::enhance(cv::Mat& img)
+cv::Mat ColorCorrect::enhance(const cv::Mat& img, float depth, FrameMetrics* metrics)
 {
-  this->method->depth = this->underwater_scene.get_depth();
-  cv::Mat corrected_img = this->method->color_correct(img);
+  cv::Mat corrected_img = this->method->color_correct(img, Scene::round_depth(depth), metrics);
 
   return corrected_img;
 }
 
 
-void ColorCorrect::optimize(cv::Mat& img)
+FrameCorrection ColorCorrect::prepare(const cv::Mat& img, float depth)
+{
+  return this->method->prepare_frame(img, Scene::round_depth(depth));
+}
+
+
+std::vector<cv::Mat> ColorCorrect::enhance_regions(const cv::Mat& img, const std::vector<cv::Rect>& regions,
+  float depth)
+{
+  return prepare(img, depth).apply(img, regions);
+}
+
+
+cv::Mat ColorCorrect::enhance_mask(const cv::Mat& img, const cv::Mat& mask, float depth)
+{
+  return prepare(img, depth).apply_mask(img, mask);
+}
+
+
+TileIterator ColorCorrect::enhance_tiles(const cv::Mat& img, cv::Size tile_size, float depth)
+{
+  return TileIterator(img, prepare(img, depth), tile_size);
+}
+
+
+void ColorCorrect::optimize(const cv::Mat& img, float depth)
+{
+  this->method->calculate_optimized_attenuation(img, Scene::round_depth(depth));
+}
+
+
+cv::Mat ColorCorrect::enhance_slam(const cv::Mat& img, const KeypointSpan& keypoints, float depth,
+  FrameMetrics* metrics)
 {
-  this->method->depth = this->underwater_scene.get_depth();
-  this->method->calculate_optimized_attenuation(img);
+  cv::Mat corrected_img = this->method->color_correct_slam(img, keypoints, Scene::round_depth(depth), metrics);
+
+  return corrected_img;
 }
 
 
-cv::Mat ColorCorrect::enhance_slam(cv::Mat& img, std::vector<cv::Point2f> point_data, std::vector<float> distance_data)
+cv::Mat ColorCorrect::enhance_depth(const cv::Mat& img, const cv::Mat& depth_map, float depth,
+  FrameMetrics* metrics)
 {
-  this->method->depth = this->underwater_scene.get_depth();
-  cv::Mat corrected_img = this->method->color_correct_slam(img, point_data, distance_data);
+  cv::Mat range_map = register_depth_map(depth_map, img.size());
+  cv::Mat corrected_img = this->method->color_correct_depth(img, range_map, Scene::round_depth(depth), metrics);
 
   return corrected_img;
 }
 
 
+void ColorCorrect::set_depth_map_options(float DEPTH_MAP_SCALE, std::vector<double> DEPTH_MAP_REGISTRATION)
+{
+  this->DEPTH_MAP_SCALE = DEPTH_MAP_SCALE;
+
+  if (DEPTH_MAP_REGISTRATION.size() == 9)
+  {
+    this->DEPTH_MAP_REGISTRATION = cv::Mat(DEPTH_MAP_REGISTRATION, true).reshape(1, 3);
+  }
+  else
+  {
+    this->DEPTH_MAP_REGISTRATION.release();
+  }
+}
+
+
+void ColorCorrect::set_exp_max_error(float EXP_MAX_ERROR)
+{
+  this->method_config.EXP_MAX_ERROR = EXP_MAX_ERROR;
+  this->method->configure(this->method_config);
+
+  if (this->method_config.LOG_SCREEN)
+  {
+    std::cout << "LOG: Exp approximation degree " << this->method->get_fast_exp().get_degree() <<
+      ", max relative error " << this->method->get_fast_exp().get_max_rel_error() << std::endl;
+  }
+}
+
+
+void ColorCorrect::set_slam_label_map(bool SLAM_LABEL_MAP)
+{
+  this->method_config.SLAM_LABEL_MAP = SLAM_LABEL_MAP;
+  this->method->configure(this->method_config);
+}
+
+
+void ColorCorrect::set_channel_order(ChannelOrder CHANNEL_ORDER)
+{
+  this->method_config.CHANNEL_ORDER = CHANNEL_ORDER;
+  this->method->configure(this->method_config);
+}
+
+
+void ColorCorrect::set_tone_map(const ToneMap& TONE_MAP)
+{
+  this->method_config.TONE_MAP = TONE_MAP;
+  this->method->configure(this->method_config);
+}
+
+
+void ColorCorrect::set_lookup_table(bool LOOKUP_TABLE)
+{
+  this->method_config.LOOKUP_TABLE = LOOKUP_TABLE;
+  this->method->configure(this->method_config);
+}
+
+
+void ColorCorrect::prewarm(cv::Size size, int type) const
+{
+  if (this->underwater_scene->get_bundle())
+  {
+    this->underwater_scene->get_bundle()->prewarm();
+  }
+  this->underwater_scene->integrate_veiling_light(this->depth);
+
+  // The kernels of the method, the calibration of the method is not touched
+  cv::Mat frame(size, type, cv::Scalar::all(0));
+  this->method->prewarm(frame, Scene::round_depth(this->depth));
+}
+
+
+void ColorCorrect::set_calibration_source(bool COLOR_CHART, std::shared_ptr<CalibrationStore> CALIBRATION_STORE)
+{
+  this->method_config.COLOR_CHART = COLOR_CHART;
+  this->method_config.CALIBRATION_STORE = CALIBRATION_STORE;
+  this->method->configure(this->method_config);
+}
+
+
+void ColorCorrect::set_veiling_light_grid(cv::Size GRID_SIZE, float SMOOTHING, float MAX_RATIO)
+{
+  this->method_config.VEILING_LIGHT_GRID.reset();
+  if (GRID_SIZE.width > 0 && GRID_SIZE.height > 0)
+  {
+    this->method_config.VEILING_LIGHT_GRID = std::make_shared<VeilingLightGrid>(GRID_SIZE, SMOOTHING, MAX_RATIO);
+  }
+  this->method->configure(this->method_config);
+
+  if (this->method_config.LOG_SCREEN && this->method_config.VEILING_LIGHT_GRID)
+  {
+    std::cout << "LOG: Veiling light grid " << GRID_SIZE.width << "x" << GRID_SIZE.height << ", smoothing " <<
+      SMOOTHING << ", max ratio " << MAX_RATIO << std::endl;
+  }
+}
+
+
+void ColorCorrect::set_color_matrix(const ColorMatrix& COLOR_MATRIX, bool FIT)
+{
+  this->method_config.COLOR_MATRIX = COLOR_MATRIX;
+  this->method_config.COLOR_MATRIX_FIT = FIT;
+  this->method->configure(this->method_config);
+}
+
+
+void ColorCorrect::set_joint_optimization(bool JOINT_OPTIMIZE, float KNOT_SPACING, float SMOOTHNESS)
+{
+  this->method_config.JOINT_OPTIMIZE = JOINT_OPTIMIZE;
+  this->method_config.KNOT_SPACING = KNOT_SPACING;
+  this->method_config.SMOOTHNESS = SMOOTHNESS;
+  this->method->configure(this->method_config);
+}
+
+
+bool ColorCorrect::fit_attenuation_curves()
+{
+  return this->method->fit_attenuation_curves();
+}
+
+
+cv::Mat ColorCorrect::register_depth_map(const cv::Mat& depth_map, cv::Size img_size) const
+{
+  cv::Mat range_map;
+  if (depth_map.type() == CV_16UC1)
+  {
+    depth_map.convertTo(range_map, CV_32F, this->DEPTH_MAP_SCALE);
+  }
+  else if (depth_map.type() == CV_32FC1)
+  {
+    range_map = depth_map;
+  }
+  else
+  {
+    CV_Error(cv::Error::StsUnsupportedFormat, "Depth map must be CV_16UC1 or CV_32FC1");
+  }
+
+  // Nearest neighbor keeps invalid (zero) depth measurements from blending into valid ones.
+  // Pixels without a registered depth are left at zero and fall back to the scene distance.
+  if (!this->DEPTH_MAP_REGISTRATION.empty())
+  {
+    cv::Mat registered_map;
+    cv::warpPerspective(range_map, registered_map, this->DEPTH_MAP_REGISTRATION, img_size, cv::INTER_NEAREST,
+      cv::BORDER_CONSTANT, cv::Scalar(0));
+    return registered_map;
+  }
+  else if (range_map.size() != img_size)
+  {
+    cv::Mat resized_map;
+    cv::resize(range_map, resized_map, img_size, 0, 0, cv::INTER_NEAREST);
+    return resized_map;
+  }
+
+  return range_map;
+}
+
+
 void ColorCorrect::save_final_data()
 {
   this->method->end_file(this->OUTPUT_FILENAME);
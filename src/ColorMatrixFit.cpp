@@ -0,0 +1,112 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/ColorMatrixFit.h"
+
+#include <cmath>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+bool ColorMatrixFit::fit(const std::vector<cv::Scalar>& measured, const std::vector<cv::Scalar>& reference,
+  float* matrix)
+{
+  if (measured.empty() || measured.size() != reference.size())
+  {
+    return false;
+  }
+
+  // Normal equations: matrix = (R^T M) (M^T M)^-1, with M and R the patches in rows
+  double mm [3][3] = {{0.0}};
+  double rm [3][3] = {{0.0}};
+  for (size_t i = 0; i < measured.size(); i++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      for (int k = 0; k < 3; k++)
+      {
+        mm[j][k] += measured[i][j] * measured[i][k];
+        rm[j][k] += reference[i][j] * measured[i][k];
+      }
+    }
+  }
+
+  double result [3][3] = {{0.0}};
+  if (measured.size() < 3)  // Not enough colors for the cross terms, white balance only
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      result[c][c] = rm[c][c] / mm[c][c];
+    }
+  }
+  else
+  {
+    // Inverse of M^T M by cofactors, singular when the patches do not span the three channels
+    double inv [3][3];
+    for (int j = 0; j < 3; j++)
+    {
+      for (int k = 0; k < 3; k++)
+      {
+        int j1 = (k + 1) % 3, j2 = (k + 2) % 3;
+        int k1 = (j + 1) % 3, k2 = (j + 2) % 3;
+        inv[j][k] = mm[j1][k1] * mm[j2][k2] - mm[j1][k2] * mm[j2][k1];
+      }
+    }
+    double det = mm[0][0] * inv[0][0] + mm[0][1] * inv[1][0] + mm[0][2] * inv[2][0];
+    double trace = mm[0][0] + mm[1][1] + mm[2][2];
+    if (!(std::fabs(det) > 1e-9 * trace * trace * trace))
+    {
+      return false;
+    }
+
+    for (int j = 0; j < 3; j++)
+    {
+      for (int k = 0; k < 3; k++)
+      {
+        for (int l = 0; l < 3; l++)
+        {
+          result[j][k] += rm[j][l] * inv[l][k] / det;
+        }
+      }
+    }
+  }
+
+  for (int j = 0; j < 3; j++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      if (!std::isfinite(result[j][k]))
+      {
+        return false;
+      }
+    }
+  }
+  for (int j = 0; j < 3; j++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      matrix[3 * j + k] = result[j][k];
+    }
+  }
+
+  return true;
+}
+
+
+cv::Scalar ColorMatrixFit::linear_truth(const cv::Scalar& truth, float gamma, float pixel_scale)
+{
+  cv::Scalar linear;
+  for (int c = 0; c < 3; c++)
+  {
+    linear[c] = 255.0 * std::pow(truth[c] / 255.0, 1.0 / gamma) * pixel_scale;
+  }
+
+  return linear;
+}
+
+}  // namespace underwater_color_enhance
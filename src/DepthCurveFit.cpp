@@ -0,0 +1,300 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/DepthCurveFit.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+static const int BANDWIDTH = 4;   /**< farthest parameter coupled to another: second differences of a curve */
+
+
+/** Solves a symmetric positive definite banded system in place, the band holds the lower diagonals of each row:
+ *  band[(BANDWIDTH + 1) * i + (i - j)] = A(i, j). False if the matrix is not positive definite.
+ */
+static bool solve_banded(std::vector<double>& band, std::vector<double>& x)
+{
+  const int n = x.size();
+  const int W = BANDWIDTH + 1;
+
+  // Cholesky factor L in place of the band
+  for (int i = 0; i < n; i++)
+  {
+    for (int j = std::max(0, i - BANDWIDTH); j <= i; j++)
+    {
+      double sum = band[W * i + (i - j)];
+      for (int k = std::max(0, i - BANDWIDTH); k < j; k++)
+      {
+        sum -= band[W * i + (i - k)] * band[W * j + (j - k)];
+      }
+      if (i == j)
+      {
+        if (!(sum > 0.0))
+        {
+          return false;
+        }
+        band[W * i] = std::sqrt(sum);
+      }
+      else
+      {
+        band[W * i + (i - j)] = sum / band[W * j];
+      }
+    }
+  }
+
+  // L y = b, then L^T x = y
+  for (int i = 0; i < n; i++)
+  {
+    for (int k = std::max(0, i - BANDWIDTH); k < i; k++)
+    {
+      x[i] -= band[W * i + (i - k)] * x[k];
+    }
+    x[i] /= band[W * i];
+  }
+  for (int i = n - 1; i >= 0; i--)
+  {
+    for (int k = i + 1; k <= std::min(n - 1, i + BANDWIDTH); k++)
+    {
+      x[i] -= band[W * k + (k - i)] * x[k];
+    }
+    x[i] /= band[W * i];
+  }
+
+  return true;
+}
+
+
+DepthCurveFit::DepthCurveFit(float DISTANCE, float KNOT_SPACING, float SMOOTHNESS)
+{
+  this->DISTANCE = DISTANCE;
+  this->KNOT_SPACING = KNOT_SPACING > 0.0f ? KNOT_SPACING : 0.5f;
+  this->SMOOTHNESS = std::max(SMOOTHNESS, 0.0f);
+}
+
+
+bool DepthCurveFit::fit(const std::vector<DepthSample>* samples, AttenuationCurves& curves) const
+{
+  float min_depth = 0.0f, max_depth = 0.0f;
+  bool first = true;
+  for (int c = 0; c < 3; c++)
+  {
+    if (samples[c].empty())
+    {
+      return false;
+    }
+    for (size_t i = 0; i < samples[c].size(); i++)
+    {
+      min_depth = first ? samples[c][i].depth : std::min(min_depth, samples[c][i].depth);
+      max_depth = first ? samples[c][i].depth : std::max(max_depth, samples[c][i].depth);
+      first = false;
+    }
+  }
+  const int num_knots = std::max(2, static_cast<int>(std::ceil((max_depth - min_depth) / this->KNOT_SPACING)) + 1);
+
+  // Channels are independent, one thread each. Initial values as the depth range optimizer.
+  std::vector<double> backscatter_att [3];
+  std::vector<double> direct_signal_att [3];
+  bool converged [3];
+  std::vector<std::thread> threads;
+  for (int c = 0; c < 3; c++)
+  {
+    backscatter_att[c].assign(num_knots, 1.0);
+    direct_signal_att[c].assign(num_knots, 1.0);
+    threads.push_back(std::thread([&, c]()
+    {
+      converged[c] = fit_channel(samples[c], min_depth, num_knots, backscatter_att[c], direct_signal_att[c]);
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    threads[i].join();
+  }
+  if (!converged[0] || !converged[1] || !converged[2])
+  {
+    return false;
+  }
+
+  std::vector<float> knots(6 * num_knots);
+  for (int i = 0; i < num_knots; i++)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      knots[6 * i + c] = backscatter_att[c][i];
+      knots[6 * i + 3 + c] = direct_signal_att[c][i];
+    }
+  }
+  curves = AttenuationCurves(min_depth, this->KNOT_SPACING, knots);
+
+  return true;
+}
+
+
+bool DepthCurveFit::fit_channel(const std::vector<DepthSample>& samples, float start, int num_knots,
+  std::vector<double>& backscatter_att, std::vector<double>& direct_signal_att) const
+{
+  const int n = 2 * num_knots;
+  const int W = BANDWIDTH + 1;
+
+  // Knots interleaved, so each sample touches four neighboring parameters
+  std::vector<double> params(n);
+  for (int i = 0; i < num_knots; i++)
+  {
+    params[2 * i] = backscatter_att[i];
+    params[2 * i + 1] = direct_signal_att[i];
+  }
+
+  std::vector<double> gradient, band;
+  double cost = evaluate(samples, start, params, &gradient, &band);
+  if (!std::isfinite(cost))
+  {
+    return false;
+  }
+
+  double damping = 1e-3;
+  for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++)
+  {
+    // Damped step, the damping grows until the cost decreases
+    double max_diagonal = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+      max_diagonal = std::max(max_diagonal, band[W * i]);
+    }
+
+    bool improved = false;
+    double new_cost = cost;
+    std::vector<double> trial(n);
+    while (!improved && damping < 1e12)
+    {
+      std::vector<double> damped = band;
+      std::vector<double> step(n);
+      for (int i = 0; i < n; i++)
+      {
+        damped[W * i] += damping * std::max(band[W * i], 1e-9 * max_diagonal + 1e-12);
+        step[i] = -gradient[i];
+      }
+
+      if (solve_banded(damped, step))
+      {
+        for (int i = 0; i < n; i++)
+        {
+          trial[i] = params[i] + step[i];
+        }
+        new_cost = evaluate(samples, start, trial, 0, 0);
+        improved = std::isfinite(new_cost) && new_cost < cost;
+      }
+      damping *= improved ? 0.1 : 10.0;
+    }
+    if (!improved)
+    {
+      break;  // No step decreases the cost: converged
+    }
+
+    params.swap(trial);
+    bool converged = cost - new_cost <= 1e-10 * cost;
+    cost = evaluate(samples, start, params, &gradient, &band);
+    if (converged)
+    {
+      break;
+    }
+  }
+
+  for (int i = 0; i < num_knots; i++)
+  {
+    backscatter_att[i] = params[2 * i];
+    direct_signal_att[i] = params[2 * i + 1];
+    if (!std::isfinite(backscatter_att[i]) || !std::isfinite(direct_signal_att[i]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+double DepthCurveFit::evaluate(const std::vector<DepthSample>& samples, float start,
+  const std::vector<double>& params, std::vector<double>* gradient, std::vector<double>* band) const
+{
+  const int n = params.size();
+  const int num_knots = n / 2;
+  const int W = BANDWIDTH + 1;
+  const double z = this->DISTANCE;
+
+  if (gradient)
+  {
+    gradient->assign(n, 0.0);
+    band->assign(W * n, 0.0);
+  }
+
+  double cost = 0.0;
+  for (size_t s = 0; s < samples.size(); s++)
+  {
+    const DepthSample& sample = samples[s];
+
+    // Knots around the depth of the sample
+    double position = (sample.depth - start) / this->KNOT_SPACING;
+    position = std::min(std::max(position, 0.0), static_cast<double>(num_knots - 1));
+    const int knot = std::min(static_cast<int>(position), num_knots - 2);
+    const double u = position - knot;
+    const double* p = &params[2 * knot];
+    const double bs = (1.0 - u) * p[0] + u * p[2];
+    const double ds = (1.0 - u) * p[1] + u * p[3];
+
+    const double backscatter = std::exp(-bs * z);
+    const double inv_direct_signal = std::exp(ds * z);
+    const double corrected = (sample.observed - sample.veiling_light * (1.0 - backscatter)) * inv_direct_signal;
+    const double residual = corrected - sample.truth;
+    cost += residual * residual;
+
+    if (gradient)
+    {
+      const double d_bs = -sample.veiling_light * z * backscatter * inv_direct_signal;
+      const double d_ds = z * corrected;
+      const double jacobian [4] = {(1.0 - u) * d_bs, (1.0 - u) * d_ds, u * d_bs, u * d_ds};
+      for (int i = 0; i < 4; i++)
+      {
+        const int row = 2 * knot + i;
+        (*gradient)[row] += residual * jacobian[i];
+        for (int j = 0; j <= i; j++)
+        {
+          (*band)[W * row + (i - j)] += jacobian[i] * jacobian[j];
+        }
+      }
+    }
+  }
+
+  // Second differences of each curve: p[k - 2] - 2 p[k] + p[k + 2] in the interleaved parameters
+  const double weight = this->SMOOTHNESS * samples.size();
+  const double coefficients [3] = {1.0, -2.0, 1.0};
+  for (int k = 2; k + 2 < n; k++)
+  {
+    const double difference = params[k - 2] - 2.0 * params[k] + params[k + 2];
+    cost += weight * difference * difference;
+
+    if (gradient)
+    {
+      for (int i = 0; i < 3; i++)
+      {
+        const int row = k - 2 + 2 * i;
+        (*gradient)[row] += weight * difference * coefficients[i];
+        for (int j = 0; j <= i; j++)
+        {
+          (*band)[W * row + 2 * (i - j)] += weight * coefficients[i] * coefficients[j];
+        }
+      }
+    }
+  }
+
+  return cost;
+}
+
+}  // namespace underwater_color_enhance
@@ -0,0 +1,103 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/DepthHistory.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+DepthHistory::DepthHistory(size_t CAPACITY, double MAX_EXTRAPOLATION)
+{
+  this->samples.resize(std::max(CAPACITY, static_cast<size_t>(2)));
+  this->count = 0;
+  this->newest = 0;
+  this->MAX_EXTRAPOLATION = MAX_EXTRAPOLATION;
+}
+
+
+void DepthHistory::add(double stamp, float depth)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (this->count > 0 && stamp <= from_newest(0).stamp)
+  {
+    return;
+  }
+
+  this->newest = (this->newest + 1) % this->samples.size();
+  this->samples[this->newest].stamp = stamp;
+  this->samples[this->newest].depth = depth;
+  this->count = std::min(this->count + 1, this->samples.size());
+}
+
+
+bool DepthHistory::get_depth(double stamp, float& depth) const
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (this->count == 0)
+  {
+    return false;
+  }
+
+  const Sample& latest = from_newest(0);
+  if (stamp >= latest.stamp)  // Image is newer than every depth measurement
+  {
+    if (this->count == 1)
+    {
+      depth = latest.depth;
+      return true;
+    }
+
+    const Sample& previous = from_newest(1);
+    double rate = (latest.depth - previous.depth) / (latest.stamp - previous.stamp);
+    depth = latest.depth + rate * std::min(stamp - latest.stamp, this->MAX_EXTRAPOLATION);
+    return true;
+  }
+
+  // Binary search for the oldest measurement after the image, the history may hold a whole recorded mission
+  size_t low = 0;
+  size_t high = this->count - 1;  // from_oldest(high) is after the image
+  while (low < high)
+  {
+    size_t middle = low + (high - low) / 2;
+    if (from_oldest(middle).stamp > stamp)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle + 1;
+    }
+  }
+
+  if (high > 0)
+  {
+    const Sample& before = from_oldest(high - 1);
+    const Sample& after = from_oldest(high);
+    double weight = (stamp - before.stamp) / (after.stamp - before.stamp);
+    depth = before.depth + weight * (after.depth - before.depth);
+    return true;
+  }
+
+  // Image is older than every depth measurement
+  depth = from_oldest(0).depth;
+  return true;
+}
+
+
+void DepthHistory::set_max_extrapolation(double MAX_EXTRAPOLATION)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->MAX_EXTRAPOLATION = MAX_EXTRAPOLATION;
+}
+
+}  // namespace underwater_color_enhance
@@ -0,0 +1,126 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/FastExp.h"
+
+#include <math.h>
+#include <algorithm>
+
+namespace underwater_color_enhance
+{
+
+/** Minimax polynomials of 2^f on [0, 1), fitted to the relative error. Row i is degree MIN_DEGREE + i.
+ */
+static const float POLYNOMIALS [FastExp::MAX_DEGREE - FastExp::MIN_DEGREE + 1][FastExp::MAX_DEGREE + 1] = {
+  {1.001724761e+00f, 6.576362931e-01f, 3.371894159e-01f, 0.0f, 0.0f, 0.0f, 0.0f},                // 1.7e-3
+  {9.999252186e-01f, 6.958335392e-01f, 2.260671591e-01f, 7.802452004e-02f, 0.0f, 0.0f, 0.0f},     // 7.5e-5
+  {1.000002593e+00f, 6.930038345e-01f, 2.414427566e-01f, 5.201146119e-02f, 1.353416762e-02f,
+    0.0f, 0.0f},                                                                                  // 2.6e-6
+  {9.999999251e-01f, 6.931530732e-01f, 2.401536171e-01f, 5.582631799e-02f, 8.989340163e-03f,
+    1.877576645e-03f, 0.0f},                                                                      // 7.5e-8
+  {1.000000002e+00f, 6.931469838e-01f, 2.402298363e-01f, 5.548334199e-02f, 9.678840987e-03f,
+    1.243968791e-03f, 2.170225517e-04f}                                                           // 1.9e-9
+};
+
+const int FastExp::MIN_DEGREE;
+const int FastExp::MAX_DEGREE;
+const int FastExp::MAX_ARG;
+
+
+FastExp::FastExp(float MAX_REL_ERROR)
+{
+  // Lowest degree that meets the accuracy target, checked against std::exp (float rounding included)
+  for (int i = MIN_DEGREE; i <= MAX_DEGREE; i++)
+  {
+    set_degree(i);
+    this->max_rel_error = measure_rel_error(-MAX_ARG, MAX_ARG, 4096);
+
+    if (this->max_rel_error <= MAX_REL_ERROR)
+    {
+      break;
+    }
+  }
+}
+
+
+FastExp FastExp::of_degree(int degree)
+{
+  FastExp fast_exp;
+  fast_exp.set_degree(std::min(std::max(degree, static_cast<int>(MIN_DEGREE)), static_cast<int>(MAX_DEGREE)));
+  fast_exp.max_rel_error = fast_exp.measure_rel_error(-MAX_ARG, MAX_ARG, 4096);
+  return fast_exp;
+}
+
+
+void FastExp::set_degree(int new_degree)
+{
+  this->degree = new_degree;
+  std::copy(POLYNOMIALS[new_degree - MIN_DEGREE], POLYNOMIALS[new_degree - MIN_DEGREE] + MAX_DEGREE + 1,
+    this->coeffs);
+}
+
+
+/** exp_array() with the degree known at compile time: the Horner loop is unrolled and the loop over the array is
+ *  vectorized.
+ */
+template <int DEGREE>
+static void exp_array_degree(const float* coeffs, const float* src, float scale, float* dst, int length)
+{
+  for (int i = 0; i < length; i++)
+  {
+    float f;
+    const float power = FastExp::split(scale * src[i], f);
+    float p = coeffs[DEGREE];
+    for (int j = DEGREE - 1; j >= 0; j--)
+    {
+      p = p * f + coeffs[j];
+    }
+    dst[i] = p * power;
+  }
+}
+
+
+void FastExp::exp_array(const float* src, float scale, float* dst, int length) const
+{
+  switch (this->degree)
+  {
+    case 2:
+      exp_array_degree<2>(this->coeffs, src, scale, dst, length);
+      break;
+    case 3:
+      exp_array_degree<3>(this->coeffs, src, scale, dst, length);
+      break;
+    case 4:
+      exp_array_degree<4>(this->coeffs, src, scale, dst, length);
+      break;
+    case 5:
+      exp_array_degree<5>(this->coeffs, src, scale, dst, length);
+      break;
+    default:
+      exp_array_degree<MAX_DEGREE>(this->coeffs, src, scale, dst, length);
+      break;
+  }
+}
+
+
+float FastExp::measure_rel_error(float min_arg, float max_arg, int samples) const
+{
+  double max_error = 0.0;
+
+  // Sample within and across the integer parts of x * log2(e), where the polynomial is the least accurate
+  for (int i = 0; i <= samples; i++)
+  {
+    float x = min_arg + (max_arg - min_arg) * static_cast<float>(i) / samples;
+    double truth = exp(static_cast<double>(x));
+    double error = fabs(static_cast<double>((*this)(x)) - truth) / truth;
+    max_error = std::max(max_error, error);
+  }
+
+  return static_cast<float>(max_error);
+}
+
+}  // namespace underwater_color_enhance
@@ -0,0 +1,210 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/FrameCorrection.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+FrameCorrection::FrameCorrection()
+{
+  this->table.set(this->gain, this->offset, this->tone);
+}
+
+
+FrameCorrection::FrameCorrection(const cv::Mat& img, ChannelOrder order, const float* gain, const float* offset,
+  const ToneMap& tone_map, bool LOOKUP_TABLE, const GridSampler& veiling_light_grid,
+  std::shared_ptr<const ColorMatrix> color_matrix) :
+  grid(veiling_light_grid), color(color_matrix)
+{
+  this->order = order;
+
+  // Invalid coefficients (e.g. from a color chart that does not fit the model) never reach the image
+  this->valid_coefficients = FrameMetrics::check_coefficients(gain, offset);
+  if (this->valid_coefficients)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      this->gain[c] = gain[c];
+      this->offset[c] = offset[c];
+    }
+  }
+  else
+  {
+    this->color.reset();  // Passed through as it is
+  }
+
+  // Tone curve from a sparse sample corrected in float, without clipping (and with the mean veiling light)
+  // The sample goes through the color matrix, the tone curve comes before the gamma encoding
+  if (tone_map.needs_sample())
+  {
+    ColorMatrix linear = this->color ? this->color->linear() : ColorMatrix();
+    cv::Mat corrected_sample;
+    dispatch_kernel<AffineKernel>(CV_32FC3, order, ToneMap::sample(img), corrected_sample, this->gain,
+      this->offset, ToneCurve(), static_cast<FrameMetrics*>(0), this->color ? &linear : 0);
+    this->tone = tone_map.curve(corrected_sample, img.depth());
+  }
+
+  this->lookup_table = LOOKUP_TABLE && img.type() == CV_8UC3 && this->grid.empty() && !this->color &&
+    this->table.set(this->gain, this->offset, this->tone);
+}
+
+
+void FrameCorrection::apply(const cv::Mat& src, cv::Mat& dst, FrameMetrics* metrics) const
+{
+  cv::Point origin;
+  if (!this->grid.empty() && src.size() != this->grid.frame_size)
+  {
+    cv::Size frame_size;
+    src.locateROI(frame_size, origin);
+    if (frame_size != this->grid.frame_size)
+    {
+      CV_Error(cv::Error::StsBadSize, "Part of the frame is not a view into it, its origin must be given for the "
+        "veiling light grid");
+    }
+  }
+
+  apply(src, origin, dst, metrics);
+}
+
+
+void FrameCorrection::apply(const cv::Mat& src, cv::Point origin, cv::Mat& dst, FrameMetrics* metrics) const
+{
+  if (metrics)
+  {
+    metrics->set_coefficients(this->gain, this->offset, this->valid_coefficients);
+  }
+
+  if (!this->grid.empty())
+  {
+    const cv::Rect part(origin, src.size());
+    CV_Assert((part & cv::Rect(cv::Point(0, 0), this->grid.frame_size)) == part);
+
+    dispatch_kernel<GridAffineKernel>(src.type(), this->order, src, dst, this->gain, this->offset, this->tone,
+      this->grid, origin, metrics, this->color.get());
+  }
+  else if (this->lookup_table && src.type() == CV_8UC3)
+  {
+    if (this->order == BGR)
+    {
+      TableAffineKernel<BGR>::run(src, dst, this->table, metrics);
+    }
+    else
+    {
+      TableAffineKernel<RGB>::run(src, dst, this->table, metrics);
+    }
+  }
+  else
+  {
+    dispatch_kernel<AffineKernel>(src.type(), this->order, src, dst, this->gain, this->offset, this->tone, metrics,
+      this->color.get());
+  }
+}
+
+
+cv::Mat FrameCorrection::apply(const cv::Mat& src, FrameMetrics* metrics) const
+{
+  cv::Mat dst;
+  apply(src, dst, metrics);
+
+  return dst;
+}
+
+
+std::vector<cv::Mat> FrameCorrection::apply(const cv::Mat& img, const std::vector<cv::Rect>& regions) const
+{
+  const cv::Rect frame(0, 0, img.cols, img.rows);
+
+  std::vector<cv::Mat> corrected_regions(regions.size());
+  for (size_t i = 0; i < regions.size(); i++)
+  {
+    cv::Rect region = regions[i] & frame;
+    if (region.area() > 0)
+    {
+      apply(img(region), region.tl(), corrected_regions[i]);
+    }
+  }
+
+  return corrected_regions;
+}
+
+
+cv::Mat FrameCorrection::apply_mask(const cv::Mat& img, const cv::Mat& mask) const
+{
+  CV_Assert(mask.type() == CV_8UC1 && mask.size() == img.size());
+
+  cv::Mat corrected_img = img.clone();
+  for (int row = 0; row < img.rows; row++)
+  {
+    // Runs of masked pixels in the row, each corrected in place
+    const uchar* m = mask.ptr<uchar>(row);
+    int col = 0;
+    while (col < img.cols)
+    {
+      while (col < img.cols && m[col] == 0)
+      {
+        col++;
+      }
+      int start = col;
+      while (col < img.cols && m[col] != 0)
+      {
+        col++;
+      }
+
+      if (col > start)
+      {
+        cv::Rect run(start, row, col - start, 1);
+        cv::Mat corrected_run = corrected_img(run);
+        apply(img(run), run.tl(), corrected_run);
+      }
+    }
+  }
+
+  return corrected_img;
+}
+
+
+TileIterator::TileIterator(const cv::Mat& img, const FrameCorrection& correction, cv::Size tile_size) :
+  img(img), correction(correction), position(0, 0)
+{
+  this->tile_size = cv::Size(std::max(1, tile_size.width), std::max(1, tile_size.height));
+}
+
+
+bool TileIterator::next(cv::Rect& tile, cv::Mat& corrected_tile)
+{
+  if (this->position.y >= this->img.rows || this->img.cols <= 0)
+  {
+    return false;
+  }
+
+  tile = cv::Rect(this->position, this->tile_size) & cv::Rect(0, 0, this->img.cols, this->img.rows);
+  this->correction.apply(this->img(tile), tile.tl(), corrected_tile);
+
+  this->position.x += this->tile_size.width;
+  if (this->position.x >= this->img.cols)
+  {
+    this->position.x = 0;
+    this->position.y += this->tile_size.height;
+  }
+
+  return true;
+}
+
+
+int TileIterator::size() const
+{
+  int tiles_x = (this->img.cols + this->tile_size.width - 1) / this->tile_size.width;
+  int tiles_y = (this->img.rows + this->tile_size.height - 1) / this->tile_size.height;
+
+  return tiles_x * tiles_y;
+}
+
+}  // namespace underwater_color_enhance
@@ -0,0 +1,166 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/FrameMetrics.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <string>
+
+namespace underwater_color_enhance
+{
+
+/** Channel names in BGR order, for the health messages.
+ */
+static const char* CHANNEL_NAMES[3] = {"blue", "green", "red"};
+
+
+FrameMetrics::FrameMetrics()
+{
+  std::fill(&this->histogram[0][0], &this->histogram[0][0] + 3 * BINS, 0);
+  std::fill(this->luminance_histogram, this->luminance_histogram + LUMINANCE_BINS, 0);
+}
+
+
+void FrameMetrics::set_coefficients(const float* gain, const float* offset, bool valid)
+{
+  this->coefficients_set = true;
+  for (int c = 0; c < 3; c++)
+  {
+    this->gain[c] = gain[c];
+    this->offset[c] = offset[c];
+  }
+
+  if (!valid)
+  {
+    this->valid_coefficients = false;
+    this->error = "Correction coefficients are not finite or gains are not positive, frame passed through";
+  }
+}
+
+
+void FrameMetrics::set_attenuation(const float* backscatter_att, const float* direct_signal_att)
+{
+  this->attenuation_set = true;
+  for (int c = 0; c < 3; c++)
+  {
+    this->backscatter_att[c] = backscatter_att[c];
+    this->direct_signal_att[c] = direct_signal_att[c];
+  }
+
+  for (int c = 0; c < 3; c++)
+  {
+    if (!std::isfinite(backscatter_att[c]) || !std::isfinite(direct_signal_att[c]))
+    {
+      // e.g. log of a non-positive backscatter ratio: the color chart does not fit the veiling light
+      this->valid_coefficients = false;
+      this->valid_attenuation = false;
+      this->error = std::string("Attenuation of the ") + CHANNEL_NAMES[c] + " channel is not finite, " +
+        "frame passed through";
+      return;
+    }
+    if (backscatter_att[c] <= 0.0f || direct_signal_att[c] <= 0.0f)
+    {
+      this->valid_attenuation = false;
+      this->error = std::string("Attenuation of the ") + CHANNEL_NAMES[c] + " channel is not positive";
+    }
+  }
+}
+
+
+bool FrameMetrics::check_coefficients(const float* gain, const float* offset)
+{
+  for (int c = 0; c < 3; c++)
+  {
+    if (!(gain[c] > 0.0f && gain[c] < FLT_MAX) || !std::isfinite(offset[c]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+double FrameMetrics::mean(int c) const
+{
+  return this->pixels > 0 ? this->sum[c] / this->pixels : 0.0;
+}
+
+
+double FrameMetrics::stddev(int c) const
+{
+  if (this->pixels == 0)
+  {
+    return 0.0;
+  }
+
+  double mean_value = mean(c);
+  return std::sqrt(std::max(0.0, this->sum_sq[c] / this->pixels - mean_value * mean_value));
+}
+
+
+double FrameMetrics::clipped_low_fraction(int c) const
+{
+  return this->pixels > 0 ? static_cast<double>(this->clipped_low[c]) / this->pixels : 0.0;
+}
+
+
+double FrameMetrics::clipped_high_fraction(int c) const
+{
+  return this->pixels > 0 ? static_cast<double>(this->clipped_high[c]) / this->pixels : 0.0;
+}
+
+
+double FrameMetrics::chroma_stddev() const
+{
+  if (this->pixels == 0)
+  {
+    return 0.0;
+  }
+
+  double mean_chroma = this->chroma_sum / this->pixels;
+  return std::sqrt(std::max(0.0, this->chroma_sq_sum / this->pixels - mean_chroma * mean_chroma));
+}
+
+
+double FrameMetrics::luminance_contrast() const
+{
+  return luminance_percentile(0.99) - luminance_percentile(0.01);
+}
+
+
+double FrameMetrics::mean_saturation() const
+{
+  return this->pixels > 0 ? this->saturation_sum / this->pixels : 0.0;
+}
+
+
+double FrameMetrics::quality() const
+{
+  return 0.4680 * chroma_stddev() / 255.0 + 0.2745 * luminance_contrast() / 255.0 + 0.2576 * mean_saturation();
+}
+
+
+double FrameMetrics::luminance_percentile(double fraction) const
+{
+  const double target = fraction * this->pixels;
+  double count = 0.0;
+  for (int i = 0; i < LUMINANCE_BINS; i++)
+  {
+    count += this->luminance_histogram[i];
+    if (count >= target && count > 0.0)
+    {
+      return i * 256.0 / LUMINANCE_BINS;
+    }
+  }
+
+  return 0.0;
+}
+
+}  // namespace underwater_color_enhance
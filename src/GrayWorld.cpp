@@ -0,0 +1,61 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/GrayWorld.h"
+#include "underwater_color_enhance/MethodRegistry.h"
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+
+namespace underwater_color_enhance
+{
+
+REGISTER_METHOD(1, "gray_world", GrayWorld)
+
+
+cv::Mat GrayWorld::color_correct(const cv::Mat& img, float depth, FrameMetrics* metrics)
+{
+  FrameContext context;
+  if (this->CHECK_TIME)
+  {
+    context.begin = clock();
+  }
+
+  cv::Mat corrected_img = prepare_frame(img, depth).apply(img, metrics);
+
+  if (this->CHECK_TIME)
+  {
+    context.end = clock();
+    std::cout << "LOG: Gray world enhancment complete. Time: " <<
+      static_cast<double>(context.end - context.begin) / CLOCKS_PER_SEC << std::endl;
+  }
+  else if (this->LOG_SCREEN)
+  {
+    std::cout << "LOG: Gray world enhancment complete" << std::endl;
+  }
+
+  return corrected_img;
+}
+
+
+FrameCorrection GrayWorld::prepare_frame(const cv::Mat& img, float depth)
+{
+  // Channel order does not matter, every channel is scaled to the same gray level
+  cv::Scalar channel_mean = mean(img);
+  float gray = (channel_mean[0] + channel_mean[1] + channel_mean[2]) / 3.0;
+
+  float gain [3];
+  float offset [3] = {0.0, 0.0, 0.0};
+  for (int i = 0; i < 3; i++)
+  {
+    gain[i] = channel_mean[i] > 0.0 ? gray / channel_mean[i] : 1.0;
+  }
+
+  return FrameCorrection(img, BGR, gain, offset, this->tone_map, this->LOOKUP_TABLE);
+}
+
+}  // namespace underwater_color_enhance
@@ -14,47 +14,214 @@
 namespace underwater_color_enhance
 {
 
-ImageHandler::ImageHandler(underwater_color_enhance::ColorCorrect correction_method,
-  bool SLAM_INPUT, bool SAVE_DATA, bool SHOW_IMAGE, bool CHECK_TIME, std::string CAMERA_TOPIC, std::string DEPTH_TOPIC)
+ImageHandler::ImageHandler(underwater_color_enhance::ColorCorrect correction_method, bool SLAM_INPUT,
+  bool DEPTH_MAP_INPUT, bool SAVE_DATA, bool CHECK_TIME, std::string CAMERA_TOPIC,
+  std::string DEPTH_TOPIC, std::string DEPTH_MAP_TOPIC, std::string OUTPUT_TOPIC, StreamScheduler* scheduler,
+  std::string INPUT_TRANSPORT, std::string OUTPUT_FORMAT, int OUTPUT_JPEG_QUALITY) : it_(nh_)
 {
   this->correction_method = correction_method;
   this->SAVE_DATA = SAVE_DATA;
-  this->SHOW_IMAGE = SHOW_IMAGE;
   this->CHECK_TIME = CHECK_TIME;
 
-  this->img_pub_ = nh_.advertise<sensor_msgs::Image>("/image_enhancement/output_image", 1);
+  this->scheduler = scheduler;
+  if (this->scheduler)
+  {
+    this->stream_id = this->scheduler->add_stream();
+  }
+
+  // Settings of the compressed transport, read when the output topic is advertised
+  nh_.setParam(OUTPUT_TOPIC + "/compressed/format", OUTPUT_FORMAT);
+  nh_.setParam(OUTPUT_TOPIC + "/compressed/jpeg_quality", OUTPUT_JPEG_QUALITY);
+  this->img_pub_ = it_.advertise(OUTPUT_TOPIC, 1);
 
-  this->img_sub_.subscribe(nh_, CAMERA_TOPIC, 1);
-  this->depth_sub_.subscribe(nh_, DEPTH_TOPIC, 1);
+  // Depth measurements only feed the history, images never wait for them
+  this->depth_sub_ = nh_.subscribe(DEPTH_TOPIC, 10, &ImageHandler::depth_callback, this);
 
-  if (!SLAM_INPUT)  // No ORB-SLAM features utilized
+  if (!SLAM_INPUT && !DEPTH_MAP_INPUT && INPUT_TRANSPORT == "compressed")  // Decoded with the frame
   {
-    this->sync.reset(new Sync(SyncPolicy(2), this->img_sub_, this->depth_sub_));
-    this->sync->registerCallback(boost::bind(&ImageHandler::camera_depth_callback, this, _1, _2));
+    this->camera_compressed_sub_ = nh_.subscribe(CAMERA_TOPIC + "/compressed", 1,
+      &ImageHandler::camera_compressed_callback, this);
+  }
+  else if (!SLAM_INPUT && !DEPTH_MAP_INPUT)  // No ORB-SLAM features or depth maps utilized
+  {
+    this->camera_sub_ = it_.subscribe(CAMERA_TOPIC, 1, &ImageHandler::camera_callback, this,
+      image_transport::TransportHints(INPUT_TRANSPORT));
+  }
+  else if (!SLAM_INPUT)  // Dense depth maps utilized
+  {
+    this->img_sub_.subscribe(it_, CAMERA_TOPIC, 1, image_transport::TransportHints(INPUT_TRANSPORT));
+    this->depth_map_sub_.subscribe(nh_, DEPTH_MAP_TOPIC, 1);
+    this->sync_depth_map.reset(new SyncDepthMap(SyncPolicyDepthMap(2), this->img_sub_, this->depth_map_sub_));
+    this->sync_depth_map->registerCallback(boost::bind(&ImageHandler::camera_depth_map_callback, this, _1, _2));
   }
   else  // ORB-SLAM features utilized
   {
     // TO DO: make this rostopic name string to be retrieved from yaml file
+    this->img_sub_.subscribe(it_, CAMERA_TOPIC, 1, image_transport::TransportHints(INPUT_TRANSPORT));
     this->orb_slam2_sub_.subscribe(nh_, "/orb_slam2/escalibr_data", 1);
-    this->sync_slam.reset(new SyncSLAM(SyncPolicySLAM(20), this->img_sub_, this->depth_sub_, this->orb_slam2_sub_));
-    this->sync_slam->registerCallback(boost::bind(&ImageHandler::camera_depth_slam_callback, this, _1, _2, _3));
+    this->sync_slam.reset(new SyncSLAM(SyncPolicySLAM(20), this->img_sub_, this->orb_slam2_sub_));
+    this->sync_slam->registerCallback(boost::bind(&ImageHandler::camera_slam_callback, this, _1, _2));
+  }
+}
+
+
+void ImageHandler::set_max_depth_extrapolation(double MAX_DEPTH_EXTRAPOLATION)
+{
+  this->depth_history.set_max_extrapolation(MAX_DEPTH_EXTRAPOLATION);
+}
+
+
+void ImageHandler::enable_preview(std::string PREVIEW_TOPIC, double PREVIEW_RATE, int PREVIEW_WIDTH)
+{
+  this->preview.reset(new PreviewPublisher(this->nh_, PREVIEW_TOPIC, PREVIEW_RATE, PREVIEW_WIDTH,
+    this->correction_method.get_channel_order()));
+}
+
+
+void ImageHandler::enable_metrics(std::string METRICS_TOPIC, double METRICS_RATE, double MAX_CLIPPED_FRACTION,
+  std::string name)
+{
+  this->metrics_publisher.reset(new MetricsPublisher(this->nh_, METRICS_TOPIC, METRICS_RATE, MAX_CLIPPED_FRACTION,
+    name));
+}
+
+
+FrameMetrics* ImageHandler::frame_metrics(FrameMetrics& metrics)
+{
+  return this->metrics_publisher && this->metrics_publisher->due() ? &metrics : 0;
+}
+
+
+void ImageHandler::depth_callback(const mavros_msgs::VFR_HUD::ConstPtr& depth_msg)
+{
+  this->depth_history.add(depth_msg->header.stamp.toSec(), depth_msg->altitude);
+}
+
+
+float ImageHandler::frame_depth(const ros::Time& stamp)
+{
+  float depth;
+  if (!this->depth_history.get_depth(stamp.toSec(), depth))
+  {
+    ROS_WARN_THROTTLE(1.0, "No depth measurement received yet, using the initial depth");
+    depth = this->correction_method.get_depth();
+  }
+
+  return depth;
+}
+
+
+cv_bridge::CvImagePtr ImageHandler::convert_image(const sensor_msgs::ImageConstPtr& img_msg,
+  ChannelOrder CHANNEL_ORDER)
+{
+  namespace enc = sensor_msgs::image_encodings;
+  bool rgb = CHANNEL_ORDER == RGB;
+
+  // 16-bit and float images keep their precision, the kernels are specialized for each pixel type.
+  // 16-bit Bayer (RAW) and mono images are demosaiced/expanded by cv_bridge to 16-bit color.
+  std::string encoding;
+  bool raw_16bit = (enc::isBayer(img_msg->encoding) || enc::isMono(img_msg->encoding)) &&
+    enc::bitDepth(img_msg->encoding) == 16;
+  if (img_msg->encoding == enc::TYPE_32FC3)
+  {
+    encoding = enc::TYPE_32FC3;
+  }
+  else if (img_msg->encoding == enc::BGR16 || img_msg->encoding == enc::RGB16 || img_msg->encoding == enc::TYPE_16UC3 ||
+    raw_16bit)
+  {
+    encoding = rgb ? enc::RGB16 : enc::BGR16;
+  }
+  else
+  {
+    encoding = rgb ? enc::RGB8 : enc::BGR8;
+  }
+
+  return cv_bridge::toCvCopy(img_msg, encoding);
+}
+
+
+cv_bridge::CvImagePtr ImageHandler::decode_image(const sensor_msgs::CompressedImageConstPtr& img_msg,
+  ChannelOrder CHANNEL_ORDER)
+{
+  namespace enc = sensor_msgs::image_encodings;
+  bool rgb = CHANNEL_ORDER == RGB;
+
+  // Decoded color images are in BGR order
+  cv::Mat image = cv::imdecode(img_msg->data, cv::IMREAD_COLOR | cv::IMREAD_ANYDEPTH);
+  if (image.empty())
+  {
+    throw cv_bridge::Exception("Could not decode image of format " + img_msg->format);
+  }
+
+  if (rgb)
+  {
+    cv::cvtColor(image, image, cv::COLOR_BGR2RGB);
+  }
+
+  std::string encoding;
+  if (image.depth() == CV_16U)
+  {
+    encoding = rgb ? enc::RGB16 : enc::BGR16;
+  }
+  else
+  {
+    encoding = rgb ? enc::RGB8 : enc::BGR8;
+  }
+
+  return cv_bridge::CvImagePtr(new cv_bridge::CvImage(img_msg->header, encoding, image));
+}
+
+
+void ImageHandler::publish_frame(const cv_bridge::CvImagePtr& cv_ptr, const cv::Mat& corrected_frame,
+  const FrameMetrics* metrics, float depth)
+{
+  if (metrics)
+  {
+    this->metrics_publisher->publish(*metrics, cv_ptr->header.stamp, depth);
+  }
+
+  if (this->preview)
+  {
+    this->preview->submit(cv_ptr->image, corrected_frame, cv_ptr->header.stamp, cv_ptr->header.frame_id);
+  }
+
+  if (ros::ok() && this->img_pub_.getNumSubscribers() > 0)
+  {
+    cv_bridge::CvImage corrected_img(cv_ptr->header, cv_ptr->encoding, corrected_frame);
+    this->img_pub_.publish(corrected_img.toImageMsg());
+  }
+}
+
+
+void ImageHandler::camera_callback(const sensor_msgs::ImageConstPtr& img_msg)
+{
+  // Altitude depth measurement at the time of the image
+  float depth = frame_depth(img_msg->header.stamp);
+
+  if (this->scheduler)  // Process on the shared worker pool, the messages are kept alive by the job
+  {
+    this->scheduler->submit(this->stream_id, boost::bind(&ImageHandler::process_camera, this, img_msg, depth));
+  }
+  else
+  {
+    process_camera(img_msg, depth);
   }
 }
 
 
-void ImageHandler::camera_depth_callback(const sensor_msgs::ImageConstPtr& img_msg,
-  const mavros_msgs::VFR_HUD::ConstPtr& depth_msg)
+void ImageHandler::process_camera(const sensor_msgs::ImageConstPtr& img_msg, float depth)
 {
+  std::clock_t begin = 0;
   if (this->CHECK_TIME)
   {
-    this->begin = clock();
+    begin = clock();
   }
 
   // Convert ROS image to CV Mat image
   cv_bridge::CvImagePtr cv_ptr;
   try
   {
-    cv_ptr = cv_bridge::toCvCopy(img_msg, sensor_msgs::image_encodings::BGR8);
+    cv_ptr = convert_image(img_msg, this->correction_method.get_channel_order());
   }
   catch(cv_bridge::Exception& e)
   {
@@ -62,13 +229,57 @@ void ImageHandler::camera_depth_callback(const sensor_msgs::ImageConstPtr& img_m
     return;
   }
 
-  // Altitude depth measurement
-  this->correction_method.set_depth(depth_msg->altitude);
+  enhance_frame(cv_ptr, depth, begin);
+}
+
+
+void ImageHandler::camera_compressed_callback(const sensor_msgs::CompressedImageConstPtr& img_msg)
+{
+  // Altitude depth measurement at the time of the image
+  float depth = frame_depth(img_msg->header.stamp);
+
+  if (this->scheduler)  // Decode and process on the shared worker pool, the message is kept alive by the job
+  {
+    this->scheduler->submit(this->stream_id, boost::bind(&ImageHandler::process_camera_compressed, this, img_msg,
+      depth));
+  }
+  else
+  {
+    process_camera_compressed(img_msg, depth);
+  }
+}
 
+
+void ImageHandler::process_camera_compressed(const sensor_msgs::CompressedImageConstPtr& img_msg, float depth)
+{
+  std::clock_t begin = 0;
+  if (this->CHECK_TIME)
+  {
+    begin = clock();
+  }
+
+  // Decode compressed ROS image to CV Mat image
+  cv_bridge::CvImagePtr cv_ptr;
+  try
+  {
+    cv_ptr = decode_image(img_msg, this->correction_method.get_channel_order());
+  }
+  catch(cv_bridge::Exception& e)
+  {
+    ROS_ERROR("cv_bridge exception: %s", e.what());
+    return;
+  }
+
+  enhance_frame(cv_ptr, depth, begin);
+}
+
+
+void ImageHandler::enhance_frame(const cv_bridge::CvImagePtr& cv_ptr, float depth, std::clock_t begin)
+{
   if (this->correction_method.OPTIMIZE)
   {
     // Calculate optimized attenuation values
-    this->correction_method.optimize(cv_ptr->image);
+    this->correction_method.optimize(cv_ptr->image, depth);
 
     if (this->SAVE_DATA)
     {
@@ -78,13 +289,15 @@ void ImageHandler::camera_depth_callback(const sensor_msgs::ImageConstPtr& img_m
   else
   {
     // Color enhance image
-    cv::Mat corrected_frame = this->correction_method.enhance(cv_ptr->image);
+    FrameMetrics metrics;
+    FrameMetrics* measured = frame_metrics(metrics);
+    cv::Mat corrected_frame = this->correction_method.enhance(cv_ptr->image, depth, measured);
 
     if (this->CHECK_TIME)
     {
-      this->end = clock();
+      std::clock_t end = clock();
       std::cout << "Enhancement complete. Total time: " <<
-        static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+        static_cast<double>(end - begin) / CLOCKS_PER_SEC << std::endl;
     }
 
     if (this->SAVE_DATA)
@@ -92,36 +305,43 @@ void ImageHandler::camera_depth_callback(const sensor_msgs::ImageConstPtr& img_m
       this->correction_method.save_final_data();
     }
 
-    if (this->SHOW_IMAGE)
-    {
-      cv::imshow("Original", cv_ptr->image);
-      cv::imshow("Corrected", corrected_frame);
-      cv::waitKey(1);
-    }
-
-    if (ros::ok())
-    {
-      sensor_msgs::Image new_img;
-      this->img_pub_.publish(new_img);
-    }
+    publish_frame(cv_ptr, corrected_frame, measured, depth);
   }
 }
 
 
-void ImageHandler::camera_depth_slam_callback(const sensor_msgs::ImageConstPtr& img_msg,
-  const mavros_msgs::VFR_HUD::ConstPtr& depth_msg,
+void ImageHandler::camera_slam_callback(const sensor_msgs::ImageConstPtr& img_msg,
   const ORB_SLAM2::Points::ConstPtr& orb_slam2_msg)
 {
+  // Altitude depth measurement at the time of the image
+  float depth = frame_depth(img_msg->header.stamp);
+
+  if (this->scheduler)  // Process on the shared worker pool, the messages are kept alive by the job
+  {
+    this->scheduler->submit(this->stream_id, boost::bind(&ImageHandler::process_camera_slam, this, img_msg,
+      orb_slam2_msg, depth));
+  }
+  else
+  {
+    process_camera_slam(img_msg, orb_slam2_msg, depth);
+  }
+}
+
+
+void ImageHandler::process_camera_slam(const sensor_msgs::ImageConstPtr& img_msg,
+  const ORB_SLAM2::Points::ConstPtr& orb_slam2_msg, float depth)
+{
+  std::clock_t begin = 0;
   if (this->CHECK_TIME)
   {
-    this->begin = clock();
+    begin = clock();
   }
 
   // Convert ROS image to CV Mat image
   cv_bridge::CvImagePtr cv_ptr;
   try
   {
-    cv_ptr = cv_bridge::toCvCopy(img_msg, sensor_msgs::image_encodings::BGR8);
+    cv_ptr = convert_image(img_msg, this->correction_method.get_channel_order());
   }
   catch(cv_bridge::Exception& e)
   {
@@ -129,25 +349,23 @@ void ImageHandler::camera_depth_slam_callback(const sensor_msgs::ImageConstPtr&
     return;
   }
 
-  // Altitude depth measurement
-  this->correction_method.set_depth(depth_msg->altitude);
-
-  // ORB-SLAM features
-  std::vector<cv::Point2f> point_data;
-  std::vector<float> distance_data;
-  for (size_t i = 0; i < sizeof(orb_slam2_msg->points); i++)
+  // ORB-SLAM features, viewed in place in the message
+  if (orb_slam2_msg->points.size() != orb_slam2_msg->distances.size())
   {
-    point_data.push_back(cv::Point2f(orb_slam2_msg->points[i].x, orb_slam2_msg->points[i].y));
-    distance_data.push_back(orb_slam2_msg->distances[i]);
+    ROS_WARN_THROTTLE(1.0, "ORB-SLAM message has %zu points and %zu distances, using the common prefix",
+      orb_slam2_msg->points.size(), orb_slam2_msg->distances.size());
   }
+  KeypointSpan keypoints(orb_slam2_msg->points, orb_slam2_msg->distances);
 
   // Color enhance image
-  cv::Mat corrected_frame = this->correction_method.enhance_slam(cv_ptr->image, point_data, distance_data);
+  FrameMetrics metrics;
+  FrameMetrics* measured = frame_metrics(metrics);
+  cv::Mat corrected_frame = this->correction_method.enhance_slam(cv_ptr->image, keypoints, depth, measured);
 
   if (this->CHECK_TIME)
   {
-    this->end = clock();
-    std::cout << "Enhancement complete. Total time: " << double(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+    std::clock_t end = clock();
+    std::cout << "Enhancement complete. Total time: " << double(end - begin) / CLOCKS_PER_SEC << std::endl;
   }
 
   if (this->SAVE_DATA)
@@ -155,18 +373,76 @@ void ImageHandler::camera_depth_slam_callback(const sensor_msgs::ImageConstPtr&
     this->correction_method.save_final_data();
   }
 
-  if (this->SHOW_IMAGE)
+  publish_frame(cv_ptr, corrected_frame, measured, depth);
+}
+
+
+void ImageHandler::camera_depth_map_callback(const sensor_msgs::ImageConstPtr& img_msg,
+  const sensor_msgs::ImageConstPtr& depth_map_msg)
+{
+  // Altitude depth measurement at the time of the image
+  float depth = frame_depth(img_msg->header.stamp);
+
+  if (this->scheduler)  // Process on the shared worker pool, the messages are kept alive by the job
+  {
+    this->scheduler->submit(this->stream_id, boost::bind(&ImageHandler::process_camera_depth_map, this, img_msg,
+      depth_map_msg, depth));
+  }
+  else
+  {
+    process_camera_depth_map(img_msg, depth_map_msg, depth);
+  }
+}
+
+
+void ImageHandler::process_camera_depth_map(const sensor_msgs::ImageConstPtr& img_msg,
+  const sensor_msgs::ImageConstPtr& depth_map_msg, float depth)
+{
+  std::clock_t begin = 0;
+  if (this->CHECK_TIME)
+  {
+    begin = clock();
+  }
+
+  // Convert ROS image to CV Mat image, the depth map is shared with the message (no copy)
+  cv_bridge::CvImagePtr cv_ptr;
+  cv_bridge::CvImageConstPtr depth_map_ptr;
+  try
   {
-    cv::imshow("Original", cv_ptr->image);
-    cv::imshow("Corrected", corrected_frame);
-    cv::waitKey(1);
+    cv_ptr = convert_image(img_msg, this->correction_method.get_channel_order());
+    depth_map_ptr = cv_bridge::toCvShare(depth_map_msg);
+  }
+  catch(cv_bridge::Exception& e)
+  {
+    ROS_ERROR("cv_bridge exception: %s", e.what());
+    return;
   }
 
-  if (ros::ok())
+  if (depth_map_ptr->image.type() != CV_16UC1 && depth_map_ptr->image.type() != CV_32FC1)
   {
-    sensor_msgs::Image new_img;
-    this->img_pub_.publish(new_img);
+    ROS_ERROR("Unsupported depth map encoding: %s", depth_map_msg->encoding.c_str());
+    return;
   }
+
+  // Color enhance image
+  FrameMetrics metrics;
+  FrameMetrics* measured = frame_metrics(metrics);
+  cv::Mat corrected_frame = this->correction_method.enhance_depth(cv_ptr->image, depth_map_ptr->image, depth,
+    measured);
+
+  if (this->CHECK_TIME)
+  {
+    std::clock_t end = clock();
+    std::cout << "Enhancement complete. Total time: " <<
+      static_cast<double>(end - begin) / CLOCKS_PER_SEC << std::endl;
+  }
+
+  if (this->SAVE_DATA)
+  {
+    this->correction_method.save_final_data();
+  }
+
+  publish_frame(cv_ptr, corrected_frame, measured, depth);
 }
 
 }  // namespace underwater_color_enhance
@@ -0,0 +1,90 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/MethodRegistry.h"
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+std::map<int, MethodRegistry::Entry>& MethodRegistry::entries()
+{
+  static std::map<int, Entry> registered_methods;
+  return registered_methods;
+}
+
+
+bool MethodRegistry::register_method(int METHOD_ID, std::string name, Factory factory)
+{
+  std::map<int, Entry>& methods = entries();
+  for (std::map<int, Entry>::const_iterator it = methods.begin(); it != methods.end(); ++it)
+  {
+    if (it->first == METHOD_ID || it->second.name == name)
+    {
+      std::cout << "ERROR: Color enhancement method " << METHOD_ID << " (" << name << ") is already registered." <<
+        std::endl;
+      return false;
+    }
+  }
+
+  Entry entry = {name, factory};
+  methods[METHOD_ID] = entry;
+  return true;
+}
+
+
+Method* MethodRegistry::create(int METHOD_ID)
+{
+  std::map<int, Entry>::const_iterator it = entries().find(METHOD_ID);
+  if (it == entries().end())
+  {
+    return 0;
+  }
+
+  return it->second.factory();
+}
+
+
+Method* MethodRegistry::create(std::string name)
+{
+  std::map<int, Entry>& methods = entries();
+  for (std::map<int, Entry>::const_iterator it = methods.begin(); it != methods.end(); ++it)
+  {
+    if (it->second.name == name)
+    {
+      return it->second.factory();
+    }
+  }
+
+  return 0;
+}
+
+
+std::string MethodRegistry::get_name(int METHOD_ID)
+{
+  std::map<int, Entry>::const_iterator it = entries().find(METHOD_ID);
+  return it == entries().end() ? std::string() : it->second.name;
+}
+
+
+std::vector<int> MethodRegistry::get_ids()
+{
+  std::vector<int> ids;
+  std::map<int, Entry>& methods = entries();
+  for (std::map<int, Entry>::const_iterator it = methods.begin(); it != methods.end(); ++it)
+  {
+    ids.push_back(it->first);
+  }
+
+  return ids;
+}
+
+}  // namespace underwater_color_enhance
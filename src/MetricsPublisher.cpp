@@ -0,0 +1,150 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/MetricsPublisher.h"
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+#include <diagnostic_msgs/KeyValue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+namespace underwater_color_enhance
+{
+
+/** Channel suffixes in BGR order.
+ */
+static const char* CHANNELS[3] = {"_b", "_g", "_r"};
+
+
+static void add_value(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, double value)
+{
+  diagnostic_msgs::KeyValue key_value;
+  key_value.key = key;
+  std::ostringstream stream;
+  stream << value;
+  key_value.value = stream.str();
+  status.values.push_back(key_value);
+}
+
+
+MetricsPublisher::MetricsPublisher(ros::NodeHandle& nh, std::string METRICS_TOPIC, double METRICS_RATE,
+  double MAX_CLIPPED_FRACTION, std::string name)
+{
+  this->METRICS_RATE = METRICS_RATE;
+  this->MAX_CLIPPED_FRACTION = MAX_CLIPPED_FRACTION;
+  this->name = name;
+  this->next_metrics = std::chrono::steady_clock::now();
+
+  this->metrics_pub_ = nh.advertise<diagnostic_msgs::DiagnosticArray>(METRICS_TOPIC, 1);
+}
+
+
+bool MetricsPublisher::due()
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (now < this->next_metrics)
+  {
+    return false;
+  }
+
+  this->next_metrics = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(1.0 / this->METRICS_RATE));
+  return true;
+}
+
+
+void MetricsPublisher::publish(const FrameMetrics& metrics, const ros::Time& stamp, float depth)
+{
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = "underwater_color_enhance: " + this->name;
+  status.hardware_id = this->name;
+
+  double max_clipped = 0.0;
+  for (int c = 0; c < 3; c++)
+  {
+    max_clipped = std::max(max_clipped, metrics.clipped_low_fraction(c) + metrics.clipped_high_fraction(c));
+  }
+
+  if (!metrics.coefficients_valid())
+  {
+    status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+    status.message = metrics.get_error();
+  }
+  else if (!metrics.attenuation_valid())
+  {
+    status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    status.message = metrics.get_error();
+  }
+  else if (max_clipped > this->MAX_CLIPPED_FRACTION)
+  {
+    status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    status.message = "Corrected channels are clipped";
+  }
+  else
+  {
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = "OK";
+  }
+
+  add_value(status, "depth", depth);
+  add_value(status, "quality", metrics.quality());
+  add_value(status, "chroma_stddev", metrics.chroma_stddev());
+  add_value(status, "luminance_contrast", metrics.luminance_contrast());
+  add_value(status, "mean_saturation", metrics.mean_saturation());
+  for (int c = 0; c < 3; c++)
+  {
+    add_value(status, std::string("mean") + CHANNELS[c], metrics.mean(c));
+    add_value(status, std::string("stddev") + CHANNELS[c], metrics.stddev(c));
+    add_value(status, std::string("clipped_low") + CHANNELS[c], metrics.clipped_low_fraction(c));
+    add_value(status, std::string("clipped_high") + CHANNELS[c], metrics.clipped_high_fraction(c));
+  }
+  if (metrics.has_coefficients())
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      add_value(status, std::string("gain") + CHANNELS[c], metrics.gain[c]);
+      add_value(status, std::string("offset") + CHANNELS[c], metrics.offset[c]);
+    }
+  }
+  if (metrics.has_attenuation())
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      add_value(status, std::string("backscatter_att") + CHANNELS[c], metrics.backscatter_att[c]);
+      add_value(status, std::string("direct_signal_att") + CHANNELS[c], metrics.direct_signal_att[c]);
+    }
+  }
+
+  // Histograms as comma separated counts of FrameMetrics::BINS bins over [0, 256)
+  for (int c = 0; c < 3; c++)
+  {
+    const uint32_t* histogram = metrics.get_histogram(c);
+    std::ostringstream stream;
+    for (int i = 0; i < FrameMetrics::BINS; i++)
+    {
+      stream << (i > 0 ? "," : "") << histogram[i];
+    }
+    diagnostic_msgs::KeyValue key_value;
+    key_value.key = std::string("histogram") + CHANNELS[c];
+    key_value.value = stream.str();
+    status.values.push_back(key_value);
+  }
+
+  diagnostic_msgs::DiagnosticArray diagnostics;
+  diagnostics.header.stamp = stamp;
+  diagnostics.status.push_back(status);
+  this->metrics_pub_.publish(diagnostics);
+}
+
+}  // namespace underwater_color_enhance
@@ -0,0 +1,292 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/ModelBundle.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace underwater_color_enhance
+{
+
+constexpr float ModelBundle::DEPTH_STEP;
+
+static const char MAGIC [8] = {'U', 'C', 'E', 'M', 'O', 'D', 'E', 'L'};
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+
+ModelBundle::~ModelBundle()
+{
+  if (this->mapping)
+  {
+    munmap(this->mapping, this->size);
+  }
+}
+
+
+size_t ModelBundle::file_size(const Header& header)
+{
+  size_t n = header.num_wavelengths;
+  return sizeof(Header) + n * sizeof(int32_t) + (3 * n + 4 * n + 3 * header.num_depths + 7 * header.num_prior +
+    6 * header.num_knots) * sizeof(float);
+}
+
+
+std::shared_ptr<const ModelBundle> ModelBundle::open(const std::string& FILENAME)
+{
+  int fd = ::open(FILENAME.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    std::cout << "ERROR: Could not open model bundle " << FILENAME << "." << std::endl;
+    return std::shared_ptr<const ModelBundle>();
+  }
+
+  struct stat info;
+  void* mapping = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(Header))
+  {
+    mapping = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);  // The mapping keeps the file
+  if (mapping == MAP_FAILED)
+  {
+    std::cout << "ERROR: Could not map model bundle " << FILENAME << "." << std::endl;
+    return std::shared_ptr<const ModelBundle>();
+  }
+
+  std::shared_ptr<ModelBundle> bundle(new ModelBundle());
+  bundle->mapping = mapping;
+  bundle->size = info.st_size;
+  madvise(mapping, bundle->size, MADV_WILLNEED);
+
+  const Header* header = static_cast<const Header*>(mapping);
+  if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION ||
+    header->byte_order != BYTE_ORDER_MARK)
+  {
+    std::cout << "ERROR: " << FILENAME << " is not a model bundle of version " << VERSION <<
+      " and of this byte order." << std::endl;
+    return std::shared_ptr<const ModelBundle>();
+  }
+  if (file_size(*header) != bundle->size)
+  {
+    std::cout << "ERROR: Model bundle " << FILENAME << " is truncated." << std::endl;
+    return std::shared_ptr<const ModelBundle>();
+  }
+
+  size_t n = header->num_wavelengths;
+  bundle->header = header;
+  bundle->wavelengths = reinterpret_cast<const int32_t*>(header + 1);
+  bundle->camera_response = reinterpret_cast<const float*>(bundle->wavelengths + n);
+  bundle->water = bundle->camera_response + 3 * n;
+  bundle->veiling_light = bundle->water + 4 * n;
+  bundle->prior = bundle->veiling_light + 3 * header->num_depths;
+  bundle->knots = bundle->prior + 7 * header->num_prior;
+  bundle->camera = std::string(header->camera, strnlen(header->camera, sizeof(header->camera)));
+  bundle->water_type = std::string(header->water_type, strnlen(header->water_type, sizeof(header->water_type)));
+
+  return bundle;
+}
+
+
+bool ModelBundle::is_bundle(const std::string& FILENAME)
+{
+  char magic [sizeof(MAGIC)];
+  std::ifstream file(FILENAME, std::ios::binary);
+  return file.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+
+bool ModelBundle::write(const std::string& FILENAME, const Scene& scene, const std::string& CAMERA,
+  const std::string& WATER_TYPE, const std::map<float, std::vector<double>>& prior_data,
+  const AttenuationCurves& prior_curves, float MAX_DEPTH)
+{
+  size_t n = scene.get_num_response();
+  if (n == 0 || !scene.water || scene.water->K_d.size() != n || scene.WAVELENGTHS.size() != n)
+  {
+    std::cout << "ERROR: Camera response and water properties must be loaded for the same wavelengths." <<
+      std::endl;
+    return false;
+  }
+  if (CAMERA.size() >= sizeof(Header::camera) || WATER_TYPE.size() >= sizeof(Header::water_type))
+  {
+    std::cout << "ERROR: Camera or water type name is too long for a model bundle." << std::endl;
+    return false;
+  }
+
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  std::strncpy(header.camera, CAMERA.c_str(), sizeof(header.camera) - 1);
+  std::strncpy(header.water_type, WATER_TYPE.c_str(), sizeof(header.water_type) - 1);
+  header.k = scene.K;
+  header.num_wavelengths = n;
+  header.num_depths = static_cast<uint32_t>(std::max(0.0f, MAX_DEPTH) / DEPTH_STEP + 0.5) + 1;
+  header.num_prior = prior_data.size();
+  header.curve_start = prior_curves.get_start();
+  header.curve_step = prior_curves.get_step();
+  header.num_knots = prior_curves.size();
+
+  std::vector<int32_t> wavelengths(scene.WAVELENGTHS.begin(), scene.WAVELENGTHS.end());
+
+  std::vector<float> values;
+  values.reserve(3 * n + 4 * n + 3 * header.num_depths + 7 * header.num_prior + 6 * header.num_knots);
+  for (size_t i = 0; i < n; i++)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      values.push_back(scene.get_camera_response(c)[i]);
+    }
+  }
+  const std::vector<float>* water[4] = {&scene.water->K_d, &scene.water->b_abs, &scene.water->b_sca,
+    &scene.water->b_att};
+  for (int j = 0; j < 4; j++)
+  {
+    values.insert(values.end(), water[j]->begin(), water[j]->end());
+  }
+
+  // Same calculation as a scene without a bundle, at every depth Scene::round_depth gives, in one batch
+  std::vector<float> depths(header.num_depths);
+  for (uint32_t i = 0; i < header.num_depths; i++)
+  {
+    depths[i] = Scene::round_depth(i * DEPTH_STEP);
+  }
+  std::vector<float> veiling_light(3 * header.num_depths);
+  scene.integrate_veiling_light(depths.data(), depths.size(), &veiling_light[0], &veiling_light[header.num_depths],
+    &veiling_light[2 * header.num_depths]);
+  for (uint32_t i = 0; i < header.num_depths; i++)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      values.push_back(veiling_light[c * header.num_depths + i]);
+    }
+  }
+
+  for (std::map<float, std::vector<double>>::const_iterator it = prior_data.begin(); it != prior_data.end(); ++it)
+  {
+    values.push_back(it->first);
+    for (size_t j = 0; j < 6; j++)
+    {
+      values.push_back(j < it->second.size() ? it->second[j] : 0.0);
+    }
+  }
+
+  values.insert(values.end(), prior_curves.get_knots().begin(),
+    prior_curves.get_knots().begin() + 6 * header.num_knots);
+
+  // Written next to the bundle and renamed, a node starting meanwhile maps the old or the new bundle
+  std::string temporary = FILENAME + ".tmp";
+  std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(wavelengths.data()), wavelengths.size() * sizeof(int32_t));
+  file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+  file.close();
+  if (!file || std::rename(temporary.c_str(), FILENAME.c_str()) != 0)
+  {
+    std::cout << "ERROR: Could not write model bundle " << FILENAME << "." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+std::vector<int> ModelBundle::get_wavelengths() const
+{
+  return std::vector<int>(this->wavelengths, this->wavelengths + this->header->num_wavelengths);
+}
+
+
+std::vector<float> ModelBundle::get_camera_response() const
+{
+  return std::vector<float>(this->camera_response, this->camera_response + 3 * this->header->num_wavelengths);
+}
+
+
+std::shared_ptr<const JerlovWater> ModelBundle::get_water() const
+{
+  size_t n = this->header->num_wavelengths;
+
+  std::shared_ptr<JerlovWater> water = std::make_shared<JerlovWater>();
+  water->WATER_TYPE = this->water_type;
+  water->K_d.assign(this->water, this->water + n);
+  water->b_abs.assign(this->water + n, this->water + 2 * n);
+  water->b_sca.assign(this->water + 2 * n, this->water + 3 * n);
+  water->b_att.assign(this->water + 3 * n, this->water + 4 * n);
+
+  return water;
+}
+
+
+std::map<float, std::vector<double>> ModelBundle::get_prior_data() const
+{
+  std::map<float, std::vector<double>> prior_data;
+  for (uint32_t i = 0; i < this->header->num_prior; i++)
+  {
+    const float* row = this->prior + 7 * i;
+    prior_data[row[0]] = std::vector<double>(row + 1, row + 7);
+  }
+
+  return prior_data;
+}
+
+
+AttenuationCurves ModelBundle::get_prior_curves() const
+{
+  if (this->header->num_knots == 0)
+  {
+    return AttenuationCurves();
+  }
+
+  return AttenuationCurves(this->header->curve_start, this->header->curve_step,
+    std::vector<float>(this->knots, this->knots + 6 * this->header->num_knots));
+}
+
+
+float ModelBundle::get_k() const
+{
+  return this->header->k;
+}
+
+
+bool ModelBundle::get_veiling_light(float depth, cv::Scalar& veiling_light) const
+{
+  long index = std::lround(depth / DEPTH_STEP);
+  if (index < 0 || index >= static_cast<long>(this->header->num_depths))
+  {
+    return false;
+  }
+
+  const float* value = this->veiling_light + 3 * index;
+  veiling_light = cv::Scalar(value[0], value[1], value[2]);
+  return true;
+}
+
+
+void ModelBundle::prewarm() const
+{
+  const long PAGE_SIZE = sysconf(_SC_PAGESIZE);
+  const volatile char* data = static_cast<const char*>(this->mapping);
+
+  char sum = 0;
+  for (size_t i = 0; i < this->size; i += PAGE_SIZE)
+  {
+    sum += data[i];
+  }
+  (void) sum;
+}
+
+}  // namespace underwater_color_enhance
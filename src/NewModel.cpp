@@ -6,8 +6,18 @@
 */
 
 #include "underwater_color_enhance/NewModel.h"
+#include "underwater_color_enhance/MethodRegistry.h"
+#include "underwater_color_enhance/ModelBundle.h"
+#include "underwater_color_enhance/ColorMatrixFit.h"
+#include "underwater_color_enhance/ChartFit.h"
 
 #include <math.h>
+#include <cmath>
+#include <cfloat>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
 #include <opencv2/opencv.hpp>
 #include <dlib/optimization.h>
 #include <utility>
@@ -18,6 +28,8 @@
 namespace underwater_color_enhance
 {
 
+REGISTER_METHOD(0, "new_model", NewModel)
+
 typedef dlib::matrix<double, 2, 1> input_vector;
 typedef dlib::matrix<double, 2, 1> parameter_vector;
 
@@ -42,84 +54,81 @@ double residual(const std::pair<input_vector, double>& data, const parameter_vec
 }
 
 
-void NewModel::calculate_optimized_attenuation(cv::Mat& img)
+void NewModel::calculate_optimized_attenuation(const cv::Mat& img, float depth)
 {
-    if (this->CHECK_TIME)
-    {
-      this->begin = clock();
-    }
+    // Samples are accumulated over frames, one frame at a time
+    std::lock_guard<std::mutex> lock(this->data_mutex);
 
-    // Split BGR image to a Mat array of each color channel
-    cv::Mat bgr[3];
-    split(img, bgr);
+    FrameContext context;
+    context.depth = depth;
 
     if (this->CHECK_TIME)
     {
-      this->end = clock();
-      std::cout << "LOG: Set image for processing complete. Time: " <<
-        static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
-
-      this->begin = clock();
-    }
-    else if (this->LOG_SCREEN)
-    {
-      std::cout << "LOG: Set image for processing complete" << std::endl;
+      context.begin = clock();
     }
 
+    // Observations are fitted as 8-bit values, like the ground truths
+    context.pixel_scale = underwater_color_enhance::pixel_scale(img.depth());
+
     // Calculate or estimate wideband veiling light
     cv::Scalar wideband_veiling_light;
     // FUTURE: average wideband veiling light be calculates using image processing techniques
     if (this->EST_VEILING_LIGHT)  // Estimate wideband veiling light as average background value
     {
-      cv::Rect region_of_interest(this->scene->BACKGROUND_SAMPLE[0], this->scene->BACKGROUND_SAMPLE[1],
-        this->scene->BACKGROUND_SAMPLE[2], this->scene->BACKGROUND_SAMPLE[3]);
-      cv::Mat background = img(region_of_interest);
-
       // TO DO: this mean is done independently for each channel
       // Should I take the average pixel color instead?
-      wideband_veiling_light = mean(background);
+      wideband_veiling_light = sample_mean(img, this->scene->BACKGROUND_SAMPLE) * (1.0 / context.pixel_scale);
     }
     else
     {
-      wideband_veiling_light = calc_wideband_veiling_light();
+      wideband_veiling_light = calc_wideband_veiling_light(context.depth);
     }
 
     if (this->CHECK_TIME)
     {
-      this->end = clock();
+      context.end = clock();
       std::cout << "LOG: Veiling light calculation complete. Time: " <<
-        static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+        static_cast<double>(context.end - context.begin) / CLOCKS_PER_SEC << std::endl;
 
-      this->begin = clock();
+      context.begin = clock();
     }
     else if (this->LOG_SCREEN)
     {
       std::cout << "LOG: Veiling light calculation complete" << std::endl;
     }
 
-    // TO DO: Could have these rectangles initialized ahead of time
-    // Create rectangles of the regions of interest
-    cv::Rect patch_1_region(this->scene->COLOR_1_SAMPLE[0], this->scene->COLOR_1_SAMPLE[1],
-      this->scene->COLOR_1_SAMPLE[2], this->scene->COLOR_1_SAMPLE[3]);
-    cv::Rect patch_2_region(this->scene->COLOR_2_SAMPLE[0], this->scene->COLOR_2_SAMPLE[1],
-       this->scene->COLOR_2_SAMPLE[2], this->scene->COLOR_2_SAMPLE[3]);
-    // Splice regions from the image
-    cv::Mat color_1_region = img(patch_1_region);
-    cv::Mat color_2_region = img(patch_2_region);
-
     // TO DO: this mean is done independently for each channel. Should I take the average pixel color instead?
     // mean pixel value of observed colors
-    cv::Scalar color_1_obs = mean(color_1_region);
-    cv::Scalar color_2_obs = mean(color_2_region);
+    cv::Scalar color_1_obs = sample_mean(img, this->scene->COLOR_1_SAMPLE) * (1.0 / context.pixel_scale);
+    cv::Scalar color_2_obs = sample_mean(img, this->scene->COLOR_2_SAMPLE) * (1.0 / context.pixel_scale);
+
+    // Every patch of every frame is kept for the joint fit over the mission
+    if (this->JOINT_OPTIMIZE)
+    {
+      std::vector<std::vector<int>> samples;
+      std::vector<cv::Scalar> truths;
+      chart_patches(samples, truths);
+      for (size_t i = 0; i < samples.size(); i++)
+      {
+        cv::Scalar obs = i == 0 ? color_1_obs : (i == 1 ? color_2_obs :
+          sample_mean(img, samples[i]) * (1.0 / context.pixel_scale));
+        for (int c = 0; c < 3; c++)
+        {
+          DepthSample sample = {context.depth, static_cast<float>(obs[c]),
+            static_cast<float>(wideband_veiling_light[c]), static_cast<float>(truths[i][c])};
+          this->mission_samples[c].push_back(sample);
+        }
+      }
+    }
 
     // Check if max depth range has been set
     if (this->depth_max_range == -1)
     {
-      this->depth_max_range = fabs((this->depth + 0.5) * 2);
+      this->depth_max_range = fabs((context.depth + 0.5) * 2);
       this->depth_max_range = roundf(this->depth_max_range * 1) / 2;
     }
 
-    if (this->depth < this->depth_max_range && this->depth > this->depth_max_range - this->RANGE)
+    if (context.depth < this->depth_max_range && context.depth > this->depth_max_range - this->RANGE)
     {
       // Blue channel observations
 
@@ -154,7 +163,7 @@ void NewModel::calculate_optimized_attenuation(cv::Mat& img)
 
       this->observed_samples_red.push_back(std::make_pair(this->observed_input, this->COLOR_2_TRUTH[2]));
     }
-    else if (this->depth > this->depth_max_range)
+    else if (context.depth > this->depth_max_range)
     {
       parameter_vector optimized_att;
 
@@ -166,9 +175,9 @@ void NewModel::calculate_optimized_attenuation(cv::Mat& img)
                                     dlib::derivative(residual),
                                     this->observed_samples_blue,
                                     optimized_att);
-      this->backscatter_att[0] = optimized_att(0);
-      this->direct_signal_att[0] = optimized_att(1);
-      std::cout << this->backscatter_att[0] << std::endl;
+      context.backscatter_att[0] = optimized_att(0);
+      context.direct_signal_att[0] = optimized_att(1);
+      std::cout << context.backscatter_att[0] << std::endl;
 
       // Green channel optimization
 
@@ -178,8 +187,8 @@ void NewModel::calculate_optimized_attenuation(cv::Mat& img)
                                     dlib::derivative(residual),
                                     this->observed_samples_green,
                                     optimized_att);
-      this->backscatter_att[1] = optimized_att(0);
-      this->direct_signal_att[1] = optimized_att(1);
+      context.backscatter_att[1] = optimized_att(0);
+      context.direct_signal_att[1] = optimized_att(1);
 
 
       // Red channel optimization
@@ -190,8 +199,41 @@ void NewModel::calculate_optimized_attenuation(cv::Mat& img)
                                     dlib::derivative(residual),
                                     this->observed_samples_red,
                                     optimized_att);
-      this->backscatter_att[2] = optimized_att(0);
-      this->direct_signal_att[2] = optimized_att(1);
+      context.backscatter_att[2] = optimized_att(0);
+      context.direct_signal_att[2] = optimized_att(1);
+
+      // The fitted values are the multipliers of the model, 1 - exp(-b_bs * z) and exp(-b_ds * z), at DISTANCE
+      bool valid_fit = true;
+      for (int i = 0; i < 3; i++)
+      {
+        const float backscatter_val = context.backscatter_att[i];
+        const float direct_signal_val = context.direct_signal_att[i];
+        if (!std::isfinite(backscatter_val) || !std::isfinite(direct_signal_val) || backscatter_val <= 0.0 ||
+          backscatter_val >= 1.0 || direct_signal_val <= 0.0 || direct_signal_val >= 1.0)
+        {
+          valid_fit = false;
+          break;
+        }
+        context.backscatter_att[i] = -1.0 * log(1.0 - backscatter_val) / this->scene->DISTANCE;
+        context.direct_signal_att[i] = -1.0 * log(direct_signal_val) / this->scene->DISTANCE;
+      }
+
+      if (!valid_fit)
+      {
+        std::cout << "ERROR: Optimized attenuation of depth range " << this->depth_max_range <<
+          " is out of the physical range. Keeping the previous calibration." << std::endl;
+
+        this->observed_samples_blue.clear();
+        this->observed_samples_green.clear();
+        this->observed_samples_red.clear();
+
+        this->depth_max_range += this->RANGE;
+        return;
+      }
+
+      // Enhancement of the following frames uses the optimized values
+      context.depth = this->depth_max_range;
+      publish_calibration(context);
 
       if (this->SAVE_DATA)
       {
@@ -202,9 +244,12 @@ void NewModel::calculate_optimized_attenuation(cv::Mat& img)
           // std::cout << "INITIALIZED FILE" << std::endl;
           initialize_file();
         }
-        set_data_to_file();
+        set_data_to_file(this->depth_max_range, context.backscatter_att, context.direct_signal_att);
       }
 
+      // Two color chart patches per frame
+      store_calibration(context, this->observed_samples_blue.size() / 2);
+
       // Reinitialize samples and depth range
       this->observed_samples_blue.clear();
       this->observed_samples_green.clear();
@@ -215,378 +260,594 @@ void NewModel::calculate_optimized_attenuation(cv::Mat& img)
 }
 
 
+bool NewModel::fit_attenuation_curves()
+{
+  std::lock_guard<std::mutex> lock(this->data_mutex);
+
+  if (!this->JOINT_OPTIMIZE || this->mission_samples[0].empty())
+  {
+    return false;
+  }
+
+  DepthCurveFit fit(this->scene->DISTANCE, this->KNOT_SPACING, this->SMOOTHNESS);
+  AttenuationCurves fitted;
+  if (!fit.fit(this->mission_samples, fitted))
+  {
+    std::cout << "ERROR: Attenuation curves could not be fitted on the mission samples." << std::endl;
+    return false;
+  }
+
+  if (this->LOG_SCREEN)
+  {
+    std::cout << "LOG: Fitted " << fitted.size() << " attenuation curve knots on " <<
+      this->mission_samples[0].size() << " samples." << std::endl;
+  }
+
+  if (this->SAVE_DATA)
+  {
+    // Add declaration to the top of the XML file
+    if (!this->file_initialized)
+    {
+      initialize_file();
+    }
+    fitted.write(this->out_doc);
+  }
+  this->curves = fitted;
+
+  return true;
+}
+
+
 /** No SLAM implementation
  */
-cv::Mat NewModel::color_correct(cv::Mat& img)
+cv::Mat NewModel::color_correct(const cv::Mat& img, float depth, FrameMetrics* metrics)
 {
+  std::clock_t begin;
   if (this->CHECK_TIME)
   {
-    this->begin = clock();
+    begin = clock();
   }
 
-  // Split BGR image to a Mat array of each color channel
-  cv::Mat bgr[3];
-  split(img, bgr);
-
-  std::vector<cv::Mat> corrected_bgr(3);
+  // Implement color enhancement.
+  cv::Mat corrected_img = prepare_frame(img, depth, metrics).apply(img, metrics);
 
   if (this->CHECK_TIME)
   {
-    this->end = clock();
-    std::cout << "LOG: Set image for processing complete. Time: " <<
-      static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
-
-    this->begin = clock();
+    std::clock_t end = clock();
+    std::cout << "LOG: New method enhancment complete. Time: " <<
+      static_cast<double>(end - begin) / CLOCKS_PER_SEC << std::endl;
   }
   else if (this->LOG_SCREEN)
   {
-    std::cout << "LOG: Set image for processing complete" << std::endl;
+    std::cout << "LOG: New method enhancment complete" << std::endl;
   }
 
-  // Calculate or estimate wideband veiling light
-  cv::Scalar wideband_veiling_light;
-  // FUTURE: average wideband veiling light be calculates using image processing techniques
-  if (this->EST_VEILING_LIGHT)  // Estimate wideband veiling light as average background value
-  {
-    cv::Rect region_of_interest(this->scene->BACKGROUND_SAMPLE[0], this->scene->BACKGROUND_SAMPLE[1],
-      this->scene->BACKGROUND_SAMPLE[2], this->scene->BACKGROUND_SAMPLE[3]);
-    cv::Mat background = img(region_of_interest);
+  return corrected_img;
+}
 
-    // TO DO: this mean is done independently for each channel
-    // Should I take the average pixel color instead?
-    wideband_veiling_light = mean(background);
-  }
-  else
-  {
-    wideband_veiling_light = calc_wideband_veiling_light();
-  }
+
+FrameCorrection NewModel::prepare_frame(const cv::Mat& img, float depth, FrameMetrics* metrics)
+{
+  FrameContext context;
+  context.depth = depth;
 
   if (this->CHECK_TIME)
   {
-    this->end = clock();
-    std::cout << "LOG: Veiling light calculation complete. Time: " <<
-      static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
-
-    this->begin = clock();
+    context.begin = clock();
   }
-  else if (this->LOG_SCREEN)
+
+  cv::Scalar wideband_veiling_light = prepare_correction(img, context);
+  check_attenuation(context, metrics);  // Gains that are not finite give the identity correction
+
+  if (this->SAVE_DATA)
   {
-    std::cout << "LOG: Veiling light calculation complete" << std::endl;
+    save_frame_data(context);
   }
 
-  if (this->PRIOR_DATA)  // Use prior data to retrieve backscatter and direct signal attenauation values
+  return frame_correction(img, wideband_veiling_light, context, update_grid(img));
+}
+
+
+/** Blank frame through the kernels of every path the method is configured for
+ */
+void NewModel::prewarm(const cv::Mat& img, float depth)
+{
+  FrameContext context;
+  context.depth = depth;
+  context.pixel_scale = underwater_color_enhance::pixel_scale(img.depth());
+
+  cv::Scalar wideband_veiling_light = this->EST_VEILING_LIGHT ? sample_mean(img, this->scene->BACKGROUND_SAMPLE) :
+    calc_wideband_veiling_light(depth) * context.pixel_scale;
+
+  // Attenuation values the frames will start with, the chart of a blank frame is not calculated.
+  // Without any yet, nominal values so the kernels do not fall back to the identity.
+  if (this->PRIOR_DATA)
   {
-    est_attenuation();
+    est_attenuation(context);
   }
-  else  // Must calculate the attenuation values using a color chart
+  else if (!use_calibration(context) && !use_stored_calibration(context))
   {
-    // TO DO: Could have these rectangles initialized ahead of time
-    // Create rectangles of the regions of interest
-    cv::Rect patch_1_region(this->scene->COLOR_1_SAMPLE[0], this->scene->COLOR_1_SAMPLE[1],
-      this->scene->COLOR_1_SAMPLE[2], this->scene->COLOR_1_SAMPLE[3]);
-    cv::Rect patch_2_region(this->scene->COLOR_2_SAMPLE[0], this->scene->COLOR_2_SAMPLE[1],
-       this->scene->COLOR_2_SAMPLE[2], this->scene->COLOR_2_SAMPLE[3]);
-    // Splice regions from the image
-    cv::Mat color_1_region = img(patch_1_region);
-    cv::Mat color_2_region = img(patch_2_region);
-// calc_attenuation(color_1_obs, color_2_obs, wideband_veiling_light);
-    // TO DO: this mean is done independently for each channel. Should I take the average pixel color instead?
-    // mean pixel value of observed colors
-    cv::Scalar color_1_obs = mean(color_1_region);
-    cv::Scalar color_2_obs = mean(color_2_region);
-
-    calc_attenuation(color_1_obs, color_2_obs, wideband_veiling_light);
+    for (int c = 0; c < 3; c++)
+    {
+      context.backscatter_att[c] = 0.1;
+      context.direct_signal_att[c] = 0.1;
+    }
+  }
+  if (!check_attenuation(context, 0))
+  {
+    return;
   }
+  context.color_matrix = get_color_matrix();
 
-  if (this->CHECK_TIME)
+  // The grid of the blank frame is not blended into the moving average
+  GridSampler grid;
+  if (this->veiling_light_grid)
   {
-    this->end = clock();
-    std::cout << "LOG: Attenuation calculation complete. Time: " <<
-      static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+    grid = GridSampler(this->veiling_light_grid->estimate(img, this->CHANNEL_ORDER),
+      this->veiling_light_grid->get_grid_size(), img.size());
+  }
+
+  // One distance for the whole frame, e.g. the lookup tables of the 8-bit kernel
+  frame_correction(img, wideband_veiling_light, context, grid).apply(img);
 
-    this->begin = clock();
+  // Dense depth maps, and SLAM range maps
+  cv::Mat range_map(img.size(), CV_32FC1, cv::Scalar(this->scene->DISTANCE));
+  correct_range_map(img, range_map, wideband_veiling_light, context, grid, 0);
+
+  // SLAM label maps
+  if (this->SLAM_LABEL_MAP && !this->veiling_light_grid)
+  {
+    cv::Mat label_map = cv::Mat::zeros(img.size(), CV_16UC1);
+    correct_label_map(img, label_map, std::vector<float>(1, this->scene->DISTANCE), wideband_veiling_light, context,
+      0);
   }
-  else if (this->LOG_SCREEN)
+}
+
+
+/** SLAM implementation that utilizes feature points
+ */
+cv::Mat NewModel::color_correct_slam(const cv::Mat& img, const KeypointSpan& keypoints, float depth,
+  FrameMetrics* metrics)
+{
+  FrameContext context;
+  context.depth = depth;
+
+  if (this->CHECK_TIME)
   {
-    std::cout << "LOG: Attenuation calculation complete" << std::endl;
+    context.begin = clock();
   }
 
-  // Calculate backscatter and direct signal values
-  float blue_backscatter_val = 1.0 - exp(-1.0 * this->backscatter_att[0] * this->scene->DISTANCE);
-  float green_backscatter_val = 1.0 - exp(-1.0 * this->backscatter_att[1] * this->scene->DISTANCE);
-  float red_backscatter_val = 1.0 - exp(-1.0 * this->backscatter_att[2] * this->scene->DISTANCE);
+  // Voronoi Diagram of the SLAM features, each facet has the distance of its feature
+  std::vector<std::vector<cv::Point> > facets;
+  std::vector<float> facet_distances;
+  calc_voronoi_facets(img.size(), keypoints, facets, facet_distances);
 
-  float blue_direct_signal_val = exp(-1.0 * this->direct_signal_att[0] * this->scene->DISTANCE);
-  float green_direct_signal_val = exp(-1.0 * this->direct_signal_att[1] * this->scene->DISTANCE);
-  float red_direct_signal_val = exp(-1.0 * this->direct_signal_att[2] * this->scene->DISTANCE);
+  // Label map: facet index per pixel, the factors are calculated once per facet.
+  // Otherwise: distance per pixel, the factors are calculated for every pixel (and the veiling light grid applied).
+  bool use_label_map = this->SLAM_LABEL_MAP && facets.size() < UINT16_MAX && !this->veiling_light_grid;
 
-  // Implement color enhancement.
-  corrected_bgr[0] = (bgr[0] - (wideband_veiling_light[0] * blue_backscatter_val)) / blue_direct_signal_val;
-  corrected_bgr[1] = (bgr[1] - (wideband_veiling_light[1] * green_backscatter_val)) / green_direct_signal_val;
-  corrected_bgr[2] = (bgr[2] - (wideband_veiling_light[2] * red_backscatter_val)) / red_direct_signal_val;
+  cv::Mat img_voronoi;
+  if (use_label_map)
+  {
+    // Pixels not covered by a facet keep the last label, which is set to the scene distance
+    img_voronoi = cv::Mat(img.rows, img.cols, CV_16UC1, cv::Scalar(facets.size()));
+    for (size_t i = 0; i < facets.size(); i++)
+    {
+      fillConvexPoly(img_voronoi, facets[i], cv::Scalar(i), 0, 0);
+    }
+    facet_distances.push_back(this->scene->DISTANCE);
+  }
+  else
+  {
+    img_voronoi = cv::Mat::zeros(img.rows, img.cols, CV_32FC1);
+    for (size_t i = 0; i < facets.size(); i++)
+    {
+      fillConvexPoly(img_voronoi, facets[i], cv::Scalar(facet_distances[i]), 0, 0);
+    }
+  }
 
   if (this->CHECK_TIME)
   {
-    this->end = clock();
-    std::cout << "LOG: New method enhancment complete. Time: " <<
-      static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+    context.end = clock();
+    std::cout << "LOG: Set image for processing complete. Time: " <<
+      static_cast<double>(context.end - context.begin) / CLOCKS_PER_SEC << std::endl;
 
-    this->begin = clock();
+    context.begin = clock();
   }
   else if (this->LOG_SCREEN)
   {
-    std::cout << "LOG: New method enhancment complete" << std::endl;
+    std::cout << "LOG: Set image for processing complete" << std::endl;
   }
 
-  // Merge the BGR channels into normal image format.
+  cv::Scalar wideband_veiling_light = prepare_correction(img, context);
+
+  // Implement color enhancement
   cv::Mat corrected_img;
-  merge(corrected_bgr, corrected_img);
+  if (!check_attenuation(context, metrics))
+  {
+    corrected_img = FrameCorrection().apply(img, metrics);
+  }
+  else if (use_label_map)
+  {
+    corrected_img = correct_label_map(img, img_voronoi, facet_distances, wideband_veiling_light, context, metrics);
+  }
+  else
+  {
+    // All six range dependent factors are derived in one pass over the range map.
+    corrected_img = correct_range_map(img, img_voronoi, wideband_veiling_light, context, update_grid(img), metrics);
+  }
 
   if (this->CHECK_TIME)
   {
-    this->end = clock();
-    std::cout << "LOG: Merge image complete. Time: " << double(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+    context.end = clock();
+    std::cout << "LOG: New method enhancment complete. Time: " <<
+      static_cast<double>(context.end - context.begin) / CLOCKS_PER_SEC << std::endl;
+
+    context.begin = clock();
   }
   else if (this->LOG_SCREEN)
   {
-    std::cout << "LOG: Merge image complete." << std::endl;
+    std::cout << "LOG: New method enhancment complete" << std::endl;
   }
 
   if (this->SAVE_DATA)
   {
-    // Add declaration to the top of the XML file
-    if (!this->file_initialized)
-    {
-      initialize_file();
-    }
-    set_data_to_file();
+    save_frame_data(context);
   }
 
   return corrected_img;
 }
 
 
-/** SLAM implementation that utilizes feature points
+/** Dense depth implementation that utilizes a range value for every pixel
  */
-cv::Mat NewModel::color_correct_slam(cv::Mat& img, std::vector<cv::Point2f> point_data,
-  std::vector<float> distance_data)
+cv::Mat NewModel::color_correct_depth(const cv::Mat& img, const cv::Mat& range_map, float depth,
+  FrameMetrics* metrics)
 {
+  FrameContext context;
+  context.depth = depth;
+
   if (this->CHECK_TIME)
   {
-    this->begin = clock();
+    context.begin = clock();
   }
 
-  // Setting up for Voronoi Diagram algorithm
-  cv::Rect rect(0, 0, img.cols, img.rows);
-  cv::Subdiv2D subdiv(rect);
+  cv::Scalar wideband_veiling_light = prepare_correction(img, context);
 
-  for (int i = 0; i < distance_data.size(); i++)
+  // Implement color enhancement in a single pass, no Voronoi diagram is required.
+  cv::Mat corrected_img;
+  if (!check_attenuation(context, metrics))
   {
-    subdiv.insert(point_data.at(i));
+    corrected_img = FrameCorrection().apply(img, metrics);
   }
-
-  // Could initialize all of these ahead of time
-  cv::Mat img_voronoi = cv::Mat::zeros(img.rows, img.cols, CV_32FC1);
-
-  std::vector<std::vector<cv::Point2f> > facets;
-  std::vector<cv::Point2f> centers;
-  subdiv.getVoronoiFacetList(std::vector<int>(), facets, centers);
-
-  std::vector<cv::Point> ifacet;
-  for (size_t i = 0; i < facets.size(); i++)
+  else
   {
-    ifacet.resize(facets[i].size());
-    for (size_t j = 0; j < facets[i].size(); j++)
-    {
-      ifacet[j] = facets[i][j];
-    }
-    fillConvexPoly(img_voronoi, ifacet, cv::Scalar(distance_data[i]), 0, 0);
+    corrected_img = correct_range_map(img, range_map, wideband_veiling_light, context, update_grid(img), metrics);
   }
 
-  // Split BGR image to a Mat array of each color channel
-  cv::Mat bgr[3];
-  split(img, bgr);
-
-  std::vector<cv::Mat> corrected_bgr(3);
-
   if (this->CHECK_TIME)
   {
-    this->end = clock();
-    std::cout << "LOG: Set image for processing complete. Time: " <<
-      static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
-
-    this->begin = clock();
+    context.end = clock();
+    std::cout << "LOG: New method enhancment complete. Time: " <<
+      static_cast<double>(context.end - context.begin) / CLOCKS_PER_SEC << std::endl;
   }
   else if (this->LOG_SCREEN)
   {
-    std::cout << "LOG: Set image for processing complete" << std::endl;
+    std::cout << "LOG: New method enhancment complete" << std::endl;
+  }
+
+  if (this->SAVE_DATA)
+  {
+    save_frame_data(context);
   }
 
+  return corrected_img;
+}
+
+
+cv::Scalar NewModel::prepare_correction(const cv::Mat& img, FrameContext& context)
+{
+  // Ground truths and calculated veiling light are 8-bit values, scaled to the pixel values of the image
+  context.pixel_scale = underwater_color_enhance::pixel_scale(img.depth());
+
   // Calculate or estimate wideband veiling light
   cv::Scalar wideband_veiling_light;
-  // FUTURE: average wideband veiling light be calculates using image processing techniques
   if (this->EST_VEILING_LIGHT)  // Estimate wideband veiling light as average background value
   {
-    cv::Rect region_of_interest(this->scene->BACKGROUND_SAMPLE[0], this->scene->BACKGROUND_SAMPLE[1],
-      this->scene->BACKGROUND_SAMPLE[2], this->scene->BACKGROUND_SAMPLE[3]);
-    cv::Mat background = img(region_of_interest);
-
-    // TO DO: this mean is done independently for each channel
-    // Should I take the average pixel color instead?
-    wideband_veiling_light = mean(background);
-    // cv::Scalar wideband_veiling_light = cv::Scalar(255, 255, 255);
+    wideband_veiling_light = sample_mean(img, this->scene->BACKGROUND_SAMPLE);
   }
-  else  // FUTURE: implement calculation for wideband veiling light
+  else
   {
-    wideband_veiling_light = calc_wideband_veiling_light();
+    wideband_veiling_light = calc_wideband_veiling_light(context.depth) * context.pixel_scale;
   }
 
   if (this->CHECK_TIME)
   {
-    this->end = clock();
+    context.end = clock();
     std::cout << "LOG: Veiling light calculation complete. Time: " <<
-      static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+      static_cast<double>(context.end - context.begin) / CLOCKS_PER_SEC << std::endl;
 
-    this->begin = clock();
+    context.begin = clock();
   }
   else if (this->LOG_SCREEN)
   {
     std::cout << "LOG: Veiling light calculation complete" << std::endl;
   }
 
+  bool calibrated = false;
   if (this->PRIOR_DATA)  // Use prior data to retrieve backscatter and direct signal attenauation values
   {
-    est_attenuation();
+    est_attenuation(context);
+    calibrated = true;
+  }
+  else if (this->OPTIMIZE)  // Use the latest values of the optimizer, once there are some
+  {
+    calibrated = use_calibration(context) || use_stored_calibration(context);
+  }
+  else if (!this->COLOR_CHART)  // No color chart in view, use the calibrations of previous missions
+  {
+    if (!use_stored_calibration(context) && this->LOG_SCREEN)
+    {
+      std::cout << "LOG: No stored calibration, attenuation not corrected" << std::endl;
+    }
+    calibrated = true;
   }
-  else  // Must calculate the attenuation values using a color chart
+
+  if (!calibrated)  // Must calculate the attenuation values using a color chart
   {
-    // TO DO: Could have these rectangles initialized ahead of time
-    // Create rectangles of the regions of interest
-    cv::Rect patch_1_region(this->scene->COLOR_1_SAMPLE[0], this->scene->COLOR_1_SAMPLE[1],
-      this->scene->COLOR_1_SAMPLE[2], this->scene->COLOR_1_SAMPLE[3]);
-    cv::Rect patch_2_region(this->scene->COLOR_2_SAMPLE[0], this->scene->COLOR_2_SAMPLE[1],
-       this->scene->COLOR_2_SAMPLE[2], this->scene->COLOR_2_SAMPLE[3]);
-    // Splice regions from the image
-    cv::Mat color_1_region = img(patch_1_region);
-    cv::Mat color_2_region = img(patch_2_region);
+    if (this->scene->COLOR_PATCHES.empty())
+    {
+      // mean pixel value of observed colors
+      cv::Scalar color_1_obs = sample_mean(img, this->scene->COLOR_1_SAMPLE);
+      cv::Scalar color_2_obs = sample_mean(img, this->scene->COLOR_2_SAMPLE);
 
-    // TO DO: this mean is done independently for each channel. Should I take the average pixel color instead?
-    // mean pixel value of observed colors
-    cv::Scalar color_1_obs = mean(color_1_region);
-    cv::Scalar color_2_obs = mean(color_2_region);
+      calc_attenuation(color_1_obs, color_2_obs, wideband_veiling_light, context);
+    }
+    else  // Full chart
+    {
+      fit_attenuation(img, wideband_veiling_light, context);
+    }
 
-    calc_attenuation(color_1_obs, color_2_obs, wideband_veiling_light);
+    // Color chart not usable in this frame: keep the last calibration, or the stored one
+    if (!this->OPTIMIZE)
+    {
+      if (publish_calibration(context))
+      {
+        store_calibration(context, 1);
+        if (this->COLOR_MATRIX_FIT)
+        {
+          fit_color_matrix(img, wideband_veiling_light, context);
+        }
+      }
+      else if ((use_calibration(context) || use_stored_calibration(context)) && this->LOG_SCREEN)
+      {
+        std::cout << "LOG: Invalid color chart attenuation, using the last calibration" << std::endl;
+      }
+    }
   }
 
+  context.color_matrix = get_color_matrix();
+
   if (this->CHECK_TIME)
   {
-    this->end = clock();
+    context.end = clock();
     std::cout << "LOG: Attenuation calculation complete. Time: " <<
-      static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+      static_cast<double>(context.end - context.begin) / CLOCKS_PER_SEC << std::endl;
 
-    this->begin = clock();
+    context.begin = clock();
   }
   else if (this->LOG_SCREEN)
   {
     std::cout << "LOG: Attenuation calculation complete" << std::endl;
   }
 
-  // Calculate backscatter and direct signal values
-  cv::Mat blue_backscatter_val = -1.0 * this->backscatter_att[0] * img_voronoi;
-  cv::exp(blue_backscatter_val, blue_backscatter_val);
-  blue_backscatter_val = 1.0 - blue_backscatter_val;
-  cv::Mat green_backscatter_val = -1.0 * this->backscatter_att[1] * img_voronoi;
-  cv::exp(green_backscatter_val, green_backscatter_val);
-  green_backscatter_val = 1.0 - green_backscatter_val;
-  cv::Mat red_backscatter_val = -1.0 * this->backscatter_att[2] * img_voronoi;
-  cv::exp(red_backscatter_val, red_backscatter_val);
-  red_backscatter_val = 1.0 - red_backscatter_val;
-
-  cv::Mat blue_direct_signal_val = -1.0 * this->direct_signal_att[0] * img_voronoi;
-  cv::exp(blue_direct_signal_val, blue_direct_signal_val);
-  cv::Mat green_direct_signal_val = -1.0 * this->direct_signal_att[1] * img_voronoi;
-  cv::exp(green_direct_signal_val, green_direct_signal_val);
-  cv::Mat red_direct_signal_val = -1.0 * this->direct_signal_att[2] * img_voronoi;
-  cv::exp(red_direct_signal_val, red_direct_signal_val);
+  return wideband_veiling_light;
+}
 
-  // Implement color enhancement.
-  corrected_bgr[0] = (bgr[0] - (wideband_veiling_light[0] * blue_backscatter_val)) / blue_direct_signal_val;
-  corrected_bgr[1] = (bgr[1] - (wideband_veiling_light[1] * green_backscatter_val)) / green_direct_signal_val;
-  corrected_bgr[2] = (bgr[2] - (wideband_veiling_light[2] * red_backscatter_val)) / red_direct_signal_val;
 
-  if (this->CHECK_TIME)
+FrameCorrection NewModel::frame_correction(const cv::Mat& img, cv::Scalar wideband_veiling_light,
+  const FrameContext& context, const GridSampler& grid) const
+{
+  // Calculate gain and offset of each channel from the backscatter and direct signal values:
+  // (I - B * backscatter_val) / direct_signal_val = I * gain + offset
+  float gain [3];
+  float offset [3];
+  for (int i = 0; i < 3; i++)
   {
-    this->end = clock();
-    std::cout << "LOG: New method enhancment complete. Time: " <<
-      static_cast<double>(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+    float backscatter_val = 1.0 - exp(-1.0 * context.backscatter_att[i] * this->scene->DISTANCE);
+    float direct_signal_val = exp(-1.0 * context.direct_signal_att[i] * this->scene->DISTANCE);
 
-    this->begin = clock();
+    gain[i] = 1.0 / direct_signal_val;
+    offset[i] = -wideband_veiling_light[i] * backscatter_val / direct_signal_val;
   }
-  else if (this->LOG_SCREEN)
+
+  return FrameCorrection(img, this->CHANNEL_ORDER, gain, offset, this->tone_map, this->LOOKUP_TABLE, grid,
+    context.color_matrix);
+}
+
+
+GridSampler NewModel::update_grid(const cv::Mat& img) const
+{
+  GridSampler grid;
+  if (this->veiling_light_grid)
   {
-    std::cout << "LOG: New method enhancment complete" << std::endl;
+    grid = this->veiling_light_grid->update(img, this->CHANNEL_ORDER);
   }
 
-  // Merge the BGR channels into normal image format.
-  cv::Mat corrected_img;
-  merge(corrected_bgr, corrected_img);
+  return grid;
+}
 
-  if (this->CHECK_TIME)
+
+cv::Mat NewModel::correct_range_map(const cv::Mat& img, const cv::Mat& range_map, cv::Scalar wideband_veiling_light,
+  const FrameContext& context, const GridSampler& grid, FrameMetrics* metrics) const
+{
+  CV_Assert(range_map.type() == CV_32FC1 && range_map.size() == img.size());
+
+  RangeFactors factors;
+  factors.fast_exp = &this->fast_exp;
+  factors.default_distance = this->scene->DISTANCE;
+  for (int c = 0; c < 3; c++)
   {
-    this->end = clock();
-    std::cout << "LOG: Merge image complete. Time: " << double(this->end - this->begin) / CLOCKS_PER_SEC << std::endl;
+    factors.backscatter_att[c] = context.backscatter_att[c];
+    factors.direct_signal_att[c] = context.direct_signal_att[c];
+    factors.veiling_light[c] = wideband_veiling_light[c];
   }
-  else if (this->LOG_SCREEN)
+
+  // The sample goes through the color matrix, the tone curve comes before the gamma encoding
+  const ColorMatrix* color = context.color_matrix.get();
+  ToneCurve tone;
+  if (this->tone_map.needs_sample())
   {
-    std::cout << "LOG: Merge image complete." << std::endl;
+    ColorMatrix linear = color ? color->linear() : ColorMatrix();
+    cv::Mat corrected_sample;
+    dispatch_kernel<RangeKernel>(CV_32FC3, this->CHANNEL_ORDER, ToneMap::sample(img), ToneMap::sample(range_map),
+      corrected_sample, factors, ToneCurve(), static_cast<FrameMetrics*>(0), color ? &linear : 0);
+    tone = this->tone_map.curve(corrected_sample, img.depth());
   }
 
-  if (this->SAVE_DATA)
+  // The tone sample is taken with the mean veiling light, the grid covers the full frame
+  if (!grid.empty())
   {
-    // Add declaration to the top of the XML file
-    if (!this->file_initialized)
+    factors.veiling_light_grid = &grid;
+  }
+
+  cv::Mat corrected_img;
+  dispatch_kernel<RangeKernel>(img.type(), this->CHANNEL_ORDER, img, range_map, corrected_img, factors, tone,
+    metrics, color);
+
+  return corrected_img;
+}
+
+
+cv::Mat NewModel::correct_label_map(const cv::Mat& img, const cv::Mat& label_map,
+  const std::vector<float>& label_distances, cv::Scalar wideband_veiling_light, const FrameContext& context,
+  FrameMetrics* metrics) const
+{
+  CV_Assert(label_map.type() == CV_16UC1 && label_map.size() == img.size());
+
+  // Gain and offset of each channel for every label:
+  // (I - B * (1 - exp(-b_bs * z))) / exp(-b_ds * z) = I * gain + offset
+  std::vector<float> factors(6 * label_distances.size());
+  for (size_t i = 0; i < label_distances.size(); i++)
+  {
+    float distance = label_distances[i];
+    for (int c = 0; c < 3; c++)
     {
-      initialize_file();
+      float backscatter_val = 1.0 - exp(-1.0 * context.backscatter_att[c] * distance);
+      float gain = exp(context.direct_signal_att[c] * distance);
+      factors[6 * i + c] = gain;
+      factors[6 * i + 3 + c] = -wideband_veiling_light[c] * backscatter_val * gain;
     }
-    set_data_to_file();
   }
 
+  const ColorMatrix* color = context.color_matrix.get();
+  ToneCurve tone;
+  if (this->tone_map.needs_sample())
+  {
+    ColorMatrix linear = color ? color->linear() : ColorMatrix();
+    cv::Mat corrected_sample;
+    dispatch_kernel<LabelKernel>(CV_32FC3, this->CHANNEL_ORDER, ToneMap::sample(img), ToneMap::sample(label_map),
+      corrected_sample, factors, ToneCurve(), static_cast<FrameMetrics*>(0), color ? &linear : 0);
+    tone = this->tone_map.curve(corrected_sample, img.depth());
+  }
+
+  cv::Mat corrected_img;
+  dispatch_kernel<LabelKernel>(img.type(), this->CHANNEL_ORDER, img, label_map, corrected_img, factors, tone,
+    metrics, color);
+
   return corrected_img;
 }
 
 
-/** Calculate background pixel using known characteristics of camera and underwater_scene
- */
-cv::Scalar NewModel::calc_wideband_veiling_light()
+void NewModel::calc_voronoi_facets(cv::Size img_size, const KeypointSpan& keypoints,
+  std::vector<std::vector<cv::Point> >& facets, std::vector<float>& facet_distances) const
 {
-  float temp_cur = this->scene->b_sca[0] * this->scene->irradiance[0] / this->scene->b_att[0];
-  cv::Scalar wideband_veiling_light = this->scene->camera_response[0] * temp_cur;
+  cv::Rect rect(0, 0, img_size.width, img_size.height);
+  cv::Subdiv2D subdiv(rect);
 
-  for (int i = 1; i < this->scene->WAVELENGTHS.size() - 1; i++)
+  // Vertex IDs keep the facets matched with their distances (duplicate points share a vertex)
+  // Vertex IDs are sequential after the 4 outer vertices of Subdiv2D
+  std::vector<int> vertex_ids;
+  std::vector<bool> inserted(keypoints.size() + 4, false);
+  facet_distances.clear();
+  for (size_t i = 0; i < keypoints.size(); i++)
   {
-    temp_cur = this->scene->b_sca[i] * this->scene->irradiance[i] / this->scene->b_att[i];
-    wideband_veiling_light +=  2.0 * this->scene->camera_response[i] * temp_cur;
+    // Subdiv2D throws on points outside of its rectangle, NaN fails every comparison below
+    cv::Point2f point = keypoints.point(i);
+    float distance = keypoints.distance(i);
+    if (!(point.x >= 0.0f && point.x < img_size.width && point.y >= 0.0f && point.y < img_size.height &&
+      distance > 0.0f && distance < FLT_MAX))
+    {
+      continue;
+    }
+
+    int vertex_id = subdiv.insert(point);
+    if (!inserted[vertex_id])
+    {
+      inserted[vertex_id] = true;
+      vertex_ids.push_back(vertex_id);
+      facet_distances.push_back(distance);
+    }
   }
 
-  temp_cur = this->scene->b_sca.back() * this->scene->irradiance.back() / this->scene->b_att.back();
-  wideband_veiling_light +=  this->scene->camera_response.back() * temp_cur;
+  std::vector<std::vector<cv::Point2f> > float_facets;
+  std::vector<cv::Point2f> centers;
+  subdiv.getVoronoiFacetList(vertex_ids, float_facets, centers);
+
+  facets.resize(float_facets.size());
+  for (size_t i = 0; i < float_facets.size(); i++)
+  {
+    facets[i].resize(float_facets[i].size());
+    for (size_t j = 0; j < float_facets[i].size(); j++)
+    {
+      facets[i][j] = float_facets[i][j];
+    }
+  }
+}
+
+
+cv::Scalar NewModel::sample_mean(const cv::Mat& img, const std::vector<int>& sample) const
+{
+  cv::Rect region_of_interest(sample[0], sample[1], sample[2], sample[3]);
+  cv::Scalar sample_mean = mean(img(region_of_interest));
+
+  if (this->CHANNEL_ORDER == RGB)
+  {
+    std::swap(sample_mean[0], sample_mean[2]);
+  }
+
+  return sample_mean;
+}
+
+
+/** Calculate background pixel using known characteristics of camera and underwater_scene
+ */
+cv::Scalar NewModel::calc_wideband_veiling_light(float depth) const
+{
+  // Veiling light (b_sca * E / b_att) of each wavelength at the depth of the frame, over the camera response
+  cv::Scalar wideband_veiling_light = this->scene->integrate_veiling_light(depth);
 
-  wideband_veiling_light *= 1.0 / this->scene->K * this->scene->WAVELENGTHS_SUB;
+  wideband_veiling_light *= 1.0 / this->scene->K;
 
   return wideband_veiling_light;
 }
 
 
-void NewModel::calc_attenuation(cv::Scalar color_1_obs, cv::Scalar color_2_obs, cv::Scalar wideband_veiling_light)
+void NewModel::calc_attenuation(cv::Scalar color_1_obs, cv::Scalar color_2_obs, cv::Scalar wideband_veiling_light,
+  FrameContext& context) const
 {
   // Calculate backscatter attenuation for each channel
   float channel_bs;
+  double color_1_truth;
+  double color_2_truth;
   for (int i = 0; i < 3; i++)
   {
-    channel_bs =  (this->COLOR_1_TRUTH[i] * color_2_obs[i]) - (this->COLOR_2_TRUTH[i] * color_1_obs[i]) +
-      (this->COLOR_2_TRUTH[i] - this->COLOR_1_TRUTH[i]) * wideband_veiling_light[i];
-    channel_bs = channel_bs / ((this->COLOR_2_TRUTH[i] - this->COLOR_1_TRUTH[i]) * wideband_veiling_light[i]);
-    this->backscatter_att[i] = -1.0 * log(channel_bs) / this->scene->DISTANCE;
+    color_1_truth = this->COLOR_1_TRUTH[i] * context.pixel_scale;
+    color_2_truth = this->COLOR_2_TRUTH[i] * context.pixel_scale;
+    channel_bs =  (color_1_truth * color_2_obs[i]) - (color_2_truth * color_1_obs[i]) +
+      (color_2_truth - color_1_truth) * wideband_veiling_light[i];
+    channel_bs = channel_bs / ((color_2_truth - color_1_truth) * wideband_veiling_light[i]);
+    context.backscatter_att[i] = -1.0 * log(channel_bs) / this->scene->DISTANCE;
   }
 
   // Calculate direct signal attenuation for each channel
@@ -594,27 +855,232 @@ void NewModel::calc_attenuation(cv::Scalar color_1_obs, cv::Scalar color_2_obs,
   for (int i = 0; i < 3; i++)
   {
     channel_ds =  color_2_obs[i] - wideband_veiling_light[i] *
-      (1.0 - exp(-1.0 * this->backscatter_att[i] * this->scene->DISTANCE));
-    channel_ds = channel_ds / this->COLOR_2_TRUTH[i];
-    this->direct_signal_att[i] = -1.0 * log(channel_ds) / this->scene->DISTANCE;
+      (1.0 - exp(-1.0 * context.backscatter_att[i] * this->scene->DISTANCE));
+    channel_ds = channel_ds / (this->COLOR_2_TRUTH[i] * context.pixel_scale);
+    context.direct_signal_att[i] = -1.0 * log(channel_ds) / this->scene->DISTANCE;
+  }
+}
+
+
+void NewModel::fit_color_matrix(const cv::Mat& img, cv::Scalar wideband_veiling_light, const FrameContext& context)
+{
+  std::shared_ptr<const ColorMatrix> current = get_color_matrix();
+  const float gamma = current ? current->gamma : 1.0f;
+
+  std::vector<std::vector<int>> samples;
+  std::vector<cv::Scalar> truths;
+  chart_patches(samples, truths);
+
+  // Patches corrected like the chart: (I - B * (1 - exp(-b_bs * z))) / exp(-b_ds * z), at the scene DISTANCE
+  std::vector<cv::Scalar> measured(samples.size());
+  std::vector<cv::Scalar> reference(samples.size());
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    cv::Scalar obs = sample_mean(img, samples[i]);
+    for (int c = 0; c < 3; c++)
+    {
+      float backscatter_val = 1.0 - exp(-1.0 * context.backscatter_att[c] * this->scene->DISTANCE);
+      measured[i][c] = (obs[c] - wideband_veiling_light[c] * backscatter_val) *
+        exp(context.direct_signal_att[c] * this->scene->DISTANCE);
+    }
+    reference[i] = ColorMatrixFit::linear_truth(truths[i], gamma, context.pixel_scale);
+  }
+
+  float matrix [9];
+  if (ColorMatrixFit::fit(measured, reference, matrix))
+  {
+    std::atomic_store(&this->color_matrix, std::make_shared<const ColorMatrix>(matrix, gamma));
+  }
+  else if (this->LOG_SCREEN)
+  {
+    std::cout << "LOG: Color matrix could not be fitted on the chart, using the last one" << std::endl;
+  }
+}
+
+
+void NewModel::fit_attenuation(const cv::Mat& img, cv::Scalar wideband_veiling_light, FrameContext& context) const
+{
+  std::vector<std::vector<int>> samples;
+  std::vector<cv::Scalar> truths;
+  chart_patches(samples, truths);
+
+  std::vector<cv::Scalar> observed(samples.size());
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    observed[i] = sample_mean(img, samples[i]);
+    truths[i] *= context.pixel_scale;
+  }
+
+  // Each channel: I = J * exp(-b_ds * z) + B * (1 - exp(-b_bs * z)), a line of the ground truths
+  float transmission [3];
+  float backscatter [3];
+  if (!ChartFit::fit(truths, observed, 0.5 * context.pixel_scale, transmission, backscatter))
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      context.backscatter_att[i] = NAN;
+      context.direct_signal_att[i] = NAN;
+    }
+    return;
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    context.backscatter_att[i] = -1.0 * log(1.0 - backscatter[i] / wideband_veiling_light[i]) / this->scene->DISTANCE;
+    context.direct_signal_att[i] = -1.0 * log(transmission[i]) / this->scene->DISTANCE;
+  }
+}
+
+
+void NewModel::chart_patches(std::vector<std::vector<int>>& samples, std::vector<cv::Scalar>& truths) const
+{
+  samples = {this->scene->COLOR_1_SAMPLE, this->scene->COLOR_2_SAMPLE};
+  truths = {cv::Scalar(this->COLOR_1_TRUTH[0], this->COLOR_1_TRUTH[1], this->COLOR_1_TRUTH[2]),
+    cv::Scalar(this->COLOR_2_TRUTH[0], this->COLOR_2_TRUTH[1], this->COLOR_2_TRUTH[2])};
+
+  const std::vector<int>& patches = this->scene->COLOR_PATCHES;
+  for (size_t i = 0; i + 7 <= patches.size(); i += 7)
+  {
+    samples.push_back(std::vector<int>(patches.begin() + i, patches.begin() + i + 4));
+    truths.push_back(cv::Scalar(patches[i + 4], patches[i + 5], patches[i + 6]));
   }
 }
 
 
 /** Set attenuation values from pre calculated attenuation values.
+ *  Uses the attenuation curves at the depth if they were loaded, otherwise the values of the nearest depth.
  */
-void NewModel::est_attenuation()
+void NewModel::est_attenuation(FrameContext& context) const
 {
-  float round_depth = fabs((this->depth + 0.5) * 2);
+  if (!this->curves.empty())
+  {
+    this->curves.evaluate(context.depth, context.backscatter_att, context.direct_signal_att);
+    return;
+  }
+
+  if (this->att_map.empty())
+  {
+    return;
+  }
+
+  float round_depth = fabs((context.depth + 0.5) * 2);
   round_depth = roundf(round_depth * 1) / 2;
 
-  this->backscatter_att[0] = this->att_map[round_depth][0];
-  this->backscatter_att[1] = this->att_map[round_depth][1];
-  this->backscatter_att[2] = this->att_map[round_depth][2];
+  std::map<float, std::vector<double>>::const_iterator it = this->att_map.lower_bound(round_depth);
+  if (it == this->att_map.end() ||
+    (it != this->att_map.begin() && round_depth - std::prev(it)->first < it->first - round_depth))
+  {
+    --it;
+  }
+  const std::vector<double>& att = it->second;
+
+  context.backscatter_att[0] = att[0];
+  context.backscatter_att[1] = att[1];
+  context.backscatter_att[2] = att[2];
+
+  context.direct_signal_att[0] = att[3];
+  context.direct_signal_att[1] = att[4];
+  context.direct_signal_att[2] = att[5];
+}
+
+
+bool NewModel::publish_calibration(const FrameContext& context)
+{
+  Calibration calibration;
+  calibration.depth = context.depth;
+  for (int c = 0; c < 3; c++)
+  {
+    if (!std::isfinite(context.backscatter_att[c]) || !std::isfinite(context.direct_signal_att[c]))
+    {
+      return false;
+    }
+    calibration.backscatter_att[c] = context.backscatter_att[c];
+    calibration.direct_signal_att[c] = context.direct_signal_att[c];
+  }
+
+  this->calibration.publish(calibration);
+  return true;
+}
+
+
+bool NewModel::use_calibration(FrameContext& context) const
+{
+  Calibration calibration;
+  if (!this->calibration.read(calibration))
+  {
+    return false;
+  }
+
+  for (int c = 0; c < 3; c++)
+  {
+    context.backscatter_att[c] = calibration.backscatter_att[c];
+    context.direct_signal_att[c] = calibration.direct_signal_att[c];
+  }
+  return true;
+}
+
+
+bool NewModel::use_stored_calibration(FrameContext& context) const
+{
+  Calibration calibration;
+  if (!this->calibration_store || !this->calibration_store->lookup(context.depth, calibration))
+  {
+    return false;
+  }
+
+  for (int c = 0; c < 3; c++)
+  {
+    context.backscatter_att[c] = calibration.backscatter_att[c];
+    context.direct_signal_att[c] = calibration.direct_signal_att[c];
+  }
+  return true;
+}
+
+
+void NewModel::store_calibration(const FrameContext& context, int samples) const
+{
+  if (!this->calibration_store)
+  {
+    return;
+  }
+
+  Calibration calibration;
+  calibration.depth = context.depth;
+  for (int c = 0; c < 3; c++)
+  {
+    // Only physical values are kept across missions
+    if (!(context.backscatter_att[c] > 0.0f) || !(context.direct_signal_att[c] > 0.0f))
+    {
+      return;
+    }
+    calibration.backscatter_att[c] = context.backscatter_att[c];
+    calibration.direct_signal_att[c] = context.direct_signal_att[c];
+  }
+
+  this->calibration_store->add(calibration, samples);
+}
+
+
+bool NewModel::check_attenuation(const FrameContext& context, FrameMetrics* metrics) const
+{
+  if (metrics)
+  {
+    metrics->set_attenuation(context.backscatter_att, context.direct_signal_att);
+  }
+
+  for (int c = 0; c < 3; c++)
+  {
+    if (!std::isfinite(context.backscatter_att[c]) || !std::isfinite(context.direct_signal_att[c]))
+    {
+      if (this->LOG_SCREEN)
+      {
+        std::cout << "LOG: Attenuation values are not finite, frame not corrected" << std::endl;
+      }
+      return false;
+    }
+  }
 
-  this->direct_signal_att[0] = this->att_map[round_depth][3];
-  this->direct_signal_att[1] = this->att_map[round_depth][4];
-  this->direct_signal_att[2] = this->att_map[round_depth][5];
+  return true;
 }
 
 
@@ -627,42 +1093,67 @@ void NewModel::initialize_file()
 }
 
 
-void NewModel::set_data_to_file()
+void NewModel::save_frame_data(const FrameContext& context)
 {
-  TiXmlElement * data_depth = new TiXmlElement("Depth");
-  this->out_doc.LinkEndChild(data_depth);
+  std::lock_guard<std::mutex> lock(this->data_mutex);
 
-  if (this->OPTIMIZE)
-  {
-    data_depth->SetDoubleAttribute("val", static_cast<double>(this->depth_max_range));
-  }
-  else
+  // Add declaration to the top of the XML file
+  if (!this->file_initialized)
   {
-    data_depth->SetDoubleAttribute("val", static_cast<double>(this->depth));
+    initialize_file();
   }
+  set_data_to_file(context.depth, context.backscatter_att, context.direct_signal_att);
+}
+
+
+void NewModel::set_data_to_file(float depth, const float* backscatter_att, const float* direct_signal_att)
+{
+  TiXmlElement * data_depth = new TiXmlElement("Depth");
+  this->out_doc.LinkEndChild(data_depth);
+
+  data_depth->SetDoubleAttribute("val", static_cast<double>(depth));
 
   TiXmlElement * data_backscatter_att = new TiXmlElement("Backscatter_Attenuation");
   data_depth->LinkEndChild(data_backscatter_att);
-  data_backscatter_att->SetDoubleAttribute("blue", this->backscatter_att[0]);
-  data_backscatter_att->SetDoubleAttribute("green", this->backscatter_att[1]);
-  data_backscatter_att->SetDoubleAttribute("red", this->backscatter_att[2]);
+  data_backscatter_att->SetDoubleAttribute("blue", backscatter_att[0]);
+  data_backscatter_att->SetDoubleAttribute("green", backscatter_att[1]);
+  data_backscatter_att->SetDoubleAttribute("red", backscatter_att[2]);
 
   TiXmlElement * data_direct_signal_att = new TiXmlElement("Direct_Signal_Attenuation");
   data_depth->LinkEndChild(data_direct_signal_att);
-  data_direct_signal_att->SetDoubleAttribute("blue", this->direct_signal_att[0]);
-  data_direct_signal_att->SetDoubleAttribute("green", this->direct_signal_att[1]);
-  data_direct_signal_att->SetDoubleAttribute("red", this->direct_signal_att[2]);
+  data_direct_signal_att->SetDoubleAttribute("blue", direct_signal_att[0]);
+  data_direct_signal_att->SetDoubleAttribute("green", direct_signal_att[1]);
+  data_direct_signal_att->SetDoubleAttribute("red", direct_signal_att[2]);
 }
 
 
 void NewModel::end_file(std::string OUTPUT_FILENAME)
 {
+  std::lock_guard<std::mutex> lock(this->data_mutex);
   this->out_doc.SaveFile(OUTPUT_FILENAME.c_str());
 }
 
 
 void NewModel::load_data(std::string INPUT_FILENAME)
 {
+  // Prior attenuation table of a model bundle, without parsing XML
+  if (ModelBundle::is_bundle(INPUT_FILENAME))
+  {
+    std::shared_ptr<const ModelBundle> bundle = ModelBundle::open(INPUT_FILENAME);
+    if (!bundle)
+    {
+      exit(EXIT_FAILURE);
+    }
+    this->att_map = bundle->get_prior_data();
+    this->curves = bundle->get_prior_curves();
+    if (this->LOG_SCREEN)
+    {
+      std::cout << "LOG: Added " << this->att_map.size() << " prior attenuation values and " <<
+        this->curves.size() << " curve knots of the model bundle." << std::endl;
+    }
+    return;
+  }
+
   TiXmlDocument* in_doc = new TiXmlDocument(INPUT_FILENAME.c_str());
   if (!in_doc->LoadFile())
   {
@@ -686,7 +1177,7 @@ void NewModel::load_data(std::string INPUT_FILENAME)
 
   pDepthNode = in_doc->FirstChildElement("Depth");
 
-  for (pDepthNode; pDepthNode; pDepthNode = pDepthNode->NextSiblingElement())
+  for (pDepthNode; pDepthNode; pDepthNode = pDepthNode->NextSiblingElement("Depth"))
   {
     pDepthNode->QueryDoubleAttribute("val", &m_depth);
 
@@ -713,6 +1204,11 @@ void NewModel::load_data(std::string INPUT_FILENAME)
   {
     std::cout << "LOG: Added prior attenuation values to program." << std::endl;
   }
+
+  if (this->curves.read(*in_doc) && this->LOG_SCREEN)
+  {
+    std::cout << "LOG: Added prior attenuation curves with " << this->curves.size() << " knots." << std::endl;
+  }
 }
 
 }  // namespace underwater_color_enhance
@@ -0,0 +1,525 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include <opencv2/opencv.hpp>
+#include <yaml-cpp/yaml.h>
+#include <tinyxml.h>
+
+#include <ros/ros.h>
+#include <ros/package.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <mavros_msgs/VFR_HUD.h>
+#include <ORB_SLAM2/Points.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/CalibrationStore.h"
+#include "underwater_color_enhance/ColorCorrect.h"
+#include "underwater_color_enhance/ToneMap.h"
+#include "underwater_color_enhance/ImageHandler.h"
+#include "underwater_color_enhance/DepthHistory.h"
+#include "underwater_color_enhance/KeypointSpan.h"
+#include "underwater_color_enhance/OrderedPipeline.h"
+
+
+/** Camera image of the bag with the messages paired to it.
+ *  ORB-SLAM points and depth maps carry the stamp of the camera image they were made from, up to sync_tolerance.
+ */
+struct BagFrame
+{
+  ros::Time time;   /**< record time of the camera image, the enhanced image is written at the same time */
+  sensor_msgs::ImageConstPtr image;
+  sensor_msgs::CompressedImageConstPtr compressed_image;
+  ORB_SLAM2::Points::ConstPtr points;
+  sensor_msgs::ImageConstPtr depth_map;
+};
+
+/** Paired frames that are still missing a message are dropped after this many newer frames.
+ */
+const size_t MAX_PENDING_FRAMES = 100;
+
+
+/** Absolute paths are kept, others are relative to the package.
+ */
+std::string package_file(const std::string& ROOT_PATH, const std::string& filename)
+{
+  return filename.empty() || filename[0] == '/' ? filename : ROOT_PATH + "/" + filename;
+}
+
+
+/** Writes an enhanced image as PNG, 16-bit and float images as 16-bit PNG.
+ */
+void write_image_file(const std::string& filename, const cv::Mat& img, underwater_color_enhance::ChannelOrder order)
+{
+  cv::Mat out_img = img;
+  if (img.depth() == CV_32F)
+  {
+    img.convertTo(out_img, CV_16U, 65535.0);
+  }
+  if (order == underwater_color_enhance::RGB)
+  {
+    cv::cvtColor(out_img, out_img, cv::COLOR_RGB2BGR);
+  }
+
+  if (!cv::imwrite(filename, out_img))
+  {
+    std::cout << "ERROR: Could not write " << filename << std::endl;
+  }
+}
+
+
+int main(int argc, char* argv[])
+{
+  ros::Time::init();
+
+  // Load configuration file
+  std::string path = ros::package::getPath("underwater_color_enhance") + argv[1];
+  YAML::Node config = YAML::LoadFile(path);
+  const std::string ROOT_PATH = ros::package::getPath("underwater_color_enhance");
+
+  // Recorded bag to enhance, and where the enhanced images are written: a new bag and/or a directory of PNGs
+  std::string INPUT_BAG = package_file(ROOT_PATH, config["input_bag"].as<std::string>());
+  std::string OUTPUT_BAG = package_file(ROOT_PATH, config["output_bag"].as<std::string>());
+  std::string OUTPUT_DIR = package_file(ROOT_PATH, config["output_dir"].as<std::string>());
+  int NUM_WORKERS = config["num_workers"].as<int>();
+
+  // Topics in the bag, the same as recorded from the vehicle
+  std::string CAMERA_TOPIC = config["camera_topic"].as<std::string>();
+  std::string OUTPUT_TOPIC = config["output_topic"].as<std::string>();
+  std::string DEPTH_TOPIC = config["depth_topic"].as<std::string>();
+  std::string DEPTH_MAP_TOPIC = config["depth_map_topic"].as<std::string>();
+  std::string INPUT_TRANSPORT = config["input_transport"].as<std::string>();
+  double MAX_DEPTH_EXTRAPOLATION = config["max_depth_extrapolation"].as<double>();
+  double SYNC_TOLERANCE = config["sync_tolerance"].as<double>();
+
+  // Scene properties
+  float DISTANCE = config["distance"].as<float>();
+  std::string CAMERA_RESPONSE_FILENAME = config["camera_response_filename"].as<std::string>();
+  std::string JERLOV_WATER_FILENAME = config["jerlov_water_filename"].as<std::string>();
+  std::string WATER_TYPE = config["water_type"].as<std::string>();
+
+  // Color enhancement method
+  int METHOD_ID = config["method_id"].as<int>();
+  underwater_color_enhance::ChannelOrder CHANNEL_ORDER = config["channel_order"].as<std::string>() == "rgb" ?
+    underwater_color_enhance::RGB : underwater_color_enhance::BGR;
+  float EXP_MAX_ERROR = config["exp_max_error"].as<float>();
+
+  // Tone mapping of the corrected values before they are quantized: "clip", "exposure" or "reinhard"
+  underwater_color_enhance::ToneMap TONE_MAP(underwater_color_enhance::ToneMap::parse_mode(
+    config["tone_map"].as<std::string>()), config["tone_map_percentile"].as<float>(),
+    config["tone_map_knee"].as<float>(), config["tone_map_max_gain"].as<float>());
+
+  // Lookup tables for 8-bit images on CPUs where float SIMD is slow
+  bool LOOKUP_TABLE = config["lookup_table"].as<bool>();
+
+  // Veiling light that varies over the frame (strobes, lamps): [] for the same veiling light everywhere
+  std::vector<int> VEILING_LIGHT_GRID = config["veiling_light_grid"].as<std::vector<int>>();
+  float VEILING_LIGHT_SMOOTHING = config["veiling_light_smoothing"].as<float>();
+  float VEILING_LIGHT_MAX_RATIO = config["veiling_light_max_ratio"].as<float>();
+
+  // Color stage after the correction, in the same pass: 3x3 matrix (fixed or fitted on the chart) and gamma
+  std::vector<float> COLOR_MATRIX = config["color_matrix"].as<std::vector<float>>();
+  bool COLOR_MATRIX_FIT = config["color_matrix_fit"].as<bool>();
+  float OUTPUT_GAMMA = config["output_gamma"].as<float>();
+
+  bool OPTIMIZE = config["optimize"].as<bool>();
+  float RANGE = config["range"].as<float>();
+  bool OPTIMIZE_JOINT = config["optimize_joint"].as<bool>();
+  float OPTIMIZE_KNOT_SPACING = config["optimize_knot_spacing"].as<float>();
+  float OPTIMIZE_SMOOTHNESS = config["optimize_smoothness"].as<float>();
+
+  bool SLAM_INPUT = config["slam_input"].as<bool>();
+  bool SLAM_LABEL_MAP = config["slam_label_map"].as<bool>();
+  bool DEPTH_MAP_INPUT = config["depth_map_input"].as<bool>();
+  float DEPTH_MAP_SCALE = config["depth_map_scale"].as<float>();
+  std::vector<double> DEPTH_MAP_REGISTRATION = config["depth_map_registration"].as<std::vector<double>>();
+
+  std::vector<int> COLOR_1_SAMPLE = config["color_1_sample"].as<std::vector<int>>();
+  std::vector<int> COLOR_2_SAMPLE = config["color_2_sample"].as<std::vector<int>>();
+  std::vector<int> COLOR_PATCHES = config["chart_patches"].as<std::vector<int>>();
+  bool EST_VEILING_LIGHT = config["est_veiling_light"].as<bool>();
+  std::vector<int> BACKGROUND_SAMPLE = config["background_sample"].as<std::vector<int>>();
+
+  bool CHECK_TIME = config["check_time"].as<bool>();
+  bool LOG_SCREEN = config["log_screen"].as<bool>();
+
+  bool SAVE_DATA = config["save_data"].as<bool>();
+  bool PRIOR_DATA = config["prior_data"].as<bool>();
+  std::string OUTPUT_FILENAME = ROOT_PATH + "/" + config["output_filename"].as<std::string>();
+  std::string INPUT_FILENAME = ROOT_PATH + "/" + config["input_filename"].as<std::string>();
+
+  // Calibrations kept across missions, by camera, water type, site and depth: "" for no calibration store
+  bool COLOR_CHART = config["color_chart"].as<bool>();
+  std::string CALIBRATION_STORE_DIR = package_file(ROOT_PATH, config["calibration_store_dir"].as<std::string>());
+  std::string CALIBRATION_SITE = config["calibration_site"].as<std::string>();
+  float CALIBRATION_BIN_SIZE = config["calibration_bin_size"].as<float>();
+  int CALIBRATION_CACHE_BINS = config["calibration_cache_bins"].as<int>();
+  int CALIBRATION_MAX_SAMPLES = config["calibration_max_samples"].as<int>();
+
+  if (LOG_SCREEN)
+  {
+    std::cout << "LOG: Configuration file loading complete" << std::endl;
+  }
+
+  // TO DO: If we have SLAM, do not optimize the attenuation values
+  if (SLAM_INPUT || DEPTH_MAP_INPUT)
+  {
+    OPTIMIZE = false;
+  }
+  if (SLAM_INPUT)
+  {
+    DEPTH_MAP_INPUT = false;
+  }
+
+  // The optimizer and the attenuation file depend on the order of the frames
+  if ((OPTIMIZE || SAVE_DATA) && NUM_WORKERS != 1)
+  {
+    NUM_WORKERS = 1;
+    if (LOG_SCREEN)
+    {
+      std::cout << "LOG: optimize/save_data use the frames in order, enhancing with one worker" << std::endl;
+    }
+  }
+
+  // So does the state carried from frame to frame: the moving average of the veiling light grid, the fitted color
+  // matrix and the last chart calibration. With several workers it would be updated in the order they finish.
+  bool CHART_CALIBRATION = COLOR_CHART && !PRIOR_DATA && !OPTIMIZE;
+  if ((VEILING_LIGHT_GRID.size() == 2 || COLOR_MATRIX_FIT || CHART_CALIBRATION) && NUM_WORKERS != 1)
+  {
+    NUM_WORKERS = 1;
+    if (LOG_SCREEN)
+    {
+      std::cout << "LOG: veiling_light_grid/color_matrix_fit/color chart carry state between frames, enhancing " <<
+        "with one worker so the output is deterministic" << std::endl;
+    }
+  }
+
+  // Underwater scene
+  underwater_color_enhance::Scene underwater_scene;
+  underwater_scene.DISTANCE = DISTANCE;
+  underwater_scene.COLOR_1_SAMPLE = COLOR_1_SAMPLE;
+  underwater_scene.COLOR_2_SAMPLE = COLOR_2_SAMPLE;
+  underwater_scene.COLOR_PATCHES = COLOR_PATCHES;
+  underwater_scene.set_depth(0.01);   // For simplicity set an initial value
+
+  if (EST_VEILING_LIGHT)   // Wideband veiling light assumed to be the average background color
+  {
+    underwater_scene.BACKGROUND_SAMPLE = BACKGROUND_SAMPLE;
+  }
+  else  // Wideband veiling light calculated using camera response values and jerlov waters
+  {
+    underwater_scene.load_camera_response_data(ROOT_PATH + "/Camera_Response_Files/" + CAMERA_RESPONSE_FILENAME);
+    underwater_scene.set_water(underwater_color_enhance::Scene::read_jerlov_water_data(ROOT_PATH +
+      "/Jerlov_Water/" + JERLOV_WATER_FILENAME, WATER_TYPE));
+  }
+
+  // Initialize color correction method
+  underwater_color_enhance::ColorCorrect correction_method(underwater_scene, METHOD_ID, EST_VEILING_LIGHT,
+    OPTIMIZE, RANGE, SAVE_DATA, CHECK_TIME, LOG_SCREEN, PRIOR_DATA, INPUT_FILENAME, OUTPUT_FILENAME);
+  correction_method.set_exp_max_error(EXP_MAX_ERROR);
+  correction_method.set_channel_order(CHANNEL_ORDER);
+  correction_method.set_tone_map(TONE_MAP);
+  correction_method.set_lookup_table(LOOKUP_TABLE);
+  correction_method.set_slam_label_map(SLAM_LABEL_MAP);
+  if (VEILING_LIGHT_GRID.size() == 2)
+  {
+    correction_method.set_veiling_light_grid(cv::Size(VEILING_LIGHT_GRID[0], VEILING_LIGHT_GRID[1]),
+      VEILING_LIGHT_SMOOTHING, VEILING_LIGHT_MAX_RATIO);
+  }
+  if (COLOR_MATRIX.size() == 9 || COLOR_MATRIX_FIT || OUTPUT_GAMMA != 1.0)
+  {
+    const float IDENTITY [9] = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+    correction_method.set_color_matrix(underwater_color_enhance::ColorMatrix(COLOR_MATRIX.size() == 9 ?
+      COLOR_MATRIX.data() : IDENTITY, OUTPUT_GAMMA), COLOR_MATRIX_FIT);
+  }
+  correction_method.set_depth_map_options(DEPTH_MAP_SCALE, DEPTH_MAP_REGISTRATION);
+  correction_method.set_joint_optimization(OPTIMIZE && OPTIMIZE_JOINT, OPTIMIZE_KNOT_SPACING, OPTIMIZE_SMOOTHNESS);
+
+  std::shared_ptr<underwater_color_enhance::CalibrationStore> calibration_store;
+  if (!CALIBRATION_STORE_DIR.empty())
+  {
+    calibration_store.reset(new underwater_color_enhance::CalibrationStore(CALIBRATION_STORE_DIR,
+      CAMERA_RESPONSE_FILENAME.substr(0, CAMERA_RESPONSE_FILENAME.rfind('.')), WATER_TYPE, CALIBRATION_SITE,
+      CALIBRATION_BIN_SIZE, CALIBRATION_CACHE_BINS, CALIBRATION_MAX_SAMPLES, LOG_SCREEN));
+  }
+  correction_method.set_calibration_source(COLOR_CHART, calibration_store);
+
+  rosbag::Bag input_bag;
+  rosbag::Bag output_bag;
+  try
+  {
+    input_bag.open(INPUT_BAG, rosbag::bagmode::Read);
+    if (!OUTPUT_BAG.empty() && !OPTIMIZE)
+    {
+      output_bag.open(OUTPUT_BAG, rosbag::bagmode::Write);
+    }
+  }
+  catch (rosbag::BagException& e)
+  {
+    std::cout << "ERROR: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  bool WRITE_BAG = output_bag.isOpen();
+  bool WRITE_FILES = !OUTPUT_DIR.empty() && !OPTIMIZE;
+
+  // All depth messages are read first, so every image gets its depth interpolated between the measurements
+  // around it, also those recorded after the image
+  std::vector<std::pair<double, float>> depths;
+  rosbag::View depth_view(input_bag, rosbag::TopicQuery(DEPTH_TOPIC));
+  for (rosbag::View::iterator it = depth_view.begin(); it != depth_view.end(); ++it)
+  {
+    mavros_msgs::VFR_HUD::ConstPtr depth_msg = it->instantiate<mavros_msgs::VFR_HUD>();
+    if (depth_msg)
+    {
+      depths.push_back(std::make_pair(depth_msg->header.stamp.toSec(), depth_msg->altitude));
+    }
+  }
+  std::stable_sort(depths.begin(), depths.end(),
+    [](const std::pair<double, float>& a, const std::pair<double, float>& b) {return a.first < b.first;});
+
+  underwater_color_enhance::DepthHistory depth_history(std::max<size_t>(1, depths.size()), MAX_DEPTH_EXTRAPOLATION);
+  for (size_t i = 0; i < depths.size(); i++)
+  {
+    depth_history.add(depths[i].first, depths[i].second);
+  }
+
+  if (LOG_SCREEN)
+  {
+    std::cout << "LOG: Read " << depths.size() << " depth measurements from " << INPUT_BAG << std::endl;
+  }
+
+  std::string image_topic = INPUT_TRANSPORT == "compressed" ? CAMERA_TOPIC + "/compressed" : CAMERA_TOPIC;
+  std::vector<std::string> topics(1, image_topic);
+  if (SLAM_INPUT)
+  {
+    topics.push_back("/orb_slam2/escalibr_data");
+  }
+  else if (DEPTH_MAP_INPUT)
+  {
+    topics.push_back(DEPTH_MAP_TOPIC);
+  }
+
+  std::clock_t begin = clock();
+  size_t num_frames = 0;
+  size_t num_dropped = 0;
+
+  underwater_color_enhance::OrderedPipeline pipeline(NUM_WORKERS);
+  if (LOG_SCREEN)
+  {
+    std::cout << "LOG: Begin enhancing " << INPUT_BAG << " with " << pipeline.get_num_workers() << " worker(s)" <<
+      std::endl;
+  }
+
+  // Enhances a complete frame on a worker, the output step writes it in the order of the bag
+  auto submit_frame = [&](const BagFrame& frame)
+  {
+    size_t index = num_frames++;
+    pipeline.submit([&, frame, index]() -> underwater_color_enhance::OrderedPipeline::OutputStep
+    {
+      ros::Time stamp = frame.image ? frame.image->header.stamp : frame.compressed_image->header.stamp;
+      float depth;
+      if (!depth_history.get_depth(stamp.toSec(), depth))
+      {
+        depth = correction_method.get_depth();
+      }
+
+      cv_bridge::CvImagePtr cv_ptr;
+      cv::Mat corrected_frame;
+      try
+      {
+        cv_ptr = frame.image ? underwater_color_enhance::ImageHandler::convert_image(frame.image, CHANNEL_ORDER) :
+          underwater_color_enhance::ImageHandler::decode_image(frame.compressed_image, CHANNEL_ORDER);
+
+        if (OPTIMIZE)
+        {
+          correction_method.optimize(cv_ptr->image, depth);
+          return underwater_color_enhance::OrderedPipeline::OutputStep();
+        }
+        else if (frame.points)
+        {
+          underwater_color_enhance::KeypointSpan keypoints(frame.points->points, frame.points->distances);
+          corrected_frame = correction_method.enhance_slam(cv_ptr->image, keypoints, depth);
+        }
+        else if (frame.depth_map)
+        {
+          cv_bridge::CvImageConstPtr depth_map_ptr = cv_bridge::toCvShare(frame.depth_map);
+          if (depth_map_ptr->image.type() != CV_16UC1 && depth_map_ptr->image.type() != CV_32FC1)
+          {
+            std::cout << "ERROR: Unsupported depth map encoding: " << frame.depth_map->encoding << std::endl;
+            return underwater_color_enhance::OrderedPipeline::OutputStep();
+          }
+          corrected_frame = correction_method.enhance_depth(cv_ptr->image, depth_map_ptr->image, depth);
+        }
+        else
+        {
+          corrected_frame = correction_method.enhance(cv_ptr->image, depth);
+        }
+      }
+      catch (cv_bridge::Exception& e)
+      {
+        std::cout << "ERROR: cv_bridge exception: " << e.what() << std::endl;
+        return underwater_color_enhance::OrderedPipeline::OutputStep();
+      }
+      catch (cv::Exception& e)  // One bad message drops its frame, not the replay
+      {
+        std::cout << "ERROR: OpenCV exception: " << e.what() << std::endl;
+        return underwater_color_enhance::OrderedPipeline::OutputStep();
+      }
+
+      return [&, frame, index, cv_ptr, corrected_frame]()
+      {
+        if (WRITE_BAG)
+        {
+          cv_bridge::CvImage corrected_img(cv_ptr->header, cv_ptr->encoding, corrected_frame);
+          output_bag.write(OUTPUT_TOPIC, frame.time, corrected_img.toImageMsg());
+        }
+        if (WRITE_FILES)
+        {
+          char filename[32];
+          snprintf(filename, sizeof(filename), "/frame_%06zu.png", index);
+          write_image_file(OUTPUT_DIR + filename, corrected_frame, CHANNEL_ORDER);
+        }
+      };
+    });
+  };
+
+  // Camera images, paired with their ORB-SLAM points or depth map: a message joins the pending frame of nearest stamp
+  // that still misses it, within SYNC_TOLERANCE seconds, else it starts a new frame
+  std::multimap<ros::Time, BagFrame> pending;
+  const ros::Duration tolerance(SYNC_TOLERANCE);
+  rosbag::View view(input_bag, rosbag::TopicQuery(topics));
+  for (rosbag::View::iterator it = view.begin(); it != view.end(); ++it)
+  {
+    ros::Time stamp;
+    BagFrame update;
+    if (it->getTopic() == image_topic)
+    {
+      update.time = it->getTime();
+      update.image = it->instantiate<sensor_msgs::Image>();
+      update.compressed_image = it->instantiate<sensor_msgs::CompressedImage>();
+      if (!update.image && !update.compressed_image)
+      {
+        continue;
+      }
+      stamp = update.image ? update.image->header.stamp : update.compressed_image->header.stamp;
+    }
+    else if (SLAM_INPUT)
+    {
+      update.points = it->instantiate<ORB_SLAM2::Points>();
+      if (!update.points)
+      {
+        continue;
+      }
+      stamp = update.points->header.stamp;
+    }
+    else
+    {
+      update.depth_map = it->instantiate<sensor_msgs::Image>();
+      if (!update.depth_map)
+      {
+        continue;
+      }
+      stamp = update.depth_map->header.stamp;
+    }
+
+    bool is_image = update.image || update.compressed_image;
+    ros::Time earliest = stamp.toSec() > SYNC_TOLERANCE ? stamp - tolerance : ros::Time();
+    std::multimap<ros::Time, BagFrame>::iterator match = pending.end();
+    for (std::multimap<ros::Time, BagFrame>::iterator candidate = pending.lower_bound(earliest);
+      candidate != pending.end() && candidate->first <= stamp + tolerance; ++candidate)
+    {
+      const BagFrame& other = candidate->second;
+      bool misses = is_image ? !other.image && !other.compressed_image : !other.points && !other.depth_map;
+      if (misses && (match == pending.end() ||
+        std::fabs((candidate->first - stamp).toSec()) < std::fabs((match->first - stamp).toSec())))
+      {
+        match = candidate;
+      }
+    }
+    if (match == pending.end())
+    {
+      match = pending.insert(std::make_pair(stamp, BagFrame()));
+    }
+
+    BagFrame& frame = match->second;
+    if (is_image)
+    {
+      frame.time = update.time;
+      frame.image = update.image;
+      frame.compressed_image = update.compressed_image;
+    }
+    frame.points = update.points ? update.points : frame.points;
+    frame.depth_map = update.depth_map ? update.depth_map : frame.depth_map;
+
+    bool has_image = frame.image || frame.compressed_image;
+    bool complete = has_image && (!SLAM_INPUT || frame.points) && (!DEPTH_MAP_INPUT || frame.depth_map);
+    if (complete)
+    {
+      submit_frame(frame);
+      pending.erase(match);
+    }
+
+    while (pending.size() > MAX_PENDING_FRAMES)
+    {
+      pending.erase(pending.begin());
+      num_dropped++;
+    }
+  }
+  num_dropped += pending.size();
+
+  pipeline.finish();
+
+  // Smooth attenuation curves over the depths of the whole bag, saved with the values of the depth ranges
+  if (OPTIMIZE && OPTIMIZE_JOINT)
+  {
+    correction_method.fit_attenuation_curves();
+  }
+  if (SAVE_DATA)
+  {
+    correction_method.save_final_data();
+  }
+  if (calibration_store)
+  {
+    calibration_store->flush();
+  }
+
+  input_bag.close();
+  if (WRITE_BAG)
+  {
+    output_bag.close();
+  }
+
+  if (CHECK_TIME)
+  {
+    std::clock_t end = clock();
+    std::cout << "Bag enhancement complete. Total CPU time: " <<
+      static_cast<double>(end - begin) / CLOCKS_PER_SEC << std::endl;
+  }
+
+  if (LOG_SCREEN)
+  {
+    std::cout << "LOG: Enhanced " << num_frames << " frames, " << num_dropped << " without a paired message" <<
+      std::endl;
+  }
+
+  return 0;
+}
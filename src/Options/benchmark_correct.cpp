@@ -0,0 +1,308 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include <opencv2/opencv.hpp>
+#include <yaml-cpp/yaml.h>
+#include <tinyxml.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <iostream>
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/ColorCorrect.h"
+#include "underwater_color_enhance/KeypointSpan.h"
+
+
+/** Input of an enhancement path.
+ */
+enum CaseInput
+{
+  INPUT_FRAME = 0,      /**< one distance for the whole frame */
+  INPUT_SLAM = 1,       /**< synthetic SLAM keypoints */
+  INPUT_DEPTH_MAP = 2   /**< synthetic dense depth map */
+};
+
+/** One enhancement path, timed on every frame.
+ */
+struct BenchmarkCase
+{
+  std::string name;
+  int METHOD_ID;
+  bool EST_VEILING_LIGHT;
+  bool PRIOR_DATA;
+  CaseInput input;
+  bool SLAM_LABEL_MAP;
+  bool LOOKUP_TABLE;
+  bool SIXTEEN_BIT;   /**< frames converted to 16-bit */
+};
+
+/** Settings shared by every case, from benchmark_config.yaml.
+ */
+struct BenchmarkSettings
+{
+  std::string ROOT_PATH;
+  float DISTANCE;
+  float DEPTH;
+  std::string CAMERA_RESPONSE_FILENAME;
+  std::string JERLOV_WATER_FILENAME;
+  std::string WATER_TYPE;
+  std::vector<int> COLOR_1_SAMPLE;
+  std::vector<int> COLOR_2_SAMPLE;
+  std::vector<int> BACKGROUND_SAMPLE;
+  std::string PRIOR_FILENAME;   /**< attenuation values of the prior data cases */
+};
+
+
+/** Correction method set up for a case.
+ */
+underwater_color_enhance::ColorCorrect make_correction(const BenchmarkCase& test_case,
+  const BenchmarkSettings& settings)
+{
+  underwater_color_enhance::Scene underwater_scene;
+  underwater_scene.DISTANCE = settings.DISTANCE;
+  underwater_scene.COLOR_1_SAMPLE = settings.COLOR_1_SAMPLE;
+  underwater_scene.COLOR_2_SAMPLE = settings.COLOR_2_SAMPLE;
+
+  if (test_case.EST_VEILING_LIGHT)
+  {
+    underwater_scene.BACKGROUND_SAMPLE = settings.BACKGROUND_SAMPLE;
+  }
+  else
+  {
+    underwater_scene.load_camera_response_data(settings.CAMERA_RESPONSE_FILENAME);
+    underwater_scene.load_jerlov_water_data(settings.JERLOV_WATER_FILENAME, settings.WATER_TYPE);
+    underwater_scene.set_depth(settings.DEPTH);
+  }
+
+  underwater_color_enhance::ColorCorrect correction_method(underwater_scene, test_case.METHOD_ID,
+    test_case.EST_VEILING_LIGHT, false, -1.0, false, false, false, test_case.PRIOR_DATA,
+    settings.PRIOR_FILENAME, "");
+  correction_method.set_slam_label_map(test_case.SLAM_LABEL_MAP);
+  correction_method.set_lookup_table(test_case.LOOKUP_TABLE);
+  correction_method.set_depth_map_options(1.0, std::vector<double>());
+
+  return correction_method;
+}
+
+
+/** Procedural frame of the size of the sample image: smooth color gradients with deterministic noise,
+ *  and the color chart and background regions of the sample image so the calibration is the same.
+ */
+cv::Mat make_synthetic_frame(const cv::Mat& sample, const BenchmarkSettings& settings, int seed)
+{
+  cv::Mat frame(sample.size(), CV_8UC3);
+  cv::RNG rng(seed);
+  const float phase = static_cast<float>(rng.uniform(0.0, 6.28));
+  for (int row = 0; row < frame.rows; row++)
+  {
+    uchar* f = frame.ptr<uchar>(row);
+    for (int col = 0; col < frame.cols; col++)
+    {
+      float u = static_cast<float>(col) / frame.cols;
+      float v = static_cast<float>(row) / frame.rows;
+      float texture = 0.5f + 0.5f * std::sin(20.0f * u + 13.0f * v + phase);
+      f[3 * col] = cv::saturate_cast<uchar>(60.0f + 120.0f * v + 30.0f * texture + rng.gaussian(4.0));
+      f[3 * col + 1] = cv::saturate_cast<uchar>(50.0f + 100.0f * u + 40.0f * texture + rng.gaussian(4.0));
+      f[3 * col + 2] = cv::saturate_cast<uchar>(10.0f + 40.0f * u * v + 20.0f * texture + rng.gaussian(4.0));
+    }
+  }
+
+  const std::vector<int>* regions[3] = {&settings.COLOR_1_SAMPLE, &settings.COLOR_2_SAMPLE,
+    &settings.BACKGROUND_SAMPLE};
+  for (int i = 0; i < 3; i++)
+  {
+    const std::vector<int>& region = *regions[i];
+    if (region.size() == 4)
+    {
+      cv::Rect rect = cv::Rect(region[0], region[1], region[2], region[3]) & cv::Rect(0, 0, frame.cols, frame.rows);
+      sample(rect).copyTo(frame(rect));
+    }
+  }
+
+  return frame;
+}
+
+
+/** Synthetic SLAM features: a grid of keypoints with distances varying smoothly around the scene distance.
+ */
+void make_keypoints(cv::Size size, float distance, std::vector<cv::Point2f>& points, std::vector<float>& distances)
+{
+  const int GRID = 16;
+  for (int i = 0; i < GRID; i++)
+  {
+    for (int j = 0; j < GRID; j++)
+    {
+      float u = (j + 0.5f) / GRID;
+      float v = (i + 0.5f) / GRID;
+      points.push_back(cv::Point2f(u * size.width, v * size.height));
+      distances.push_back(distance * (1.0f + 0.5f * std::sin(6.0f * u) * std::cos(4.0f * v)));
+    }
+  }
+}
+
+
+/** Synthetic depth map in meters: a floor receding from the bottom to the top of the frame.
+ */
+cv::Mat make_depth_map(cv::Size size, float distance)
+{
+  cv::Mat depth_map(size, CV_32FC1);
+  for (int row = 0; row < size.height; row++)
+  {
+    float v = static_cast<float>(row) / size.height;
+    depth_map.row(row).setTo(distance * (4.0f - 3.5f * v));
+  }
+
+  return depth_map;
+}
+
+
+/** Enhances a frame along the path of a case.
+ */
+cv::Mat run_case(underwater_color_enhance::ColorCorrect& correction_method, const BenchmarkCase& test_case,
+  const cv::Mat& frame, const underwater_color_enhance::KeypointSpan& keypoints, const cv::Mat& depth_map,
+  float depth)
+{
+  switch (test_case.input)
+  {
+    case INPUT_SLAM:
+      return correction_method.enhance_slam(frame, keypoints, depth);
+    case INPUT_DEPTH_MAP:
+      return correction_method.enhance_depth(frame, depth_map, depth);
+    default:
+      return correction_method.enhance(frame, depth);
+  }
+}
+
+
+bool file_exists(const std::string& filename)
+{
+  std::ifstream file(filename.c_str());
+  return file.good();
+}
+
+
+int main(int argc, char* argv[])
+{
+  // ROOT_PATH environment variable, prefix for all files.
+  const char* ROOT_PATH = std::getenv("ROOT_PATH");
+  // Load configuration file
+  YAML::Node config = YAML::LoadFile(argv[1]);
+
+  BenchmarkSettings settings;
+  settings.ROOT_PATH = std::string(ROOT_PATH);
+  settings.DISTANCE = config["distance"].as<float>();
+  settings.DEPTH = config["depth"].as<float>();
+  settings.CAMERA_RESPONSE_FILENAME = settings.ROOT_PATH + "/" + config["camera_response_filename"].as<std::string>();
+  settings.JERLOV_WATER_FILENAME = settings.ROOT_PATH + "/" + config["jerlov_water_filename"].as<std::string>();
+  settings.WATER_TYPE = config["water_type"].as<std::string>();
+  settings.COLOR_1_SAMPLE = config["color_1_sample"].as<std::vector<int>>();
+  settings.COLOR_2_SAMPLE = config["color_2_sample"].as<std::vector<int>>();
+  settings.BACKGROUND_SAMPLE = config["background_sample"].as<std::vector<int>>();
+  settings.PRIOR_FILENAME = settings.ROOT_PATH + "/" + config["prior_filename"].as<std::string>();
+
+  const std::string IMAGE_FILE = settings.ROOT_PATH + "/" + config["image"].as<std::string>();
+  int SYNTHETIC_FRAMES = config["synthetic_frames"].as<int>();
+  int ITERATIONS = std::max(1, config["iterations"].as<int>());
+  const std::string RESULTS_FILENAME = config["results_filename"].as<std::string>();
+
+  cv::Mat image = cv::imread(IMAGE_FILE, cv::IMREAD_COLOR);
+  if (image.empty())
+  {
+    std::cout << "ERROR: Could not read image " << IMAGE_FILE << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Frames: the sample image followed by procedural frames
+  std::vector<std::string> frame_names(1, "shipwreck");
+  std::vector<cv::Mat> frames(1, image);
+  for (int i = 0; i < SYNTHETIC_FRAMES; i++)
+  {
+    frame_names.push_back("synthetic_" + std::to_string(i));
+    frames.push_back(make_synthetic_frame(image, settings, i + 1));
+  }
+
+  std::vector<cv::Point2f> points;
+  std::vector<float> distances;
+  make_keypoints(image.size(), settings.DISTANCE, points, distances);
+  underwater_color_enhance::KeypointSpan keypoints(points, distances);
+  cv::Mat depth_map = make_depth_map(image.size(), settings.DISTANCE);
+
+  // Enhancement paths
+  const BenchmarkCase CASES[] =
+  {
+    // name                 method  est. B   prior  input            label  table  16-bit
+    {"chart_calculated",      0,    false,   false, INPUT_FRAME,     true,  false, false},
+    {"chart_estimated",       0,    true,    false, INPUT_FRAME,     true,  false, false},
+    {"chart_lookup_table",    0,    false,   false, INPUT_FRAME,     true,  true,  false},
+    {"chart_16bit",           0,    false,   false, INPUT_FRAME,     true,  false, true},
+    {"prior_calculated",      0,    false,   true,  INPUT_FRAME,     true,  false, false},
+    {"prior_estimated",       0,    true,    true,  INPUT_FRAME,     true,  false, false},
+    {"slam_label_map",        0,    false,   false, INPUT_SLAM,      true,  false, false},
+    {"slam_range_map",        0,    false,   false, INPUT_SLAM,      false, false, false},
+    {"depth_map",             0,    false,   false, INPUT_DEPTH_MAP, true,  false, false},
+    {"gray_world",            1,    false,   false, INPUT_FRAME,     true,  false, false},
+  };
+  const size_t NUM_CASES = sizeof(CASES) / sizeof(CASES[0]);
+
+  std::ofstream results;
+  if (!RESULTS_FILENAME.empty())
+  {
+    results.open((settings.ROOT_PATH + "/" + RESULTS_FILENAME).c_str());
+    results << "case,frame,ms_per_frame,mpixel_per_s" << std::endl;
+  }
+
+  printf("%-20s %-12s %12s %12s\n", "case", "frame", "ms/frame", "Mpixel/s");
+
+  for (size_t c = 0; c < NUM_CASES; c++)
+  {
+    const BenchmarkCase& test_case = CASES[c];
+    if (test_case.PRIOR_DATA && !file_exists(settings.PRIOR_FILENAME))
+    {
+      printf("%-20s %-12s skipped: no %s\n", test_case.name.c_str(), "-", settings.PRIOR_FILENAME.c_str());
+      continue;
+    }
+
+    underwater_color_enhance::ColorCorrect correction_method = make_correction(test_case, settings);
+
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+      cv::Mat frame = frames[f];
+      if (test_case.SIXTEEN_BIT)
+      {
+        frame.convertTo(frame, CV_16UC3, 257.0);
+      }
+
+      // Throughput over several runs
+      cv::Mat corrected_frame;
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      for (int i = 0; i < ITERATIONS; i++)
+      {
+        corrected_frame = run_case(correction_method, test_case, frame, keypoints, depth_map, settings.DEPTH);
+      }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() / ITERATIONS;
+      double ms_per_frame = 1000.0 * seconds;
+      double mpixel_per_s = frame.total() / seconds / 1e6;
+
+      printf("%-20s %-12s %12.2f %12.1f\n", test_case.name.c_str(), frame_names[f].c_str(), ms_per_frame,
+        mpixel_per_s);
+      if (results.is_open())
+      {
+        results << test_case.name << "," << frame_names[f] << "," << ms_per_frame << "," << mpixel_per_s <<
+          std::endl;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,99 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include <yaml-cpp/yaml.h>
+
+#include <ros/package.h>
+
+#include <stdlib.h>
+#include <iostream>
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/NewModel.h"
+#include "underwater_color_enhance/ModelBundle.h"
+
+
+/** Builds the model bundle of the node from the inputs it would otherwise parse at startup:
+ *  the camera response and Jerlov water CSV files, and the prior attenuation XML file if there is one.
+ *  Uses the same configuration file as the node (ros_config.yaml).
+ */
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    std::cout << "ERROR: Usage: sixthProgram <configuration file relative to the package>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Load configuration file
+  const std::string ROOT_PATH = ros::package::getPath("underwater_color_enhance");
+  YAML::Node config = YAML::LoadFile(ROOT_PATH + argv[1]);
+
+  std::string MODEL_BUNDLE = config["model_bundle"].as<std::string>();
+  float MODEL_BUNDLE_MAX_DEPTH = config["model_bundle_max_depth"].as<float>();
+  std::string CAMERA_RESPONSE_FILENAME = config["camera_response_filename"].as<std::string>();
+  std::string JERLOV_WATER_FILENAME = config["jerlov_water_filename"].as<std::string>();
+  std::string WATER_TYPE = config["water_type"].as<std::string>();
+  std::string INPUT_FILENAME = ROOT_PATH + "/" + config["input_filename"].as<std::string>();
+  bool LOG_SCREEN = config["log_screen"].as<bool>();
+
+  if (MODEL_BUNDLE.empty())
+  {
+    std::cout << "ERROR: No model_bundle file set in " << argv[1] << "." << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (MODEL_BUNDLE[0] != '/')
+  {
+    MODEL_BUNDLE = ROOT_PATH + "/" + MODEL_BUNDLE;
+  }
+
+  underwater_color_enhance::Scene underwater_scene;
+  underwater_scene.load_camera_response_data(ROOT_PATH + "/Camera_Response_Files/" + CAMERA_RESPONSE_FILENAME);
+  underwater_scene.set_water(underwater_color_enhance::Scene::read_jerlov_water_data(ROOT_PATH + "/Jerlov_Water/" +
+    JERLOV_WATER_FILENAME, WATER_TYPE));
+
+  // Prior attenuation values, if they were recorded (and are not already a bundle)
+  std::map<float, std::vector<double>> prior_data;
+  underwater_color_enhance::AttenuationCurves prior_curves;
+  if (std::ifstream(INPUT_FILENAME) && !underwater_color_enhance::ModelBundle::is_bundle(INPUT_FILENAME))
+  {
+    underwater_color_enhance::NewModel model;
+    model.load_data(INPUT_FILENAME);
+    prior_data = model.get_prior_data();
+    prior_curves = model.get_prior_curves();
+  }
+
+  if (!underwater_color_enhance::ModelBundle::write(MODEL_BUNDLE, underwater_scene, CAMERA_RESPONSE_FILENAME,
+    WATER_TYPE, prior_data, prior_curves, MODEL_BUNDLE_MAX_DEPTH))
+  {
+    return EXIT_FAILURE;
+  }
+
+  // Read back what the node will map
+  std::shared_ptr<const underwater_color_enhance::ModelBundle> bundle =
+    underwater_color_enhance::ModelBundle::open(MODEL_BUNDLE);
+  if (!bundle)
+  {
+    return EXIT_FAILURE;
+  }
+
+  if (LOG_SCREEN)
+  {
+    std::cout << "LOG: Wrote model bundle " << MODEL_BUNDLE << ": " << CAMERA_RESPONSE_FILENAME << ", " <<
+      WATER_TYPE << ", veiling light to " << MODEL_BUNDLE_MAX_DEPTH << " m, " << prior_data.size() <<
+      " prior attenuation values, " << prior_curves.size() <<
+      " prior curve knots" << std::endl;
+  }
+
+  return 0;
+}
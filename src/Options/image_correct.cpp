@@ -16,6 +16,8 @@
 
 #include "underwater_color_enhance/Scene.h"
 #include "underwater_color_enhance/ColorCorrect.h"
+#include "underwater_color_enhance/ToneMap.h"
+#include "underwater_color_enhance/Preview.h"
 
 
 int main(int argc, char* argv[])
@@ -28,6 +30,10 @@ int main(int argc, char* argv[])
   // Single image to color enhance
   const std::string IMAGE_FILE = std::string(ROOT_PATH) + "/" + config["image"].as<std::string>();
 
+  // Optional dense depth map (CV_16U or CV_32F) of the same scene. Empty: use distance for every pixel.
+  const std::string DEPTH_MAP_NAME = config["depth_map"].as<std::string>();
+  float DEPTH_MAP_SCALE = config["depth_map_scale"].as<float>();
+
   // Scene properties: distance to object of interest in image and depth in water
   float DISTANCE = config["distance"].as<float>();
   double DEPTH = config["depth"].as<double>();
@@ -38,6 +44,17 @@ int main(int argc, char* argv[])
 
   // Color enhancement method
   int METHOD_ID = config["method_id"].as<int>();
+  underwater_color_enhance::ChannelOrder CHANNEL_ORDER = config["channel_order"].as<std::string>() == "rgb" ?
+    underwater_color_enhance::RGB : underwater_color_enhance::BGR;
+  float EXP_MAX_ERROR = config["exp_max_error"].as<float>();
+
+  // Tone mapping of the corrected values before they are quantized: "clip", "exposure" or "reinhard"
+  underwater_color_enhance::ToneMap TONE_MAP(underwater_color_enhance::ToneMap::parse_mode(
+    config["tone_map"].as<std::string>()), config["tone_map_percentile"].as<float>(),
+    config["tone_map_knee"].as<float>(), config["tone_map_max_gain"].as<float>());
+
+  // Lookup tables for 8-bit images on CPUs where float SIMD is slow
+  bool LOOKUP_TABLE = config["lookup_table"].as<bool>();
 
   // Optimized option is unnecessary in single image color correction
   bool OPTIMIZE = false;
@@ -53,8 +70,13 @@ int main(int argc, char* argv[])
   // TO DO: Instead use image processing to calculate the average background color
   std::vector<int> BACKGROUND_SAMPLE = config["background_sample"].as<std::vector<int>>();
 
+  // Corrected image at the bit depth of the input image. Empty: not written.
+  const std::string OUTPUT_IMAGE_NAME = config["output_image"].as<std::string>();
+
   // Other checks
-  bool SHOW_IMAGE = config["show_image"].as<bool>();
+  // Side-by-side raw and corrected image, written to a file. Empty: no preview.
+  const std::string PREVIEW_NAME = config["preview_filename"].as<std::string>();
+  int PREVIEW_WIDTH = config["preview_width"].as<int>();
   bool CHECK_TIME = config["check_time"].as<bool>();
   bool LOG_SCREEN = config["log_screen"].as<bool>();
 
@@ -68,8 +90,19 @@ int main(int argc, char* argv[])
     std::cout << "LOG: Configuration file loading complete" << std::endl;
   }
 
-  // Image to color enhance
-  cv::Mat image = cv::imread(IMAGE_FILE);
+  // Image to color enhance, 16-bit and float images (PNG, TIFF, EXR) keep their precision
+  cv::Mat image = cv::imread(IMAGE_FILE, cv::IMREAD_COLOR | cv::IMREAD_ANYDEPTH);
+  if (image.empty())
+  {
+    std::cout << "ERROR: Could not read image " << IMAGE_FILE << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  cv::Mat depth_map;
+  if (!DEPTH_MAP_NAME.empty())
+  {
+    depth_map = cv::imread(std::string(ROOT_PATH) + "/" + DEPTH_MAP_NAME, cv::IMREAD_ANYDEPTH);
+  }
 
   // Underwater scene
   underwater_color_enhance::Scene underwater_scene;
@@ -97,6 +130,11 @@ int main(int argc, char* argv[])
   underwater_color_enhance::ColorCorrect correction_method(underwater_scene, METHOD_ID,
     EST_VEILING_LIGHT, OPTIMIZE, RANGE, SAVE_DATA, CHECK_TIME, LOG_SCREEN, PRIOR_DATA,
     INPUT_FILENAME, OUTPUT_FILENAME);
+  correction_method.set_exp_max_error(EXP_MAX_ERROR);
+  correction_method.set_channel_order(CHANNEL_ORDER);
+  correction_method.set_tone_map(TONE_MAP);
+  correction_method.set_lookup_table(LOOKUP_TABLE);
+  correction_method.set_depth_map_options(DEPTH_MAP_SCALE, std::vector<double>());
 
   if (LOG_SCREEN)
   {
@@ -110,7 +148,15 @@ int main(int argc, char* argv[])
     begin = clock();
   }
 
-  cv::Mat corrected_frame = correction_method.enhance(image);
+  cv::Mat corrected_frame;
+  if (depth_map.empty())
+  {
+    corrected_frame = correction_method.enhance(image);
+  }
+  else
+  {
+    corrected_frame = correction_method.enhance_depth(image, depth_map);
+  }
 
   if (CHECK_TIME)
   {
@@ -127,11 +173,15 @@ int main(int argc, char* argv[])
     correction_method.save_final_data();
   }
 
-  if (SHOW_IMAGE)
+  if (!OUTPUT_IMAGE_NAME.empty() && !cv::imwrite(std::string(ROOT_PATH) + "/" + OUTPUT_IMAGE_NAME, corrected_frame))
+  {
+    std::cout << "ERROR: Could not write " << OUTPUT_IMAGE_NAME << std::endl;
+  }
+
+  if (!PREVIEW_NAME.empty())
   {
-    cv::imshow("Original", image);
-    cv::imshow("Corrected", corrected_frame);
-    cv::waitKey(0);
+    cv::Mat preview = underwater_color_enhance::make_preview(image, corrected_frame, PREVIEW_WIDTH);
+    cv::imwrite(std::string(ROOT_PATH) + "/" + PREVIEW_NAME, preview);
   }
 
   return 0;
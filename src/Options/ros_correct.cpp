@@ -16,117 +16,347 @@
 #include <iostream>
 
 #include <ctype.h>
+#include <chrono>
 #include <ctime>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/CalibrationStore.h"
+#include "underwater_color_enhance/ModelBundle.h"
 #include "underwater_color_enhance/ColorCorrect.h"
+#include "underwater_color_enhance/ToneMap.h"
 #include "underwater_color_enhance/ImageHandler.h"
+#include "underwater_color_enhance/StreamScheduler.h"
+
+
+/** Setting of a camera stream: the value in the stream entry if set, otherwise the top level value.
+ */
+template <typename T>
+T stream_setting(const YAML::Node& stream, const YAML::Node& config, const std::string& key)
+{
+  return stream[key] ? stream[key].as<T>() : config[key].as<T>();
+}
 
 
 int main(int argc, char* argv[])
 {
   ros::init(argc, argv, "ros_color_enhance");
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
   // Load configuration file
   std::string path = ros::package::getPath("underwater_color_enhance") + argv[1];
   YAML::Node config = YAML::LoadFile(path);
+  const std::string ROOT_PATH = ros::package::getPath("underwater_color_enhance");
 
-  // ROS topics for imagery and depth values
-  std::string CAMERA_TOPIC = config["camera_topic"].as<std::string>();
+  // Camera streams, each entry may override the camera topic, camera response, ROIs and files.
+  // Without a list of streams, one stream is set up from the top level settings.
+  std::vector<YAML::Node> streams;
+  if (config["streams"] && config["streams"].size() > 0)
+  {
+    for (size_t i = 0; i < config["streams"].size(); i++)
+    {
+      streams.push_back(config["streams"][i]);
+    }
+  }
+  else
+  {
+    streams.push_back(YAML::Node(YAML::NodeType::Map));
+  }
+  bool MULTI_STREAM = streams.size() > 1;
+  int NUM_WORKERS = config["num_workers"].as<int>();
+
+  // ROS topic for depth values, shared by all cameras of the vehicle
   std::string DEPTH_TOPIC = config["depth_topic"].as<std::string>();
+  double MAX_DEPTH_EXTRAPOLATION = config["max_depth_extrapolation"].as<double>();
 
-  // Scene properties: distance to object of interest in image and depth in water
-  // NOTE: distance will not be used in cases when SLAM features are integrated
-  float DISTANCE = config["distance"].as<float>();
+  // Image transports: "raw" or "compressed" camera images, compressed output format and quality
+  std::string INPUT_TRANSPORT = config["input_transport"].as<std::string>();
+  std::string OUTPUT_FORMAT = config["output_format"].as<std::string>();
+  int OUTPUT_JPEG_QUALITY = config["output_jpeg_quality"].as<int>();
 
-  std::string CAMERA_RESPONSE_FILENAME = config["camera_response_filename"].as<std::string>();
   std::string JERLOV_WATER_FILENAME = config["jerlov_water_filename"].as<std::string>();
   std::string WATER_TYPE = config["water_type"].as<std::string>();
 
+  // Prebuilt camera response, water and veiling light tables (see sixthProgram), "" to parse the CSV files
+  std::string MODEL_BUNDLE = config["model_bundle"].as<std::string>();
+
+  // Frame size the buffers and workers are prewarmed with before subscribing, [] for no prewarm
+  std::vector<int> PREWARM_SIZE = config["prewarm_size"].as<std::vector<int>>();
+
   // Color enhancement method
   int METHOD_ID = config["method_id"].as<int>();
+  underwater_color_enhance::ChannelOrder CHANNEL_ORDER = config["channel_order"].as<std::string>() == "rgb" ?
+    underwater_color_enhance::RGB : underwater_color_enhance::BGR;
+  float EXP_MAX_ERROR = config["exp_max_error"].as<float>();
+
+  // Tone mapping of the corrected values before they are quantized: "clip", "exposure" or "reinhard"
+  underwater_color_enhance::ToneMap TONE_MAP(underwater_color_enhance::ToneMap::parse_mode(
+    config["tone_map"].as<std::string>()), config["tone_map_percentile"].as<float>(),
+    config["tone_map_knee"].as<float>(), config["tone_map_max_gain"].as<float>());
+
+  // Lookup tables for 8-bit images on CPUs where float SIMD is slow
+  bool LOOKUP_TABLE = config["lookup_table"].as<bool>();
+
+  // Veiling light that varies over the frame (strobes, lamps): [] for the same veiling light everywhere
+  std::vector<int> VEILING_LIGHT_GRID = config["veiling_light_grid"].as<std::vector<int>>();
+  float VEILING_LIGHT_SMOOTHING = config["veiling_light_smoothing"].as<float>();
+  float VEILING_LIGHT_MAX_RATIO = config["veiling_light_max_ratio"].as<float>();
+
+  // Color stage after the correction, in the same pass: 3x3 matrix (fixed or fitted on the chart) and gamma
+  std::vector<float> COLOR_MATRIX = config["color_matrix"].as<std::vector<float>>();
+  bool COLOR_MATRIX_FIT = config["color_matrix_fit"].as<bool>();
+  float OUTPUT_GAMMA = config["output_gamma"].as<float>();
 
   // Optimize attenuation values over depth in specified range
   bool OPTIMIZE = config["optimize"].as<bool>();
   float RANGE = config["range"].as<float>();
+  bool OPTIMIZE_JOINT = config["optimize_joint"].as<bool>();
+  float OPTIMIZE_KNOT_SPACING = config["optimize_knot_spacing"].as<float>();
+  float OPTIMIZE_SMOOTHNESS = config["optimize_smoothness"].as<float>();
 
   // Check if SLAM features will be used
   bool SLAM_INPUT = config["slam_input"].as<bool>();
+  bool SLAM_LABEL_MAP = config["slam_label_map"].as<bool>();
 
-  // Color patch locations if using color chart
-  std::vector<int> COLOR_1_SAMPLE = config["color_1_sample"].as<std::vector<int>>();
-  std::vector<int> COLOR_2_SAMPLE = config["color_2_sample"].as<std::vector<int>>();
+  // Check if dense depth maps (stereo, DVL) will be used, and how they are aligned with the camera images
+  bool DEPTH_MAP_INPUT = config["depth_map_input"].as<bool>();
+  float DEPTH_MAP_SCALE = config["depth_map_scale"].as<float>();
 
   // Wideband veiling light: estimated (true) or calculated (false)
   bool EST_VEILING_LIGHT = config["est_veiling_light"].as<bool>();
 
-  // TO DO: Instead use image processing to calculate average background color
-  std::vector<int> BACKGROUND_SAMPLE = config["background_sample"].as<std::vector<int>>();
-
   // Other checks
-  bool SHOW_IMAGE = config["show_image"].as<bool>();
+  bool PREVIEW = config["preview"].as<bool>();
+  double PREVIEW_RATE = config["preview_rate"].as<double>();
+  int PREVIEW_WIDTH = config["preview_width"].as<int>();
   bool CHECK_TIME = config["check_time"].as<bool>();
+
+  // Quality and health of the corrected frames on a low rate diagnostics topic
+  bool METRICS = config["metrics"].as<bool>();
+  std::string METRICS_TOPIC = config["metrics_topic"].as<std::string>();
+  double METRICS_RATE = config["metrics_rate"].as<double>();
+  double METRICS_MAX_CLIPPED = config["metrics_max_clipped"].as<double>();
   bool LOG_SCREEN = config["log_screen"].as<bool>();
 
   bool SAVE_DATA = config["save_data"].as<bool>();
   bool PRIOR_DATA = config["prior_data"].as<bool>();
-  std::string OUTPUT_FILENAME = ros::package::getPath("underwater_color_enhance") + "/" +
-    config["output_filename"].as<std::string>();
-  std::string INPUT_FILENAME = ros::package::getPath("underwater_color_enhance") + "/" +
-    config["input_filename"].as<std::string>();
+
+  // Calibrations kept across missions, by camera, water type, site and depth: "" for no calibration store
+  bool COLOR_CHART = config["color_chart"].as<bool>();
+  std::string CALIBRATION_STORE_DIR = config["calibration_store_dir"].as<std::string>();
+  std::string CALIBRATION_SITE = config["calibration_site"].as<std::string>();
+  float CALIBRATION_BIN_SIZE = config["calibration_bin_size"].as<float>();
+  int CALIBRATION_CACHE_BINS = config["calibration_cache_bins"].as<int>();
+  int CALIBRATION_MAX_SAMPLES = config["calibration_max_samples"].as<int>();
 
   if (LOG_SCREEN)
   {
     std::cout << "LOG: Configuration file loading complete" << std::endl;
   }
 
-  // Underwater scene
-  underwater_color_enhance::Scene underwater_scene;
-  underwater_scene.DISTANCE = DISTANCE;
-  underwater_scene.COLOR_1_SAMPLE = COLOR_1_SAMPLE;
-  underwater_scene.COLOR_2_SAMPLE = COLOR_2_SAMPLE;
-  // TO DO: unsure if this is required
-  underwater_scene.set_depth(0.01);   // For simplicity set an initial value
-
-  if (EST_VEILING_LIGHT)   // Wideband veiling light assumed to be the average background color
+  // TO DO: If we have SLAM, do not optimize the attenuation values
+  if (SLAM_INPUT || DEPTH_MAP_INPUT)
   {
-    underwater_scene.BACKGROUND_SAMPLE = BACKGROUND_SAMPLE;
+    OPTIMIZE = false;
   }
-  else  // Wideband veiling light calculated using camera response values and jerlov waters
+
+  // The model bundle is mapped once and shared by the scenes of the streams of its camera
+  std::shared_ptr<const underwater_color_enhance::ModelBundle> bundle;
+  if (!EST_VEILING_LIGHT && !MODEL_BUNDLE.empty())
   {
-    underwater_scene.load_camera_response_data(ros::package::getPath("underwater_color_enhance") +
-      "/Camera_Response_Files/" + CAMERA_RESPONSE_FILENAME);
-    underwater_scene.load_jerlov_water_data(ros::package::getPath("underwater_color_enhance") +
-      "/Jerlov_Water/" + JERLOV_WATER_FILENAME, WATER_TYPE);
+    bundle = underwater_color_enhance::ModelBundle::open(MODEL_BUNDLE[0] == '/' ? MODEL_BUNDLE :
+      ROOT_PATH + "/" + MODEL_BUNDLE);
+    if (bundle && bundle->get_water_type() != WATER_TYPE)
+    {
+      std::cout << "ERROR: Model bundle is of water type " << bundle->get_water_type() << ", not " << WATER_TYPE <<
+        ", parsing the CSV files." << std::endl;
+      bundle.reset();
+    }
   }
 
-  // TO DO: If we have SLAM, do not optimize the attenuation values
-  if (SLAM_INPUT)
+  // Jerlov water properties are loaded once, when a stream is not covered by the bundle, and shared
+  std::shared_ptr<const underwater_color_enhance::JerlovWater> water;
+
+  // One worker pool shared by all streams, which also decodes compressed images.
+  // A single raw stream is processed in the ROS callbacks: the pool would still run one frame of it at a time
+  // (see StreamScheduler), so it would only add a thread hand-off per frame.
+  std::unique_ptr<underwater_color_enhance::StreamScheduler> scheduler;
+  if (MULTI_STREAM || INPUT_TRANSPORT == "compressed")
   {
-    OPTIMIZE = false;
+    scheduler.reset(new underwater_color_enhance::StreamScheduler(NUM_WORKERS));
   }
 
-  if (LOG_SCREEN)
+  std::vector<boost::shared_ptr<underwater_color_enhance::ImageHandler>> image_scene_handlers;
+  std::map<std::string, std::shared_ptr<underwater_color_enhance::CalibrationStore>> calibration_stores;
+
+  // Streams whose attenuation curves are fitted at shutdown, with their save_data
+  std::vector<std::pair<underwater_color_enhance::ColorCorrect, bool>> joint_methods;
+
+  for (size_t i = 0; i < streams.size(); i++)
   {
-    std::cout << "LOG: Scene set up comlete" << std::endl;
-  }
+    const YAML::Node& stream = streams[i];
+
+    // ROS topics for imagery of this camera
+    std::string CAMERA_TOPIC = stream_setting<std::string>(stream, config, "camera_topic");
+    std::string OUTPUT_TOPIC = stream_setting<std::string>(stream, config, "output_topic");
+    std::string PREVIEW_TOPIC = stream_setting<std::string>(stream, config, "preview_topic");
+    std::string DEPTH_MAP_TOPIC = stream_setting<std::string>(stream, config, "depth_map_topic");
+    std::vector<double> DEPTH_MAP_REGISTRATION = stream_setting<std::vector<double>>(stream, config,
+      "depth_map_registration");
+
+    // Scene properties: distance to object of interest in image and depth in water
+    // NOTE: distance will not be used in cases when SLAM features are integrated
+    float DISTANCE = stream_setting<float>(stream, config, "distance");
+    std::string CAMERA_RESPONSE_FILENAME = stream_setting<std::string>(stream, config, "camera_response_filename");
+
+    // Color patch locations if using color chart
+    std::vector<int> COLOR_1_SAMPLE = stream_setting<std::vector<int>>(stream, config, "color_1_sample");
+    std::vector<int> COLOR_2_SAMPLE = stream_setting<std::vector<int>>(stream, config, "color_2_sample");
+    std::vector<int> COLOR_PATCHES = stream_setting<std::vector<int>>(stream, config, "chart_patches");
+
+    // TO DO: Instead use image processing to calculate average background color
+    std::vector<int> BACKGROUND_SAMPLE = stream_setting<std::vector<int>>(stream, config, "background_sample");
+
+    std::string OUTPUT_FILENAME = ROOT_PATH + "/" + stream_setting<std::string>(stream, config, "output_filename");
+    std::string INPUT_FILENAME = ROOT_PATH + "/" + stream_setting<std::string>(stream, config, "input_filename");
+
+    // Underwater scene
+    underwater_color_enhance::Scene underwater_scene;
+    underwater_scene.DISTANCE = DISTANCE;
+    underwater_scene.COLOR_1_SAMPLE = COLOR_1_SAMPLE;
+    underwater_scene.COLOR_2_SAMPLE = COLOR_2_SAMPLE;
+    underwater_scene.COLOR_PATCHES = COLOR_PATCHES;
+    // TO DO: unsure if this is required
+    underwater_scene.set_depth(0.01);   // For simplicity set an initial value
+
+    if (EST_VEILING_LIGHT)   // Wideband veiling light assumed to be the average background color
+    {
+      underwater_scene.BACKGROUND_SAMPLE = BACKGROUND_SAMPLE;
+    }
+    else if (bundle && bundle->get_camera() == CAMERA_RESPONSE_FILENAME)  // Prebuilt tables of the bundle
+    {
+      underwater_scene.load_bundle(bundle);
+    }
+    else  // Wideband veiling light calculated using camera response values and jerlov waters
+    {
+      if (!water)
+      {
+        water = underwater_color_enhance::Scene::read_jerlov_water_data(ROOT_PATH + "/Jerlov_Water/" +
+          JERLOV_WATER_FILENAME, WATER_TYPE);
+      }
+      underwater_scene.load_camera_response_data(ROOT_PATH + "/Camera_Response_Files/" + CAMERA_RESPONSE_FILENAME);
+      underwater_scene.set_water(water);
+    }
+
+    if (LOG_SCREEN)
+    {
+      std::cout << "LOG: Scene set up comlete for " << CAMERA_TOPIC << std::endl;
+    }
 
-  // Initialize color correction method
-  underwater_color_enhance::ColorCorrect correction_method(underwater_scene, METHOD_ID,
-    EST_VEILING_LIGHT, OPTIMIZE, RANGE, SAVE_DATA, CHECK_TIME, LOG_SCREEN, PRIOR_DATA, INPUT_FILENAME, OUTPUT_FILENAME);
+    // Initialize color correction method
+    underwater_color_enhance::ColorCorrect correction_method(underwater_scene, METHOD_ID, EST_VEILING_LIGHT,
+      OPTIMIZE, RANGE, SAVE_DATA, CHECK_TIME, LOG_SCREEN, PRIOR_DATA, INPUT_FILENAME, OUTPUT_FILENAME);
+    correction_method.set_exp_max_error(EXP_MAX_ERROR);
+    correction_method.set_channel_order(CHANNEL_ORDER);
+    correction_method.set_tone_map(TONE_MAP);
+    correction_method.set_lookup_table(LOOKUP_TABLE);
+    correction_method.set_slam_label_map(SLAM_LABEL_MAP);
+    if (VEILING_LIGHT_GRID.size() == 2)
+    {
+      correction_method.set_veiling_light_grid(cv::Size(VEILING_LIGHT_GRID[0], VEILING_LIGHT_GRID[1]),
+        VEILING_LIGHT_SMOOTHING, VEILING_LIGHT_MAX_RATIO);
+    }
+    if (COLOR_MATRIX.size() == 9 || COLOR_MATRIX_FIT || OUTPUT_GAMMA != 1.0)
+    {
+      const float IDENTITY [9] = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+      correction_method.set_color_matrix(underwater_color_enhance::ColorMatrix(COLOR_MATRIX.size() == 9 ?
+        COLOR_MATRIX.data() : IDENTITY, OUTPUT_GAMMA), COLOR_MATRIX_FIT);
+    }
+    correction_method.set_depth_map_options(DEPTH_MAP_SCALE, DEPTH_MAP_REGISTRATION);
+    correction_method.set_joint_optimization(OPTIMIZE && OPTIMIZE_JOINT, OPTIMIZE_KNOT_SPACING, OPTIMIZE_SMOOTHNESS);
+    if (OPTIMIZE && OPTIMIZE_JOINT)
+    {
+      joint_methods.push_back(std::make_pair(correction_method, SAVE_DATA));
+    }
+
+    // Streams of the same camera share the calibrations of their depth bins
+    std::shared_ptr<underwater_color_enhance::CalibrationStore> calibration_store;
+    if (!CALIBRATION_STORE_DIR.empty())
+    {
+      std::string CAMERA_PROFILE = CAMERA_RESPONSE_FILENAME.substr(0, CAMERA_RESPONSE_FILENAME.rfind('.'));
+      std::shared_ptr<underwater_color_enhance::CalibrationStore>& store = calibration_stores[CAMERA_PROFILE];
+      if (!store)
+      {
+        std::string STORE_DIR = CALIBRATION_STORE_DIR[0] == '/' ? CALIBRATION_STORE_DIR :
+          ROOT_PATH + "/" + CALIBRATION_STORE_DIR;
+        store.reset(new underwater_color_enhance::CalibrationStore(STORE_DIR, CAMERA_PROFILE, WATER_TYPE,
+          CALIBRATION_SITE, CALIBRATION_BIN_SIZE, CALIBRATION_CACHE_BINS, CALIBRATION_MAX_SAMPLES, LOG_SCREEN));
+      }
+      calibration_store = store;
+    }
+    correction_method.set_calibration_source(COLOR_CHART, calibration_store);
+
+    // The first frame finds its buffers, tables and worker threads ready: prewarmed before subscribing
+    if (PREWARM_SIZE.size() == 2)
+    {
+      cv::Size size(PREWARM_SIZE[0], PREWARM_SIZE[1]);
+      if (scheduler)
+      {
+        scheduler->prewarm(std::bind(&underwater_color_enhance::ColorCorrect::prewarm, &correction_method, size,
+          CV_8UC3));
+      }
+      else
+      {
+        correction_method.prewarm(size);
+      }
+    }
+
+    image_scene_handlers.push_back(boost::shared_ptr<underwater_color_enhance::ImageHandler>(
+      new underwater_color_enhance::ImageHandler(correction_method, SLAM_INPUT, DEPTH_MAP_INPUT, SAVE_DATA,
+        CHECK_TIME, CAMERA_TOPIC, DEPTH_TOPIC, DEPTH_MAP_TOPIC, OUTPUT_TOPIC, scheduler.get(), INPUT_TRANSPORT,
+        OUTPUT_FORMAT, OUTPUT_JPEG_QUALITY)));
+    image_scene_handlers.back()->set_max_depth_extrapolation(MAX_DEPTH_EXTRAPOLATION);
+    if (PREVIEW)
+    {
+      image_scene_handlers.back()->enable_preview(PREVIEW_TOPIC, PREVIEW_RATE, PREVIEW_WIDTH);
+    }
+    if (METRICS)
+    {
+      image_scene_handlers.back()->enable_metrics(METRICS_TOPIC, METRICS_RATE, METRICS_MAX_CLIPPED, CAMERA_TOPIC);
+    }
+  }
 
   if (LOG_SCREEN)
   {
-    std::cout << "LOG: Enhancement complete" << std::endl;
+    std::cout << "LOG: Enhancement set up complete for " << streams.size() << " stream(s) in " <<
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
     std::cout << "LOG: Begin enhancing image" << std::endl;
   }
 
-  underwater_color_enhance::ImageHandler image_scene_handler(correction_method, SLAM_INPUT, SAVE_DATA,
-    SHOW_IMAGE, CHECK_TIME, CAMERA_TOPIC, DEPTH_TOPIC);
-
   ros::spin();
 
+  // Workers finish their frames before the handlers are destroyed
+  scheduler.reset();
+
+  // Smooth attenuation curves over the depths of the whole mission, saved with the values of the depth ranges
+  for (auto& joint_method : joint_methods)
+  {
+    if (joint_method.first.fit_attenuation_curves() && joint_method.second)
+    {
+      joint_method.first.save_final_data();
+    }
+  }
+
+  // Refined calibrations are kept for the next mission
+  for (auto& store : calibration_stores)
+  {
+    store.second->flush();
+  }
+
   return 0;
 }
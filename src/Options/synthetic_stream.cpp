@@ -0,0 +1,376 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include <opencv2/opencv.hpp>
+#include <yaml-cpp/yaml.h>
+
+#include <ros/ros.h>
+#include <ros/package.h>
+#include <rosbag/bag.h>
+#include <image_transport/image_transport.h>
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+#include <mavros_msgs/VFR_HUD.h>
+#include <ORB_SLAM2/Points.h>
+#include <geometry_msgs/Point.h>
+
+#include <stdlib.h>
+#include <iostream>
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/SceneGenerator.h"
+#include "underwater_color_enhance/Kernels.h"
+
+
+/** Clean frames still waiting for their enhanced image are dropped after this many newer frames.
+ */
+const size_t MAX_PENDING_FRAMES = 100;
+
+
+/** Absolute paths are kept, others are relative to the package.
+ */
+std::string package_file(const std::string& ROOT_PATH, const std::string& filename)
+{
+  return filename.empty() || filename[0] == '/' ? filename : ROOT_PATH + "/" + filename;
+}
+
+
+/** Altitude depth of the vehicle over time: a dive from DEPTH_MIN to DEPTH_MAX and back every DEPTH_PERIOD seconds.
+ */
+float depth_profile(double time, float DEPTH_MIN, float DEPTH_MAX, double DEPTH_PERIOD)
+{
+  if (DEPTH_PERIOD <= 0.0)
+  {
+    return DEPTH_MIN;
+  }
+
+  return DEPTH_MIN + (DEPTH_MAX - DEPTH_MIN) * 0.5f * (1.0f - std::cos(2.0 * M_PI * time / DEPTH_PERIOD));
+}
+
+
+/** Messages of a synthetic frame, all with the stamp of the camera image.
+ */
+struct FrameMessages
+{
+  sensor_msgs::ImagePtr image;
+  sensor_msgs::ImagePtr clean;
+  sensor_msgs::ImagePtr depth_map;
+  mavros_msgs::VFR_HUD depth;
+  ORB_SLAM2::Points points;
+};
+
+
+FrameMessages make_messages(const underwater_color_enhance::SyntheticFrame& frame, const ros::Time& stamp)
+{
+  ros::Header header;
+  header.stamp = stamp;
+  header.frame_id = "camera";
+
+  std::string encoding = frame.image.depth() == CV_16U ? sensor_msgs::image_encodings::BGR16 :
+    sensor_msgs::image_encodings::BGR8;
+
+  FrameMessages messages;
+  messages.image = cv_bridge::CvImage(header, encoding, frame.image).toImageMsg();
+  messages.clean = cv_bridge::CvImage(header, encoding, frame.clean).toImageMsg();
+  messages.depth_map = cv_bridge::CvImage(header, sensor_msgs::image_encodings::TYPE_32FC1,
+    frame.range_map).toImageMsg();
+
+  messages.depth.header = header;
+  messages.depth.altitude = frame.depth;
+
+  messages.points.header = header;
+  messages.points.points.resize(frame.points.size());
+  for (size_t i = 0; i < frame.points.size(); i++)
+  {
+    messages.points.points[i].x = frame.points[i].x;
+    messages.points.points[i].y = frame.points[i].y;
+    messages.points.points[i].z = 0.0;
+  }
+  messages.points.distances = frame.distances;
+
+  return messages;
+}
+
+
+/** PSNR (dB) of an image against its clean scene, in 8-bit units.
+ */
+double recovery_psnr(const cv::Mat& img, const cv::Mat& clean)
+{
+  cv::Mat img_8bit, clean_8bit;
+  img.convertTo(img_8bit, CV_32F, 1.0 / underwater_color_enhance::pixel_scale(img.depth()));
+  clean.convertTo(clean_8bit, CV_32F, 1.0 / underwater_color_enhance::pixel_scale(clean.depth()));
+
+  double mse = cv::norm(img_8bit, clean_8bit, cv::NORM_L2SQR) / (img_8bit.total() * img_8bit.channels());
+  return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+}
+
+
+/** Recovery monitor class.
+ *  Matches the enhanced images of the color enhancement node with the clean scenes they were rendered from,
+ *  and reports the received frame rate and recovery error.
+ */
+class RecoveryMonitor
+{
+public:
+  RecoveryMonitor(ros::NodeHandle& nh, const std::string& OUTPUT_TOPIC) : it_(nh)
+  {
+    this->output_sub_ = it_.subscribe(OUTPUT_TOPIC, 10, &RecoveryMonitor::output_callback, this);
+  }
+
+  void add_clean_frame(const ros::Time& stamp, const cv::Mat& clean)
+  {
+    this->clean_frames[stamp] = clean;
+    while (this->clean_frames.size() > MAX_PENDING_FRAMES)
+    {
+      this->clean_frames.erase(this->clean_frames.begin());
+      this->dropped++;
+    }
+  }
+
+  void output_callback(const sensor_msgs::ImageConstPtr& img_msg)
+  {
+    std::map<ros::Time, cv::Mat>::iterator it = this->clean_frames.find(img_msg->header.stamp);
+    if (it == this->clean_frames.end())
+    {
+      return;
+    }
+
+    cv_bridge::CvImageConstPtr cv_ptr;
+    try
+    {
+      cv_ptr = cv_bridge::toCvShare(img_msg);
+    }
+    catch (cv_bridge::Exception& e)
+    {
+      ROS_ERROR("cv_bridge exception: %s", e.what());
+      return;
+    }
+
+    cv::Mat clean = it->second;
+    if (img_msg->encoding == sensor_msgs::image_encodings::RGB8 ||
+      img_msg->encoding == sensor_msgs::image_encodings::RGB16)
+    {
+      cv::cvtColor(clean, clean, cv::COLOR_BGR2RGB);
+    }
+
+    double psnr = recovery_psnr(cv_ptr->image, clean);
+    if (std::isfinite(psnr))
+    {
+      this->psnr_sum += psnr;
+      this->psnr_min = std::min(this->psnr_min, psnr);
+    }
+    this->received++;
+    this->clean_frames.erase(this->clean_frames.begin(), ++it);
+  }
+
+  /** Prints the statistics since the last report.
+   */
+  void report(double seconds)
+  {
+    if (this->received > 0)
+    {
+      std::cout << "LOG: Received " << this->received / seconds << " fps, recovery PSNR mean " <<
+        this->psnr_sum / this->received << " dB, min " << this->psnr_min << " dB" << std::endl;
+    }
+    else
+    {
+      std::cout << "LOG: No enhanced images received" << std::endl;
+    }
+    if (this->dropped > 0)
+    {
+      std::cout << "LOG: " << this->dropped << " frames not enhanced in time" << std::endl;
+    }
+
+    this->received = 0;
+    this->dropped = 0;
+    this->psnr_sum = 0.0;
+    this->psnr_min = std::numeric_limits<double>::infinity();
+  }
+
+private:
+  image_transport::ImageTransport it_;
+  image_transport::Subscriber output_sub_;
+
+  std::map<ros::Time, cv::Mat> clean_frames;  /**< by stamp of the camera image */
+  size_t received = 0;
+  size_t dropped = 0;
+  double psnr_sum = 0.0;
+  double psnr_min = std::numeric_limits<double>::infinity();
+};
+
+
+int main(int argc, char* argv[])
+{
+  ros::init(argc, argv, "synthetic_stream");
+
+  // Load configuration file
+  const std::string ROOT_PATH = ros::package::getPath("underwater_color_enhance");
+  YAML::Node config = YAML::LoadFile(ROOT_PATH + argv[1]);
+
+  // The scene and topics are those of the enhancement configuration, so the calibration sees the rendered chart
+  YAML::Node enhance_config = YAML::LoadFile(ROOT_PATH + config["enhance_config"].as<std::string>());
+  std::string CAMERA_TOPIC = enhance_config["camera_topic"].as<std::string>();
+  std::string OUTPUT_TOPIC = enhance_config["output_topic"].as<std::string>();
+  std::string DEPTH_TOPIC = enhance_config["depth_topic"].as<std::string>();
+  std::string DEPTH_MAP_TOPIC = enhance_config["depth_map_topic"].as<std::string>();
+
+  underwater_color_enhance::Scene underwater_scene;
+  underwater_scene.DISTANCE = enhance_config["distance"].as<float>();
+  underwater_scene.COLOR_1_SAMPLE = enhance_config["color_1_sample"].as<std::vector<int>>();
+  underwater_scene.COLOR_2_SAMPLE = enhance_config["color_2_sample"].as<std::vector<int>>();
+  underwater_scene.COLOR_PATCHES = enhance_config["chart_patches"].as<std::vector<int>>();
+  underwater_scene.BACKGROUND_SAMPLE = enhance_config["background_sample"].as<std::vector<int>>();
+  underwater_scene.load_camera_response_data(ROOT_PATH + "/Camera_Response_Files/" +
+    enhance_config["camera_response_filename"].as<std::string>());
+  underwater_scene.load_jerlov_water_data(ROOT_PATH + "/Jerlov_Water/" +
+    enhance_config["jerlov_water_filename"].as<std::string>(), enhance_config["water_type"].as<std::string>());
+
+  // Frames
+  cv::Size SIZE(config["width"].as<int>(), config["height"].as<int>());
+  double FPS = config["fps"].as<double>();
+  int NUM_FRAMES = config["num_frames"].as<int>();
+  int SEED = config["seed"].as<int>();
+  std::string TEXTURE_IMAGE = package_file(ROOT_PATH, config["texture_image"].as<std::string>());
+
+  float DEPTH_MIN = config["depth_min"].as<float>();
+  float DEPTH_MAX = config["depth_max"].as<float>();
+  double DEPTH_PERIOD = config["depth_period"].as<double>();
+
+  float RANGE_SLOPE = config["range_slope"].as<float>();
+  int NUM_KEYPOINTS = config["num_keypoints"].as<int>();
+  float NOISE = config["noise"].as<float>();
+  bool SIXTEEN_BIT = config["sixteen_bit"].as<bool>();
+  std::vector<float> BACKSCATTER_ATT = config["backscatter_att"].as<std::vector<float>>();
+  std::vector<float> DIRECT_SIGNAL_ATT = config["direct_signal_att"].as<std::vector<float>>();
+
+  std::string OUTPUT_BAG = package_file(ROOT_PATH, config["output_bag"].as<std::string>());
+  bool LOG_SCREEN = config["log_screen"].as<bool>();
+
+  underwater_color_enhance::SceneGenerator generator(
+    std::shared_ptr<const underwater_color_enhance::Scene>(new underwater_color_enhance::Scene(underwater_scene)),
+    SIZE, SEED);
+  generator.set_options(RANGE_SLOPE, NUM_KEYPOINTS, NOISE, SIXTEEN_BIT);
+  generator.set_attenuation(BACKSCATTER_ATT, DIRECT_SIGNAL_ATT);
+  if (!TEXTURE_IMAGE.empty())
+  {
+    cv::Mat texture = cv::imread(TEXTURE_IMAGE, cv::IMREAD_COLOR | cv::IMREAD_ANYDEPTH);
+    if (texture.empty())
+    {
+      std::cout << "ERROR: Could not read " << TEXTURE_IMAGE << std::endl;
+      return 1;
+    }
+    generator.set_texture(texture);
+  }
+
+  if (LOG_SCREEN)
+  {
+    cv::Scalar direct_signal_att = generator.get_direct_signal_attenuation();
+    cv::Scalar backscatter_att = generator.get_backscatter_attenuation(DEPTH_MIN);
+    cv::Scalar veiling_light = generator.get_veiling_light(DEPTH_MIN);
+    std::cout << "LOG: Wideband direct signal attenuation (BGR) " << direct_signal_att[0] << ", " <<
+      direct_signal_att[1] << ", " << direct_signal_att[2] << std::endl;
+    std::cout << "LOG: Wideband backscatter attenuation (BGR) at " << DEPTH_MIN << " m " << backscatter_att[0] <<
+      ", " << backscatter_att[1] << ", " << backscatter_att[2] << std::endl;
+    std::cout << "LOG: Wideband veiling light (BGR) at " << DEPTH_MIN << " m " << veiling_light[0] << ", " <<
+      veiling_light[1] << ", " << veiling_light[2] << std::endl;
+  }
+
+  // Offline: frames at FPS in a bag for the bag replay, with the clean scenes on <camera_topic>/ground_truth
+  if (!OUTPUT_BAG.empty())
+  {
+    if (NUM_FRAMES <= 0)
+    {
+      std::cout << "ERROR: num_frames must be set to write a bag" << std::endl;
+      return 1;
+    }
+
+    rosbag::Bag bag;
+    try
+    {
+      bag.open(OUTPUT_BAG, rosbag::bagmode::Write);
+    }
+    catch (rosbag::BagException& e)
+    {
+      std::cout << "ERROR: Could not open " << OUTPUT_BAG << ": " << e.what() << std::endl;
+      return 1;
+    }
+
+    ros::Time start = ros::Time::now();
+    for (int i = 0; i < NUM_FRAMES; i++)
+    {
+      double time = i / FPS;
+      ros::Time stamp = start + ros::Duration(time);
+      FrameMessages messages = make_messages(generator.render(depth_profile(time, DEPTH_MIN, DEPTH_MAX,
+        DEPTH_PERIOD)), stamp);
+
+      bag.write(DEPTH_TOPIC, stamp, messages.depth);
+      bag.write(CAMERA_TOPIC, stamp, messages.image);
+      bag.write(CAMERA_TOPIC + "/ground_truth", stamp, messages.clean);
+      bag.write("/orb_slam2/escalibr_data", stamp, messages.points);
+      bag.write(DEPTH_MAP_TOPIC, stamp, messages.depth_map);
+    }
+    bag.close();
+
+    if (LOG_SCREEN)
+    {
+      std::cout << "LOG: Wrote " << NUM_FRAMES << " frames to " << OUTPUT_BAG << std::endl;
+    }
+    return 0;
+  }
+
+  // Live: frames at FPS to the color enhancement node, which is measured on its output topic
+  ros::NodeHandle nh;
+  image_transport::ImageTransport it(nh);
+  image_transport::Publisher image_pub = it.advertise(CAMERA_TOPIC, 1);
+  image_transport::Publisher clean_pub = it.advertise(CAMERA_TOPIC + "/ground_truth", 1);
+  image_transport::Publisher depth_map_pub = it.advertise(DEPTH_MAP_TOPIC, 1);
+  ros::Publisher depth_pub = nh.advertise<mavros_msgs::VFR_HUD>(DEPTH_TOPIC, 10);
+  ros::Publisher points_pub = nh.advertise<ORB_SLAM2::Points>("/orb_slam2/escalibr_data", 1);
+  RecoveryMonitor monitor(nh, OUTPUT_TOPIC);
+
+  if (LOG_SCREEN)
+  {
+    std::cout << "LOG: Streaming " << SIZE.width << "x" << SIZE.height << " frames at " << FPS << " fps" << std::endl;
+  }
+
+  ros::Rate rate(FPS);
+  ros::Time start = ros::Time::now();
+  ros::Time last_report = start;
+  for (int i = 0; ros::ok() && (NUM_FRAMES <= 0 || i < NUM_FRAMES); i++)
+  {
+    ros::Time stamp = ros::Time::now();
+    underwater_color_enhance::SyntheticFrame frame = generator.render(depth_profile((stamp - start).toSec(),
+      DEPTH_MIN, DEPTH_MAX, DEPTH_PERIOD));
+    FrameMessages messages = make_messages(frame, stamp);
+    monitor.add_clean_frame(stamp, frame.clean);
+
+    // Depth first, so the frame is not extrapolated
+    depth_pub.publish(messages.depth);
+    points_pub.publish(messages.points);
+    depth_map_pub.publish(messages.depth_map);
+    image_pub.publish(messages.image);
+    clean_pub.publish(messages.clean);
+
+    ros::spinOnce();
+    if ((stamp - last_report).toSec() >= 1.0)
+    {
+      monitor.report((stamp - last_report).toSec());
+      last_report = stamp;
+    }
+    rate.sleep();
+  }
+
+  return 0;
+}
@@ -0,0 +1,140 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/OrderedPipeline.h"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace underwater_color_enhance
+{
+
+OrderedPipeline::OrderedPipeline(int NUM_WORKERS, size_t MAX_IN_FLIGHT)
+{
+  if (NUM_WORKERS <= 0)
+  {
+    NUM_WORKERS = std::max(1u, std::thread::hardware_concurrency());
+  }
+  this->MAX_IN_FLIGHT = MAX_IN_FLIGHT > 0 ? MAX_IN_FLIGHT : 2 * NUM_WORKERS;
+
+  for (int i = 0; i < NUM_WORKERS; i++)
+  {
+    this->workers.push_back(std::thread(&OrderedPipeline::worker_loop, this));
+  }
+  this->output_thread = std::thread(&OrderedPipeline::output_loop, this);
+}
+
+
+OrderedPipeline::~OrderedPipeline()
+{
+  finish();
+}
+
+
+void OrderedPipeline::submit(Job job)
+{
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->space_available.wait(lock, [this]
+    {
+      return this->next_job - this->next_output < this->MAX_IN_FLIGHT;
+    });
+    this->jobs.push_back(std::make_pair(this->next_job, job));
+    this->next_job++;
+  }
+  this->job_available.notify_one();
+}
+
+
+void OrderedPipeline::finish()
+{
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->stopping)
+    {
+      return;
+    }
+    this->space_available.wait(lock, [this] {return this->next_output == this->next_job;});
+    this->stopping = true;
+  }
+  this->job_available.notify_all();
+  this->output_available.notify_all();
+
+  for (size_t i = 0; i < this->workers.size(); i++)
+  {
+    this->workers[i].join();
+  }
+  this->output_thread.join();
+}
+
+
+void OrderedPipeline::worker_loop()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  while (true)
+  {
+    this->job_available.wait(lock, [this] {return this->stopping || !this->jobs.empty();});
+
+    if (this->jobs.empty())   // stopping, every job is done
+    {
+      return;
+    }
+
+    std::pair<size_t, Job> job = this->jobs.front();
+    this->jobs.pop_front();
+
+    lock.unlock();
+    OutputStep output = job.second();
+    lock.lock();
+
+    this->outputs[job.first] = output;
+    if (job.first == this->next_output)
+    {
+      this->output_available.notify_one();
+    }
+  }
+}
+
+
+void OrderedPipeline::output_loop()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  while (true)
+  {
+    this->output_available.wait(lock, [this]
+    {
+      return this->stopping || this->outputs.count(this->next_output) > 0;
+    });
+
+    std::map<size_t, OutputStep>::iterator it = this->outputs.find(this->next_output);
+    if (it == this->outputs.end())  // stopping, every output step is done
+    {
+      return;
+    }
+
+    OutputStep output;
+    output.swap(it->second);
+    this->outputs.erase(it);
+
+    lock.unlock();
+    if (output)
+    {
+      output();
+    }
+    lock.lock();
+
+    this->next_output++;
+    this->space_available.notify_all();
+  }
+}
+
+}  // namespace underwater_color_enhance
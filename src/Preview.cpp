@@ -0,0 +1,49 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/Preview.h"
+#include "underwater_color_enhance/Kernels.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+
+namespace underwater_color_enhance
+{
+
+/** Downscales first, so 16-bit and float images are converted at the preview resolution.
+ */
+static cv::Mat preview_half(const cv::Mat& img, int half_width)
+{
+  cv::Mat small_img = img;
+  if (img.cols > half_width)
+  {
+    int half_height = std::max(1, img.rows * half_width / img.cols);
+    cv::resize(img, small_img, cv::Size(half_width, half_height), 0, 0, cv::INTER_AREA);
+  }
+
+  if (small_img.depth() == CV_8U)
+  {
+    return small_img;
+  }
+
+  cv::Mat preview_img;
+  small_img.convertTo(preview_img, CV_8U, 1.0 / pixel_scale(small_img.depth()));
+  return preview_img;
+}
+
+
+cv::Mat make_preview(const cv::Mat& raw, const cv::Mat& corrected, int PREVIEW_WIDTH)
+{
+  int half_width = std::max(1, PREVIEW_WIDTH / 2);
+
+  cv::Mat preview;
+  cv::hconcat(preview_half(raw, half_width), preview_half(corrected, half_width), preview);
+
+  return preview;
+}
+
+}  // namespace underwater_color_enhance
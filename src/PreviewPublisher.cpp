@@ -0,0 +1,120 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/PreviewPublisher.h"
+#include "underwater_color_enhance/Preview.h"
+
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/image_encodings.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace underwater_color_enhance
+{
+
+PreviewPublisher::PreviewPublisher(ros::NodeHandle& nh, std::string PREVIEW_TOPIC, double PREVIEW_RATE,
+  int PREVIEW_WIDTH, ChannelOrder CHANNEL_ORDER) : it_(nh)
+{
+  this->PREVIEW_RATE = PREVIEW_RATE;
+  this->PREVIEW_WIDTH = PREVIEW_WIDTH;
+  this->CHANNEL_ORDER = CHANNEL_ORDER;
+  this->next_preview = std::chrono::steady_clock::now();
+
+  this->preview_pub_ = this->it_.advertise(PREVIEW_TOPIC, 1);
+
+  this->worker = std::thread(&PreviewPublisher::run, this);
+
+  // Previews only run when the CPU is otherwise idle
+  sched_param param;
+  param.sched_priority = 0;
+  if (pthread_setschedparam(this->worker.native_handle(), SCHED_IDLE, &param) != 0)
+  {
+    ROS_WARN("Could not lower the priority of the preview thread");
+  }
+}
+
+
+PreviewPublisher::~PreviewPublisher()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stop = true;
+  }
+  this->condition.notify_one();
+  this->worker.join();
+}
+
+
+void PreviewPublisher::submit(const cv::Mat& raw, const cv::Mat& corrected, const ros::Time& stamp,
+  const std::string& frame_id)
+{
+  if (this->preview_pub_.getNumSubscribers() == 0)
+  {
+    return;
+  }
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->pending || now < this->next_preview)
+  {
+    return;
+  }
+
+  // Images are shared, not copied: the preview thread only reads them
+  this->raw = raw;
+  this->corrected = corrected;
+  this->stamp = stamp;
+  this->frame_id = frame_id;
+  this->pending = true;
+  this->next_preview = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(1.0 / this->PREVIEW_RATE));
+
+  this->condition.notify_one();
+}
+
+
+void PreviewPublisher::run()
+{
+  namespace enc = sensor_msgs::image_encodings;
+
+  while (true)
+  {
+    cv_bridge::CvImage preview;
+    cv::Mat raw;
+    cv::Mat corrected;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->condition.wait(lock, [this] {return this->pending || this->stop;});
+      if (this->stop)
+      {
+        return;
+      }
+
+      raw = this->raw;
+      corrected = this->corrected;
+      preview.header.stamp = this->stamp;
+      preview.header.frame_id = this->frame_id;
+      this->raw.release();
+      this->corrected.release();
+    }
+
+    preview.encoding = this->CHANNEL_ORDER == RGB ? enc::RGB8 : enc::BGR8;
+    preview.image = make_preview(raw, corrected, this->PREVIEW_WIDTH);
+    this->preview_pub_.publish(preview.toImageMsg());
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pending = false;
+  }
+}
+
+}  // namespace underwater_color_enhance
@@ -6,11 +6,15 @@
 */
 
 #include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/ModelBundle.h"
+#include "underwater_color_enhance/FastExp.h"
 
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -22,33 +26,157 @@ namespace underwater_color_enhance
 
 void Scene::set_depth(float new_depth)
 {
-  new_depth = fabs(new_depth);
-  new_depth = roundf(new_depth * 100) / 100;
+  this->depth = round_depth(new_depth);
+}
+
+
+float Scene::round_depth(float depth)
+{
+  const float MIN_DEPTH = 0.01;  // Minimum altitude depth measurement
+
+  depth = fabs(depth);
+  depth = roundf(depth * 100) / 100;
 
   // Errors occur if depth is 0
-  if (0.0 == new_depth)
+  if (0.0 == depth)
+  {
+    depth = MIN_DEPTH;
+  }
+
+  return depth;
+}
+
+
+/** Exponential of the batch versions: the most accurate polynomial, close to expf but vectorizable
+ */
+static const FastExp& spectral_exp()
+{
+  static const FastExp SPECTRAL_EXP = FastExp::of_degree(FastExp::MAX_DEGREE);
+  return SPECTRAL_EXP;
+}
+
+
+/** Irradiance and veiling light at a depth
+ */
+std::vector<float> Scene::calc_veiling_light(float depth) const
+{
+  std::vector<float> veiling_light(this->num_water);
+
+  const float* k_d = spectral_row(K_D);
+  const float* surface = spectral_row(SURFACE_VEILING_LIGHT);
+  for (int i = 0; i < this->num_water; i++)
   {
-    new_depth = this->MIN_DEPTH;
+    veiling_light[i] = surface[i] * expf(-k_d[i] * depth);
   }
 
-  // Update depth if new
-  if (this->depth != new_depth)
+  return veiling_light;
+}
+
+
+void Scene::calc_irradiance(const float* depths, int count, float* irradiance) const
+{
+  const float* k_d_row = spectral_row(K_D);
+  for (int i = 0; i < this->num_water; i++)
   {
-    this->depth = new_depth;
-    this->reset_data();  // Update irradiance and veiling light with new depth
+    float* row = irradiance + i * count;
+    spectral_exp().exp_array(depths, -k_d_row[i], row, count);
+    for (int j = 0; j < count; j++)
+    {
+      row[j] *= this->IRRADIANCE_0;
+    }
   }
 }
 
 
-/** Update irradiance and veiling light because of a new depth
- */
-void Scene::reset_data()
+void Scene::integrate_veiling_light(const float* depths, int count, float* blue, float* green, float* red) const
+{
+  std::fill(blue, blue + count, 0.0f);
+  std::fill(green, green + count, 0.0f);
+  std::fill(red, red + count, 0.0f);
+
+  // Wavelength by wavelength, every depth is an independent lane
+  const float* k_d = spectral_row(K_D);
+  const float* surface = spectral_row(SURFACE_VEILING_LIGHT);
+  const float* weight_blue = spectral_row(WEIGHT_BLUE);
+  const float* weight_green = spectral_row(WEIGHT_GREEN);
+  const float* weight_red = spectral_row(WEIGHT_RED);
+  const int CHUNK = 64;
+  float attenuation [CHUNK];
+  for (int start = 0; start < count; start += CHUNK)
+  {
+    const int length = std::min(CHUNK, count - start);
+    for (int i = 0; i < this->num_integrated; i++)
+    {
+      spectral_exp().exp_array(depths + start, -k_d[i], attenuation, length);
+      for (int j = 0; j < length; j++)
+      {
+        const float veiling_light = surface[i] * attenuation[j];
+        blue[start + j] += weight_blue[i] * veiling_light;
+        green[start + j] += weight_green[i] * veiling_light;
+        red[start + j] += weight_red[i] * veiling_light;
+      }
+    }
+  }
+}
+
+
+cv::Scalar Scene::integrate_response(const std::vector<float>& spectrum) const
+{
+  const int n = spectrum.size();
+  if (n == 0 || this->num_response < n)
+  {
+    return cv::Scalar(0.0, 0.0, 0.0);
+  }
+
+  // Trapezoidal rule: the ends count once, the other wavelengths twice
+  float integral [3];
+  for (int c = 0; c < 3; c++)
+  {
+    const float* response = get_camera_response(c);
+    float sum = 0.0f;
+    for (int i = 1; i < n - 1; i++)
+    {
+      sum += response[i] * spectrum[i];
+    }
+    integral[c] = (2.0f * sum + response[0] * spectrum[0] + response[n - 1] * spectrum[n - 1]) *
+      this->WAVELENGTHS_SUB;
+  }
+
+  return cv::Scalar(integral[0], integral[1], integral[2]);
+}
+
+
+cv::Scalar Scene::calc_wideband_attenuation() const
+{
+  if (!this->water)
+  {
+    return cv::Scalar(0.0, 0.0, 0.0);
+  }
+
+  cv::Scalar weighted = integrate_response(this->water->b_att);
+  cv::Scalar response = integrate_response(std::vector<float>(this->water->b_att.size(), 1.0));
+
+  cv::Scalar attenuation(0.0, 0.0, 0.0);
+  for (int c = 0; c < 3; c++)
+  {
+    attenuation[c] = response[c] > 0.0 ? weighted[c] / response[c] : 0.0;
+  }
+
+  return attenuation;
+}
+
+
+cv::Scalar Scene::integrate_veiling_light(float depth) const
 {
-  for (int i = 0; i < this->K_d.size(); i++)
+  cv::Scalar veiling_light;
+  if (this->bundle && this->bundle->get_veiling_light(depth, veiling_light))
   {
-    this->irradiance[i] = (this->IRRADIANCE_0 * exp(-this->K_d[i] * this->depth));
-    this->veiling_light[i] = ((this->b_sca[i] * this->irradiance[i]) / this->b_att[i]);
+    return veiling_light;
   }
+
+  float blue, green, red;
+  integrate_veiling_light(&depth, 1, &blue, &green, &red);
+  return cv::Scalar(blue, green, red);
 }
 
 
@@ -57,6 +185,7 @@ void Scene::load_camera_response_data(std::string CAMERA_RESPONSE_FILENAME)
   std::string line;
   std::vector<std::string> result;
 
+  std::vector<float> camera_response = this->camera_response;
   std::ifstream myfile(CAMERA_RESPONSE_FILENAME);
   if (myfile)
   {
@@ -65,16 +194,108 @@ void Scene::load_camera_response_data(std::string CAMERA_RESPONSE_FILENAME)
       boost::split(result, line, boost::is_any_of(","), boost::token_compress_on);
       if (isdigit(result[0][0]) && stoi(result[0]) % 50 == 0)
       {
-        cv::Scalar sub = {stof(result[3]), stof(result[2]), stof(result[1]), 0.0};
-        this->camera_response.push_back(sub);
+        camera_response.push_back(stof(result[3]));
+        camera_response.push_back(stof(result[2]));
+        camera_response.push_back(stof(result[1]));
       }
     }
   }
+  set_camera_response(camera_response);
+}
+
+
+void Scene::set_camera_response(const std::vector<float>& camera_response)
+{
+  this->camera_response = camera_response;
+  update_spectra();
 }
 
 
 void Scene::load_jerlov_water_data(std::string JERLOV_WATER_FILENAME, std::string WATER_TYPE)
 {
+  set_water(read_jerlov_water_data(JERLOV_WATER_FILENAME, WATER_TYPE));
+}
+
+
+void Scene::set_water(std::shared_ptr<const JerlovWater> water)
+{
+  this->water = water;
+  update_spectra();
+}
+
+
+void Scene::load_bundle(std::shared_ptr<const ModelBundle> bundle)
+{
+  this->bundle = bundle;
+  this->WAVELENGTHS = bundle->get_wavelengths();
+  this->WAVELENGTHS_SUB = (this->WAVELENGTHS.back() - this->WAVELENGTHS[0]) / (this->WAVELENGTHS.size() - 1) / 2;
+  this->camera_response = bundle->get_camera_response();
+  this->water = bundle->get_water();
+  this->K = bundle->get_k();
+  update_spectra();
+}
+
+
+void Scene::update_spectra()
+{
+  const int n = this->camera_response.size() / 3;
+  const size_t m = this->water ? this->water->K_d.size() : 0;
+  const bool water_loaded = m > 0 && this->water->b_sca.size() == m && this->water->b_att.size() == m;
+  this->num_response = n;
+  this->num_water = water_loaded ? static_cast<int>(m) : 0;
+  this->num_integrated = this->num_water <= n ? this->num_water : 0;
+  if (n > 0 && this->num_water > 0 && this->num_water != n)
+  {
+    std::cout << "ERROR: The water properties have " << this->num_water << " wavelengths, the camera response " << n
+      << ". Use the same wavelengths for both" << (this->num_integrated == 0 ? ", the veiling light is zero" : "")
+      << std::endl;
+  }
+  this->spectra_stride = (std::max(n, this->num_water) + 7) & ~7;
+  if (this->spectra_stride == 0)
+  {
+    this->spectra.reset();
+    return;
+  }
+
+  const int stride = this->spectra_stride;
+  float* spectra = static_cast<float*>(cv::fastMalloc(NUM_SPECTRAL_ROWS * stride * sizeof(float)));
+  std::fill(spectra, spectra + NUM_SPECTRAL_ROWS * stride, 0.0f);
+
+  for (int i = 0; i < n; i++)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      spectra[(RESPONSE_BLUE + c) * stride + i] = this->camera_response[3 * i + c];
+    }
+  }
+
+  for (int i = 0; i < this->num_water; i++)
+  {
+    spectra[K_D * stride + i] = this->water->K_d[i];
+    spectra[SURFACE_VEILING_LIGHT * stride + i] = this->IRRADIANCE_0 * this->water->b_sca[i] / this->water->b_att[i];
+  }
+
+  // Weights of the trapezoidal rule over the wavelengths of the water, as integrate_response()
+  const int last = this->num_integrated - 1;
+  for (int i = 0; i < this->num_integrated; i++)
+  {
+    const float weight = ((i == 0) + (i == last) + 2 * (i > 0 && i < last)) * this->WAVELENGTHS_SUB;
+    for (int c = 0; c < 3; c++)
+    {
+      spectra[(WEIGHT_BLUE + c) * stride + i] = weight * this->camera_response[3 * i + c];
+    }
+  }
+
+  this->spectra.reset(spectra, cv::fastFree);
+}
+
+
+std::shared_ptr<const JerlovWater> Scene::read_jerlov_water_data(std::string JERLOV_WATER_FILENAME,
+  std::string WATER_TYPE)
+{
+  std::shared_ptr<JerlovWater> water = std::make_shared<JerlovWater>();
+  water->WATER_TYPE = WATER_TYPE;
+
   std::string line;
   std::vector<std::string> result;
 
@@ -97,12 +318,10 @@ void Scene::load_jerlov_water_data(std::string JERLOV_WATER_FILENAME, std::strin
       // At requested water type data
       if (at_correct_jerlov && isdigit(result[0][0]) && stoi(result[0]) % 50 == 0)
       {
-        this->K_d.push_back(stof(result[1]));
-        this->b_abs.push_back(stof(result[2]));
-        this->b_sca.push_back(stof(result[3]));
-        this->b_att.push_back(this->b_abs.back() + this->b_sca.back());
-        this->irradiance.push_back(this->IRRADIANCE_0 * exp(-this->K_d.back() * this->depth));
-        this->veiling_light.push_back((this->b_sca.back() * this->irradiance.back()) / this->b_att.back());
+        water->K_d.push_back(stof(result[1]));
+        water->b_abs.push_back(stof(result[2]));
+        water->b_sca.push_back(stof(result[3]));
+        water->b_att.push_back(water->b_abs.back() + water->b_sca.back());
       }
 
       // Found requested water type data
@@ -112,6 +331,8 @@ void Scene::load_jerlov_water_data(std::string JERLOV_WATER_FILENAME, std::strin
       }
     }
   }
+
+  return water;
 }
 
 }  // namespace underwater_color_enhance
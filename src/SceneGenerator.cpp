@@ -0,0 +1,267 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/SceneGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace underwater_color_enhance
+{
+
+SceneGenerator::SceneGenerator(std::shared_ptr<const Scene> scene, cv::Size size, int seed)
+  : scene(scene), size(size), rng(seed)
+{
+  this->direct_signal_att = this->scene->calc_wideband_attenuation();
+  make_texture(seed);
+}
+
+
+void SceneGenerator::set_texture(const cv::Mat& texture)
+{
+  cv::Mat resized;
+  cv::resize(texture, resized, this->size, 0, 0, cv::INTER_AREA);
+
+  // Clean scene in 8-bit units, whatever the depth of the texture
+  double scale = 1.0;
+  if (resized.depth() == CV_16U)
+  {
+    scale = 1.0 / 257.0;
+  }
+  else if (resized.depth() == CV_32F)
+  {
+    scale = 255.0;
+  }
+  resized.convertTo(this->texture, CV_32FC3, scale);
+
+  paint_chart();
+}
+
+
+void SceneGenerator::set_options(float RANGE_SLOPE, int NUM_KEYPOINTS, float NOISE, bool SIXTEEN_BIT)
+{
+  this->RANGE_SLOPE = RANGE_SLOPE;
+  this->NUM_KEYPOINTS = NUM_KEYPOINTS;
+  this->NOISE = NOISE;
+  this->SIXTEEN_BIT = SIXTEEN_BIT;
+}
+
+
+void SceneGenerator::set_attenuation(const std::vector<float>& backscatter_att,
+  const std::vector<float>& direct_signal_att)
+{
+  this->fixed_backscatter = backscatter_att.size() == 3;
+  if (this->fixed_backscatter)
+  {
+    this->backscatter_att = cv::Scalar(backscatter_att[0], backscatter_att[1], backscatter_att[2]);
+  }
+
+  if (direct_signal_att.size() == 3)
+  {
+    this->direct_signal_att = cv::Scalar(direct_signal_att[0], direct_signal_att[1], direct_signal_att[2]);
+  }
+  else
+  {
+    this->direct_signal_att = this->scene->calc_wideband_attenuation();
+  }
+}
+
+
+/** b_att weighted by the camera response and the veiling light spectrum: the backscatter is made of the veiling
+ *  light, which is bluer than a gray object, so it is attenuated less than the direct signal
+ */
+cv::Scalar SceneGenerator::get_backscatter_attenuation(float depth) const
+{
+  if (this->fixed_backscatter || !this->scene->water)
+  {
+    return this->fixed_backscatter ? this->backscatter_att : cv::Scalar(0.0, 0.0, 0.0);
+  }
+
+  std::vector<float> veiling_light = this->scene->calc_veiling_light(Scene::round_depth(depth));
+  std::vector<float> weighted(veiling_light.size());
+  for (size_t i = 0; i < veiling_light.size(); i++)
+  {
+    weighted[i] = veiling_light[i] * this->scene->water->b_att[i];
+  }
+
+  cv::Scalar numerator = this->scene->integrate_response(weighted);
+  cv::Scalar denominator = this->scene->integrate_response(veiling_light);
+  cv::Scalar attenuation(0.0, 0.0, 0.0);
+  for (int c = 0; c < 3; c++)
+  {
+    attenuation[c] = denominator[c] > 0.0 ? numerator[c] / denominator[c] : 0.0;
+  }
+
+  return attenuation;
+}
+
+
+cv::Scalar SceneGenerator::get_veiling_light(float depth) const
+{
+  return this->scene->integrate_response(this->scene->calc_veiling_light(Scene::round_depth(depth))) *
+    (1.0 / this->scene->K);
+}
+
+
+SyntheticFrame SceneGenerator::render(float depth)
+{
+  SyntheticFrame frame;
+  frame.depth = depth;
+
+  // Distances: a floor receding from the bottom to the top of the frame, around DISTANCE
+  const float DISTANCE = this->scene->DISTANCE;
+  frame.range_map.create(this->size, CV_32FC1);
+  for (int row = 0; row < this->size.height; row++)
+  {
+    float v = (row + 0.5f) / this->size.height;
+    frame.range_map.row(row).setTo(DISTANCE * (1.0f + this->RANGE_SLOPE * (0.5f - v)));
+  }
+
+  // The color chart faces the camera at DISTANCE, the background sample only shows veiling light
+  std::vector<cv::Rect> regions;
+  std::vector<cv::Scalar> truths;
+  chart_patches(regions, truths);
+  for (size_t i = 0; i < regions.size(); i++)
+  {
+    frame.range_map(regions[i]).setTo(DISTANCE);
+  }
+  cv::Rect bounds(0, 0, this->size.width, this->size.height);
+  if (this->scene->BACKGROUND_SAMPLE.size() == 4)
+  {
+    const std::vector<int>& sample = this->scene->BACKGROUND_SAMPLE;
+    frame.range_map(cv::Rect(sample[0], sample[1], sample[2], sample[3]) & bounds).setTo(this->FAR_RANGE);
+  }
+
+  // Forward model of each pixel: I = J * exp(-b_ds * z) + B * (1 - exp(-b_bs * z))
+  const cv::Scalar veiling_light = get_veiling_light(depth);
+  const cv::Scalar backscatter_att = get_backscatter_attenuation(depth);
+  const float scale = this->SIXTEEN_BIT ? 257.0f : 1.0f;
+  const int type = this->SIXTEEN_BIT ? CV_16UC3 : CV_8UC3;
+
+  cv::Mat degraded(this->size, CV_32FC3);
+  for (int row = 0; row < this->size.height; row++)
+  {
+    const float* J = this->texture.ptr<float>(row);
+    const float* z = frame.range_map.ptr<float>(row);
+    float* I = degraded.ptr<float>(row);
+    for (int col = 0; col < this->size.width; col++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        float transmission = std::exp(-static_cast<float>(this->direct_signal_att[c]) * z[col]);
+        float backscatter = 1.0f - std::exp(-static_cast<float>(backscatter_att[c]) * z[col]);
+        float value = J[3 * col + c] * transmission + static_cast<float>(veiling_light[c]) * backscatter;
+        if (this->NOISE > 0.0f)
+        {
+          value += static_cast<float>(this->rng.gaussian(this->NOISE));
+        }
+        I[3 * col + c] = value * scale;
+      }
+    }
+  }
+  degraded.convertTo(frame.image, type);
+  this->texture.convertTo(frame.clean, type, scale);
+
+  // ORB-style keypoints with the distance of the floor below them
+  frame.points.reserve(this->NUM_KEYPOINTS);
+  frame.distances.reserve(this->NUM_KEYPOINTS);
+  for (int i = 0; i < this->NUM_KEYPOINTS; i++)
+  {
+    cv::Point2f point(this->rng.uniform(0.0f, static_cast<float>(this->size.width)),
+      this->rng.uniform(0.0f, static_cast<float>(this->size.height)));
+    int row = std::min(static_cast<int>(point.y), this->size.height - 1);
+    int col = std::min(static_cast<int>(point.x), this->size.width - 1);
+    float distance = frame.range_map.at<float>(row, col);
+    if (distance >= this->FAR_RANGE)
+    {
+      continue;  // no features on open water
+    }
+    frame.points.push_back(point);
+    frame.distances.push_back(distance);
+  }
+
+  return frame;
+}
+
+
+void SceneGenerator::make_texture(int seed)
+{
+  cv::RNG texture_rng(seed);
+  this->texture.create(this->size, CV_32FC3);
+
+  // Smooth gradients of sand and vegetation
+  const float phase = static_cast<float>(texture_rng.uniform(0.0, 6.28));
+  for (int row = 0; row < this->size.height; row++)
+  {
+    float* J = this->texture.ptr<float>(row);
+    for (int col = 0; col < this->size.width; col++)
+    {
+      float u = static_cast<float>(col) / this->size.width;
+      float v = static_cast<float>(row) / this->size.height;
+      float texture = 0.5f + 0.5f * std::sin(20.0f * u + 13.0f * v + phase);
+      J[3 * col] = 60.0f + 80.0f * v + 30.0f * texture;
+      J[3 * col + 1] = 80.0f + 90.0f * u + 40.0f * texture;
+      J[3 * col + 2] = 110.0f + 80.0f * u * v + 50.0f * texture;
+    }
+  }
+
+  // Colored tiles, like rocks and debris, so every channel has strong edges
+  const int NUM_TILES = 24;
+  int max_side = std::max(8, std::min(this->size.width, this->size.height) / 6);
+  for (int i = 0; i < NUM_TILES; i++)
+  {
+    int width = texture_rng.uniform(4, max_side);
+    int height = texture_rng.uniform(4, max_side);
+    cv::Rect tile(texture_rng.uniform(0, std::max(1, this->size.width - width)),
+      texture_rng.uniform(0, std::max(1, this->size.height - height)), width, height);
+    cv::Scalar color(texture_rng.uniform(20.0, 235.0), texture_rng.uniform(20.0, 235.0),
+      texture_rng.uniform(20.0, 235.0));
+    this->texture(tile & cv::Rect(0, 0, this->size.width, this->size.height)).setTo(color);
+  }
+
+  paint_chart();
+}
+
+
+void SceneGenerator::paint_chart()
+{
+  std::vector<cv::Rect> regions;
+  std::vector<cv::Scalar> truths;
+  chart_patches(regions, truths);
+  for (size_t i = 0; i < regions.size(); i++)
+  {
+    this->texture(regions[i]).setTo(truths[i]);
+  }
+}
+
+
+void SceneGenerator::chart_patches(std::vector<cv::Rect>& regions, std::vector<cv::Scalar>& truths) const
+{
+  // Ground truth of the white and black patches, see NewModel
+  const cv::Scalar TRUTH[2] = {cv::Scalar(242, 243, 243), cv::Scalar(52, 52, 52)};
+  const std::vector<int>* charts[2] = {&this->scene->COLOR_1_SAMPLE, &this->scene->COLOR_2_SAMPLE};
+
+  cv::Rect bounds(0, 0, this->size.width, this->size.height);
+  for (int i = 0; i < 2; i++)
+  {
+    if (charts[i]->size() == 4)
+    {
+      const std::vector<int>& sample = *charts[i];
+      regions.push_back(cv::Rect(sample[0], sample[1], sample[2], sample[3]) & bounds);
+      truths.push_back(TRUTH[i]);
+    }
+  }
+
+  const std::vector<int>& patches = this->scene->COLOR_PATCHES;
+  for (size_t i = 0; i + 7 <= patches.size(); i += 7)
+  {
+    regions.push_back(cv::Rect(patches[i], patches[i + 1], patches[i + 2], patches[i + 3]) & bounds);
+    truths.push_back(cv::Scalar(patches[i + 4], patches[i + 5], patches[i + 6]));
+  }
+}
+
+}  // namespace underwater_color_enhance
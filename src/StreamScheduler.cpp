@@ -0,0 +1,162 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/StreamScheduler.h"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+StreamScheduler::StreamScheduler(int NUM_WORKERS)
+{
+  if (NUM_WORKERS <= 0)
+  {
+    NUM_WORKERS = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (int i = 0; i < NUM_WORKERS; i++)
+  {
+    this->workers.push_back(std::thread(&StreamScheduler::worker_loop, this));
+  }
+}
+
+
+StreamScheduler::~StreamScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->job_available.notify_all();
+
+  for (size_t i = 0; i < this->workers.size(); i++)
+  {
+    this->workers[i].join();
+  }
+}
+
+
+int StreamScheduler::add_stream()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->streams.push_back(Stream());
+  return this->streams.size() - 1;
+}
+
+
+void StreamScheduler::submit(int stream_id, std::function<void()> job)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Stream& stream = this->streams.at(stream_id);
+    if (stream.waiting_job)
+    {
+      stream.dropped++;
+    }
+    stream.waiting_job = job;
+  }
+  this->job_available.notify_one();
+}
+
+
+size_t StreamScheduler::get_dropped(int stream_id)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->streams.at(stream_id).dropped;
+}
+
+
+void StreamScheduler::prewarm(std::function<void()> job)
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->warmup_job = job;
+  this->warmup_pending = this->workers.size();
+  this->warmup_generation++;
+  this->job_available.notify_all();
+
+  this->warmup_done.wait(lock, [this] {return this->warmup_pending == 0;});
+  this->warmup_job = std::function<void()>();
+}
+
+
+int StreamScheduler::take_next_stream()
+{
+  for (size_t i = 0; i < this->streams.size(); i++)
+  {
+    size_t stream_id = (this->next_stream + i) % this->streams.size();
+    Stream& stream = this->streams[stream_id];
+    if (stream.waiting_job && !stream.busy)
+    {
+      this->next_stream = stream_id + 1;
+      return stream_id;
+    }
+  }
+
+  return -1;
+}
+
+
+void StreamScheduler::worker_loop()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  int warmup_generation = 0;   // Jobs of prewarm() calls made before the worker started are run too
+
+  while (true)
+  {
+    int stream_id = -1;
+    this->job_available.wait(lock, [this, &stream_id, warmup_generation]
+    {
+      if (this->warmup_generation != warmup_generation)
+      {
+        return true;
+      }
+      stream_id = this->take_next_stream();
+      return this->stopping || stream_id >= 0;
+    });
+
+    if (this->stopping)
+    {
+      return;
+    }
+
+    // Each worker runs the prewarm job once, before the frames
+    if (this->warmup_generation != warmup_generation)
+    {
+      warmup_generation = this->warmup_generation;
+      std::function<void()> job = this->warmup_job;
+
+      lock.unlock();
+      job();
+      lock.lock();
+
+      if (--this->warmup_pending == 0)
+      {
+        this->warmup_done.notify_all();
+      }
+      continue;
+    }
+
+    std::function<void()> job;
+    job.swap(this->streams[stream_id].waiting_job);
+    this->streams[stream_id].busy = true;
+
+    lock.unlock();
+    job();
+    lock.lock();
+
+    // A frame of this stream may have arrived while it was busy
+    this->streams[stream_id].busy = false;
+    this->job_available.notify_one();
+  }
+}
+
+}  // namespace underwater_color_enhance
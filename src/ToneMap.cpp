@@ -0,0 +1,122 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/ToneMap.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <string>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+ToneMap::ToneMap(ToneMapMode MODE, float PERCENTILE, float KNEE, float MAX_GAIN)
+{
+  this->MODE = MODE;
+  this->PERCENTILE = std::min(100.0f, std::max(0.0f, PERCENTILE));
+  this->KNEE = std::min(0.99f, std::max(0.0f, KNEE));
+  this->MAX_GAIN = std::max(1.0f, MAX_GAIN);
+}
+
+
+ToneMapMode ToneMap::parse_mode(const std::string& name)
+{
+  if (name == "exposure")
+  {
+    return TONE_MAP_EXPOSURE;
+  }
+  else if (name == "reinhard")
+  {
+    return TONE_MAP_REINHARD;
+  }
+
+  return TONE_MAP_CLIP;
+}
+
+
+cv::Mat ToneMap::sample(const cv::Mat& img)
+{
+  cv::Size sample_size((img.cols + SAMPLE_STEP - 1) / SAMPLE_STEP, (img.rows + SAMPLE_STEP - 1) / SAMPLE_STEP);
+
+  cv::Mat img_sample;
+  cv::resize(img, img_sample, sample_size, 0, 0, cv::INTER_NEAREST);
+
+  if (img_sample.channels() == 3 && img_sample.depth() != CV_32F)
+  {
+    img_sample.convertTo(img_sample, CV_32FC3);
+  }
+
+  return img_sample;
+}
+
+
+float ToneMap::white_point(const cv::Mat& corrected_sample) const
+{
+  CV_Assert(corrected_sample.type() == CV_32FC3);
+
+  std::vector<float> brightest;
+  brightest.reserve(corrected_sample.total());
+  for (int row = 0; row < corrected_sample.rows; row++)
+  {
+    const float* s = corrected_sample.ptr<float>(row);
+    for (int i = 0; i < 3 * corrected_sample.cols; i += 3)
+    {
+      float value = std::max(s[i], std::max(s[i + 1], s[i + 2]));
+      if (value < FLT_MAX)   // Also false for NaN
+      {
+        brightest.push_back(value);
+      }
+    }
+  }
+
+  if (brightest.empty())
+  {
+    return 0.0f;
+  }
+
+  size_t n = std::min(brightest.size() - 1, static_cast<size_t>(this->PERCENTILE / 100.0f * brightest.size()));
+  std::nth_element(brightest.begin(), brightest.begin() + n, brightest.end());
+
+  return brightest[n];
+}
+
+
+ToneCurve ToneMap::curve(const cv::Mat& corrected_sample, int depth) const
+{
+  ToneCurve tone;
+  if (this->MODE == TONE_MAP_CLIP)
+  {
+    return tone;
+  }
+
+  const float FULL_SCALE = full_scale(depth);
+  float white = white_point(corrected_sample);
+  if (white <= 0.0f)
+  {
+    return tone;
+  }
+
+  if (this->MODE == TONE_MAP_EXPOSURE)
+  {
+    // White point to full scale, dark frames are brightened up to MAX_GAIN
+    tone.gain = std::min(this->MAX_GAIN, FULL_SCALE / white);
+  }
+  else if (white > FULL_SCALE)  // Reinhard shoulder only if something would be clipped
+  {
+    tone.knee = this->KNEE * FULL_SCALE;
+    tone.shoulder_range = FULL_SCALE - tone.knee;
+    tone.inv_shoulder_range = 1.0f / tone.shoulder_range;
+
+    float t_white = (white - tone.knee) * tone.inv_shoulder_range;
+    tone.inv_white_sq = 1.0f / (t_white * t_white);
+  }
+
+  return tone;
+}
+
+}  // namespace underwater_color_enhance
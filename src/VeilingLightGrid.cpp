@@ -0,0 +1,103 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/VeilingLightGrid.h"
+#include "underwater_color_enhance/ToneMap.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <mutex>
+#include <vector>
+
+namespace underwater_color_enhance
+{
+
+VeilingLightGrid::VeilingLightGrid(cv::Size GRID_SIZE, float SMOOTHING, float MAX_RATIO)
+{
+  this->GRID_SIZE = cv::Size(std::max(1, GRID_SIZE.width), std::max(1, GRID_SIZE.height));
+  this->SMOOTHING = std::min(std::max(SMOOTHING, 0.01f), 1.0f);
+  this->MAX_RATIO = std::max(MAX_RATIO, 1.0f);
+}
+
+
+GridSampler VeilingLightGrid::update(const cv::Mat& img, ChannelOrder order)
+{
+  std::vector<float> ratios = estimate(img, order);
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->smoothed.size() != ratios.size())
+    {
+      this->smoothed = ratios;
+    }
+    else
+    {
+      for (size_t i = 0; i < ratios.size(); i++)
+      {
+        this->smoothed[i] += this->SMOOTHING * (ratios[i] - this->smoothed[i]);
+      }
+    }
+    ratios = this->smoothed;
+  }
+
+  return GridSampler(ratios, this->GRID_SIZE, img.size());
+}
+
+
+std::vector<float> VeilingLightGrid::estimate(const cv::Mat& img, ChannelOrder order) const
+{
+  const int cells = this->GRID_SIZE.area();
+  std::vector<float> ratios(3 * cells, 1.0f);
+
+  // Sub-block means of a sparse sample, the frame itself is read once at the sample positions
+  cv::Mat blocks;
+  cv::resize(ToneMap::sample(img), blocks, cv::Size(SUBCELLS * this->GRID_SIZE.width,
+    SUBCELLS * this->GRID_SIZE.height), 0, 0, cv::INTER_AREA);
+
+  // Darkest sub-block of each cell
+  cv::Mat dark(this->GRID_SIZE, CV_32FC3, cv::Scalar::all(FLT_MAX));
+  for (int row = 0; row < blocks.rows; row++)
+  {
+    const float* block = blocks.ptr<float>(row);
+    float* cell = dark.ptr<float>(row / SUBCELLS);
+    for (int col = 0; col < blocks.cols; col++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        float& value = cell[3 * (col / SUBCELLS) + c];
+        value = std::min(value, block[3 * col + c]);
+      }
+    }
+  }
+
+  // Objects that fill a cell stand out from their neighbors
+  if (dark.rows >= 3 && dark.cols >= 3)
+  {
+    cv::medianBlur(dark, dark, 3);
+  }
+
+  cv::Scalar frame_mean = cv::mean(dark);
+  for (int y = 0; y < dark.rows; y++)
+  {
+    const float* cell = dark.ptr<float>(y);
+    for (int x = 0; x < dark.cols; x++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        // BGR, whatever the channel order of the image
+        int channel = order == BGR ? c : 2 - c;
+        float ratio = frame_mean[channel] > 0.0 ? cell[3 * x + channel] / frame_mean[channel] : 1.0f;
+        ratio = std::min(std::max(ratio, 1.0f / this->MAX_RATIO), this->MAX_RATIO);
+        ratios[3 * (y * dark.cols + x) + c] = ratio == ratio ? ratio : 1.0f;   // NaN of a broken frame
+      }
+    }
+  }
+
+  return ratios;
+}
+
+}  // namespace underwater_color_enhance
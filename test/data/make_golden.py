@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+#
+# \author     Monika Roznere <mroznere@gmail.com>
+# \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+#
+# Golden images of test_regression.cpp, computed from the image formation model with numpy, independently of the
+# C++ kernels: I = J * exp(-b_ds * z) + B * (1 - exp(-b_bs * z)), corrected as J = I * gain + offset.
+# OpenCV is only used for image files and the Voronoi facets of the SLAM keypoints.
+#
+# Writes frame.png (the input), attenuation.xml (prior data) and <case>.png next to this script:
+#   python3 test/data/make_golden.py
+
+import os
+
+import cv2
+import numpy as np
+
+DATA_DIR = os.path.dirname(os.path.abspath(__file__))
+ROOT_DIR = os.path.dirname(os.path.dirname(DATA_DIR))
+
+# Same as test_regression.cpp
+FRAME_SIZE = (240, 135)   # sample image downscaled 8 times
+DISTANCE = 0.33
+DEPTH = 6.06
+COLOR_1_SAMPLE = [63, 73, 6, 4]
+COLOR_2_SAMPLE = [167, 76, 2, 1]
+BACKGROUND_SAMPLE = [81, 69, 2, 2]
+COLOR_1_TRUTH = np.array([242.0, 243.0, 243.0])
+COLOR_2_TRUTH = np.array([52.0, 52.0, 52.0])
+WATER_TYPE = 'Jerlov IA'
+K = 0.1
+
+# Prior data: the entry nearest to the rounded depth of the frame (6.5) is used
+PRIOR = {
+    6.0: ([0.9, 0.8, 0.5], [0.4, 0.6, 2.1]),
+    7.5: ([0.1, 0.1, 0.1], [0.1, 0.1, 0.1]),
+}
+
+
+def read_rows(filename):
+    with open(filename, newline='') as f:
+        return [line.split(',') for line in f.read().split('\r')]
+
+
+def camera_response():
+    """BGR response at the wavelengths that are multiples of 50 nm."""
+    rows = read_rows(os.path.join(ROOT_DIR, 'Camera_Response_Files', 'Sony_IMX322LQJ-C_Camera_Response.csv'))
+    return np.array([[float(r[3]), float(r[2]), float(r[1])] for r in rows if r[0][:1].isdigit() and
+                     int(r[0]) % 50 == 0])
+
+
+def jerlov_water():
+    """K_d, b_sca and b_att of the water type at the wavelengths that are multiples of 50 nm."""
+    rows = read_rows(os.path.join(ROOT_DIR, 'Jerlov_Water', 'Jerlov_Water_Types.csv'))
+    start = [r[0] for r in rows].index(WATER_TYPE) + 1
+    values = []
+    for r in rows[start:]:
+        if not r[0][:1].isdigit():
+            break
+        if int(r[0]) % 50 == 0:
+            values.append([float(r[1]), float(r[2]), float(r[3])])
+    values = np.array(values)
+    return values[:, 0], values[:, 2], values[:, 1] + values[:, 2]
+
+
+def calculated_veiling_light(depth):
+    """b_sca * E(depth) / b_att over the camera response (trapezoidal rule, 50 nm steps), divided by K."""
+    response = camera_response()
+    k_d, b_sca, b_att = jerlov_water()
+    spectrum = b_sca * np.exp(-k_d * depth) / b_att
+    weights = np.full(len(spectrum), 2.0)
+    weights[0] = weights[-1] = 1.0
+    return (weights * spectrum) @ response[:len(spectrum)] * 25.0 / K
+
+
+def sample_mean(img, region):
+    x, y, w, h = region
+    return img[y:y + h, x:x + w].reshape(-1, 3).astype(np.float64).mean(axis=0)
+
+
+def chart_attenuation(img, veiling_light, scale):
+    """Attenuation values from the two chart patches."""
+    obs_1 = sample_mean(img, COLOR_1_SAMPLE)
+    obs_2 = sample_mean(img, COLOR_2_SAMPLE)
+    truth_1 = COLOR_1_TRUTH * scale
+    truth_2 = COLOR_2_TRUTH * scale
+    backscatter = (truth_1 * obs_2 - truth_2 * obs_1 + (truth_2 - truth_1) * veiling_light) / \
+        ((truth_2 - truth_1) * veiling_light)
+    backscatter_att = -np.log(backscatter) / DISTANCE
+    direct_signal = (obs_2 - veiling_light * (1.0 - np.exp(-backscatter_att * DISTANCE))) / truth_2
+    direct_signal_att = -np.log(direct_signal) / DISTANCE
+    return backscatter_att, direct_signal_att
+
+
+def correct(img, distance, veiling_light, backscatter_att, direct_signal_att, dtype):
+    """Corrected image, distance is a scalar or a distance per pixel."""
+    z = np.asarray(distance, dtype=np.float64)[..., np.newaxis]
+    gain = np.exp(direct_signal_att * z)
+    offset = -veiling_light * (1.0 - np.exp(-backscatter_att * z)) * gain
+    return quantize(img * gain + offset, dtype)
+
+
+def quantize(values, dtype):
+    return np.clip(np.rint(values), 0, np.iinfo(dtype).max).astype(dtype)
+
+
+def keypoints():
+    """Grid of keypoints at whole pixels, distances around the scene distance."""
+    points, distances = [], []
+    for i in range(6):
+        for j in range(8):
+            points.append((15 + 30 * j, 11 + 22 * i))
+            distances.append(np.float32(DISTANCE) * np.float32(1.0 + 0.25 * ((i + j) % 4)))
+    return points, distances
+
+
+def voronoi_facets(points):
+    subdiv = cv2.Subdiv2D((0, 0, FRAME_SIZE[0], FRAME_SIZE[1]))
+    ids = [subdiv.insert((float(x), float(y))) for x, y in points]
+    facets, _ = subdiv.getVoronoiFacetList(ids)
+    return [np.rint(facet).astype(np.int32) for facet in facets]
+
+
+def slam_distances(label_map):
+    """Distance per pixel from the Voronoi facets, the scene distance where no facet is drawn."""
+    points, distances = keypoints()
+    labels = np.full((FRAME_SIZE[1], FRAME_SIZE[0]), len(points), np.uint16)
+    for i, facet in enumerate(voronoi_facets(points)):
+        cv2.fillConvexPoly(labels, facet, i, 8, 0)
+    table = np.array(distances + [DISTANCE], dtype=np.float64)
+    distance = table[labels]
+    if not label_map:
+        # Range map: uncovered pixels are zero, which falls back to the scene distance as well
+        distance[labels == len(points)] = DISTANCE
+    return distance
+
+
+def depth_map():
+    rows = np.arange(FRAME_SIZE[1], dtype=np.float32) / np.float32(FRAME_SIZE[1])
+    column = np.float32(DISTANCE) * (np.float32(4.0) - np.float32(3.5) * rows)
+    return np.repeat(column[:, np.newaxis], FRAME_SIZE[0], axis=1).astype(np.float64)
+
+
+def write_prior(filename):
+    with open(filename, 'w') as f:
+        f.write('<?xml version="1.0" ?>\n')
+        for depth, (backscatter_att, direct_signal_att) in sorted(PRIOR.items()):
+            f.write('<Depth val="%g">\n' % depth)
+            f.write('    <Backscatter_Attenuation blue="%g" green="%g" red="%g" />\n' % tuple(backscatter_att))
+            f.write('    <Direct_Signal_Attenuation blue="%g" green="%g" red="%g" />\n' % tuple(direct_signal_att))
+            f.write('</Depth>\n')
+
+
+def main():
+    image = cv2.imread(os.path.join(ROOT_DIR, 'Images', 'shipwreck_depth_000606.png'), cv2.IMREAD_COLOR)
+    frame = cv2.resize(image, FRAME_SIZE, interpolation=cv2.INTER_AREA)
+    cv2.imwrite(os.path.join(DATA_DIR, 'frame.png'), frame)
+    write_prior(os.path.join(DATA_DIR, 'attenuation.xml'))
+
+    img = frame.astype(np.float64)
+    img_16bit = img * 257.0
+    calculated = calculated_veiling_light(DEPTH)
+    estimated = sample_mean(img, BACKGROUND_SAMPLE)
+    prior = nearest_prior(DEPTH)
+
+    # The chart calibration cancels the veiling light at DISTANCE, so the estimated veiling light is only tested
+    # where the distance differs (SLAM) or the attenuation does not come from the chart (prior data)
+    chart = chart_attenuation(img, calculated, 1.0)
+    chart_estimated = chart_attenuation(img, estimated, 1.0)
+    goldens = {
+        'chart_calculated': correct(img, DISTANCE, calculated, *chart, dtype=np.uint8),
+        'chart_16bit': correct(img_16bit, DISTANCE, calculated * 257.0,
+                               *chart_attenuation(img_16bit, calculated * 257.0, 257.0), dtype=np.uint16),
+        'prior_calculated': correct(img, DISTANCE, calculated, *prior, dtype=np.uint8),
+        'prior_lookup_table': correct(img, DISTANCE, estimated, *prior, dtype=np.uint8),
+        'slam_label_map': correct(img, slam_distances(True), calculated, *chart, dtype=np.uint8),
+        'slam_range_map': correct(img, slam_distances(False), estimated, *chart_estimated, dtype=np.uint8),
+        'depth_map': correct(img, depth_map(), calculated, *chart, dtype=np.uint8),
+    }
+
+    # Gray world: every channel scaled to the mean gray level
+    channel_mean = img.reshape(-1, 3).mean(axis=0)
+    goldens['gray_world'] = quantize(img * (channel_mean.mean() / channel_mean), np.uint8)
+
+    print('veiling light calculated %s, estimated %s' % (calculated, estimated))
+    print('chart attenuation backscatter %s, direct signal %s' % chart)
+    for name, golden in sorted(goldens.items()):
+        cv2.imwrite(os.path.join(DATA_DIR, name + '.png'), golden)
+
+
+def nearest_prior(depth):
+    """Prior attenuation values at the depth rounded up to half meters, as NewModel::est_attenuation()."""
+    round_depth = np.round(abs((depth + 0.5) * 2)) / 2
+    nearest = min(sorted(PRIOR), key=lambda d: (abs(d - round_depth), -d))
+    return tuple(np.array(values) for values in PRIOR[nearest])
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,168 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/FastExp.h"
+
+#include <gtest/gtest.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+using underwater_color_enhance::FastExp;
+
+/** Maximum relative error of each degree (MIN_DEGREE to MAX_DEGREE), as listed with the polynomials in FastExp.cpp.
+ *  The table holds the error of the exact polynomials.
+ */
+static const double TABLE_ERROR [FastExp::MAX_DEGREE - FastExp::MIN_DEGREE + 1] = {1.7e-3, 7.5e-5, 2.6e-6, 7.5e-8,
+  1.9e-9};
+
+
+static double rel_error(float approx, double x)
+{
+  double truth = exp(x);
+  return fabs(static_cast<double>(approx) - truth) / truth;
+}
+
+
+/** Allowed error at x: the table with a 10% margin, plus single precision. Rounding x * log2(e) to a float costs
+ *  up to one ulp of the exponent, which grows with |x|, and the evaluation a few ulps of the result.
+ */
+static double bound(int degree, double x)
+{
+  return 1.1 * TABLE_ERROR[degree - FastExp::MIN_DEGREE] + 2.5e-7 + fabs(x) * 1.44269504 * ldexp(1.0, -24) * M_LN2;
+}
+
+
+TEST(FastExp, MaxRelErrorOfEachDegree)
+{
+  const int SAMPLES = 200000;
+  for (int degree = FastExp::MIN_DEGREE; degree <= FastExp::MAX_DEGREE; degree++)
+  {
+    FastExp fast_exp = FastExp::of_degree(degree);
+    ASSERT_EQ(degree, fast_exp.get_degree());
+
+    // Relative to the bound at each x, so the float rounding of large arguments is not charged to small ones
+    double max_ratio = 0.0;
+    for (int i = 0; i <= SAMPLES; i++)
+    {
+      float x = -FastExp::MAX_ARG + 2.0f * FastExp::MAX_ARG * static_cast<float>(i) / SAMPLES;
+      max_ratio = std::max(max_ratio, rel_error(fast_exp(x), x) / bound(degree, x));
+    }
+
+    EXPECT_LE(max_ratio, 1.0) << "degree " << degree;
+    EXPECT_LE(fast_exp.get_max_rel_error(), bound(degree, FastExp::MAX_ARG)) << "degree " << degree;
+  }
+}
+
+
+TEST(FastExp, DegreeSelection)
+{
+  // Lowest degree that meets the target, the most accurate one if none does
+  EXPECT_EQ(2, FastExp(1e-2).get_degree());
+  EXPECT_EQ(3, FastExp(1e-4).get_degree());
+  EXPECT_EQ(FastExp::MAX_DEGREE, FastExp(1e-12).get_degree());
+
+  // The highest degrees are both limited by single precision
+  for (int degree = FastExp::MIN_DEGREE; degree < FastExp::MAX_DEGREE - 1; degree++)
+  {
+    EXPECT_GT(FastExp::of_degree(degree).get_max_rel_error(), FastExp::of_degree(degree + 1).get_max_rel_error());
+  }
+}
+
+
+TEST(FastExp, IntegerPowers)
+{
+  // f = 0 evaluates only the constant term
+  for (int degree = FastExp::MIN_DEGREE; degree <= FastExp::MAX_DEGREE; degree++)
+  {
+    FastExp fast_exp = FastExp::of_degree(degree);
+    for (int n = -20; n <= 20; n++)
+    {
+      float x = n * 0.693147181f;
+      EXPECT_LE(rel_error(fast_exp(x), x), bound(degree, x));
+    }
+  }
+}
+
+
+TEST(FastExp, ClampEdges)
+{
+  // exp(x) = 2^t with t clamped to [-126, 126]
+  const float MAX_POWER = ldexpf(1.0f, 126);
+  const float MIN_POWER = ldexpf(1.0f, -126);
+  const float EDGE = 126.0f * 0.693147181f;
+
+  for (int degree = FastExp::MIN_DEGREE; degree <= FastExp::MAX_DEGREE; degree++)
+  {
+    FastExp fast_exp = FastExp::of_degree(degree);
+    const double edge_bound = bound(degree, EDGE);
+
+    // Inside the edges, still accurate
+    EXPECT_LE(rel_error(fast_exp(EDGE - 0.5f), EDGE - 0.5f), edge_bound);
+    EXPECT_LE(rel_error(fast_exp(-EDGE + 0.5f), -EDGE + 0.5f), edge_bound);
+
+    // On and past the edges, the clamped value, finite and normal
+    const float above [4] = {EDGE, 88.0f, 1000.0f, 1e30f};
+    const float below [4] = {-EDGE, -88.0f, -1000.0f, -1e30f};
+    for (int i = 0; i < 4; i++)
+    {
+      float high = fast_exp(above[i]);
+      float low = fast_exp(below[i]);
+      EXPECT_TRUE(isfinite(high));
+      EXPECT_NEAR(1.0, high / MAX_POWER, edge_bound);
+      EXPECT_GT(low, 0.0f);
+      EXPECT_NEAR(1.0, low / MIN_POWER, edge_bound);
+    }
+  }
+}
+
+
+TEST(FastExp, ExpArrayMatchesScalar)
+{
+  // Lengths that leave a tail after the vectorized loop
+  const int LENGTHS [3] = {1, 7, 1029};
+  const float SCALES [3] = {1.0f, -2.5f, 0.33f};
+
+  for (int degree = FastExp::MIN_DEGREE; degree <= FastExp::MAX_DEGREE; degree++)
+  {
+    FastExp fast_exp = FastExp::of_degree(degree);
+    for (int l = 0; l < 3; l++)
+    {
+      std::vector<float> src(LENGTHS[l]);
+      std::vector<float> dst(LENGTHS[l]);
+      for (int i = 0; i < LENGTHS[l]; i++)
+      {
+        src[i] = -8.0f + 16.0f * i / LENGTHS[l];
+      }
+
+      for (int s = 0; s < 3; s++)
+      {
+        fast_exp.exp_array(src.data(), SCALES[s], dst.data(), LENGTHS[l]);
+        for (int i = 0; i < LENGTHS[l]; i++)
+        {
+          float expected = fast_exp(SCALES[s] * src[i]);
+          EXPECT_NEAR(1.0, dst[i] / expected, 1e-6) << "degree " << degree << " at " << src[i];
+        }
+      }
+    }
+  }
+}
+
+
+TEST(FastExp, ExpArrayClampEdges)
+{
+  FastExp fast_exp;
+  const float src [4] = {-1e30f, -90.0f, 90.0f, 1e30f};
+  float dst [4];
+  fast_exp.exp_array(src, 1.0f, dst, 4);
+
+  EXPECT_FLOAT_EQ(fast_exp(-1e30f), dst[0]);
+  EXPECT_FLOAT_EQ(fast_exp(-90.0f), dst[1]);
+  EXPECT_FLOAT_EQ(fast_exp(90.0f), dst[2]);
+  EXPECT_FLOAT_EQ(fast_exp(1e30f), dst[3]);
+  EXPECT_TRUE(isfinite(dst[3]));
+}
@@ -0,0 +1,325 @@
+/**
+*
+* \author     Monika Roznere <mroznere@gmail.com>
+* \copyright  Copyright (c) 2019, Dartmouth Robotics Lab.
+*
+*/
+
+#include "underwater_color_enhance/Scene.h"
+#include "underwater_color_enhance/ColorCorrect.h"
+#include "underwater_color_enhance/KeypointSpan.h"
+#include "underwater_color_enhance/SceneGenerator.h"
+
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+using underwater_color_enhance::ColorCorrect;
+using underwater_color_enhance::KeypointSpan;
+using underwater_color_enhance::Scene;
+using underwater_color_enhance::SceneGenerator;
+using underwater_color_enhance::SyntheticFrame;
+
+/** Golden images of every enhancement path on test/data/frame.png, the sample image downscaled 8 times.
+ *  The goldens are computed from the image formation model by test/data/make_golden.py (numpy), not recorded from
+ *  this code. The settings below must match it.
+ *
+ *  The synthetic cases render a frame with SceneGenerator (fixed seed, no noise) and compare the enhanced frame with
+ *  its clean scene, the ground truth of the forward model.
+ */
+
+static const std::string DATA_DIR = std::string(PACKAGE_DIR) + "/test/data";
+
+static const double MIN_PSNR = 40.0;    /**< dB against the golden image */
+static const double MAX_ERROR = 2.0;    /**< largest absolute error in 8-bit units: float rounding and fast exp */
+
+static const float DISTANCE = 0.33;
+static const float DEPTH = 6.06;
+static const std::vector<int> COLOR_1_SAMPLE = {63, 73, 6, 4};
+static const std::vector<int> COLOR_2_SAMPLE = {167, 76, 2, 1};
+static const std::vector<int> BACKGROUND_SAMPLE = {81, 69, 2, 2};
+
+static const double MIN_RECOVERY_PSNR = 40.0;   /**< dB against the clean scene */
+static const double MAX_RECOVERY_ERROR = 4.0;   /**< 8-bit quantization of the degraded frame, amplified by the gain */
+
+static const cv::Size SYNTHETIC_SIZE(240, 135);
+static const int SYNTHETIC_SEED = 7;
+static const float SYNTHETIC_DISTANCE = 1.0;
+static const std::vector<int> SYNTHETIC_COLOR_1_SAMPLE = {40, 40, 6, 6};
+static const std::vector<int> SYNTHETIC_COLOR_2_SAMPLE = {150, 60, 6, 6};
+static const std::vector<int> SYNTHETIC_BACKGROUND_SAMPLE = {200, 10, 4, 4};
+static const std::vector<int> SYNTHETIC_PATCHES = {
+  60, 90, 6, 6, 40, 60, 180,
+  90, 90, 6, 6, 170, 90, 50,
+  120, 90, 6, 6, 60, 160, 70,
+  150, 90, 6, 6, 128, 128, 128};
+
+
+/** Input of an enhancement path.
+ */
+enum CaseInput
+{
+  INPUT_FRAME = 0,      /**< one distance for the whole frame */
+  INPUT_SLAM = 1,       /**< grid of SLAM keypoints */
+  INPUT_DEPTH_MAP = 2   /**< dense depth map */
+};
+
+/** One enhancement path.
+ */
+struct RegressionCase
+{
+  int METHOD_ID;
+  bool EST_VEILING_LIGHT;
+  bool PRIOR_DATA;
+  CaseInput input;
+  bool SLAM_LABEL_MAP;
+  bool LOOKUP_TABLE;
+  bool SIXTEEN_BIT;   /**< frame converted to 16-bit */
+};
+
+
+ColorCorrect make_correction(const RegressionCase& test_case)
+{
+  Scene underwater_scene;
+  underwater_scene.DISTANCE = DISTANCE;
+  underwater_scene.COLOR_1_SAMPLE = COLOR_1_SAMPLE;
+  underwater_scene.COLOR_2_SAMPLE = COLOR_2_SAMPLE;
+
+  if (test_case.EST_VEILING_LIGHT)
+  {
+    underwater_scene.BACKGROUND_SAMPLE = BACKGROUND_SAMPLE;
+  }
+  else
+  {
+    underwater_scene.load_camera_response_data(std::string(PACKAGE_DIR) +
+      "/Camera_Response_Files/Sony_IMX322LQJ-C_Camera_Response.csv");
+    underwater_scene.load_jerlov_water_data(std::string(PACKAGE_DIR) + "/Jerlov_Water/Jerlov_Water_Types.csv",
+      "Jerlov IA");
+    underwater_scene.set_depth(DEPTH);
+  }
+
+  const std::string PRIOR_FILENAME = DATA_DIR + "/attenuation.xml";
+  ColorCorrect correction_method(underwater_scene, test_case.METHOD_ID, test_case.EST_VEILING_LIGHT, false, -1.0,
+    false, false, false, test_case.PRIOR_DATA, PRIOR_FILENAME, "");
+  correction_method.set_slam_label_map(test_case.SLAM_LABEL_MAP);
+  correction_method.set_lookup_table(test_case.LOOKUP_TABLE);
+  correction_method.set_depth_map_options(1.0, std::vector<double>());
+
+  return correction_method;
+}
+
+
+/** Grid of keypoints at whole pixels, distances around the scene distance.
+ */
+void make_keypoints(std::vector<cv::Point2f>& points, std::vector<float>& distances)
+{
+  for (int i = 0; i < 6; i++)
+  {
+    for (int j = 0; j < 8; j++)
+    {
+      points.push_back(cv::Point2f(15 + 30 * j, 11 + 22 * i));
+      distances.push_back(DISTANCE * (1.0f + 0.25f * ((i + j) % 4)));
+    }
+  }
+}
+
+
+/** Depth map in meters: a floor receding from the bottom to the top of the frame.
+ */
+cv::Mat make_depth_map(cv::Size size)
+{
+  cv::Mat depth_map(size, CV_32FC1);
+  for (int row = 0; row < size.height; row++)
+  {
+    float v = static_cast<float>(row) / size.height;
+    depth_map.row(row).setTo(DISTANCE * (4.0f - 3.5f * v));
+  }
+
+  return depth_map;
+}
+
+
+/** Enhances the test frame along the path of a case.
+ */
+cv::Mat run_case(const RegressionCase& test_case)
+{
+  cv::Mat frame = cv::imread(DATA_DIR + "/frame.png", cv::IMREAD_COLOR);
+  EXPECT_FALSE(frame.empty()) << "no " << DATA_DIR << "/frame.png";
+  if (test_case.SIXTEEN_BIT)
+  {
+    frame.convertTo(frame, CV_16UC3, 257.0);
+  }
+
+  ColorCorrect correction_method = make_correction(test_case);
+  if (test_case.LOOKUP_TABLE)
+  {
+    EXPECT_TRUE(correction_method.prepare(frame, DEPTH).uses_lookup_table());
+  }
+
+  switch (test_case.input)
+  {
+    case INPUT_SLAM:
+    {
+      std::vector<cv::Point2f> points;
+      std::vector<float> distances;
+      make_keypoints(points, distances);
+      return correction_method.enhance_slam(frame, KeypointSpan(points, distances), DEPTH);
+    }
+    case INPUT_DEPTH_MAP:
+      return correction_method.enhance_depth(frame, make_depth_map(frame.size()), DEPTH);
+    default:
+      return correction_method.enhance(frame, DEPTH);
+  }
+}
+
+
+/** Compares an enhanced image with a reference image: PSNR and largest absolute error, in 8-bit units.
+ */
+void expect_close(const std::string& name, const cv::Mat& img, const cv::Mat& reference, double min_psnr,
+  double max_allowed_error)
+{
+  ASSERT_EQ(reference.size(), img.size()) << name;
+  ASSERT_EQ(reference.type(), img.type()) << name;
+
+  cv::Mat img_8bit, reference_8bit;
+  img.convertTo(img_8bit, CV_32F, 1.0 / underwater_color_enhance::pixel_scale(img.depth()));
+  reference.convertTo(reference_8bit, CV_32F, 1.0 / underwater_color_enhance::pixel_scale(reference.depth()));
+
+  double mse = cv::norm(img_8bit, reference_8bit, cv::NORM_L2SQR) / (img_8bit.total() * img_8bit.channels());
+  double psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+  double max_error = cv::norm(img_8bit, reference_8bit, cv::NORM_INF);
+
+  EXPECT_GE(psnr, min_psnr) << name;
+  EXPECT_LE(max_error, max_allowed_error) << name;
+}
+
+
+/** Compares an enhanced image with its golden image.
+ */
+void expect_golden(const std::string& name, const cv::Mat& img)
+{
+  cv::Mat golden = cv::imread(DATA_DIR + "/" + name + ".png", cv::IMREAD_UNCHANGED);
+  ASSERT_FALSE(golden.empty()) << "no golden image " << name;
+  expect_close(name, img, golden, MIN_PSNR, MAX_ERROR);
+}
+
+
+/** Settings of a synthetic case. Every case corrects the frame with its range map as the depth map, so the
+ *  distances differ from the chart distance and the backscatter and direct signal attenuation both matter.
+ */
+struct SyntheticCase
+{
+  bool EST_VEILING_LIGHT;
+  bool CHART_PATCHES;     /**< more chart patches: robust chart fit */
+  bool COLOR_MATRIX_FIT;
+};
+
+
+/** Renders the synthetic frame of a case, enhances it and compares it with the clean scene. The background sample
+ *  only shows veiling light, it is left out of the comparison.
+ */
+void expect_recovery(const std::string& name, const SyntheticCase& test_case)
+{
+  Scene underwater_scene;
+  underwater_scene.DISTANCE = SYNTHETIC_DISTANCE;
+  underwater_scene.COLOR_1_SAMPLE = SYNTHETIC_COLOR_1_SAMPLE;
+  underwater_scene.COLOR_2_SAMPLE = SYNTHETIC_COLOR_2_SAMPLE;
+  underwater_scene.BACKGROUND_SAMPLE = SYNTHETIC_BACKGROUND_SAMPLE;
+  if (test_case.CHART_PATCHES)
+  {
+    underwater_scene.COLOR_PATCHES = SYNTHETIC_PATCHES;
+  }
+  underwater_scene.load_camera_response_data(std::string(PACKAGE_DIR) +
+    "/Camera_Response_Files/Sony_IMX322LQJ-C_Camera_Response.csv");
+  underwater_scene.load_jerlov_water_data(std::string(PACKAGE_DIR) + "/Jerlov_Water/Jerlov_Water_Types.csv",
+    "Jerlov IA");
+  underwater_scene.set_depth(DEPTH);
+
+  SceneGenerator generator(std::shared_ptr<const Scene>(new Scene(underwater_scene)), SYNTHETIC_SIZE,
+    SYNTHETIC_SEED);
+  generator.set_options(0.5, 0, 0.0, false);
+  SyntheticFrame frame = generator.render(DEPTH);
+
+  ColorCorrect correction_method(underwater_scene, 0, test_case.EST_VEILING_LIGHT, false, -1.0, false, false, false,
+    false, "", "");
+  correction_method.set_depth_map_options(1.0, std::vector<double>());
+  if (test_case.COLOR_MATRIX_FIT)
+  {
+    correction_method.set_color_matrix(underwater_color_enhance::ColorMatrix(), true);
+  }
+
+  // The background sample is rendered far away, where the gain of the depth map would overflow
+  const std::vector<int>& sample = SYNTHETIC_BACKGROUND_SAMPLE;
+  cv::Rect background(sample[0], sample[1], sample[2], sample[3]);
+  frame.range_map(background).setTo(SYNTHETIC_DISTANCE);
+  cv::Mat enhanced = correction_method.enhance_depth(frame.image, frame.range_map, DEPTH);
+  enhanced(background).setTo(cv::Scalar::all(0));
+  frame.clean(background).setTo(cv::Scalar::all(0));
+  expect_close(name, enhanced, frame.clean, MIN_RECOVERY_PSNR, MAX_RECOVERY_ERROR);
+}
+
+
+//                                       method  est. B   prior  input            label  table  16-bit
+
+TEST(Regression, ChartCalculated)
+{
+  expect_golden("chart_calculated", run_case({0, false,   false, INPUT_FRAME,     true,  false, false}));
+}
+
+TEST(Regression, Chart16Bit)
+{
+  expect_golden("chart_16bit", run_case({0,      false,   false, INPUT_FRAME,     true,  false, true}));
+}
+
+TEST(Regression, PriorCalculated)
+{
+  expect_golden("prior_calculated", run_case({0, false,   true,  INPUT_FRAME,     true,  false, false}));
+}
+
+TEST(Regression, PriorLookupTable)
+{
+  expect_golden("prior_lookup_table", run_case({0, true,  true,  INPUT_FRAME,     true,  true,  false}));
+}
+
+TEST(Regression, SlamLabelMap)
+{
+  expect_golden("slam_label_map", run_case({0,   false,   false, INPUT_SLAM,      true,  false, false}));
+}
+
+TEST(Regression, SlamRangeMap)
+{
+  expect_golden("slam_range_map", run_case({0,   true,    false, INPUT_SLAM,      false, false, false}));
+}
+
+TEST(Regression, DepthMap)
+{
+  expect_golden("depth_map", run_case({0,        false,   false, INPUT_DEPTH_MAP, true,  false, false}));
+}
+
+TEST(Regression, GrayWorld)
+{
+  expect_golden("gray_world", run_case({1,       false,   false, INPUT_FRAME,     true,  false, false}));
+}
+
+
+//                                        est. B        patches  matrix fit
+
+TEST(Regression, SyntheticDepthMap)
+{
+  expect_recovery("synthetic_depth_map", {false,        false,   false});
+}
+
+TEST(Regression, SyntheticChartFit)
+{
+  expect_recovery("synthetic_chart_fit", {true,         true,    false});
+}
+
+TEST(Regression, SyntheticColorMatrixFit)
+{
+  expect_recovery("synthetic_color_matrix_fit", {false, true,    true});
+}